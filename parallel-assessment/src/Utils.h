@@ -3,8 +3,12 @@
 
 #include <fstream>
 #include <vector>
+#include <map>
+#include <string>
 #include <iostream>
 #include <sstream>
+#include <iterator>
+#include <algorithm>
 #include "paths.h"
 
 #ifdef __APPLE__
@@ -122,9 +126,12 @@ void CheckError(cl_int error) {
 
 void AddSources(cl::Program::Sources& sources, const std::string& file_name) {
 	//TODO: add file existence check
+	// The sources only point at the text, so it is kept alive here (once per file) rather than leaked for every call.
+	static std::map<std::string, std::string> source_code;
 	std::ifstream file(kernel_path + file_name);
-	std::string* source_code = new std::string(std::istreambuf_iterator<char>(file), (std::istreambuf_iterator<char>()));
-	sources.push_back(std::make_pair((*source_code).c_str(), source_code->length() + 1));
+	std::string& text = source_code[file_name];
+	text.assign(std::istreambuf_iterator<char>(file), (std::istreambuf_iterator<char>()));
+	sources.push_back(std::make_pair(text.c_str(), text.length() + 1));
 }
 
 std::string ListPlatformsDevices() {
@@ -205,15 +212,13 @@ enum ProfilingResolution {
 	PROF_NULL = -1
 };
 
-unsigned long* GetFullProfilingInfoData(const cl::Event& evnt, ProfilingResolution resolution)
+void GetFullProfilingInfoData(const cl::Event& evnt, ProfilingResolution resolution, unsigned long* profiled_info)
 {
-	// Gather the full profiling info and store within an array of size 4, this provides more flexibility when profiling kernels.
-	return new unsigned long[4] {
-		(unsigned long)((evnt.getProfilingInfo<CL_PROFILING_COMMAND_SUBMIT>() - evnt.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>()) / resolution),
-		(unsigned long)((evnt.getProfilingInfo<CL_PROFILING_COMMAND_START>() - evnt.getProfilingInfo<CL_PROFILING_COMMAND_SUBMIT>()) / resolution),
-		(unsigned long)((evnt.getProfilingInfo<CL_PROFILING_COMMAND_END>() - evnt.getProfilingInfo<CL_PROFILING_COMMAND_START>()) / resolution),
-		(unsigned long)((evnt.getProfilingInfo<CL_PROFILING_COMMAND_END>() - evnt.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>()) / resolution)
-	};
+	// Gather the full profiling info and store within the provided array of size 4, this provides more flexibility when profiling kernels.
+	profiled_info[0] = (unsigned long)((evnt.getProfilingInfo<CL_PROFILING_COMMAND_SUBMIT>() - evnt.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>()) / resolution);
+	profiled_info[1] = (unsigned long)((evnt.getProfilingInfo<CL_PROFILING_COMMAND_START>() - evnt.getProfilingInfo<CL_PROFILING_COMMAND_SUBMIT>()) / resolution);
+	profiled_info[2] = (unsigned long)((evnt.getProfilingInfo<CL_PROFILING_COMMAND_END>() - evnt.getProfilingInfo<CL_PROFILING_COMMAND_START>()) / resolution);
+	profiled_info[3] = (unsigned long)((evnt.getProfilingInfo<CL_PROFILING_COMMAND_END>() - evnt.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>()) / resolution);
 }
 
 std::string GetFullProfilingInfo(unsigned long* profiled_info)
@@ -237,7 +242,7 @@ const char* GetResolutionString(ProfilingResolution resolution)
 		case PROF_US: return "[us]";
 		case PROF_MS: return "[ms]";
 		case PROF_S: return "[s]";
-		default: break;
+		default: return "";
 	}
 }
 
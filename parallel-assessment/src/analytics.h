@@ -2,6 +2,18 @@
 #define analytics_h
 
 #include <chrono>
+#include <mutex>
+#include <string>
+#include <cstdio>
+#include <cstring>
+
+#ifdef __linux__
+	#include <linux/perf_event.h>
+	#include <sys/ioctl.h>
+	#include <sys/syscall.h>
+	#include <unistd.h>
+	#include <cerrno>
+#endif
 
 namespace analytics
 {
@@ -28,7 +40,7 @@ namespace timer
 
 	long long Query(ProfilingResolution resolution)
 	{
-		long long new_query = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - start).count();
+		long long new_query = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
 		since_last = new_query - last_query;
 		last_query = new_query;
 
@@ -40,7 +52,7 @@ namespace timer
 		return since_last / resolution;
 	}
 
-	void Start() { start = std::chrono::high_resolution_clock::now(); }
+	void Start() { start = std::chrono::steady_clock::now(); }
 	long long Stop(ProfilingResolution resolution = PROF_NULL)
 	{
 		long long query = Query(resolution);
@@ -51,4 +63,236 @@ namespace timer
 	void Reset() { Start(); }
 }
 
+namespace counters
+{
+	/* Hardware counters of the host hot paths (read, parse, convert, the native reductions and the Sorted() checks), which the timer above
+	   cannot break down: a slow parse may be bound by branch misses, cache misses or memory bandwidth. Every thread counts its own work with
+	   a group of perf_event_open counters and adds it to the region the work belongs to, so a region sums every thread of the operation.
+	   Counting is off unless enabled (-C) and is a no-op other than on Linux, or where the kernel does not expose the counters. */
+
+	enum Counter
+	{
+		Cycles,
+		Instructions,
+		LlcMisses,						// The generic cache-misses event, which counts misses of the last level cache.
+		BranchMisses,
+		counter_count
+	};
+
+	const char* counter_names[counter_count] = { "cycles", "instructions", "LLC misses", "branch misses" };
+
+	struct Sample
+	{
+		unsigned long long values[counter_count] = {};
+		bool counted[counter_count] = {};	// Whether the counter could be opened, a PMU may lack e.g. the cache events.
+		unsigned long long scopes = 0;		// Scopes which were counted, one per thread and partition of the work.
+	};
+
+	bool enabled = false;				// Whether the scopes below count at all, set from the command line.
+
+	class Region
+	{
+		private:
+			const char* name;
+			std::mutex mutex;
+			Sample total;
+
+		public:
+			explicit Region(const char* name) : name(name) {}
+
+			const char* Name() const { return name; }
+
+			void Add(const Sample& sample)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				for (int c = 0; c < counter_count; c++)
+				{
+					total.values[c] += sample.values[c];
+					total.counted[c] = total.counted[c] || sample.counted[c];
+				}
+				total.scopes += sample.scopes;
+			}
+
+			Sample Take()
+			{
+				// Return everything counted since the last call, so every operation reports its own work.
+				std::lock_guard<std::mutex> lock(mutex);
+				Sample sample = total;
+				total = Sample();
+				return sample;
+			}
+	};
+
+	Region read("read");
+	Region parse("parse");
+	Region convert("convert");
+	Region reduce("reduce");
+	Region sorted("sorted check");
+
+	class ThreadCounters
+	{
+		// The counter group of one thread, opened on its first scope and counting only that thread, in user space.
+		private:
+			int fds[counter_count] = { -1, -1, -1, -1 };
+			int slots[counter_count] = {};	// Position of every opened counter within a read of the group.
+			int opened = 0;
+			bool tried = false;
+			bool running = false;
+
+		#ifdef __linux__
+			static int Open(unsigned int type, unsigned long long config, int group_fd)
+			{
+				perf_event_attr attr;
+				memset(&attr, 0, sizeof(attr));
+				attr.size = sizeof(attr);
+				attr.type = type;
+				attr.config = config;
+				attr.disabled = (group_fd == -1);
+				attr.exclude_kernel = 1;
+				attr.exclude_hv = 1;
+				attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+				return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+			}
+		#endif
+
+			bool Available()
+			{
+				if (tried)
+					return fds[Cycles] != -1;
+				tried = true;
+
+			#ifdef __linux__
+				const unsigned long long configs[counter_count] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+					PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+
+				// The cycles lead the group, so every counter is scheduled onto the PMU together and their ratios are comparable.
+				for (int c = 0; c < counter_count; c++)
+				{
+					fds[c] = Open(PERF_TYPE_HARDWARE, configs[c], fds[Cycles]);
+					if (fds[c] != -1)
+						slots[c] = opened++;
+					else if (c == Cycles)
+					{
+						ReportUnavailable(strerror(errno));
+						return false;
+					}
+				}
+				return true;
+			#else
+				ReportUnavailable("perf_event_open requires Linux");
+				return false;
+			#endif
+			}
+
+			static void ReportUnavailable(const char* reason)
+			{
+				// Reported once rather than by every thread, as every thread fails for the same reason.
+				static std::once_flag reported;
+				std::call_once(reported, [reason]()
+				{
+					fprintf(stderr, "Hardware counters are unavailable (%s), the kernel must expose the PMU and perf_event_paranoid allow user counters.\n", reason);
+				});
+			}
+
+		public:
+			~ThreadCounters()
+			{
+			#ifdef __linux__
+				for (int c = 0; c < counter_count; c++)
+				{
+					if (fds[c] != -1)
+						::close(fds[c]);
+				}
+			#endif
+			}
+
+			bool Start()
+			{
+				// A nested scope on the same thread is left to the outer one, which already counts its work.
+				if (running || !Available())
+					return false;
+
+			#ifdef __linux__
+				ioctl(fds[Cycles], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+				ioctl(fds[Cycles], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+			#endif
+				running = true;
+				return true;
+			}
+
+			bool Stop(Sample& sample)
+			{
+				if (!running)
+					return false;
+				running = false;
+
+			#ifdef __linux__
+				ioctl(fds[Cycles], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+				// The group reads as { count, time enabled, time running, value... }, the values being scaled up when the PMU was multiplexed.
+				unsigned long long data[3 + counter_count];
+				if (::read(fds[Cycles], data, sizeof(data)) < (ssize_t)((3 + opened) * sizeof(unsigned long long)))
+					return false;
+
+				double scale = (data[2]) ? (double)data[1] / data[2] : 0.0;
+				for (int c = 0; c < counter_count; c++)
+				{
+					sample.counted[c] = (fds[c] != -1);
+					sample.values[c] = (sample.counted[c]) ? (unsigned long long)(data[3 + slots[c]] * scale) : 0;
+				}
+				sample.scopes = 1;
+				return true;
+			#else
+				return false;
+			#endif
+			}
+	};
+
+	ThreadCounters& ThisThread()
+	{
+		static thread_local ThreadCounters thread_counters;
+		return thread_counters;
+	}
+
+	class Scope
+	{
+		// Count the work of the calling thread from construction to destruction into the given region.
+		private:
+			Region* region;
+
+		public:
+			explicit Scope(Region& region) : region((enabled && ThisThread().Start()) ? &region : nullptr) {}
+			~Scope()
+			{
+				Sample sample;
+				if (region && ThisThread().Stop(sample))
+					region->Add(sample);
+			}
+
+			Scope(const Scope&) = delete;
+			Scope& operator=(const Scope&) = delete;
+	};
+
+	std::string Format(const Sample& sample)
+	{
+		std::string output;
+		for (int c = 0; c < counter_count; c++)
+		{
+			output += (c) ? ", " : "";
+			output += std::string(counter_names[c]) + " " + ((sample.counted[c]) ? std::to_string(sample.values[c]) : "n/a");
+		}
+
+		// Instructions per cycle and misses per thousand instructions, which compare across datasets of any size.
+		if (sample.counted[Instructions] && sample.values[Cycles] && sample.values[Instructions])
+		{
+			char ratios[128];
+			double kilo_instructions = sample.values[Instructions] / 1000.0;
+			snprintf(ratios, sizeof(ratios), " (IPC %.2f, LLC MPKI %.3f, branch MPKI %.3f)", (double)sample.values[Instructions] / sample.values[Cycles],
+				sample.values[LlcMisses] / kilo_instructions, sample.values[BranchMisses] / kilo_instructions);
+			output += ratios;
+		}
+		return output + " over " + std::to_string(sample.scopes) + " scope(s)";
+	}
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,694 @@
+#define CL_USE_DEPRECATED_OPENCL_1_2_APIS
+#define __CL_ENABLE_EXCEPTIONS
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <functional>
+#include <numeric>
+#include <cmath>
+#include <cstdio>
+
+#include "Utils.h"
+#include "windows_fileread.h"
+#include "analytics.h"
+#include "funcs.h"
+#include "paths.h"
+#include "native_funcs.h"
+#include "histogram.h"
+#include "records.h"
+#include "compressed.h"
+#include "summation.h"
+#include "dataset.h"
+#include "quantile_sketch.h"
+#include "topk.h"
+
+// std::inclusive_scan and std::exclusive_scan are only available from C++17, MSVC reports its standard through _MSVC_LANG.
+#if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+	#define BENCH_STD_SCAN
+#endif
+
+/* Standalone benchmark harness for the analyzer. Every section is a function within the bench namespace which prints its own table, a
+   single section can be selected with -b <name>, otherwise every section is executed in turn. Each measurement is the best of N repeats
+   (-r) so that one-off page faults and thread start up do not distort the results. */
+
+namespace bench
+{
+	int repeats = 5;
+
+	double BestOf(std::function<void()> body)
+	{
+		// Execute body the requested number of times and return the fastest execution in milliseconds.
+		double best = 0.0;
+		for (int r = 0; r < repeats; r++)
+		{
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			body();
+			double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			best = (r == 0 || elapsed < best) ? elapsed : best;
+		}
+
+		return best;
+	}
+
+	void InitDevice(int platform_id, int device_id)
+	{
+		// The same context, queue and program as the analyzer, only needed by the sections which execute kernels.
+		context = GetContext(platform_id, device_id);
+		queue = cl::CommandQueue(context, CL_QUEUE_PROFILING_ENABLE);
+		cl::Program::Sources sources;
+		AddSources(sources, "kernels.cl");
+		program = cl::Program(context, sources);
+		program.build();
+
+		std::printf("Running on %s, %s\n", GetPlatformName(platform_id).c_str(), GetDeviceName(platform_id, device_id).c_str());
+	}
+
+	std::vector<size_t> ThreadCounts(size_t max_threads)
+	{
+		// 1, 2, 4, ... up to and always including the maximum thread count.
+		std::vector<size_t> counts;
+		for (size_t t = 1; t < max_threads; t <<= 1)
+			counts.push_back(t);
+		counts.push_back(max_threads);
+
+		return counts;
+	}
+
+	void Scaling(const char* data, unsigned int len, size_t max_threads)
+	{
+		std::printf("\n== Native thread pool scaling (%u bytes) ==\n", len);
+
+		// Sequential reference, the original line counting and parsing used before the thread pool.
+		const char* sequential_data = data;
+		double sequential_parse = BestOf([&]()
+		{
+			size_t size = winstr::QueryLineCount(sequential_data, len);
+			delete[] winstr::ParseLines(sequential_data, len, ' ', 5, size);
+		});
+		std::printf("Sequential parse: %.2f ms\n\n", sequential_parse);
+		std::printf("%8s %6s %11s %9s %9s %11s %10s %8s %8s %8s\n", "Threads", "Nodes", "Parse[ms]", "Sum[ms]", "Min[ms]", "StdDev[ms]", "Sort[ms]", "xParse", "xSum", "xSort");
+
+		double base_parse = 0.0, base_sum = 0.0, base_sort = 0.0;
+		std::vector<size_t> counts = ThreadCounts(max_threads);
+		for (size_t c = 0; c < counts.size(); c++)
+		{
+			// Recreate the global pool with the requested number of pinned workers.
+			ReleaseThreadPool();
+			thread_count = counts[c];
+			ThreadPool& pool = *GetThreadPool();
+
+			size_t size = 0;
+			ArenaArray<fp_type> parsed;
+			double parse = BestOf([&]() { parsed = ParallelParse(pool, data, len, ' ', 5, size); });
+			fp_type* A_f = parsed.Data();
+
+			ArenaArray<int> converted = ParallelConvert(pool, A_f, size, 10);
+			int* A = converted.Data();
+			int* B = nullptr;
+			long long* S = nullptr;
+			size_t padded_size = size;
+
+			double sum = BestOf([&]() { NativeSum(A, S, padded_size, size); });
+			double min = BestOf([&]() { NativeMinMax(A, B, padded_size, size, false); });
+			double stddev = BestOf([&]()
+			{
+				NativeSum(A, S, padded_size, size);
+				NativeVariance(A, S, padded_size, size, (int)mean(S[0], size));
+			});
+			double sort = BestOf([&]() { NativeSort(A, B, padded_size, size); });
+
+			if (c == 0) { base_parse = parse; base_sum = sum; base_sort = sort; }
+			std::printf("%8zu %6zu %11.2f %9.3f %9.3f %11.3f %10.2f %8.2f %8.2f %8.2f\n", pool.Size(), pool.NodeCount(), parse, sum, min, stddev, sort,
+				base_parse / parse, base_sum / sum, base_sort / sort);
+
+		}
+
+		ReleaseThreadPool();
+	}
+
+	void Distribution(const char* data, unsigned int len)
+	{
+		std::printf("\n== Histogram vs sort based percentiles ==\n");
+
+		size_t size = 0;
+		ArenaArray<fp_type> parsed = ParallelParse(*GetThreadPool(), data, len, ' ', 5, size);
+		fp_type* A_f = parsed.Data();
+		ArenaArray<int> converted = ParallelConvert(*GetThreadPool(), A_f, size, 10);
+		int* A = converted.Data();
+		int* B = nullptr;
+		size_t padded_size = size;
+
+		// Sort based reference, exactly as the menu finds the median and quartiles.
+		int* sorted = nullptr;
+		double sort = BestOf([&]() { sorted = NativeSort(A, B, padded_size, size); });
+
+		std::vector<Histogram> histograms;
+		double histogram = BestOf([&]() { histograms = NativeHistograms(A, size, nullptr); });
+		std::vector<Histogram> histograms_fp;
+		double histogram_fp = BestOf([&]() { histograms_fp = NativeHistograms(A_f, size, nullptr); });
+
+		// Every percentile read from the bins must select exactly the same element as source() within the sorted array.
+		const fp_type percentiles[] = { 0.0f, 0.01f, 0.25f, 0.5f, 0.75f, 0.99f, 0.999999f };
+		int mismatches = 0;
+		for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++)
+		{
+			if (histograms[0].Percentile(percentiles[i]) != source(sorted, size, percentiles[i]) / 10.0f)
+				mismatches++;
+		}
+
+		std::printf("%12s %12s %12s %12s\n", "Sort[ms]", "Hist[ms]", "HistFP[ms]", "Mismatches");
+		std::printf("%12.3f %12.3f %12.3f %12d\n", sort, histogram, histogram_fp, mismatches);
+		std::printf("Median: %.1f, Mode: %.1f, Bins: %zu\n", histograms[0].Median(), histograms[0].Mode(), histograms[0].Bins());
+
+	}
+
+	template<typename T, typename Out, typename Op>
+	void ReferenceScan(const T* in, const int* heads, size_t len, Out* out, Out identity, Op op, bool inclusive)
+	{
+		// Sequential reference of Scan(), std::inclusive_scan/std::exclusive_scan when available. There is no standard segmented scan.
+#ifdef BENCH_STD_SCAN
+		if (!heads && inclusive)
+			return (void)std::inclusive_scan(in, in + len, out, [&](Out a, Out b) { return op(a, b); }, identity);
+		if (!heads)
+			return (void)std::exclusive_scan(in, in + len, out, identity, [&](Out a, Out b) { return op(a, b); });
+#endif
+		Out running = identity;
+		for (size_t i = 0; i < len; i++)
+		{
+			if (heads && heads[i])
+				running = identity;
+
+			Out exclusive = running;
+			running = op(running, (Out)in[i]);
+			out[i] = (inclusive) ? running : exclusive;
+		}
+	}
+
+	template<typename T, typename Out, typename Op>
+	void ScanRow(const char* name, const std::string& op, const T* in, const int* heads, size_t len, bool inclusive, Out identity, Op host_op)
+	{
+		// Total time includes the upload and read back of Scan(), the kernel time and bandwidth only count the scan kernels themselves.
+		Out* result = nullptr;
+		double total = BestOf([&]() { result = Scan<T, Out>(op, in, heads, len, inclusive); });
+
+		cl::Buffer in_buffer = PooledBuffer("scan_in", in, len);
+		cl::Buffer heads_buffer = PooledBuffer("scan_heads", heads, (heads) ? len : 0);
+		cl::Buffer out_buffer = PooledBuffer<Out>("scan_out", nullptr, len);
+		double kernel = 0.0;
+		for (int r = 0; r < repeats; r++)
+		{
+			KernelProfile profile;
+			if (heads)
+				EnqueueSegmentedScan<T, Out>(op, in_buffer, heads_buffer, out_buffer, len, inclusive, profile);
+			else EnqueueScan<T, Out>(op, in_buffer, out_buffer, len, inclusive, profile);
+			kernel = (r == 0 || profile.ex_time / 1e6 < kernel) ? profile.ex_time / 1e6 : kernel;
+		}
+
+		/* Floating point sums are accumulated in a different order, so they only need to agree with the reference to within rounding. The
+		   float sums of a device without cl_khr_fp64 round far more coarsely than the double sums. */
+		std::vector<Out> reference(len);
+		double sequential = BestOf([&]() { ReferenceScan(in, heads, len, reference.data(), identity, host_op, inclusive); });
+		double tolerance = (typeid(Out) == typeid(float)) ? 1e-3 : 1e-9;
+		size_t mismatches = 0;
+		for (size_t i = 0; i < len; i++)
+		{
+			if (result[i] != reference[i] && std::fabs((double)result[i] - (double)reference[i]) > tolerance * std::max(1.0, std::fabs((double)reference[i])))
+				mismatches++;
+		}
+
+		double bytes = (double)len * (sizeof(T) + sizeof(Out) + ((heads) ? sizeof(int) : 0));
+		std::printf("%-26s %12.3f %12.3f %12.3f %10.2f %12zu\n", name, sequential, total, kernel, (kernel > 0.0) ? bytes / (kernel * 1e6) : 0.0, mismatches);
+	}
+
+	void Scans(const char* data, unsigned int len)
+	{
+		std::printf("\n== Prefix scans ==\n");
+
+		size_t size = 0;
+		ArenaArray<fp_type> parsed = ParallelParse(*GetThreadPool(), data, len, ' ', 5, size);
+		fp_type* A_f = parsed.Data();
+		ArenaArray<int> converted = ParallelConvert(*GetThreadPool(), A_f, size, 10);
+		int* A = converted.Data();
+
+		// Segment heads at every change of station within the dataset.
+		StationColumn column;
+		ParseStations(*GetThreadPool(), data, len, ' ', column);
+		std::vector<int> heads(size);
+		for (size_t i = 0; i < size; i++)
+			heads[i] = (i == 0 || column.ids[i] != column.ids[i - 1]);
+
+		auto add = [](auto a, auto b) { return a + b; };
+		auto max = [](auto a, auto b) { return std::max(a, b); };
+		std::printf("%-26s %12s %12s %12s %10s %12s\n", "Scan", "Host[ms]", "Total[ms]", "Kernel[ms]", "GB/s", "Mismatches");
+		ScanRow("inclusive add INT", "add", A, (const int*)nullptr, size, true, 0, add);
+		ScanRow("exclusive add INT", "add", A, (const int*)nullptr, size, false, 0, add);
+		ScanRow("inclusive max INT", "max", A, (const int*)nullptr, size, true, INT_MIN, max);
+		ScanRow("segmented add INT", "add", A, heads.data(), size, true, 0, add);
+		ScanRow("segmented max FP", "max", A_f, heads.data(), size, true, -INFINITY, max);
+
+		// The floating point sums are scanned into double wherever the device supports cl_khr_fp64, and into float otherwise.
+		auto fp_add_rows = [&](auto identity, const std::string& suffix)
+		{
+			ScanRow(("inclusive add FP" + suffix).c_str(), "add", A_f, (const int*)nullptr, size, true, identity, add);
+			ScanRow(("exclusive add FP" + suffix).c_str(), "add", A_f, (const int*)nullptr, size, false, identity, add);
+			ScanRow(("segmented add FP" + suffix).c_str(), "add", A_f, heads.data(), size, true, identity, add);
+		};
+		if (DeviceSupportsFP64())
+			fp_add_rows(0.0, "");
+		else fp_add_rows(0.0f, " (float)");
+
+		column.Release();
+	}
+
+	void Compression(const char* data, unsigned int len)
+	{
+		std::printf("\n== Compressed columns ==\n");
+
+		size_t size = 0;
+		ArenaArray<fp_type> parsed = ParallelParse(*GetThreadPool(), data, len, ' ', 5, size);
+		fp_type* A_f = parsed.Data();
+		ArenaArray<int> converted = ParallelConvert(*GetThreadPool(), A_f, size, 10);
+		int* A = converted.Data();
+
+		// Host reference of every reduction.
+		long long reference_sum = 0;
+		int reference_min = A[0], reference_max = A[0];
+		for (size_t i = 0; i < size; i++)
+		{
+			reference_sum += A[i];
+			reference_min = std::min(reference_min, A[i]);
+			reference_max = std::max(reference_max, A[i]);
+		}
+
+		CompressedColumn column;
+		double encode = BestOf([&]() { column.Encode(*GetThreadPool(), A, size); });
+
+		// Every packed value must decode to exactly the original value.
+		size_t decode_mismatches = 0;
+		for (size_t i = 0; i < size; i++)
+			decode_mismatches += (column.Decode(i) != A[i]);
+		std::printf("Encode: %.3f ms, %zu blocks, %.2f bits per value, %zu decode mismatches\n\n", encode, column.Blocks(),
+			column.packed.size() * 32.0 / size, decode_mismatches);
+
+		std::printf("%-12s %12s %8s %10s %10s %10s %12s\n", "Storage", "Bytes", "Ratio", "Sum[ms]", "Min[ms]", "Max[ms]", "Mismatches");
+		const ColumnStorage storages[] = { PlainColumns, Int16Columns, PackedColumns };
+		for (size_t s = 0; s < sizeof(storages) / sizeof(storages[0]); s++)
+		{
+			ColumnStorage storage = storages[s];
+			if (storage == Int16Columns && !column.int16_valid)
+				continue;
+
+			// Every execution uploads its column, so the time includes the transfer of the stored bytes.
+			long long sum = 0;
+			int min = 0, max = 0;
+			double sum_time, min_time, max_time;
+			size_t bytes = (storage == PlainColumns) ? column.PlainBytes() : (storage == Int16Columns) ? column.Int16Bytes() : column.PackedBytes();
+			if (storage == PlainColumns)
+			{
+				// The analyzer pads its copy in place (see Resize), so the copy is owned by the arena rather than deleted here.
+				ArenaArray<int> copy(size, ScratchMemory);
+				int* P = copy.Data();
+				std::copy(A, A + size, P);
+				int* B = nullptr;
+				long long* S = nullptr;
+				size_t padded_size = size;
+				wg_size_changed = true;
+
+				sum_time = BestOf([&]() { Sum(P, S, padded_size, size); sum = S[0]; });
+				min_time = BestOf([&]() { LocalMinMax(P, B, padded_size, size, false); min = B[0]; });
+				max_time = BestOf([&]() { LocalMinMax(P, B, padded_size, size, true); max = B[0]; });
+			}
+			else
+			{
+				sum_time = BestOf([&]() { sum = CompressedReduce(column, storage, "reduce_sum", 0LL); });
+				min_time = BestOf([&]() { min = CompressedReduce(column, storage, "reduce_min", std::numeric_limits<int>::max()); });
+				max_time = BestOf([&]() { max = CompressedReduce(column, storage, "reduce_max", std::numeric_limits<int>::lowest()); });
+			}
+
+			int mismatches = (sum != reference_sum) + (min != reference_min) + (max != reference_max);
+			std::printf("%-12s %12zu %8.2f %10.3f %10.3f %10.3f %12d\n", StorageName(storage), bytes, (double)column.PlainBytes() / bytes,
+				sum_time, min_time, max_time, mismatches);
+		}
+
+		// The floating point column as float and as half, the error of each being that of the result against the column in double.
+		double reference_sum_f = 0.0;
+		for (size_t i = 0; i < size; i++)
+			reference_sum_f += A_f[i];
+		fp_type reference_min_f = *std::min_element(A_f, A_f + size), reference_max_f = *std::max_element(A_f, A_f + size);
+
+		HalfColumn half;
+		double half_encode = BestOf([&]() { half.Encode(*GetThreadPool(), A_f, size); });
+		std::printf("\nHalf encode: %.3f ms\n\n", half_encode);
+
+		std::printf("%-12s %12s %8s %10s %10s %10s %12s %10s %10s\n", "Storage", "Bytes", "Ratio", "Sum[ms]", "Min[ms]", "Max[ms]", "Sort[ms]", "Sum rel", "Extr abs");
+		for (int h = 0; h < 2; h++)
+		{
+			fp_type sum = 0, min = 0, max = 0;
+			double sum_time, min_time, max_time, sort_time;
+			size_t bytes = (h) ? half.Bytes() : half.PlainBytes();
+			if (!h)
+			{
+				ArenaArray<fp_type> copy(size, ScratchMemory);
+				fp_type* P = copy.Data();
+				std::copy(A_f, A_f + size, P);
+				fp_type* B = nullptr;
+				size_t padded_size = size;
+				wg_size_changed = true;
+
+				sum_time = BestOf([&]() { Sum(P, B, padded_size, size); sum = B[0]; });
+				min_time = BestOf([&]() { LocalMinMax(P, B, padded_size, size, false); min = B[0]; });
+				max_time = BestOf([&]() { LocalMinMax(P, B, padded_size, size, true); max = B[0]; });
+				sort_time = BestOf([&]() { Sort(P, B, padded_size, size); });
+			}
+			else
+			{
+				sum_time = BestOf([&]() { sum = CompressedReduce(half, HalfColumns, "reduce_sum", (fp_type)0); });
+				min_time = BestOf([&]() { min = CompressedReduce(half, HalfColumns, "reduce_min", std::numeric_limits<fp_type>::max()); });
+				max_time = BestOf([&]() { max = CompressedReduce(half, HalfColumns, "reduce_max", std::numeric_limits<fp_type>::lowest()); });
+				sort_time = BestOf([&]() { CompressedSort<fp_type>(half, HalfColumns); });
+			}
+
+			double extreme_error = std::max(std::fabs((double)min - reference_min_f), std::fabs((double)max - reference_max_f));
+			std::printf("%-12s %12zu %8.2f %10.3f %10.3f %10.3f %12.3f %10.3g %10.3g\n", (h) ? "HALF" : "FP", bytes, (double)half.PlainBytes() / bytes,
+				sum_time, min_time, max_time, sort_time, (sum - reference_sum_f) / reference_sum_f, extreme_error);
+		}
+		half.Release();
+	}
+
+	void SummationRow(const char* name, const fp_type* A_f, size_t size, SummationMode mode, long double reference_sum, long double reference_std)
+	{
+		// Every repeat of the sum is kept, a deterministic summation produces a single distinct result however often it is executed.
+		std::vector<double> sums;
+		double sum = 0.0, std = 0.0, sum_time, std_time;
+		if (mode == AtomicSummation)
+		{
+			// The same path as the analyzer, a padded copy summed by reduce_sum_FP and sum_sqr_diff_FP.
+			ArenaArray<fp_type> copy(size, ScratchMemory);
+			fp_type* P = copy.Data();
+			std::copy(A_f, A_f + size, P);
+			fp_type* B = nullptr;
+			size_t padded_size = size;
+			wg_size_changed = true;
+
+			sum_time = BestOf([&]() { Sum(P, B, padded_size, size); sum = B[0]; sums.push_back(sum); });
+			fp_type sum_mean = mean((fp_type)sum, size);
+			std_time = BestOf([&]() { Variance(P, B, padded_size, size, sum_mean); std = std::sqrt(CorrectedVariance(B[0], (fp_type)sum, sum_mean, size)); });
+		}
+		else
+		{
+			sum_time = BestOf([&]() { sum = CompensatedSum(A_f, size, mode); sums.push_back(sum); });
+			double sum_mean = (fp_type)(sum / size);
+			std_time = BestOf([&]() { std = std::sqrt(CorrectedVariance(CompensatedSum(A_f, size, mode, &sum_mean), sum, sum_mean, size)); });
+		}
+
+		std::sort(sums.begin(), sums.end());
+		size_t distinct = std::unique(sums.begin(), sums.end()) - sums.begin();
+		std::printf("%-22s %10.3f %10.3f %14.3e %14.3e %10zu\n", name, sum_time, std_time, (double)std::fabs((sum - reference_sum) / reference_sum),
+			(double)std::fabs((std - reference_std) / reference_std), distinct);
+	}
+
+	void Summation(const char* data, unsigned int len)
+	{
+		std::printf("\n== Floating point summation ==\n");
+
+		size_t size = 0;
+		ArenaArray<fp_type> parsed = ParallelParse(*GetThreadPool(), data, len, ' ', 5, size);
+		fp_type* A_f = parsed.Data();
+
+		// Sequential long double reference, itself compensated so that its error is far below that of any device path.
+		long double reference_sum = 0.0L, comp = 0.0L;
+		for (size_t i = 0; i < size; i++)
+		{
+			long double t = reference_sum + A_f[i];
+			comp += (std::fabs(reference_sum) >= std::fabs((long double)A_f[i])) ? (reference_sum - t) + A_f[i] : (A_f[i] - t) + reference_sum;
+			reference_sum = t;
+		}
+		reference_sum += comp;
+
+		long double reference_mean = reference_sum / size, reference_sqr_diff = 0.0L;
+		for (size_t i = 0; i < size; i++)
+			reference_sqr_diff += (A_f[i] - reference_mean) * (A_f[i] - reference_mean);
+		long double reference_std = std::sqrt(reference_sqr_diff / size);
+		std::printf("Reference sum: %.6Lf, standard deviation: %.9Lf\n", reference_sum, reference_std);
+
+		std::printf("%-22s %10s %10s %14s %14s %10s\n", "Summation", "Sum[ms]", "StdDev[ms]", "SumError", "StdDevError", "Distinct");
+		SummationRow("atomic float", A_f, size, AtomicSummation, reference_sum, reference_std);
+		SummationRow("compensated float", A_f, size, CompensatedFloat, reference_sum, reference_std);
+		if (DeviceSupportsFP64())
+			SummationRow("compensated double", A_f, size, CompensatedDouble, reference_sum, reference_std);
+		else std::printf("%-22s (no cl_khr_fp64)\n", "compensated double");
+
+	}
+
+	void Load(const std::string& path)
+	{
+		std::printf("\n== Dataset loading (%s) ==\n", path.c_str());
+		ThreadPool& pool = *GetThreadPool();
+
+		// Every stage of the original load in turn, each one touching the whole dataset before the next begins.
+		double read = 0.0, parse = 0.0, convert = 0.0, upload = 0.0;
+		double staged = BestOf([&]()
+		{
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			auto lap = [&]()
+			{
+				std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+				double elapsed = std::chrono::duration<double, std::milli>(now - start).count();
+				start = now;
+				return elapsed;
+			};
+
+			unsigned int len = 0;
+			size_t size = 0;
+			const char* data = winstr::ReadOptimal(path.c_str(), len);
+			read = lap();
+
+			StationColumn column;
+			TimeColumn time_column;
+			ArenaArray<fp_type> parsed = ParallelParse(pool, data, len, ' ', 5, size);
+			fp_type* A_f = parsed.Data();
+			ParseStations(pool, data, len, ' ', column);
+			ParseTimes(pool, data, len, ' ', time_column);
+			parse = lap();
+
+			ArenaArray<int> converted = ParallelConvert(pool, A_f, size, 10);
+			int* A = converted.Data();
+			convert = lap();
+
+			DeviceColumns<fp_type> fp_device;
+			DeviceColumns<int> int_device;
+			fp_device.Upload(A_f, size, column);
+			int_device.Upload(A, size, column);
+			upload = lap();
+
+			delete[] data;
+			column.Release();
+			time_column.Release();
+		});
+
+		// The pipeline overlaps every stage, parsing the integer column alongside the floating point column and streaming both.
+		Dataset pipelined;
+		pipelined.stream_to_device = true;
+		pipelined.Open(path);
+		double pipeline = BestOf([&]()
+		{
+			StationColumn column;
+			TimeColumn time_column;
+			pipelined.Load(pool, DatasetQuery(), ' ', 5, column, time_column);
+			pipelined.Release();
+			column.Release();
+			time_column.Release();
+		});
+
+		std::printf("%-10s %9s %10s %12s %11s %10s\n", "Load", "Read[ms]", "Parse[ms]", "Convert[ms]", "Upload[ms]", "Total[ms]");
+		std::printf("%-10s %9.2f %10.2f %12.2f %11.2f %10.2f\n", "staged", read, parse, convert, upload, staged);
+		std::printf("%-10s %9s %10s %12s %11s %10.2f (%.2fx)\n", "pipelined", "-", "-", "-", "-", pipeline, staged / pipeline);
+	}
+
+	void Sketch(const char* data, unsigned int len)
+	{
+		std::printf("\n== Quantile sketches ==\n");
+		ThreadPool& pool = *GetThreadPool();
+
+		size_t size = 0;
+		ArenaArray<fp_type> parsed = ParallelParse(pool, data, len, ' ', 5, size);
+		fp_type* A_f = parsed.Data();
+		std::vector<fp_type> sorted(A_f, A_f + size);
+		std::sort(sorted.begin(), sorted.end());
+
+		// The exact alternatives, a selection of a single percentile and a sort which then answers every percentile.
+		double select = BestOf([&]() { SelectQuantile(A_f, size, 0.5); });
+		double sort = BestOf([&]()
+		{
+			std::vector<fp_type> copy(A_f, A_f + size);
+			std::sort(copy.begin(), copy.end());
+		});
+		std::printf("Exact selection: %.2f ms per percentile, sort: %.2f ms\n", select, sort);
+		std::printf("%10s %6s %7s %10s %11s %12s %13s\n", "Error", "K", "Items", "Build[ms]", "Merge[ms]", "Query[us]", "MaxRankError");
+
+		const double errors[] = { 0.01, 0.005, 0.001 };
+		for (size_t e = 0; e < sizeof(errors) / sizeof(errors[0]); e++)
+		{
+			// One sketch per partition of the pool, as every parsing thread builds its own, then merged in partition order.
+			size_t k = SketchK(errors[e]);
+			std::vector<QuantileSketch> sketches;
+			double build = BestOf([&]()
+			{
+				sketches.assign(pool.DefaultPartitions(), QuantileSketch(k));
+				pool.ParallelFor(size, sketches.size(), [&](size_t p, size_t begin, size_t end)
+				{
+					for (size_t i = begin; i < end; i++)
+						sketches[p].Update(A_f[i]);
+				});
+			});
+
+			QuantileSketch merged(k);
+			double merge = BestOf([&]()
+			{
+				merged = QuantileSketch(k);
+				for (size_t p = 0; p < sketches.size(); p++)
+					merged.Merge(sketches[p]);
+				merged.Quantile(0.5);
+			});
+
+			// Every whole percentile, after the first query has already prepared the sketch.
+			double query = BestOf([&]()
+			{
+				for (int p = 1; p < 100; p++)
+					merged.Quantile(p / 100.0);
+			}) * 1000.0 / 99.0;
+
+			// The rank error is the distance from the requested rank to the nearest rank of the answered value.
+			double max_error = 0.0;
+			for (int p = 1; p < 1000; p++)
+			{
+				double q = p / 1000.0;
+				fp_type value = merged.Quantile(q);
+				double low = (double)(std::lower_bound(sorted.begin(), sorted.end(), value) - sorted.begin()) / size;
+				double high = (double)(std::upper_bound(sorted.begin(), sorted.end(), value) - sorted.begin()) / size;
+				max_error = std::max(max_error, (q < low) ? low - q : (q > high) ? q - high : 0.0);
+			}
+
+			std::printf("%10.4f %6zu %7zu %10.2f %11.3f %12.3f %13.5f\n", errors[e], k, merged.Items(), build, merge, query, max_error);
+		}
+
+	}
+
+	void TopK(const char* data, unsigned int len)
+	{
+		std::printf("\n== Top K records ==\n");
+
+		size_t size = 0;
+		ArenaArray<fp_type> parsed = ParallelParse(*GetThreadPool(), data, len, ' ', 5, size);
+		fp_type* A_f = parsed.Data();
+		ArenaArray<int> converted = ParallelConvert(*GetThreadPool(), A_f, size, 10);
+		int* A = converted.Data();
+		StationColumn column;
+		DeviceColumns<int> device;
+		device.Upload(A, size, column);
+
+		// The reference sorts a copy of every record with its row, which is what the top K avoids.
+		double sort = BestOf([&]()
+		{
+			std::vector<ExtremeRecord<int>> records(size);
+			for (size_t i = 0; i < size; i++)
+				records[i] = { A[i], (int)i };
+			std::sort(records.begin(), records.end(), [](const ExtremeRecord<int>& a, const ExtremeRecord<int>& b) { return TopKBetter(a, b, true); });
+		});
+		std::printf("Full sort: %.2f ms\n", sort);
+		std::printf("%6s %12s %12s %10s\n", "K", "Device[ms]", "Native[ms]", "Identical");
+
+		const size_t ks[] = { 10, 100, 1000 };
+		for (size_t i = 0; i < sizeof(ks) / sizeof(ks[0]); i++)
+		{
+			std::vector<ExtremeRecord<int>> device_top, native_top;
+			double device_time = BestOf([&]() { device_top = DeviceTopK(device, ks[i], true); });
+			double native_time = BestOf([&]() { native_top = NativeTopK(A, size, ks[i], true); });
+
+			bool identical = device_top.size() == native_top.size();
+			for (size_t r = 0; identical && r < device_top.size(); r++)
+				identical = device_top[r].row == native_top[r].row;
+			std::printf("%6zu %12.3f %12.3f %10s\n", ks[i], device_time, native_time, (identical) ? "yes" : "no");
+		}
+
+	}
+}
+
+void PrintHelp() {
+	std::cerr << "Benchmark usage:" << std::endl;
+
+	std::cerr << "  -s : use the short dataset" << std::endl;
+	std::cerr << "  -p : select platform" << std::endl;
+	std::cerr << "  -d : select device" << std::endl;
+	std::cerr << "  -t : maximum number of native threads" << std::endl;
+	std::cerr << "  -r : number of repeats per measurement" << std::endl;
+	std::cerr << "  -b : run a single section (scaling, histogram, scan, compression, summation, load, sketch, topk)" << std::endl;
+	std::cerr << "  -R : directory of the project (holding src and data), found automatically by default" << std::endl;
+	std::cerr << "  -h : print this message" << std::endl;
+}
+
+int main(int argc, char **argv) {
+	const char* file_dir = "temp_lincolnshire.txt";
+	std::string section = "";
+	size_t max_threads = 0;
+	int platform_id = 0;
+	int device_id = 0;
+	const char* root = nullptr;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-s") == 0) { file_dir = "temp_lincolnshire_short.txt"; }
+		else if ((strcmp(argv[i], "-p") == 0) && (i < (argc - 1))) { platform_id = atoi(argv[++i]); }
+		else if ((strcmp(argv[i], "-d") == 0) && (i < (argc - 1))) { device_id = atoi(argv[++i]); }
+		else if ((strcmp(argv[i], "-t") == 0) && (i < (argc - 1))) { max_threads = atoi(argv[++i]); }
+		else if ((strcmp(argv[i], "-r") == 0) && (i < (argc - 1))) { bench::repeats = std::max(1, atoi(argv[++i])); }
+		else if ((strcmp(argv[i], "-b") == 0) && (i < (argc - 1))) { section = argv[++i]; }
+		else if ((strcmp(argv[i], "-R") == 0) && (i < (argc - 1))) { root = argv[++i]; }
+		else if (strcmp(argv[i], "-h") == 0) { PrintHelp(); return 0; }
+	}
+
+	try
+	{
+		InitPaths(root);
+		profiler_output = false;
+
+		unsigned int len = 0;
+		const char* data = winstr::ReadOptimal(std::string(data_path + file_dir).c_str(), len);
+		if (!data)
+			return 1;
+
+		// The pool never creates more workers than logical CPUs, so larger requests are clamped here to keep the table honest.
+		size_t cpu_count = NumaTopology::Query().CpuCount();
+		if (!max_threads || max_threads > cpu_count)
+			max_threads = cpu_count;
+
+		if (section.empty() || section == "scaling")
+			bench::Scaling(data, len, max_threads);
+		if (section.empty() || section == "histogram")
+			bench::Distribution(data, len);
+		if (section.empty() || section == "scan" || section == "compression" || section == "summation" || section == "load" || section == "topk")
+			bench::InitDevice(platform_id, device_id);
+		if (section.empty() || section == "scan")
+			bench::Scans(data, len);
+		if (section.empty() || section == "compression")
+			bench::Compression(data, len);
+		if (section.empty() || section == "summation")
+			bench::Summation(data, len);
+		if (section.empty() || section == "load")
+			bench::Load(data_path + file_dir);
+		if (section.empty() || section == "sketch")
+			bench::Sketch(data, len);
+		if (section.empty() || section == "topk")
+			bench::TopK(data, len);
+
+		ReleasePools();
+		delete[] data;
+	}
+	catch (const cl::Error& err) {
+		std::cerr << "ERROR: " << err.what() << ", " << getErrorString(err.err()) << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
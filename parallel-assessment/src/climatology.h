@@ -0,0 +1,387 @@
+#ifndef climatology_h
+#define climatology_h
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <cstdio>
+
+#include "funcs.h"
+#include "native_funcs.h"
+#include "records.h"
+#include "timeseries.h"
+#include "summation.h"
+#include "filter.h"
+
+/* Anomaly detection against a climatology baseline. Every record belongs to a group of its station, day of the year and hour, and the
+   climatology of a group is the mean and standard deviation of every record within it (over all years of the dataset). A record is then
+   an anomaly when its z-score, the distance from the mean of its group in standard deviations, reaches the threshold.
+
+   The day of the year is counted within a leap year, so that the 1st of March is always the same day and the 29th of February is a
+   group of its own. The groups of a station are contiguous, so the records are grouped by a counting sort of every station segment of
+   the time ordering (timeseries.h) as a task of its own, once per dataset. The climatology kernels then compute every group in one pass
+   and score every resident record in a second, fused with the compaction of the flagged rows (see the CLIMATOLOGY KERNELS of kernels.cl). */
+
+const int climatology_slots = 366 * 24;		// Groups of every station, one per hour of every day of a leap year.
+double anomaly_threshold = 3.0;				// Absolute z-score at which a record is flagged.
+int climatology_min_count = 5;				// Fewest records within a group for its climatology to be used.
+
+const unsigned int leap_month_days[12] = { 0, 31, 60, 91, 121, 152, 182, 213, 244, 274, 305, 335 };
+
+int ClimatologySlot(unsigned int minutes)
+{
+	// The hour of the leap year day of a minute timestamp.
+	int year;
+	unsigned int month, day;
+	CivilFromDays(epoch_days + (int)(minutes / minutes_per_day), year, month, day);
+	return (int)(leap_month_days[month - 1] + day - 1) * 24 + (int)((minutes % minutes_per_day) / 60);
+}
+
+std::string FormatSlot(int slot)
+{
+	// Format a slot of the leap year as "MM-DD HH:00".
+	int day = slot / 24;
+	int month = (int)(std::upper_bound(leap_month_days, leap_month_days + 12, (unsigned int)day) - leap_month_days);
+	char buffer[16];
+	snprintf(buffer, sizeof(buffer), "%02d-%02u %02d:00", month, day - leap_month_days[month - 1] + 1, slot % 24);
+	return buffer;
+}
+
+struct ClimatologyIndex
+{
+	const unsigned int* source = nullptr;	// Time column the index was built from.
+	size_t size = 0;
+	size_t group_count = 0;
+	std::vector<int> keys;					// Group of every record.
+	std::vector<int> order;					// Record index of every position, the records of every group being contiguous.
+	std::vector<int> offsets;				// First position of every group within order, followed by the size.
+
+	cl::Buffer device_keys;					// The index uploaded once for the climatology kernels.
+	cl::Buffer device_order;
+	cl::Buffer device_offsets;
+
+	void Build(ThreadPool& pool, const TimeSeries& series, size_t station_count)
+	{
+		source = times.minutes.Data();
+		size = series.size;
+		group_count = station_count * climatology_slots;
+		keys.assign(size, 0);
+		order.assign(size, 0);
+		offsets.assign(group_count + 1, 0);
+		device_keys = device_order = device_offsets = cl::Buffer();
+
+		/* Every station segment of the time ordering holds exactly the records of the groups of that station, so each is counting sorted
+		   into the same positions of order as a task. Consecutive records usually share a day, so the calendar is only consulted once a day. */
+		TaskGroup group;
+		std::vector<bool> present(station_count, false);
+		for (size_t begin = 0; begin < size; )
+		{
+			size_t end = begin + 1;
+			while (end < size && !series.station_head[end])
+				end++;
+			present[series.station[begin]] = true;
+
+			pool.Submit(group, pool.NodeOf(begin, size), [&, begin, end]()
+			{
+				int base = series.station[begin] * climatology_slots;
+				std::vector<int> counts(climatology_slots + 1, 0);
+				std::vector<int> slots(end - begin);
+				unsigned int day = ~0u;
+				int day_slot = 0;
+				for (size_t i = begin; i < end; i++)
+				{
+					if (series.minutes[i] / minutes_per_day != day)
+					{
+						day = series.minutes[i] / minutes_per_day;
+						day_slot = ClimatologySlot(day * minutes_per_day);
+					}
+					slots[i - begin] = day_slot + (int)((series.minutes[i] % minutes_per_day) / 60);
+					counts[slots[i - begin] + 1]++;
+				}
+
+				for (int s = 0; s < climatology_slots; s++)
+				{
+					counts[s + 1] += counts[s];
+					offsets[base + s] = (int)begin + counts[s];
+				}
+				for (size_t i = begin; i < end; i++)
+				{
+					int position = (int)begin + counts[slots[i - begin]]++;
+					order[position] = (int)series.order[i];
+					keys[series.order[i]] = base + slots[i - begin];
+				}
+			});
+			begin = end;
+		}
+		group.Wait();
+
+		// The groups of a station without any records are empty, starting where the groups of the next station do.
+		offsets[group_count] = (int)size;
+		int next = (int)size;
+		for (size_t s = station_count; s-- > 0; )
+		{
+			if (present[s])
+			{
+				next = offsets[s * climatology_slots];
+				continue;
+			}
+			std::fill(offsets.begin() + s * climatology_slots, offsets.begin() + (s + 1) * climatology_slots, next);
+		}
+	}
+
+	void Upload()
+	{
+		if (device_keys())
+			return;
+
+		device_keys = cl::Buffer(context, CL_MEM_READ_ONLY, std::max<size_t>(1, size) * sizeof(int));
+		device_order = cl::Buffer(context, CL_MEM_READ_ONLY, std::max<size_t>(1, size) * sizeof(int));
+		device_offsets = cl::Buffer(context, CL_MEM_READ_ONLY, offsets.size() * sizeof(int));
+		if (size)
+		{
+			queue.enqueueWriteBuffer(device_keys, CL_TRUE, 0, size * sizeof(int), keys.data());
+			queue.enqueueWriteBuffer(device_order, CL_TRUE, 0, size * sizeof(int), order.data());
+		}
+		queue.enqueueWriteBuffer(device_offsets, CL_TRUE, 0, offsets.size() * sizeof(int), offsets.data());
+	}
+
+	int Count(size_t g) const { return offsets[g + 1] - offsets[g]; }
+
+	void Release()
+	{
+		source = nullptr;
+		size = group_count = 0;
+		std::vector<int>().swap(keys);
+		std::vector<int>().swap(order);
+		std::vector<int>().swap(offsets);
+		device_keys = device_order = device_offsets = cl::Buffer();
+	}
+};
+
+ClimatologyIndex climatology_index;			// Climatology groups of the loaded dataset, built on first use.
+
+ClimatologyIndex& GetClimatologyIndex()
+{
+	if (climatology_index.source != times.minutes.Data() || climatology_index.size != std::min(stations.size, times.size))
+	{
+		timer::Start();
+		climatology_index.Build(*GetThreadPool(), GetTimeSeries(), stations.StationCount());
+		std::cout << "Grouped " << climatology_index.size << " records into " << climatology_index.group_count << " climatology groups "
+			<< GetResolutionString(profiler_resolution) << ": " << timer::Stop(profiler_resolution) << std::endl;
+	}
+
+	return climatology_index;
+}
+
+// ------------------------------------------------------------------------ Anomaly Scores ------------------------------------------------------------------------ //
+
+struct Anomaly
+{
+	int row;								// Index of the record within the loaded columns.
+	fp_type score;							// z-score of the record against the climatology of its group.
+};
+
+struct AnomalyReport
+{
+	std::vector<fp_type> means;				// Climatology mean of every group, in the units of the dataset.
+	std::vector<fp_type> deviations;		// Climatology standard deviation of every group.
+	std::vector<Anomaly> anomalies;			// Every flagged record, in dataset order.
+};
+
+template<typename T>
+AnomalyReport DeviceAnomalies(const std::string& climatology_id, DeviceColumns<T>& columns, ClimatologyIndex& index)
+{
+	AnomalyReport report;
+	size_t size = std::min(columns.size, index.size);
+	size_t group_count = index.group_count;
+	index.Upload();
+
+	// Compute the climatology of every group, which stays on the device for the scores.
+	timer::Start();
+	KernelProfile profile;
+	cl::Kernel climatology_kernel = kernel_cache.Get(program, climatology_id);
+	cl::Buffer means = PooledBuffer<fp_type>("climatology_means", nullptr, group_count);
+	cl::Buffer deviations = PooledBuffer<fp_type>("climatology_deviations", nullptr, group_count);
+	climatology_kernel.setArg(0, columns.values);
+	climatology_kernel.setArg(1, index.device_order);
+	climatology_kernel.setArg(2, index.device_offsets);
+	climatology_kernel.setArg(3, means);
+	climatology_kernel.setArg(4, deviations);
+	climatology_kernel.setArg(5, (int)group_count);
+	EnqueueProfiled(climatology_kernel, group_count, PreferredLocalSize(climatology_kernel), profile);
+	PrintProfilerInfo(climatology_id, profile.ex_time, profile.profiled_info, timer::Stop(profiler_resolution));
+
+	// Score every record and compact the flagged rows, then read back only those (and the climatology, for the report).
+	std::string kernel_id = "anomaly_scores";
+	ConcatKernelID(T(), kernel_id);
+
+	timer::Start();
+	KernelProfile score_profile;
+	cl::Kernel score_kernel = kernel_cache.Get(program, kernel_id);
+	int flagged_count = 0;
+	cl::Buffer flagged = PooledBuffer<int>("anomaly_count", &flagged_count, 1);
+	cl::Buffer rows = PooledBuffer<int>("anomaly_rows", nullptr, size);
+	cl::Buffer scores = PooledBuffer<fp_type>("anomaly_scores", nullptr, size);
+	score_kernel.setArg(0, columns.values);
+	score_kernel.setArg(1, index.device_keys);
+	score_kernel.setArg(2, index.device_offsets);
+	score_kernel.setArg(3, means);
+	score_kernel.setArg(4, deviations);
+	score_kernel.setArg(5, rows);
+	score_kernel.setArg(6, scores);
+	score_kernel.setArg(7, flagged);
+	score_kernel.setArg(8, (fp_type)anomaly_threshold);
+	score_kernel.setArg(9, climatology_min_count);
+	score_kernel.setArg(10, (int)size);
+	EnqueueProfiled(score_kernel, size, PreferredLocalSize(score_kernel), score_profile);
+
+	queue.enqueueReadBuffer(flagged, CL_TRUE, 0, sizeof(int), &flagged_count);
+	std::vector<int> flagged_rows(flagged_count);
+	std::vector<fp_type> flagged_scores(flagged_count);
+	if (flagged_count)
+	{
+		queue.enqueueReadBuffer(rows, CL_TRUE, 0, flagged_count * sizeof(int), flagged_rows.data());
+		queue.enqueueReadBuffer(scores, CL_TRUE, 0, flagged_count * sizeof(fp_type), flagged_scores.data());
+	}
+	report.means.resize(group_count);
+	report.deviations.resize(group_count);
+	queue.enqueueReadBuffer(means, CL_TRUE, 0, group_count * sizeof(fp_type), report.means.data());
+	queue.enqueueReadBuffer(deviations, CL_TRUE, 0, group_count * sizeof(fp_type), report.deviations.data());
+
+	// The work groups append in the order they finish, so the rows are put back into dataset order.
+	for (int i = 0; i < flagged_count; i++)
+	{
+		Anomaly anomaly = { flagged_rows[i], flagged_scores[i] };
+		report.anomalies.push_back(anomaly);
+	}
+	std::sort(report.anomalies.begin(), report.anomalies.end(), [](const Anomaly& a, const Anomaly& b) { return a.row < b.row; });
+
+	PrintProfilerInfo(kernel_id, score_profile.ex_time, score_profile.profiled_info, timer::Stop(profiler_resolution));
+	return report;
+}
+
+template<typename T>
+AnomalyReport NativeAnomalies(const T* A, size_t size, const ClimatologyIndex& index)
+{
+	std::string kernel_id = "native_anomaly_scores";
+	ConcatKernelID(T(), kernel_id);
+
+	timer::Start();
+	ThreadPool& pool = *GetThreadPool();
+	AnomalyReport report;
+	size = std::min(size, index.size);
+	size_t group_count = index.group_count;
+
+	// The climatology of every group, about the first value of the group in the same manner as CLIMATOLOGY.
+	typedef typename NativeAccumulator<T>::type Acc;
+	report.means.assign(group_count, 0);
+	report.deviations.assign(group_count, 0);
+	pool.ParallelFor(group_count, pool.DefaultPartitions(), [&](size_t, size_t begin, size_t end)
+	{
+		for (size_t g = begin; g < end; g++)
+		{
+			int first = index.offsets[g], last = index.offsets[g + 1];
+			if (first == last)
+				continue;
+
+			T shift = A[index.order[first]];
+			Acc offset = 0, sqr_diff = 0;
+			for (int i = first + 1; i < last; i++)
+			{
+				Acc d = (Acc)A[index.order[i]] - (Acc)shift;
+				offset += d;
+				sqr_diff += d * d;
+			}
+
+			double n = (double)(last - first);
+			double mean_offset = (double)offset / n;
+			report.means[g] = (fp_type)(shift + mean_offset);
+			report.deviations[g] = (fp_type)std::sqrt(std::max(0.0, (double)sqr_diff / n - mean_offset * mean_offset));
+		}
+	});
+
+	// Score every record, each partition collecting its flagged records in order so that the partitions simply concatenate.
+	std::vector<std::vector<Anomaly>> flagged(pool.DefaultPartitions());
+	pool.ParallelFor(size, flagged.size(), [&](size_t p, size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			int g = index.keys[i];
+			fp_type deviation = report.deviations[g];
+			if (index.Count(g) < climatology_min_count || !(deviation > 0))
+				continue;
+
+			fp_type z = ((fp_type)A[i] - report.means[g]) / deviation;
+			if (std::fabs(z) >= (fp_type)anomaly_threshold)
+			{
+				Anomaly anomaly = { (int)i, z };
+				flagged[p].push_back(anomaly);
+			}
+		}
+	});
+	for (size_t p = 0; p < flagged.size(); p++)
+		report.anomalies.insert(report.anomalies.end(), flagged[p].begin(), flagged[p].end());
+
+	PrintNativeInfo(kernel_id, pool);
+	return report;
+}
+
+template<typename T>
+AnomalyReport ClimatologyAnomalies(const T* values, size_t size, bool native)
+{
+	// The integer climatology is summed exactly in 64 bits, the floating point climatology in double wherever the device supports it.
+	ClimatologyIndex& index = GetClimatologyIndex();
+	if (native)
+		return NativeAnomalies(values, size, index);
+	else if (typeid(T) == typeid(int))
+		return DeviceAnomalies("climatology_INT", ResidentColumns(values, size), index);
+	else if (DeviceSupportsFP64())
+		return DeviceAnomalies("climatology_DP", ResidentColumns(values, size), index);
+	else return DeviceAnomalies("climatology_FP", ResidentColumns(values, size), index);
+}
+
+template<typename T>
+void ReportAnomalies(const AnomalyReport& report, const T* A, fp_type division)
+{
+	// Count the records which have a usable climatology, then print the strongest anomalies and export every flagged record to a csv file.
+	const ClimatologyIndex& index = climatology_index;
+	size_t groups = 0, scored = 0;
+	for (size_t g = 0; g < index.group_count; g++)
+	{
+		if (index.Count(g) >= climatology_min_count && report.deviations[g] > 0)
+		{
+			groups++;
+			scored += index.Count(g);
+		}
+	}
+	printf("%zu of %zu records flagged at |z| >= %.2f (%zu records scored within %zu groups of at least %d records)\n", report.anomalies.size(),
+		index.size, anomaly_threshold, scored, groups, climatology_min_count);
+
+	std::vector<Anomaly> strongest(report.anomalies);
+	size_t shown = std::min<size_t>(20, strongest.size());
+	std::partial_sort(strongest.begin(), strongest.begin() + shown, strongest.end(), [](const Anomaly& a, const Anomaly& b)
+	{
+		return std::fabs(a.score) > std::fabs(b.score) || (std::fabs(a.score) == std::fabs(b.score) && a.row < b.row);
+	});
+	for (size_t i = 0; i < shown; i++)
+	{
+		int row = strongest[i].row, g = index.keys[row];
+		printf("\t%zu. %.1f at %s, %s: z = %+.2f against %.2f +/- %.2f for %s\n", i + 1, A[row] / division,
+			stations.names[stations.ids[row]].c_str(), FormatMinutes(times.minutes[row]).c_str(), strongest[i].score,
+			report.means[g] / division, report.deviations[g] / division, FormatSlot(g % climatology_slots).c_str());
+	}
+
+	std::ofstream file(ExportPath("anomalies"));
+	file << "row,station,time,value,climatology_mean,climatology_deviation,z_score\n";
+	for (size_t i = 0; i < report.anomalies.size(); i++)
+	{
+		int row = report.anomalies[i].row, g = index.keys[row];
+		file << row << "," << stations.names[stations.ids[row]] << "," << FormatMinutes(times.minutes[row]) << "," << A[row] / division << ","
+			<< report.means[g] / division << "," << report.deviations[g] / division << "," << report.anomalies[i].score << "\n";
+	}
+	printf("Exported %zu anomalies to '%s'\n\n", report.anomalies.size(), ExportPath("anomalies").c_str());
+}
+
+#endif
@@ -0,0 +1,487 @@
+#ifndef compressed_h
+#define compressed_h
+
+#include <vector>
+#include <string>
+#include <limits>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+
+#include "funcs.h"
+#include "thread_pool.h"
+#include "native_funcs.h"
+#include "filter.h"
+
+/* Compressed storage of the temperature columns. The integer values are temperatures multiplied by 10, which always fit within a short and
+   rarely span more than a few hundred within any short run of records, so a column can be held either as int16 (half the bytes of int) or
+   as frame of reference blocks of 256 values bit-packed relative to the minimum of each block. The floating point column can likewise be
+   held as half (IEEE 754 binary16), half the bytes of float, which is exact for the integer part and keeps 11 significant bits, so e.g.
+   21.3 is held as 21.296875. The compressed kernels decode the values in registers as they reduce, or widen the column on the device once
+   for a sort, so only the compressed bytes are ever uploaded. Half storage is lossy, so its results are reported against references
+   of the full precision column gathered as it is encoded. */
+
+enum ColumnStorage
+{
+	PlainColumns,
+	Int16Columns,
+	PackedColumns,
+	HalfColumns
+};
+ColumnStorage column_storage = PlainColumns;	// How the columns are held when uploaded for the single device reductions and sorts.
+
+const size_t packed_block_size = 256;			// Values per frame of reference block, must match PACKED_BLOCK_SHIFT within kernels.cl.
+
+struct CompressedColumn
+{
+	const int* source = nullptr;				// Host array the column was encoded from.
+	size_t size = 0;
+
+	bool int16_valid = false;					// Whether every value fits within a short.
+	std::vector<short> int16;					// Every value as a short.
+
+	std::vector<unsigned int> packed;			// Bit-packed offsets of every block, each block beginning on a word boundary.
+	std::vector<int> block_ref;					// Minimum value of every block.
+	std::vector<unsigned int> block_offset;		// First word of every block, plus the end of the last block.
+
+	size_t PlainBytes() const { return size * sizeof(int); }
+	size_t Int16Bytes() const { return int16.size() * sizeof(short); }
+	size_t PackedBytes() const { return packed.size() * sizeof(unsigned int) + block_ref.size() * sizeof(int) + block_offset.size() * sizeof(unsigned int); }
+	size_t Blocks() const { return block_ref.size(); }
+
+	void Encode(ThreadPool& pool, const int* values, size_t count)
+	{
+		Release();
+		source = values;
+		size = count;
+		size_t blocks = (count + packed_block_size - 1) / packed_block_size;
+
+		// Narrow every value to a short and find the range of every block, in parallel over whole blocks.
+		int16.resize(count);
+		block_ref.resize(blocks);
+		std::vector<unsigned int> block_bits(blocks);
+		std::vector<char> narrow(pool.DefaultPartitions(), 1);
+		pool.ParallelFor(blocks, narrow.size(), [&](size_t p, size_t begin, size_t end)
+		{
+			for (size_t b = begin; b < end; b++)
+			{
+				size_t first = b * packed_block_size, last = std::min(first + packed_block_size, count);
+				int min = values[first], max = values[first];
+				for (size_t i = first; i < last; i++)
+				{
+					min = std::min(min, values[i]);
+					max = std::max(max, values[i]);
+					int16[i] = (short)values[i];
+				}
+
+				narrow[p] &= (min >= std::numeric_limits<short>::min() && max <= std::numeric_limits<short>::max());
+				unsigned int range = (unsigned int)((long long)max - min);
+				unsigned int bits = 0;
+				while (bits < 32 && (range >> bits))
+					bits++;
+
+				block_ref[b] = min;
+				block_bits[b] = bits;
+			}
+		});
+		int16_valid = std::find(narrow.begin(), narrow.end(), 0) == narrow.end();
+		if (!int16_valid)
+			std::vector<short>().swap(int16);
+
+		// A block of 256 values at b bits occupies exactly 8 * b words, the offsets are a sequential scan as there is one per block.
+		block_offset.resize(blocks + 1);
+		block_offset[0] = 0;
+		for (size_t b = 0; b < blocks; b++)
+			block_offset[b + 1] = block_offset[b] + block_bits[b] * (packed_block_size / 32);
+
+		// Pack every block, the final partial block is packed as though it were padded with its minimum.
+		packed.assign(std::max(1u, block_offset[blocks]), 0);
+		pool.ParallelFor(blocks, pool.DefaultPartitions(), [&](size_t, size_t begin, size_t end)
+		{
+			for (size_t b = begin; b < end; b++)
+			{
+				unsigned int bits = block_bits[b];
+				size_t first = b * packed_block_size, last = std::min(first + packed_block_size, count);
+				for (size_t i = first; bits && i < last; i++)
+				{
+					unsigned int value = (unsigned int)((long long)values[i] - block_ref[b]);
+					size_t bit = (i - first) * bits;
+					size_t word = block_offset[b] + bit / 32;
+					unsigned int shift = bit % 32;
+
+					packed[word] |= value << shift;
+					if (shift + bits > 32)
+						packed[word + 1] |= value >> (32 - shift);
+				}
+			}
+		});
+	}
+
+	int Decode(size_t i) const
+	{
+		// Host equivalent of decode_packed within kernels.cl.
+		size_t b = i / packed_block_size;
+		unsigned int bits = (block_offset[b + 1] - block_offset[b]) / (packed_block_size / 32);
+		if (!bits)
+			return block_ref[b];
+
+		size_t bit = (i % packed_block_size) * bits;
+		size_t word = block_offset[b] + bit / 32;
+		unsigned int shift = bit % 32;
+
+		unsigned int value = packed[word] >> shift;
+		if (shift + bits > 32)
+			value |= packed[word + 1] << (32 - shift);
+
+		return block_ref[b] + (int)(value & ((bits < 32) ? ((1u << bits) - 1) : 0xFFFFFFFFu));
+	}
+
+	void Release()
+	{
+		source = nullptr;
+		size = 0;
+		int16_valid = false;
+		std::vector<short>().swap(int16);
+		std::vector<unsigned int>().swap(packed);
+		std::vector<int>().swap(block_ref);
+		std::vector<unsigned int>().swap(block_offset);
+	}
+};
+
+cl_half FloatToHalf(float value)
+{
+	// Round to the nearest half, ties to even as vstore_half does, overflowing to infinity and underflowing through the subnormals to zero.
+	unsigned int bits;
+	memcpy(&bits, &value, sizeof(bits));
+	unsigned int sign = (bits >> 16) & 0x8000;
+	int exponent = (int)((bits >> 23) & 0xFF) - 127 + 15;
+	unsigned int mantissa = bits & 0x7FFFFF;
+
+	if (((bits >> 23) & 0xFF) == 0xFF)
+		return (cl_half)(sign | 0x7C00 | ((mantissa) ? 0x200 : 0));
+	if (exponent >= 31)
+		return (cl_half)(sign | 0x7C00);
+
+	// A normal half keeps the top 10 bits of the mantissa, a subnormal the implicit bit and fewer of the rest.
+	unsigned int shift = 13;
+	unsigned int result = sign | ((unsigned int)exponent << 10);
+	if (exponent <= 0)
+	{
+		if (exponent < -10)
+			return (cl_half)sign;
+		mantissa |= 0x800000;
+		shift = 14 - exponent;
+		result = sign;
+	}
+
+	unsigned int kept = mantissa >> shift, rest = mantissa & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+	result += kept;
+	if (rest > halfway || (rest == halfway && (kept & 1)))
+		result++;							// A carry out of the mantissa correctly increments the exponent, up to infinity.
+	return (cl_half)result;
+}
+
+float HalfToFloat(cl_half value)
+{
+	// Host equivalent of vload_half, which is exact.
+	unsigned int exponent = (value >> 10) & 0x1F, mantissa = value & 0x3FF;
+	float magnitude = (exponent == 0) ? std::ldexp((float)mantissa, -24)
+		: (exponent == 31) ? ((mantissa) ? NAN : INFINITY) : std::ldexp((float)(mantissa | 0x400), (int)exponent - 25);
+	return (value & 0x8000) ? -magnitude : magnitude;
+}
+
+struct HalfColumn
+{
+	const fp_type* source = nullptr;			// Host array the column was encoded from.
+	size_t size = 0;
+	std::vector<cl_half> values;				// Every value rounded to half.
+
+	// Sum, sum of squares, minimum and maximum of the full precision column in double, the reference of the half reductions.
+	double reference_sum = 0.0, reference_sqr = 0.0, reference_min = INFINITY, reference_max = -INFINITY;
+
+	size_t PlainBytes() const { return size * sizeof(fp_type); }
+	size_t Bytes() const { return values.size() * sizeof(cl_half); }
+
+	void Encode(ThreadPool& pool, const fp_type* column, size_t count)
+	{
+		Release();
+		source = column;
+		size = count;
+		values.resize(count);
+
+		// The references are gathered within the same pass as the encoding, so no query ever reads the full precision column again.
+		size_t partitions = pool.DefaultPartitions();
+		std::vector<double> sums(partitions, 0.0), sqrs(partitions, 0.0), mins(partitions, INFINITY), maxs(partitions, -INFINITY);
+		pool.ParallelFor(count, partitions, [&](size_t p, size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				values[i] = FloatToHalf((float)column[i]);
+				double value = column[i];
+				sums[p] += value;
+				sqrs[p] += value * value;
+				mins[p] = std::min(mins[p], value);
+				maxs[p] = std::max(maxs[p], value);
+			}
+		});
+
+		for (size_t p = 0; p < partitions; p++)
+		{
+			reference_sum += sums[p];
+			reference_sqr += sqrs[p];
+			reference_min = std::min(reference_min, mins[p]);
+			reference_max = std::max(reference_max, maxs[p]);
+		}
+	}
+
+	fp_type Decode(size_t i) const { return HalfToFloat(values[i]); }
+
+	void Release()
+	{
+		source = nullptr;
+		size = 0;
+		std::vector<cl_half>().swap(values);
+		reference_sum = reference_sqr = 0.0;
+		reference_min = INFINITY;
+		reference_max = -INFINITY;
+	}
+};
+
+CompressedColumn compressed_column;				// Compressed copy of the integer dataset, encoded on first use.
+HalfColumn half_column;							// Half copy of the floating point dataset, encoded on first use.
+
+CompressedColumn& GetCompressedColumn(const int* values, size_t size)
+{
+	if (compressed_column.source != values || compressed_column.size != size)
+	{
+		timer::Start();
+		compressed_column.Encode(*GetThreadPool(), values, size);
+		std::cout << "Encoded compressed column (int16: " << compressed_column.Int16Bytes() << " bytes, packed: " << compressed_column.PackedBytes()
+			<< " bytes, plain: " << compressed_column.PlainBytes() << " bytes) " << GetResolutionString(profiler_resolution) << ": " << timer::Stop(profiler_resolution) << std::endl;
+	}
+
+	return compressed_column;
+}
+
+HalfColumn& GetHalfColumn(const fp_type* values, size_t size)
+{
+	if (half_column.source != values || half_column.size != size)
+	{
+		timer::Start();
+		half_column.Encode(*GetThreadPool(), values, size);
+		std::cout << "Encoded half column (half: " << half_column.Bytes() << " bytes, plain: " << half_column.PlainBytes() << " bytes) "
+			<< GetResolutionString(profiler_resolution) << ": " << timer::Stop(profiler_resolution) << std::endl;
+	}
+
+	return half_column;
+}
+
+const char* StorageName(ColumnStorage storage)
+{
+	switch (storage)
+	{
+		case Int16Columns: return "INT16";
+		case PackedColumns: return "BIT-PACKED";
+		case HalfColumns: return "HALF";
+		default: return "PLAIN";
+	}
+}
+
+const char* StorageSuffix(ColumnStorage storage)
+{
+	switch (storage)
+	{
+		case Int16Columns: return "_I16";
+		case PackedColumns: return "_PACKED";
+		default: return "_HALF";
+	}
+}
+
+int SetColumnArgs(cl::Kernel& kernel, const CompressedColumn& column, ColumnStorage storage)
+{
+	// Upload only the compressed bytes, in the same manner as the plain reductions upload the whole column every execution.
+	int arg = 0;
+	if (storage == Int16Columns)
+		kernel.setArg(arg++, PooledBuffer("column_int16", column.int16.data(), column.int16.size()));
+	else
+	{
+		kernel.setArg(arg++, PooledBuffer("column_packed", column.packed.data(), column.packed.size()));
+		kernel.setArg(arg++, PooledBuffer("column_block_ref", column.block_ref.data(), column.block_ref.size()));
+		kernel.setArg(arg++, PooledBuffer("column_block_offset", column.block_offset.data(), column.block_offset.size()));
+	}
+	return arg;
+}
+
+int SetColumnArgs(cl::Kernel& kernel, const HalfColumn& column, ColumnStorage)
+{
+	kernel.setArg(0, PooledBuffer("column_half", column.values.data(), column.values.size()));
+	return 1;
+}
+
+// ------------------------------------------------------------------------ Compressed Functions ------------------------------------------------------------------------ //
+
+template<typename Out, typename Column, typename Mean = int>
+Out CompressedReduce(const Column& column, ColumnStorage storage, std::string kernel_id, Out identity, const Mean* mean = nullptr)
+{
+	/* The integer sums produce a 64 bit result and the minimum and maximum an int, the half column a float, given by the type of the identity.
+	   Determine the kernel name from the storage, e.g. reduce_sum with packed storage is "reduce_sum_PACKED". */
+	kernel_id += StorageSuffix(storage);
+	cl::Device device = context.getInfo<CL_CONTEXT_DEVICES>()[0];
+	bool partials = GroupPartials<Out>(device);
+	if (partials)
+		kernel_id += "_PARTIALS";
+
+	// Start a chrono timer and fetch the kernel with the determined id, this is only created on the first execution.
+	timer::Start();
+	cl::Kernel kernel = kernel_cache.Get(program, kernel_id);
+	int arg = SetColumnArgs(kernel, column, storage);
+
+	// A few work groups per compute unit, each work item then strides over the column.
+	size_t group_size = PreferredLocalSize(kernel);
+	cl_uint compute_units = device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+	size_t group_count = std::max<size_t>(1, std::min<size_t>(compute_units * 8, (column.size + group_size - 1) / group_size));
+
+	// The output is seeded with the identity of the reduction, or holds one partial sum per work group without 64 bit atomics.
+	Out result = (mean) ? 0 : identity;
+	std::vector<Out> sums((partials) ? group_count : 1, result);
+	cl::Buffer out_buffer = PooledBuffer("column_result", sums.data(), sums.size());
+	kernel.setArg(arg++, out_buffer);
+	kernel.setArg(arg++, cl::Local(group_size * sizeof(Out)));
+	if (mean)
+		kernel.setArg(arg++, *mean);
+	kernel.setArg(arg++, (int)column.size);
+
+	KernelProfile profile;
+	EnqueueProfiled(kernel, group_count * group_size, group_size, profile);
+	queue.enqueueReadBuffer(out_buffer, CL_TRUE, 0, sums.size() * sizeof(Out), sums.data());
+	result = (partials) ? AddPartials(sums.data(), sums.size()) : sums[0];
+
+	PrintProfilerInfo(kernel_id, profile.ex_time, profile.profiled_info, timer::Stop(profiler_resolution));
+	return result;
+}
+
+template<typename T, typename Column>
+T* CompressedSort(const Column& column, ColumnStorage storage)
+{
+	// Widen the compressed column into a device buffer with room for the padding of the sort, which then sorts it as it does a filtered subset.
+	std::string kernel_id = std::string("widen") + StorageSuffix(storage);
+
+	timer::Start();
+	cl::Kernel kernel = kernel_cache.Get(program, kernel_id);
+	size_t group_size = PreferredLocalSize(kernel);
+	cl::Device device = context.getInfo<CL_CONTEXT_DEVICES>()[0];
+	size_t max_group_size = device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
+
+	DeviceSubset<T> subset;
+	subset.count = column.size;
+	subset.capacity = column.size + max_group_size * 2;
+	subset.values = buffer_pool.Device(context, "column_widened", CL_MEM_READ_WRITE, subset.capacity * sizeof(T));
+
+	int arg = SetColumnArgs(kernel, column, storage);
+	kernel.setArg(arg++, subset.values);
+	kernel.setArg(arg++, (int)column.size);
+
+	KernelProfile profile;
+	EnqueueProfiled(kernel, column.size, group_size, profile);
+	PrintProfilerInfo(kernel_id, profile.ex_time, profile.profiled_info, timer::Stop(profiler_resolution));
+
+	return SubsetSort(subset);
+}
+
+double PrecisionReduce(const HalfColumn& column, const std::string& kernel_id, const fp_type* mean)
+{
+	// The result of the same reduction over the full precision column, from the references gathered when the column was encoded.
+	if (mean)
+		return column.reference_sqr - 2.0 * *mean * column.reference_sum + (double)*mean * *mean * column.size;
+	if (kernel_id == "reduce_min")
+		return column.reference_min;
+	if (kernel_id == "reduce_max")
+		return column.reference_max;
+	return column.reference_sum;
+}
+
+void PrintStorageError(const std::string& kernel_id, double result, double reference)
+{
+	// Output and log the error of a reduction of a lossy storage against the full precision column.
+	if (!profiler_output)
+		return;
+
+	char output[256];
+	snprintf(output, sizeof(output), "Storage error (%s%s against the precision column): %.6g, relative %.3g", kernel_id.c_str(),
+		StorageSuffix(column_storage), result - reference, (reference) ? std::fabs((result - reference) / reference) : 0.0);
+	std::cout << output << std::endl;
+	winstr::Write(output);
+}
+
+/* The functions below route the reductions and sorts to the compressed kernels when a storage of the column is selected, returning false when
+   the plain kernels should be used instead. The integer column may be held as int16 or bit-packed blocks and the floating point column as
+   half, each storage applying only to its own column. */
+
+template<typename T, typename Out>
+bool StorageReduce(T*& A, Out*& B, size_t original_size, const std::string& kernel_id, Out identity, const T* mean = nullptr)
+{
+	return false;
+}
+
+template<typename Out>
+bool StorageReduce(fp_type*& A, Out*& B, size_t original_size, const std::string& kernel_id, Out identity, const fp_type* mean = nullptr)
+{
+	if (column_storage != HalfColumns)
+		return false;
+
+	HalfColumn& column = GetHalfColumn(A, original_size);
+	B = buffer_pool.Host<Out>(kernel_id + "_compressed", 1);
+	B[0] = CompressedReduce(column, column_storage, kernel_id, identity, mean);
+	PrintStorageError(kernel_id, B[0], PrecisionReduce(column, kernel_id, mean));
+	return true;
+}
+
+template<typename Out>
+bool StorageReduce(int*& A, Out*& B, size_t original_size, const std::string& kernel_id, Out identity, const int* mean = nullptr)
+{
+	if (column_storage == PlainColumns || column_storage == HalfColumns)
+		return false;
+
+	CompressedColumn& column = GetCompressedColumn(A, original_size);
+	if (column_storage == Int16Columns && !column.int16_valid)
+	{
+		std::cout << "The dataset does not fit within int16, using the plain column.\n";
+		return false;
+	}
+
+	B = buffer_pool.Host<Out>(kernel_id + "_compressed", 1);
+	B[0] = CompressedReduce(column, column_storage, kernel_id, identity, mean);
+	return true;
+}
+
+template<typename T>
+T* StorageSort(T*& A, size_t original_size)
+{
+	return nullptr;
+}
+
+fp_type* StorageSort(fp_type*& A, size_t original_size)
+{
+	if (column_storage != HalfColumns)
+		return nullptr;
+
+	return CompressedSort<fp_type>(GetHalfColumn(A, original_size), column_storage);
+}
+
+int* StorageSort(int*& A, size_t original_size)
+{
+	if (column_storage == PlainColumns || column_storage == HalfColumns)
+		return nullptr;
+
+	CompressedColumn& column = GetCompressedColumn(A, original_size);
+	if (column_storage == Int16Columns && !column.int16_valid)
+	{
+		std::cout << "The dataset does not fit within int16, using the plain column.\n";
+		return nullptr;
+	}
+
+	return CompressedSort<int>(column, column_storage);
+}
+
+#endif
\ No newline at end of file
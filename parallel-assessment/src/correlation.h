@@ -0,0 +1,407 @@
+#ifndef correlation_h
+#define correlation_h
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <cstdio>
+
+#include "funcs.h"
+#include "native_funcs.h"
+#include "records.h"
+#include "timeseries.h"
+#include "summation.h"
+
+/* Cross-station statistics, such as SCAMPTON against WADDINGTON at matching times. The station series of the time ordering (timeseries.h)
+   are joined onto a common time axis by a sort-merge join on the packed timestamp: the time slots of every station are merged into the
+   sorted slots of the whole dataset, and every station then walks its own (already time ordered) records alongside them, writing each into
+   its row of an aligned grid of stations by slots. A slot is join_resolution minutes wide, as stations rarely report at exactly the same
+   minute, and the first record of a station within a slot is the one matched.
+
+   The covariance, Pearson correlation, regression line and the linear trend of the difference between the stations are all derived from
+   nine moments of every pair, which the pair_moments kernels sum for every station pair of the grid in a single batched execution. */
+
+const int pair_moment_count = 9;			// Moments of every pair, must match PAIR_MOMENT_COUNT within kernels.cl.
+unsigned int join_resolution = 60;			// Minutes of a slot of the aligned series, records of two stations within one slot are matched.
+
+int MissingSlot(int) { return std::numeric_limits<int>::min(); }
+fp_type MissingSlot(fp_type) { return NAN; }
+bool PresentSlot(int value) { return value != std::numeric_limits<int>::min(); }
+bool PresentSlot(fp_type value) { return !std::isnan(value); }
+
+template<typename T>
+struct AlignedSeries
+{
+	const T* source = nullptr;				// Host array the grid was built from.
+	size_t source_size = 0;
+	unsigned int resolution = 0;
+
+	size_t station_count = 0;
+	std::vector<unsigned int> slots;		// Time of every slot in units of resolution, in order.
+	std::vector<int> days;					// Day of every slot, relative to the middle slot.
+	std::vector<T> grid;					// A row of every slot per station, missing where the station has no record within the slot.
+	std::vector<T> shifts;					// Mean of every station, which the moments are taken about.
+
+	size_t SlotCount() const { return slots.size(); }
+
+	void Build(ThreadPool& pool, const TimeSeries& series, const T* values, size_t size, size_t stations_size, unsigned int slot_minutes)
+	{
+		source = values;
+		source_size = size;
+		resolution = std::max(1u, slot_minutes);
+		station_count = stations_size;
+
+		// The station segments of the time ordering, each of which is in time order.
+		std::vector<size_t> bounds;
+		for (size_t i = 0; i < series.size; i++)
+		{
+			if (series.station_head[i])
+				bounds.push_back(i);
+		}
+		bounds.push_back(series.size);
+		size_t segments = bounds.size() - 1;
+
+		// The distinct slots of every station, then the union of neighbouring stations pairwise as tasks, in the same manner as SortOrder.
+		std::vector<std::vector<unsigned int>> station_slots(segments);
+		TaskGroup group;
+		for (size_t s = 0; s < segments; s++)
+		{
+			pool.Submit(group, pool.NodeOf(bounds[s], series.size), [&, s]()
+			{
+				std::vector<unsigned int>& own = station_slots[s];
+				for (size_t i = bounds[s]; i < bounds[s + 1]; i++)
+				{
+					unsigned int slot = series.minutes[i] / resolution;
+					if (own.empty() || own.back() != slot)
+						own.push_back(slot);
+				}
+			});
+		}
+		group.Wait();
+
+		for (size_t width = 1; width < segments; width <<= 1)
+		{
+			for (size_t s = 0; s + width < segments; s += width * 2)
+			{
+				pool.Submit(group, pool.NodeOf(bounds[s], series.size), [&, s, width]()
+				{
+					std::vector<unsigned int> merged;
+					merged.reserve(station_slots[s].size() + station_slots[s + width].size());
+					std::set_union(station_slots[s].begin(), station_slots[s].end(), station_slots[s + width].begin(), station_slots[s + width].end(),
+						std::back_inserter(merged));
+					station_slots[s].swap(merged);
+					std::vector<unsigned int>().swap(station_slots[s + width]);
+				});
+			}
+			group.Wait();
+		}
+		slots.clear();
+		if (segments)
+			slots.swap(station_slots[0]);
+
+		int middle_day = (slots.empty()) ? 0 : (int)((unsigned long long)slots[slots.size() / 2] * resolution / minutes_per_day);
+		days.resize(slots.size());
+		for (size_t u = 0; u < slots.size(); u++)
+			days[u] = (int)((unsigned long long)slots[u] * resolution / minutes_per_day) - middle_day;
+
+		// Every station walks its records alongside the slots, the merge half of the join, filling its own row of the grid.
+		size_t slot_count = slots.size();
+		grid.assign(station_count * slot_count, MissingSlot(T()));
+		shifts.assign(station_count, 0);
+		for (size_t s = 0; s < segments; s++)
+		{
+			pool.Submit(group, pool.NodeOf(bounds[s], series.size), [&, s]()
+			{
+				size_t station = series.station[bounds[s]];
+				T* row = grid.data() + station * slot_count;
+				double sum = 0.0;
+				size_t u = 0;
+				for (size_t i = bounds[s]; i < bounds[s + 1]; i++)
+				{
+					unsigned int slot = series.minutes[i] / resolution;
+					while (slots[u] < slot)
+						u++;
+
+					T value = values[series.order[i]];
+					if (!PresentSlot(row[u]))
+						row[u] = value;
+					sum += value;
+				}
+
+				double station_mean = sum / (bounds[s + 1] - bounds[s]);
+				shifts[station] = (typeid(T) == typeid(int)) ? (T)std::lround(station_mean) : (T)station_mean;
+			});
+		}
+		group.Wait();
+	}
+};
+
+AlignedSeries<int> aligned_int;				// Aligned series of the integer dataset, built on first use.
+AlignedSeries<fp_type> aligned_fp;			// Aligned series of the floating point dataset, built on first use.
+
+AlignedSeries<int>& GetAlignedStorage(const int*) { return aligned_int; }
+AlignedSeries<fp_type>& GetAlignedStorage(const fp_type*) { return aligned_fp; }
+
+template<typename T>
+AlignedSeries<T>& GetAlignedSeries(const T* values, size_t size)
+{
+	AlignedSeries<T>& aligned = GetAlignedStorage(values);
+	if (aligned.source != values || aligned.source_size != size || aligned.resolution != std::max(1u, join_resolution))
+	{
+		timer::Start();
+		aligned.Build(*GetThreadPool(), GetTimeSeries(), values, size, stations.StationCount(), join_resolution);
+		std::cout << "Aligned " << aligned.station_count << " stations onto " << aligned.SlotCount() << " slots of " << aligned.resolution
+			<< " minutes " << GetResolutionString(profiler_resolution) << ": " << timer::Stop(profiler_resolution) << std::endl;
+	}
+
+	return aligned;
+}
+
+// ------------------------------------------------------------------------ Pair Statistics ------------------------------------------------------------------------ //
+
+struct PairStatistics
+{
+	int a = 0, b = 0;						// Station ids of the pair.
+	unsigned long long n = 0;				// Slots where both stations have a record.
+	double mean_a = 0.0, mean_b = 0.0;
+	double covariance = 0.0;
+	double correlation = 0.0;				// Pearson correlation coefficient.
+	double slope = 0.0, intercept = 0.0;	// Least squares regression line of b on a.
+	double trend = 0.0;						// Linear trend of b - a over time, per decade.
+};
+
+PairStatistics PairFromMoments(int a, int b, const double* m, double shift_a, double shift_b, fp_type division)
+{
+	// The moments are about the station means (shift) and the middle day, see PAIR_MOMENTS within kernels.cl.
+	PairStatistics pair;
+	pair.a = a;
+	pair.b = b;
+	pair.n = (unsigned long long)m[0];
+	if (pair.n < 2)
+	{
+		pair.mean_a = pair.mean_b = pair.covariance = pair.correlation = pair.slope = pair.intercept = pair.trend = NAN;
+		return pair;
+	}
+
+	double n = m[0];
+	double mean_x = m[1] / n, mean_y = m[2] / n, mean_t = m[6] / n;
+	double var_x = m[3] / n - mean_x * mean_x;
+	double var_y = m[4] / n - mean_y * mean_y;
+	double cov_xy = m[5] / n - mean_x * mean_y;
+	double var_t = m[7] / n - mean_t * mean_t;
+	double cov_td = m[8] / n - mean_t * (mean_y - mean_x);
+
+	pair.mean_a = (mean_x + shift_a) / division;
+	pair.mean_b = (mean_y + shift_b) / division;
+	pair.covariance = cov_xy / ((double)division * division);
+	pair.correlation = cov_xy / std::sqrt(var_x * var_y);
+	pair.slope = cov_xy / var_x;
+	pair.intercept = pair.mean_b - pair.slope * pair.mean_a;
+	pair.trend = (var_t > 0.0) ? cov_td / var_t * 3652.5 / division : NAN;
+	return pair;
+}
+
+std::vector<int> StationPairs(size_t station_count)
+{
+	// Every unordered pair of distinct stations, flattened as (a, b) with a < b.
+	std::vector<int> pairs;
+	for (size_t a = 0; a < station_count; a++)
+	{
+		for (size_t b = a + 1; b < station_count; b++)
+		{
+			pairs.push_back((int)a);
+			pairs.push_back((int)b);
+		}
+	}
+	return pairs;
+}
+
+template<typename Acc, typename T>
+std::vector<double> DevicePairMoments(const std::string& kernel_id, const AlignedSeries<T>& aligned, const std::vector<int>& pairs)
+{
+	timer::Start();
+	cl::Kernel kernel = kernel_cache.Get(program, kernel_id);
+	size_t pair_count = pairs.size() / 2;
+	size_t slot_count = aligned.SlotCount();
+
+	// A power of two work group, as the moments are combined as a tree, whose moments fit within local memory.
+	cl::Device device = context.getInfo<CL_CONTEXT_DEVICES>()[0];
+	cl_ulong local_mem_size = device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+	size_t group_size = 1;
+	while (group_size * 2 <= PreferredLocalSize(kernel) && group_size * 2 * pair_moment_count * sizeof(Acc) <= local_mem_size)
+		group_size <<= 1;
+
+	// Enough work groups to fill the device however few pairs there are, but never more groups per pair than there are slots to share.
+	cl_uint compute_units = device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+	size_t groups_per_pair = (compute_units * 8 + pair_count - 1) / pair_count;
+	groups_per_pair = std::max<size_t>(1, std::min(groups_per_pair, (slot_count + group_size - 1) / group_size));
+	size_t group_count = pair_count * groups_per_pair;
+
+	cl::Buffer partials_buffer = PooledBuffer<Acc>("correlation_partials", nullptr, group_count * pair_moment_count);
+	kernel.setArg(0, PooledBuffer("correlation_grid", aligned.grid.data(), aligned.grid.size()));
+	kernel.setArg(1, PooledBuffer("correlation_days", aligned.days.data(), aligned.days.size()));
+	kernel.setArg(2, PooledBuffer("correlation_shifts", aligned.shifts.data(), aligned.shifts.size()));
+	kernel.setArg(3, PooledBuffer("correlation_pairs", pairs.data(), pairs.size()));
+	kernel.setArg(4, partials_buffer);
+	kernel.setArg(5, cl::Local(group_size * pair_moment_count * sizeof(Acc)));
+	kernel.setArg(6, (int)groups_per_pair);
+	kernel.setArg(7, (int)slot_count);
+
+	KernelProfile profile;
+	EnqueueProfiled(kernel, group_count * group_size, group_size, profile);
+	std::vector<Acc> partials(group_count * pair_moment_count);
+	queue.enqueueReadBuffer(partials_buffer, CL_TRUE, 0, partials.size() * sizeof(Acc), partials.data());
+
+	// The work groups of every pair are added in order, so the result does not depend on which group finished first.
+	std::vector<double> moments(pair_count * pair_moment_count, 0.0);
+	std::vector<Acc> sums(pair_moment_count);
+	for (size_t p = 0; p < pair_count; p++)
+	{
+		std::fill(sums.begin(), sums.end(), (Acc)0);
+		for (size_t g = p * groups_per_pair; g < (p + 1) * groups_per_pair; g++)
+		{
+			for (int j = 0; j < pair_moment_count; j++)
+				sums[j] += partials[g * pair_moment_count + j];
+		}
+		for (int j = 0; j < pair_moment_count; j++)
+			moments[p * pair_moment_count + j] = (double)sums[j];
+	}
+
+	PrintProfilerInfo(kernel_id, profile.ex_time, profile.profiled_info, timer::Stop(profiler_resolution));
+	return moments;
+}
+
+template<typename T>
+std::vector<double> NativePairMoments(const AlignedSeries<T>& aligned, const std::vector<int>& pairs)
+{
+	std::string kernel_id = "native_pair_moments";
+	ConcatKernelID(T(), kernel_id);
+
+	timer::Start();
+	ThreadPool& pool = *GetThreadPool();
+	size_t pair_count = pairs.size() / 2;
+	size_t slot_count = aligned.SlotCount();
+
+	// Every partition of the slots sums the moments of every pair, in the same manner as PAIR_MOMENTS.
+	typedef typename NativeAccumulator<T>::type Acc;
+	std::vector<std::vector<Acc>> partials(pool.DefaultPartitions(), std::vector<Acc>(pair_count * pair_moment_count, 0));
+	pool.ParallelFor(slot_count, partials.size(), [&](size_t part, size_t begin, size_t end)
+	{
+		for (size_t p = 0; p < pair_count; p++)
+		{
+			const T* row_a = aligned.grid.data() + pairs[2 * p] * slot_count;
+			const T* row_b = aligned.grid.data() + pairs[2 * p + 1] * slot_count;
+			Acc* m = partials[part].data() + p * pair_moment_count;
+			for (size_t u = begin; u < end; u++)
+			{
+				if (!PresentSlot(row_a[u]) || !PresentSlot(row_b[u]))
+					continue;
+
+				Acc x = (Acc)row_a[u] - (Acc)aligned.shifts[pairs[2 * p]];
+				Acc y = (Acc)row_b[u] - (Acc)aligned.shifts[pairs[2 * p + 1]];
+				Acc t = (Acc)aligned.days[u];
+				m[0] += 1;
+				m[1] += x;
+				m[2] += y;
+				m[3] += x * x;
+				m[4] += y * y;
+				m[5] += x * y;
+				m[6] += t;
+				m[7] += t * t;
+				m[8] += t * (y - x);
+			}
+		}
+	});
+
+	std::vector<double> moments(pair_count * pair_moment_count, 0.0);
+	for (size_t i = 0; i < moments.size(); i++)
+	{
+		Acc sum = 0;
+		for (size_t part = 0; part < partials.size(); part++)
+			sum += partials[part][i];
+		moments[i] = (double)sum;
+	}
+
+	PrintNativeInfo(kernel_id, pool);
+	return moments;
+}
+
+template<typename T>
+std::vector<PairStatistics> PairStatisticsOf(const AlignedSeries<T>& aligned, const std::vector<double>& moments, const std::vector<int>& pairs, fp_type division)
+{
+	std::vector<PairStatistics> statistics;
+	for (size_t p = 0; p < pairs.size() / 2; p++)
+	{
+		int a = pairs[2 * p], b = pairs[2 * p + 1];
+		statistics.push_back(PairFromMoments(a, b, &moments[p * pair_moment_count], aligned.shifts[a], aligned.shifts[b], division));
+	}
+	return statistics;
+}
+
+template<typename T>
+std::vector<PairStatistics> StationCorrelations(const T* values, size_t size, bool native, fp_type division)
+{
+	// The integer moments are exact in 64 bits, the floating point moments are summed in double wherever the device supports it.
+	AlignedSeries<T>& aligned = GetAlignedSeries(values, size);
+	std::vector<int> pairs = StationPairs(aligned.station_count);
+	if (pairs.empty())
+		return std::vector<PairStatistics>();
+
+	std::vector<double> moments;
+	if (native)
+		moments = NativePairMoments(aligned, pairs);
+	else if (typeid(T) == typeid(int))
+		moments = DevicePairMoments<long long>("pair_moments_INT", aligned, pairs);
+	else if (DeviceSupportsFP64())
+		moments = DevicePairMoments<double>("pair_moments_DP", aligned, pairs);
+	else moments = DevicePairMoments<fp_type>("pair_moments_FP", aligned, pairs);
+
+	return PairStatisticsOf(aligned, moments, pairs, division);
+}
+
+void ReportCorrelations(const std::vector<PairStatistics>& statistics)
+{
+	// Print the correlation matrix, then export every statistic of every pair to a csv file.
+	size_t station_count = stations.StationCount();
+	std::vector<double> matrix(station_count * station_count, NAN);
+	for (size_t s = 0; s < station_count; s++)
+		matrix[s * station_count + s] = 1.0;
+	for (size_t p = 0; p < statistics.size(); p++)
+		matrix[statistics[p].a * station_count + statistics[p].b] = matrix[statistics[p].b * station_count + statistics[p].a] = statistics[p].correlation;
+
+	printf("Pearson correlation at matching times (slots of %u minutes)\n%16s", join_resolution, "");
+	for (size_t s = 0; s < station_count; s++)
+		printf(" %10.10s", stations.names[s].c_str());
+	printf("\n");
+	for (size_t a = 0; a < station_count; a++)
+	{
+		printf("%16.16s", stations.names[a].c_str());
+		for (size_t b = 0; b < station_count; b++)
+			printf(" %10.4f", matrix[a * station_count + b]);
+		printf("\n");
+	}
+
+	std::ofstream file(ExportPath("correlations"));
+	file << "station_a,station_b,matches,mean_a,mean_b,covariance,correlation,slope,intercept,trend_per_decade\n";
+	for (size_t p = 0; p < statistics.size(); p++)
+	{
+		const PairStatistics& pair = statistics[p];
+		file << stations.names[pair.a] << "," << stations.names[pair.b] << "," << pair.n << "," << pair.mean_a << "," << pair.mean_b << ","
+			<< pair.covariance << "," << pair.correlation << "," << pair.slope << "," << pair.intercept << "," << pair.trend << "\n";
+	}
+	printf("Exported %zu station pairs to '%s'\n\n", statistics.size(), ExportPath("correlations").c_str());
+}
+
+void ReportPair(const PairStatistics& pair)
+{
+	printf("%s vs %s: %llu matching times\n", stations.names[pair.a].c_str(), stations.names[pair.b].c_str(), pair.n);
+	printf("\tMeans: %.3f, %.3f\n\tCovariance: %.4f, Pearson correlation: %.4f\n", pair.mean_a, pair.mean_b, pair.covariance, pair.correlation);
+	printf("\tRegression: %s = %.4f * %s + %.4f\n", stations.names[pair.b].c_str(), pair.slope, stations.names[pair.a].c_str(), pair.intercept);
+	printf("\tTrend of the difference: %+.4f per decade\n\n", pair.trend);
+}
+
+#endif
@@ -0,0 +1,957 @@
+#ifndef dataset_h
+#define dataset_h
+
+#include <vector>
+#include <string>
+#include <deque>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <fstream>
+#include <climits>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <memory>
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <glob.h>
+	#include <sys/stat.h>
+	#include <sys/mman.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+#include "thread_pool.h"
+#include "native_funcs.h"
+#include "records.h"
+#include "filter.h"
+#include "spsc_queue.h"
+#include "quantile_sketch.h"
+
+/* A logical dataset made of one or more files, each file being a partition of the columns. A directory, or a glob such as
+   "data\temp_*.txt", is listed without reading any file, and the station and year of a partition are taken from its file name where it
+   follows the layout "<STATION>_<YEAR>.txt" or "<STATION>\<YEAR>.txt". A query then prunes whole partitions before any parsing happens,
+   and selects the matching records of the partitions which remain.
+
+   The selected files are loaded by a pipeline of lanes connected by bounded SPSC queues (see spsc_queue.h). Every lane is a reader thread,
+   which fills a few fixed size buffers with newline aligned blocks of the files, and a parser thread, which turns every block into a chunk
+   of the columns (including the integer column of convert()) and hands the buffer straight back. The calling thread places the parsed
+   chunks in file order and streams each one into the device resident columns of filter.h, so reading, parsing and uploading all overlap
+   and the load takes about as long as the slowest of them. The host columns are finally assembled from the chunks in parallel.
+
+   A lazy load instead indexes the lines of every file and decodes only the records which are used: the temperatures of the rows selected
+   by the query, then the station and time columns on their first use. The rows of a station or a range of years are found by binary search
+   over the index, which requires every file to be ordered by station and then by time, as the supplied datasets are.
+
+   Either way every parsing thread also builds a quantile sketch (see quantile_sketch.h) of the temperatures it decodes. The sketches are
+   merged into one per partition, in file order, and the partitions into one for the whole dataset, so any percentile of the loaded records
+   (or of any combination of partitions) is answered without sorting or even touching the columns. */
+
+struct DatasetPartition
+{
+	std::string path;
+	size_t bytes = 0;					// File size when listed.
+	std::string station;				// Station of every record within the file, empty when not known from the name.
+	int year = 0;						// Year of every record within the file, 0 when not known from the name.
+	size_t offset = 0;					// First record of the partition within the loaded columns.
+	size_t count = 0;					// Records of the partition within the loaded columns.
+	QuantileSketch sketch;				// Temperatures of the partition's loaded records.
+};
+
+struct DatasetQuery
+{
+	std::string station;				// Only load partitions of this station, or any station when empty.
+	int first_year = INT_MIN;			// Only load partitions within these years, inclusive.
+	int last_year = INT_MAX;
+
+	bool HasYears() const { return first_year != INT_MIN || last_year != INT_MAX; }
+	unsigned int FirstMinute() const { return (first_year == INT_MIN) ? 0 : YearMinutes(first_year); }
+	unsigned int EndMinute() const { return (last_year == INT_MAX) ? UINT_MAX : YearMinutes(last_year + 1); }
+
+	bool Keeps(const DatasetPartition& partition) const
+	{
+		// A partition is only pruned when its name proves that none of its records can match.
+		if (!station.empty() && !partition.station.empty() && partition.station != station)
+			return false;
+		if (partition.year != 0 && (partition.year < first_year || partition.year > last_year))
+			return false;
+		return true;
+	}
+
+	std::string Describe() const
+	{
+		std::string description = (station.empty()) ? "all stations" : "station " + station;
+		if (first_year != INT_MIN || last_year != INT_MAX)
+		{
+			description += ", years " + ((first_year == INT_MIN) ? std::string("..") : std::to_string(first_year)) + " to "
+				+ ((last_year == INT_MAX) ? std::string("..") : std::to_string(last_year));
+		}
+		return description;
+	}
+};
+
+bool ParseYearRange(const char* arg, DatasetQuery& query)
+{
+	// Parse "YYYY" or "YYYY:YYYY" (either side may be empty) into the year range of the query.
+	const char* colon = strchr(arg, ':');
+	if (!colon)
+	{
+		query.first_year = query.last_year = atoi(arg);
+		return query.first_year != 0;
+	}
+
+	if (colon != arg)
+		query.first_year = atoi(arg);
+	if (colon[1] != '\0')
+		query.last_year = atoi(colon + 1);
+	return query.first_year <= query.last_year;
+}
+
+// ------------------------------------------------------------------------ Partition Naming ------------------------------------------------------------------------ //
+
+inline bool IsYear(const std::string& text)
+{
+	return text.size() == 4 && std::all_of(text.begin(), text.end(), [](char c) { return c >= '0' && c <= '9'; });
+}
+
+void NamePartition(DatasetPartition& partition)
+{
+	// Split the path into the parent directory and the file name stem.
+	size_t slash = partition.path.find_last_of("\\/");
+	std::string file = (slash == std::string::npos) ? partition.path : partition.path.substr(slash + 1);
+	std::string stem = file.substr(0, file.find_last_of('.'));
+
+	// "<STATION>_<YEAR>" or "<STATION>-<YEAR>" names both, while "<YEAR>" names the year and leaves the station to the parent directory.
+	if (IsYear(stem))
+	{
+		partition.year = atoi(stem.c_str());
+		if (slash != std::string::npos)
+		{
+			std::string parent = partition.path.substr(0, slash);
+			size_t parent_slash = parent.find_last_of("\\/");
+			partition.station = (parent_slash == std::string::npos) ? parent : parent.substr(parent_slash + 1);
+			if (partition.station == "." || partition.station == "..")
+				partition.station.clear();
+		}
+	}
+	else if (stem.size() > 5 && (stem[stem.size() - 5] == '_' || stem[stem.size() - 5] == '-') && IsYear(stem.substr(stem.size() - 4)))
+	{
+		partition.year = atoi(stem.substr(stem.size() - 4).c_str());
+		partition.station = stem.substr(0, stem.size() - 5);
+	}
+}
+
+void ListFiles(const std::string& pattern, bool recurse, std::vector<DatasetPartition>& out_partitions)
+{
+	// List every file matching the pattern, descending into sub directories when listing a whole directory.
+#ifdef _WIN32
+	size_t slash = pattern.find_last_of("\\/");
+	std::string directory = (slash == std::string::npos) ? "" : pattern.substr(0, slash + 1);
+
+	WIN32_FIND_DATAA find_data;
+	HANDLE find = FindFirstFileA(pattern.c_str(), &find_data);
+	if (find == INVALID_HANDLE_VALUE)
+		return;
+
+	do
+	{
+		std::string name = find_data.cFileName;
+		if (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+		{
+			if (recurse && name != "." && name != "..")
+				ListFiles(directory + name + "/*", true, out_partitions);
+			continue;
+		}
+
+		DatasetPartition partition;
+		partition.path = directory + name;
+		partition.bytes = ((size_t)find_data.nFileSizeHigh << 32) | find_data.nFileSizeLow;
+		NamePartition(partition);
+		out_partitions.push_back(partition);
+	} while (FindNextFileA(find, &find_data));
+
+	FindClose(find);
+#else
+	// glob() returns the full path of every match (never "." or ".."), a pattern written with backslashes is first given forward slashes.
+	std::string posix_pattern = pattern;
+	std::replace(posix_pattern.begin(), posix_pattern.end(), '\\', '/');
+	glob_t matches;
+	if (glob(posix_pattern.c_str(), 0, nullptr, &matches) != 0)
+		return;
+
+	for (size_t i = 0; i < matches.gl_pathc; i++)
+	{
+		std::string path = matches.gl_pathv[i];
+		struct stat status;
+		if (stat(path.c_str(), &status) != 0)
+			continue;
+		if (S_ISDIR(status.st_mode))
+		{
+			if (recurse)
+				ListFiles(path + "/*", true, out_partitions);
+			continue;
+		}
+
+		DatasetPartition partition;
+		partition.path = path;
+		partition.bytes = (size_t)status.st_size;
+		NamePartition(partition);
+		out_partitions.push_back(partition);
+	}
+
+	globfree(&matches);
+#endif
+}
+
+bool IsDirectory(const std::string& path)
+{
+#ifdef _WIN32
+	DWORD attributes = GetFileAttributesA(path.c_str());
+	return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+	struct stat status;
+	return stat(path.c_str(), &status) == 0 && S_ISDIR(status.st_mode);
+#endif
+}
+
+// ------------------------------------------------------------------------ Dataset ------------------------------------------------------------------------ //
+
+struct DatasetChunk
+{
+	size_t offset = 0;					// First record of the chunk within the loaded columns.
+	size_t bytes = 0;					// Bytes of text the chunk was parsed from.
+	std::vector<fp_type> values;
+	std::vector<int> int_values;
+	std::vector<unsigned int> minutes;
+	std::vector<unsigned short> station_ids;	// Ids into names, local to the chunk.
+	std::vector<std::string> names;
+	QuantileSketch sketch;
+};
+
+struct PipelineBlock
+{
+	size_t slot;						// Index of the file within the loaded partitions.
+	size_t begin, end;					// Bytes of the file, every line beginning within them belonging to the block.
+};
+
+struct PipelineBuffer
+{
+	size_t block = 0;
+	std::vector<char> data;				// The block from the byte before it, extended to the end of its last line.
+	size_t begin = 0, end = 0;			// Lines of the block within data.
+};
+
+class MappedFile
+{
+	/* A single owner of a read only mapping of a whole file, so that its pages are only read in as they are touched: the line index streams
+	   through the file once, and the decode then faults in just the pages of the selected rows. */
+	private:
+		const char* data = nullptr;
+		size_t size = 0;
+	#ifdef _WIN32
+		HANDLE mapping = NULL;
+	#endif
+
+	public:
+		MappedFile() {}
+
+		MappedFile(MappedFile&& other)
+		{
+			*this = std::move(other);
+		}
+
+		MappedFile& operator=(MappedFile&& other)
+		{
+			if (this != &other)
+			{
+				Unmap();
+				std::swap(data, other.data);
+				std::swap(size, other.size);
+			#ifdef _WIN32
+				std::swap(mapping, other.mapping);
+			#endif
+			}
+			return *this;
+		}
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		~MappedFile()
+		{
+			Unmap();
+		}
+
+		bool Map(const std::string& path)
+		{
+			Unmap();
+		#ifdef _WIN32
+			HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+			if (file == INVALID_HANDLE_VALUE)
+				return false;
+
+			// An empty file has nothing to map, CreateFileMapping() rejecting a size of zero.
+			LARGE_INTEGER file_size;
+			bool mapped = GetFileSizeEx(file, &file_size) != 0;
+			if (mapped && file_size.QuadPart > 0)
+			{
+				mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+				data = (mapping) ? (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+				mapped = data != nullptr;
+				size = (mapped) ? (size_t)file_size.QuadPart : 0;
+			}
+			CloseHandle(file);
+		#else
+			int file = open(path.c_str(), O_RDONLY);
+			if (file < 0)
+				return false;
+
+			// An empty file has nothing to map, mmap() rejecting a length of zero.
+			struct stat status;
+			bool mapped = fstat(file, &status) == 0;
+			if (mapped && status.st_size > 0)
+			{
+				void* view = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+				mapped = view != MAP_FAILED;
+				data = (mapped) ? (const char*)view : nullptr;
+				size = (mapped) ? (size_t)status.st_size : 0;
+			}
+			close(file);
+		#endif
+			if (!mapped)
+				Unmap();
+			return mapped;
+		}
+
+		void Unmap()
+		{
+		#ifdef _WIN32
+			if (data)
+				UnmapViewOfFile(data);
+			if (mapping)
+				CloseHandle(mapping);
+			mapping = NULL;
+		#else
+			if (data)
+				munmap((void*)data, size);
+		#endif
+			data = nullptr;
+			size = 0;
+		}
+
+		const char* Data() const { return data; }
+		size_t Size() const { return size; }
+};
+
+struct LazyPartition
+{
+	MappedFile text;					// Whole file, mapped until every column has been decoded.
+	LineIndex index;
+	std::vector<std::pair<size_t, size_t>> rows;	// Ranges of the file's rows selected by the query.
+};
+
+struct RowBlock
+{
+	const LazyPartition* file;
+	size_t begin, end;					// Rows of the file.
+	size_t offset;						// First record of the block within the loaded columns.
+};
+
+const size_t lazy_block_rows = 1 << 16;			// Rows of a lazily loaded file decoded by a single task.
+
+bool MapWholeFile(const std::string& path, MappedFile& out_file)
+{
+	if (!out_file.Map(path))
+	{
+		std::cout << "Unable to map " << path << ", the partition is empty.\n";
+		return false;
+	}
+	return true;
+}
+
+struct Dataset
+{
+	std::vector<DatasetPartition> partitions;	// Every listed partition, in file name order.
+	std::vector<size_t> loaded;					// Indices of the partitions kept by the last query.
+
+	ArenaArray<fp_type> values;			// Temperature column of the loaded partitions.
+	ArenaArray<int> int_values;			// Temperature column multiplied by int_multiplier, as convert() produces.
+	size_t size = 0;
+	QuantileSketch sketch;				// Temperatures of every loaded record, merged from the partition sketches.
+
+	cl::Buffer device_values;			// Device columns streamed by the pipeline, holding the first size records.
+	cl::Buffer device_int_values;
+	cl::Buffer device_station_ids;
+
+	size_t lanes = 0;					// Reader and parser thread pairs of the pipeline, or 0 for one per thread of the pool.
+	size_t block_bytes = 4 << 20;		// Bytes of a file read and parsed as one block.
+	size_t buffers_per_lane = 4;		// Blocks which a reader may fill ahead of its parser.
+	bool stream_to_device = false;		// Whether the pipeline uploads the columns as they are parsed.
+	int int_multiplier = 10;
+	size_t io_threads = 2;				// Files read concurrently by a lazy load.
+	bool lazy = false;					// Whether to index the files and decode only the records which are used.
+	double sketch_error = 0.005;		// Normalised rank error of the quantile sketches.
+
+	bool Open(const std::string& pattern)
+	{
+		Release();
+		partitions.clear();
+
+		// A directory is listed recursively, otherwise the pattern is either a glob or the path of a single file.
+		if (IsDirectory(pattern))
+		{
+			std::string directory = pattern;
+			if (directory.back() != '\\' && directory.back() != '/')
+				directory += "/";
+			ListFiles(directory + "*", true, partitions);
+		}
+		else ListFiles(pattern, false, partitions);
+
+		std::sort(partitions.begin(), partitions.end(), [](const DatasetPartition& a, const DatasetPartition& b) { return a.path < b.path; });
+		return !partitions.empty();
+	}
+
+	size_t LoadedBytes() const
+	{
+		size_t bytes = 0;
+		for (size_t i = 0; i < loaded.size(); i++)
+			bytes += partitions[loaded[i]].bytes;
+		return bytes;
+	}
+
+	void Load(ThreadPool& pool, const DatasetQuery& query, char delimiter, unsigned char column_index, StationColumn& out_stations, TimeColumn& out_times)
+	{
+		Release();
+		out_stations.Release();
+		out_times.Release();
+		record_delimiter = delimiter;
+
+		// Prune on the partition names alone, before any file is opened.
+		loaded.clear();
+		for (size_t i = 0; i < partitions.size(); i++)
+		{
+			partitions[i].offset = partitions[i].count = 0;
+			partitions[i].sketch = QuantileSketch(SketchK(sketch_error));
+			if (query.Keeps(partitions[i]))
+				loaded.push_back(i);
+		}
+
+		if (lazy)
+			LoadLazy(pool, query, column_index);
+		else
+		{
+			std::vector<DatasetChunk> chunks;
+			Pipeline(pool, query, delimiter, column_index, chunks, out_stations);
+			Assemble(pool, chunks, out_stations, out_times);
+		}
+
+		sketch = CombinedSketch(loaded);
+	}
+
+	QuantileSketch CombinedSketch(const std::vector<size_t>& indices) const
+	{
+		// Merge the sketches of the given partitions, which must have been loaded together for their sketches to share a k.
+		QuantileSketch combined(SketchK(sketch_error));
+		for (size_t i = 0; i < indices.size(); i++)
+			combined.Merge(partitions[indices[i]].sketch);
+		return combined;
+	}
+
+	bool RecordsPending() const { return !lazy_partitions.empty(); }
+
+	void DecodeRecords(ThreadPool& pool, StationColumn& out_stations, TimeColumn& out_times)
+	{
+		out_stations.Release();
+		out_times.Release();
+		out_stations.ids.Allocate(size, DatasetMemory);
+		out_stations.size = size;
+		out_times.minutes.Allocate(size, DatasetMemory);
+		out_times.size = size;
+
+		// Decode the station and time of every selected row, interning the names of each block into its own dictionary.
+		std::vector<RowBlock> blocks = RowBlocks();
+		std::vector<std::vector<std::string>> block_names(blocks.size());
+		TaskGroup group;
+		for (size_t b = 0; b < blocks.size(); b++)
+		{
+			pool.Submit(group, pool.NodeOf(blocks[b].offset, size), [&, b]()
+			{
+				counters::Scope scope(counters::parse);
+				const RowBlock& block = blocks[b];
+				StationDictionary local;
+				for (size_t row = block.begin, i = block.offset; row < block.end; row++, i++)
+				{
+					const char* line = block.file->index.Begin(row);
+					const char* line_end = block.file->index.End(row);
+					out_stations.ids[i] = local.InternLine(line, line_end, record_delimiter);
+					out_times.minutes[i] = ParseRecordMinutes(line, line_end, record_delimiter);
+				}
+				block_names[b].swap(local.names);
+			});
+		}
+		group.Wait();
+
+		// Merge the block dictionaries in dataset order and rewrite the local ids, as ParseStations does.
+		StationDictionary global;
+		std::vector<std::vector<unsigned short>> remap(blocks.size());
+		for (size_t b = 0; b < blocks.size(); b++)
+			remap[b] = MergeStationNames(block_names[b], global);
+		out_stations.names = global.names;
+
+		for (size_t b = 0; b < blocks.size(); b++)
+		{
+			pool.Submit(group, pool.NodeOf(blocks[b].offset, size), [&, b]()
+			{
+				for (size_t i = blocks[b].offset; i < blocks[b].offset + (blocks[b].end - blocks[b].begin); i++)
+					out_stations.ids[i] = remap[b][out_stations.ids[i]];
+			});
+		}
+		group.Wait();
+
+		// Every column has now been decoded, so the text of the files is no longer needed.
+		std::vector<LazyPartition>().swap(lazy_partitions);
+	}
+
+	void Release()
+	{
+		values.Release();
+		int_values.Release();
+		size = 0;
+		sketch = QuantileSketch(SketchK(sketch_error));
+		device_values = device_int_values = device_station_ids = cl::Buffer();
+		device_capacity = 0;
+		ReleaseColumns();
+		std::vector<LazyPartition>().swap(lazy_partitions);
+	}
+
+private:
+	char record_delimiter = ' ';
+	std::vector<LazyPartition> lazy_partitions;	// Indexed text of every loaded partition, while the record columns are not yet decoded.
+	size_t device_capacity = 0;					// Records which the device columns can hold.
+
+	void Pipeline(ThreadPool& pool, const DatasetQuery& query, char delimiter, unsigned char column_index, std::vector<DatasetChunk>& chunks, StationColumn& out_stations)
+	{
+		// Split every kept file into fixed size blocks, which the readers claim in order.
+		std::vector<PipelineBlock> blocks;
+		size_t total_bytes = 0;
+		for (size_t slot = 0; slot < loaded.size(); slot++)
+		{
+			size_t bytes = partitions[loaded[slot]].bytes;
+			for (size_t begin = 0; begin < bytes; begin += block_bytes)
+			{
+				PipelineBlock block = { slot, begin, std::min(begin + block_bytes, bytes) };
+				blocks.push_back(block);
+			}
+			total_bytes += bytes;
+		}
+		chunks.resize(blocks.size());
+		for (size_t c = 0; c < chunks.size(); c++)
+			chunks[c].sketch = QuantileSketch(SketchK(sketch_error));
+		if (blocks.empty())
+			return;
+
+		/* Every lane owns its buffers, which circulate from the reader to the parser through one queue and back through another, so at most
+		   buffers_per_lane blocks of text are held per lane however far the readers are ahead. */
+		size_t lane_count = std::max<size_t>(1, std::min((lanes) ? lanes : pool.Size(), blocks.size()));
+		std::vector<std::unique_ptr<PipelineBuffer>> buffers;
+		std::vector<std::unique_ptr<SpscQueue<PipelineBuffer*>>> free_buffers, filled_buffers;
+		std::vector<std::unique_ptr<SpscQueue<size_t>>> parsed_blocks;
+		std::atomic<size_t> next_block(0);
+		std::vector<std::thread> threads;
+		for (size_t lane = 0; lane < lane_count; lane++)
+		{
+			free_buffers.emplace_back(new SpscQueue<PipelineBuffer*>(buffers_per_lane));
+			filled_buffers.emplace_back(new SpscQueue<PipelineBuffer*>(buffers_per_lane + 1));
+			parsed_blocks.emplace_back(new SpscQueue<size_t>(buffers_per_lane + 1));
+			for (size_t b = 0; b < buffers_per_lane; b++)
+			{
+				buffers.emplace_back(new PipelineBuffer());
+				free_buffers[lane]->Push(buffers.back().get());
+			}
+		}
+
+		for (size_t lane = 0; lane < lane_count; lane++)
+		{
+			// The reader fills a free buffer with the next unclaimed block, a null buffer telling the parser that every block is claimed.
+			threads.push_back(std::thread([&, lane]()
+			{
+				std::ifstream file;
+				size_t open_slot = loaded.size();
+				for (size_t b = next_block++; b < blocks.size(); b = next_block++)
+				{
+					PipelineBuffer* buffer = free_buffers[lane]->Pop();
+					buffer->block = b;
+					if (blocks[b].slot != open_slot)
+					{
+						open_slot = blocks[b].slot;
+						file.close();
+						file.clear();
+						file.open(partitions[loaded[open_slot]].path, std::ios::binary);
+						if (!file)
+							std::cout << "Unable to open " << partitions[loaded[open_slot]].path << ", the partition is empty.\n";
+					}
+					ReadBlock(file, blocks[b], *buffer);
+					filled_buffers[lane]->Push(buffer);
+				}
+				filled_buffers[lane]->Push(nullptr);
+			}));
+
+			// The parser turns every filled buffer into the chunk of its block, then returns the buffer before announcing the chunk.
+			threads.push_back(std::thread([&, lane]()
+			{
+				for (PipelineBuffer* buffer = filled_buffers[lane]->Pop(); buffer; buffer = filled_buffers[lane]->Pop())
+				{
+					size_t block = buffer->block;
+					ParseChunk(buffer->data.data(), buffer->begin, buffer->end, query, delimiter, column_index, int_multiplier, chunks[block]);
+					free_buffers[lane]->Push(buffer);
+					parsed_blocks[lane]->Push(block);
+				}
+				parsed_blocks[lane]->Push(blocks.size());
+			}));
+		}
+
+		// The calling thread places the chunks in block order as they are parsed, merging their station dictionaries in the same order.
+		StationDictionary global;
+		std::vector<char> parsed(blocks.size(), 0);
+		size_t next = 0, finished_lanes = 0;
+		while (finished_lanes < lane_count)
+		{
+			bool progress = false;
+			for (size_t lane = 0; lane < lane_count; lane++)
+			{
+				size_t block;
+				while (parsed_blocks[lane]->TryPop(block))
+				{
+					progress = true;
+					if (block == blocks.size())
+						finished_lanes++;
+					else parsed[block] = 1;
+				}
+			}
+
+			for (; next < blocks.size() && parsed[next]; next++)
+				PlaceChunk(blocks[next], chunks[next], global, total_bytes);
+
+			if (!progress)
+				std::this_thread::yield();
+		}
+
+		for (size_t t = 0; t < threads.size(); t++)
+			threads[t].join();
+
+		// The streamed writes read directly from the chunks, which must therefore outlive them.
+		if (stream_to_device)
+			queue.finish();
+		out_stations.names = global.names;
+	}
+
+	static void ReadBlock(std::ifstream& file, const PipelineBlock& block, PipelineBuffer& buffer)
+	{
+		// Read from the byte before the block, which tells whether the block begins with a line of its own.
+		counters::Scope scope(counters::read);
+		size_t first = (block.begin > 0) ? block.begin - 1 : 0;
+		buffer.data.resize(block.end - first);
+		file.clear();
+		file.seekg(first);
+		file.read(buffer.data.data(), buffer.data.size());
+		buffer.data.resize((size_t)file.gcount());
+
+		// Extend the block to the end of the last line which begins within it.
+		while (!buffer.data.empty() && buffer.data.back() != '\n' && file)
+		{
+			size_t length = buffer.data.size();
+			buffer.data.resize(length + 4096);
+			file.read(buffer.data.data() + length, 4096);
+			buffer.data.resize(length + (size_t)file.gcount());
+
+			const char* newline = (const char*)memchr(buffer.data.data() + length, '\n', buffer.data.size() - length);
+			if (newline)
+				buffer.data.resize((newline - buffer.data.data()) + 1);
+		}
+
+		// The partial line at the front of the block belongs to the previous block, as does a block within which no line begins.
+		size_t block_end = std::min(block.end - first, buffer.data.size());
+		buffer.begin = 0;
+		if (block.begin > 0)
+		{
+			const char* newline = (const char*)memchr(buffer.data.data(), '\n', block_end);
+			buffer.begin = (newline) ? (newline - buffer.data.data()) + 1 : block_end;
+		}
+		buffer.end = (buffer.begin < block_end) ? buffer.data.size() : buffer.begin;
+	}
+
+	static void ParseChunk(const char* data, size_t begin, size_t end, const DatasetQuery& query, char delimiter, unsigned char column_index, int multiplier, DatasetChunk& chunk)
+	{
+		/* Parse the station, time and temperature of every line together, keeping only the records which match the query. The integer
+		   conversion is fused into the parse here, so its counters are those of the parse. */
+		counters::Scope scope(counters::parse);
+		StationDictionary local;
+		unsigned int first_minute = query.FirstMinute(), end_minute = query.EndMinute();
+		chunk.bytes = end - begin;
+		ForEachLine(data, begin, end, [&](const char* line, const char* line_end)
+		{
+			const char* name_end = (const char*)memchr(line, delimiter, line_end - line);
+			size_t name_len = ((name_end) ? name_end : line_end) - line;
+			if (!query.station.empty() && (query.station.size() != name_len || memcmp(query.station.data(), line, name_len) != 0))
+				return;
+
+			unsigned int minutes = ParseRecordMinutes(line, line_end, delimiter);
+			if (minutes < first_minute || minutes >= end_minute)
+				return;
+
+			fp_type value = ParseColumnValue(line, line_end, delimiter, column_index);
+			chunk.station_ids.push_back(local.Intern(line, name_len));
+			chunk.minutes.push_back(minutes);
+			chunk.values.push_back(value);
+			chunk.int_values.push_back((int)std::lround(value * multiplier));
+			chunk.sketch.Update(value);
+		});
+		chunk.names.swap(local.names);
+	}
+
+	void PlaceChunk(const PipelineBlock& block, DatasetChunk& chunk, StationDictionary& global, size_t total_bytes)
+	{
+		// Rewrite the chunk's station ids as global ids, and give the chunk the next records of the dataset.
+		std::vector<unsigned short> remap = MergeStationNames(chunk.names, global);
+		for (size_t i = 0; i < chunk.station_ids.size(); i++)
+			chunk.station_ids[i] = remap[chunk.station_ids[i]];
+
+		DatasetPartition& partition = partitions[loaded[block.slot]];
+		if (block.begin == 0)
+			partition.offset = size;
+		chunk.offset = size;
+		size += chunk.values.size();
+		partition.count = size - partition.offset;
+		partition.sketch.Merge(chunk.sketch);
+		chunk.sketch = QuantileSketch();
+
+		if (!stream_to_device || chunk.values.empty())
+			return;
+
+		// Size the device columns from the records per byte of the first chunk, growing them on the device should the estimate fall short.
+		if (size > device_capacity)
+		{
+			size_t estimate = (size_t)((double)chunk.values.size() / std::max<size_t>(1, chunk.bytes) * total_bytes * 1.05);
+			size_t capacity = std::max(size, std::max(estimate, device_capacity * 2));
+			GrowDeviceColumn<fp_type>(device_values, chunk.offset, capacity);
+			GrowDeviceColumn<int>(device_int_values, chunk.offset, capacity);
+			GrowDeviceColumn<unsigned short>(device_station_ids, chunk.offset, capacity);
+			device_capacity = capacity;
+		}
+
+		// Non-blocking writes, so the upload of this chunk overlaps the parsing of the chunks after it.
+		size_t count = chunk.values.size();
+		queue.enqueueWriteBuffer(device_values, CL_FALSE, chunk.offset * sizeof(fp_type), count * sizeof(fp_type), chunk.values.data());
+		queue.enqueueWriteBuffer(device_int_values, CL_FALSE, chunk.offset * sizeof(int), count * sizeof(int), chunk.int_values.data());
+		queue.enqueueWriteBuffer(device_station_ids, CL_FALSE, chunk.offset * sizeof(unsigned short), count * sizeof(unsigned short), chunk.station_ids.data());
+	}
+
+	template<typename T>
+	static void GrowDeviceColumn(cl::Buffer& buffer, size_t used, size_t capacity)
+	{
+		// The copy is ordered after every write already enqueued, and the old buffer is retained by the queue until the copy completes.
+		cl::Buffer grown(context, CL_MEM_READ_ONLY, capacity * sizeof(T));
+		if (used)
+			queue.enqueueCopyBuffer(buffer, grown, 0, 0, used * sizeof(T));
+		buffer = grown;
+	}
+
+	void Assemble(ThreadPool& pool, std::vector<DatasetChunk>& chunks, StationColumn& out_stations, TimeColumn& out_times)
+	{
+		values.Allocate(size, DatasetMemory);
+		int_values.Allocate(size, DatasetMemory);
+		out_stations.ids.Allocate(size, DatasetMemory);
+		out_stations.size = size;
+		out_times.minutes.Allocate(size, DatasetMemory);
+		out_times.size = size;
+
+		// Copy every chunk in parallel, first touching each range of the columns on the node which later processes it.
+		TaskGroup group;
+		for (size_t c = 0; c < chunks.size(); c++)
+		{
+			pool.Submit(group, pool.NodeOf(chunks[c].offset, size), [&, c]()
+			{
+				DatasetChunk& chunk = chunks[c];
+				std::copy(chunk.values.begin(), chunk.values.end(), values.Data() + chunk.offset);
+				std::copy(chunk.int_values.begin(), chunk.int_values.end(), int_values.Data() + chunk.offset);
+				std::copy(chunk.station_ids.begin(), chunk.station_ids.end(), out_stations.ids.Data() + chunk.offset);
+				std::copy(chunk.minutes.begin(), chunk.minutes.end(), out_times.minutes.Data() + chunk.offset);
+				chunk = DatasetChunk();
+			});
+		}
+		group.Wait();
+	}
+
+	void LoadLazy(ThreadPool& pool, const DatasetQuery& query, unsigned char column_index)
+	{
+		/* Map every kept file whole on the I/O threads, as the text is decoded on demand rather than streamed through the pipeline. Nothing is
+		   copied, the pages being read in by the line index and then by the decode of the selected rows. */
+		lazy_partitions.resize(loaded.size());
+		std::atomic<size_t> next_file(0);
+		std::vector<std::thread> readers;
+		for (size_t t = 0; t < std::min(io_threads, loaded.size()); t++)
+		{
+			readers.push_back(std::thread([&]()
+			{
+				counters::Scope scope(counters::read);
+				for (size_t slot = next_file++; slot < loaded.size(); slot = next_file++)
+					MapWholeFile(partitions[loaded[slot]].path, lazy_partitions[slot].text);
+			}));
+		}
+		for (size_t t = 0; t < readers.size(); t++)
+			readers[t].join();
+
+		// Index the lines of every file and select the rows of the query, parsing only the few lines probed by the binary searches.
+		for (size_t slot = 0; slot < loaded.size(); slot++)
+		{
+			LazyPartition& file = lazy_partitions[slot];
+			DatasetPartition& partition = partitions[loaded[slot]];
+			file.index.Build(pool, file.text.Data(), file.text.Size());
+			file.rows = SelectRows(file.index, query, partition);
+
+			partition.offset = size;
+			for (size_t r = 0; r < file.rows.size(); r++)
+				size += file.rows[r].second - file.rows[r].first;
+			partition.count = size - partition.offset;
+		}
+
+		// Decode the temperatures of the selected rows alone, the station and time columns waiting for their first use (see DecodeRecords).
+		values.Allocate(size, DatasetMemory);
+		int_values.Allocate(size, DatasetMemory);
+		std::vector<RowBlock> blocks = RowBlocks();
+		std::vector<QuantileSketch> block_sketches(blocks.size(), QuantileSketch(SketchK(sketch_error)));
+		TaskGroup group;
+		for (size_t b = 0; b < blocks.size(); b++)
+		{
+			pool.Submit(group, pool.NodeOf(blocks[b].offset, size), [&, b]()
+			{
+				counters::Scope scope(counters::parse);
+				const RowBlock& block = blocks[b];
+				for (size_t row = block.begin, i = block.offset; row < block.end; row++, i++)
+				{
+					values[i] = ParseColumnValue(block.file->index.Begin(row), block.file->index.End(row), record_delimiter, column_index);
+					int_values[i] = (int)std::lround(values[i] * int_multiplier);
+					block_sketches[b].Update(values[i]);
+				}
+			});
+		}
+		group.Wait();
+
+		// Merge the block sketches into their partitions in dataset order, so that the merged sketches are the same from one load to the next.
+		for (size_t b = 0; b < blocks.size(); b++)
+			partitions[loaded[blocks[b].file - lazy_partitions.data()]].sketch.Merge(block_sketches[b]);
+	}
+
+	std::vector<std::pair<size_t, size_t>> SelectRows(const LineIndex& index, const DatasetQuery& query, const DatasetPartition& partition) const
+	{
+		std::vector<std::pair<size_t, size_t>> rows;
+		size_t count = index.Count();
+		bool by_station = !query.station.empty() && partition.station.empty();
+		bool by_year = query.HasYears() && partition.year == 0;
+		if (!by_station && !by_year)
+		{
+			if (count)
+				rows.push_back(std::make_pair((size_t)0, count));
+			return rows;
+		}
+
+		auto name_length = [&](size_t row)
+		{
+			const char* line = index.Begin(row);
+			const char* line_end = index.End(row);
+			const char* name_end = (const char*)memchr(line, record_delimiter, line_end - line);
+			return (size_t)(((name_end) ? name_end : line_end) - line);
+		};
+		auto same_station = [&](size_t a, size_t b)
+		{
+			size_t length = name_length(a);
+			return length == name_length(b) && memcmp(index.Begin(a), index.Begin(b), length) == 0;
+		};
+		auto first_at = [&](size_t low, size_t high, unsigned int minutes)
+		{
+			// First row of [low, high) at or after the given time, the rows of a station being in time order.
+			while (low < high)
+			{
+				size_t mid = low + (high - low) / 2;
+				if (ParseRecordMinutes(index.Begin(mid), index.End(mid), record_delimiter) < minutes)
+					low = mid + 1;
+				else high = mid;
+			}
+			return low;
+		};
+
+		for (size_t begin = 0; begin < count;)
+		{
+			// Gallop and then binary search for the end of the station's run of rows, so that every station costs O(log N) probes.
+			size_t same = begin, step = 1;
+			while (begin + step < count && same_station(begin, begin + step))
+			{
+				same = begin + step;
+				step *= 2;
+			}
+			size_t end = std::min(begin + step, count);
+			while (end - same > 1)
+			{
+				size_t mid = same + (end - same) / 2;
+				if (same_station(begin, mid))
+					same = mid;
+				else end = mid;
+			}
+
+			size_t length = name_length(begin);
+			if (!by_station || (length == query.station.size() && memcmp(index.Begin(begin), query.station.data(), length) == 0))
+			{
+				size_t first = (by_year) ? first_at(begin, end, query.FirstMinute()) : begin;
+				size_t last = (by_year) ? first_at(first, end, query.EndMinute()) : end;
+				if (first < last)
+					rows.push_back(std::make_pair(first, last));
+			}
+			begin = end;
+		}
+
+		return rows;
+	}
+
+	std::vector<RowBlock> RowBlocks() const
+	{
+		// Split the selected rows of every file into blocks of rows, in dataset order.
+		std::vector<RowBlock> blocks;
+		size_t offset = 0;
+		for (size_t slot = 0; slot < lazy_partitions.size(); slot++)
+		{
+			const LazyPartition& file = lazy_partitions[slot];
+			for (size_t r = 0; r < file.rows.size(); r++)
+			{
+				for (size_t begin = file.rows[r].first; begin < file.rows[r].second; begin += lazy_block_rows)
+				{
+					RowBlock block = { &file, begin, std::min(begin + lazy_block_rows, file.rows[r].second), offset };
+					offset += block.end - block.begin;
+					blocks.push_back(block);
+				}
+			}
+		}
+		return blocks;
+	}
+};
+
+Dataset dataset;						// Partitions and temperature column of the loaded dataset.
+
+void RequireRecordColumns()
+{
+	// Decode the station and time columns of a lazily loaded dataset on their first use.
+	if (!dataset.RecordsPending())
+		return;
+
+	timer::Start();
+	dataset.DecodeRecords(*GetThreadPool(), stations, times);
+	std::cout << "Decoded station/time columns (" << stations.StationCount() << " stations) " << GetResolutionString(profiler_resolution)
+		<< ": " << timer::Stop(profiler_resolution) << std::endl;
+	PrintCounterInfo("decode_records", counters::parse);
+}
+
+#endif
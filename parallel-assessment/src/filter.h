@@ -0,0 +1,344 @@
+#ifndef filter_h
+#define filter_h
+
+#include <vector>
+#include <string>
+#include <limits>
+#include <cmath>
+#include <cstdio>
+
+#include "funcs.h"
+#include "records.h"
+
+/* Filtered queries such as "stats where temperature < 0" or "stats for one station". The temperature and station columns are uploaded once
+   and stay resident on the device, a filter compacts the matching records into a dense column (and a dense list of their record indices)
+   on the device, and the existing reduction and sort kernels then operate directly on that column. Only the number of matches and the
+   results of the statistics are read back. */
+
+struct RecordFilter
+{
+	fp_type min_value = -INFINITY;		// Lower temperature bound.
+	fp_type max_value = INFINITY;		// Upper temperature bound.
+	bool min_inclusive = true;			// Whether a temperature equal to min_value matches.
+	bool max_inclusive = true;			// Whether a temperature equal to max_value matches.
+	int station = -1;					// Station id which every record must belong to, or -1 for every station.
+
+	std::string Describe() const
+	{
+		char buffer[256];
+		std::string range = "";
+		if (min_value > -INFINITY && max_value < INFINITY)
+			snprintf(buffer, sizeof(buffer), "%.1f %s T %s %.1f", min_value, (min_inclusive) ? "<=" : "<", (max_inclusive) ? "<=" : "<", max_value);
+		else if (min_value > -INFINITY)
+			snprintf(buffer, sizeof(buffer), "T %s %.1f", (min_inclusive) ? ">=" : ">", min_value);
+		else if (max_value < INFINITY)
+			snprintf(buffer, sizeof(buffer), "T %s %.1f", (max_inclusive) ? "<=" : "<", max_value);
+		else snprintf(buffer, sizeof(buffer), "All Temperatures");
+		range = buffer;
+
+		return (station < 0) ? range : stations.names[station] + ", " + range;
+	}
+};
+
+/* The device copies of a column of the loaded dataset. They are identified by the column rather than by the host array they came from, as the
+   menu passes the padded copies of Resize() as often as the dataset itself, so they remain valid until the dataset is released. */
+template<typename T>
+struct DeviceColumns
+{
+	size_t size = 0;
+	cl::Buffer values;					// Temperature of every record.
+	cl::Buffer station_ids;				// Station id of every record.
+
+	void Upload(const T* data, size_t count, const StationColumn& column)
+	{
+		// Upload the columns once, they are then reused by every filter until the dataset is released.
+		size = count;
+		values = cl::Buffer(context, CL_MEM_READ_ONLY, std::max<size_t>(1, count) * sizeof(T));
+		station_ids = cl::Buffer(context, CL_MEM_READ_ONLY, std::max<size_t>(1, count) * sizeof(unsigned short));
+		if (count)
+			queue.enqueueWriteBuffer(values, CL_TRUE, 0, count * sizeof(T), data);
+		if (count && column.size >= count)
+			queue.enqueueWriteBuffer(station_ids, CL_TRUE, 0, count * sizeof(unsigned short), column.ids.Data());
+	}
+
+	void Adopt(size_t count, cl::Buffer device_values, cl::Buffer device_station_ids)
+	{
+		// Take over columns which were already streamed to the device while the dataset was loaded (see Dataset::Pipeline).
+		size = count;
+		values = device_values;
+		station_ids = device_station_ids;
+	}
+
+	bool Resident(size_t count) const { return values() && size == count; }
+
+	void Release()
+	{
+		size = 0;
+		values = cl::Buffer();
+		station_ids = cl::Buffer();
+	}
+};
+
+DeviceColumns<int> int_columns;			// Device resident columns of the integer dataset.
+DeviceColumns<fp_type> fp_columns;		// Device resident columns of the floating point dataset.
+
+DeviceColumns<int>& ResidentColumns(const int* values, size_t size)
+{
+	if (!int_columns.Resident(size))
+		int_columns.Upload(values, size, stations);
+
+	return int_columns;
+}
+
+DeviceColumns<fp_type>& ResidentColumns(const fp_type* values, size_t size)
+{
+	if (!fp_columns.Resident(size))
+		fp_columns.Upload(values, size, stations);
+
+	return fp_columns;
+}
+
+void ReleaseColumns()
+{
+	int_columns.Release();
+	fp_columns.Release();
+}
+
+// ------------------------------------------------------------------------ Filter Functions ------------------------------------------------------------------------ //
+
+template<typename T>
+struct DeviceSubset
+{
+	cl::Buffer values;					// Matching values followed by room for padding, in dataset order.
+	cl::Buffer indices;					// Record index of every matching value.
+	size_t count = 0;					// Number of matching values.
+	size_t capacity = 0;				// Number of values which fit within the values buffer.
+};
+
+int FilterBound(fp_type value, fp_type scale, bool upper, bool inclusive, int)
+{
+	// Integer records are scaled by 10, so an exclusive bound moves to the next representable record.
+	if (std::isinf(value))
+		return (value < 0) ? std::numeric_limits<int>::min() : std::numeric_limits<int>::max();
+
+	double scaled = std::nearbyint((double)value * scale * 1000.0) / 1000.0;
+	if (upper)
+		return (int)((inclusive) ? std::floor(scaled) : std::ceil(scaled) - 1);
+	return (int)((inclusive) ? std::ceil(scaled) : std::floor(scaled) + 1);
+}
+
+fp_type FilterBound(fp_type value, fp_type, bool upper, bool inclusive, fp_type)
+{
+	if (inclusive || std::isinf(value))
+		return value;
+
+	return std::nextafter(value, (upper) ? -INFINITY : INFINITY);
+}
+
+template<typename T>
+DeviceSubset<T> Filter(DeviceColumns<T>& columns, const RecordFilter& filter, fp_type scale)
+{
+	// Determine the kernel names using the type T, e.g. T == int will concatinate  "_INT".
+	std::string count_id = "filter_count";
+	std::string compact_id = "filter_compact";
+	ConcatKernelID(T(), count_id);
+	ConcatKernelID(T(), compact_id);
+
+	// Start a chrono timer and fetch both kernels, every work item evaluates two records as within the scans.
+	timer::Start();
+	KernelProfile profile;
+	cl::Kernel count_kernel = kernel_cache.Get(program, count_id);
+	cl::Kernel compact_kernel = kernel_cache.Get(program, compact_id);
+	size_t group_size = ScanLocalSize(count_kernel, compact_kernel, 2 * sizeof(int));
+	size_t group_count = std::max<size_t>(1, (columns.size + group_size * 2 - 1) / (group_size * 2));
+
+	T lo = FilterBound(filter.min_value, scale, false, filter.min_inclusive, T());
+	T hi = FilterBound(filter.max_value, scale, true, filter.max_inclusive, T());
+
+	// First pass, count the matches of every block.
+	cl::Buffer counts_buffer = PooledBuffer<int>("filter_counts", nullptr, group_count);
+	count_kernel.setArg(0, columns.values);
+	count_kernel.setArg(1, columns.station_ids);
+	count_kernel.setArg(2, counts_buffer);
+	count_kernel.setArg(3, cl::Local(group_size * sizeof(int)));
+	count_kernel.setArg(4, lo);
+	count_kernel.setArg(5, hi);
+	count_kernel.setArg(6, filter.station);
+	count_kernel.setArg(7, (int)columns.size);
+	EnqueueProfiled(count_kernel, group_count * group_size, group_size, profile);
+
+	/* The inclusive scan of the counts is where the output of every block ends, the last of which is the number of matches. That single value
+	   is the only read back, it is needed to size the kernels which follow. */
+	cl::Buffer ends_buffer = PooledBuffer<int>("filter_ends", nullptr, group_count);
+	EnqueueScan<int, int>("add", counts_buffer, ends_buffer, group_count, true, profile);
+	int count = 0;
+	queue.enqueueReadBuffer(ends_buffer, CL_TRUE, (group_count - 1) * sizeof(int), sizeof(int), &count);
+
+	// The values buffer has room for the padding of the reductions and the sort, the largest work group plus half a work group.
+	cl::Device device = context.getInfo<CL_CONTEXT_DEVICES>()[0];
+	size_t max_group_size = device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
+
+	DeviceSubset<T> subset;
+	subset.count = count;
+	subset.capacity = columns.size + max_group_size * 2;
+	subset.values = buffer_pool.Device(context, "filter_values", CL_MEM_READ_WRITE, subset.capacity * sizeof(T));
+	subset.indices = PooledBuffer<int>("filter_indices", nullptr, columns.size);
+
+	// Second pass, write every match to its position within the dense output.
+	compact_kernel.setArg(0, columns.values);
+	compact_kernel.setArg(1, columns.station_ids);
+	compact_kernel.setArg(2, ends_buffer);
+	compact_kernel.setArg(3, subset.values);
+	compact_kernel.setArg(4, subset.indices);
+	compact_kernel.setArg(5, cl::Local(group_size * 2 * sizeof(int)));
+	compact_kernel.setArg(6, lo);
+	compact_kernel.setArg(7, hi);
+	compact_kernel.setArg(8, filter.station);
+	compact_kernel.setArg(9, (int)columns.size);
+	EnqueueProfiled(compact_kernel, group_count * group_size, group_size, profile);
+
+	PrintProfilerInfo(compact_id, profile.ex_time, profile.profiled_info, timer::Stop(profiler_resolution));
+	return subset;
+}
+
+template<typename T>
+size_t PadSubset(DeviceSubset<T>& subset, cl::Buffer buffer, size_t group_size, size_t extra, T neutral)
+{
+	/* The reduction kernels only operate on whole work groups, so the values following the matches are filled with a value which cannot
+	   change the result (zero for sums, the mean for squared differences, the type limits for min/max and the sort). */
+	size_t padded = std::max(group_size, ((subset.count + group_size - 1) / group_size) * group_size);
+	queue.enqueueFillBuffer(buffer, neutral, subset.count * sizeof(T), (padded + extra - subset.count) * sizeof(T));
+
+	return padded;
+}
+
+template<typename Out, typename T>
+Out SubsetReduce(DeviceSubset<T>& subset, std::string kernel_id, T neutral, const T* mean = nullptr)
+{
+	/* Execute one of the reduce_sum, reduce_min, reduce_max or sum_sqr_diff kernels on the subset, without it leaving the device. Out is
+	   the type of the result, the accumulator type for the sums. */
+	ConcatKernelID(T(), kernel_id);
+	bool partials = GroupPartials<Out>(context.getInfo<CL_CONTEXT_DEVICES>()[0]);
+	if (partials)
+		kernel_id += "_PARTIALS";
+
+	timer::Start();
+	cl::Kernel kernel = kernel_cache.Get(program, kernel_id);
+	size_t group_size = PreferredLocalSize(kernel);
+	size_t padded = PadSubset(subset, subset.values, group_size, 0, neutral);
+
+	// The output is seeded with the neutral value rather than zero, so that the minimum of values above zero is not zero.
+	Out result = (mean) ? 0 : (Out)neutral;
+	std::vector<Out> sums((partials) ? padded / group_size : 1, result);
+	cl::Buffer out_buffer = PooledBuffer("filter_result", sums.data(), sums.size());
+	kernel.setArg(0, subset.values);
+	kernel.setArg(1, out_buffer);
+	kernel.setArg(2, cl::Local(group_size * sizeof(Out)));
+	if (mean)
+		kernel.setArg(3, *mean);
+
+	// Without 64 bit atomics the integer sums hold one partial sum per work group, which are added on the host.
+	KernelProfile profile;
+	EnqueueProfiled(kernel, padded, group_size, profile);
+	queue.enqueueReadBuffer(out_buffer, CL_TRUE, 0, sums.size() * sizeof(Out), sums.data());
+	result = (partials) ? AddPartials(sums.data(), sums.size()) : sums[0];
+
+	PrintProfilerInfo(kernel_id, profile.ex_time, profile.profiled_info, timer::Stop(profiler_resolution));
+	return result;
+}
+
+template<typename T>
+T* SubsetSort(DeviceSubset<T>& subset)
+{
+	// Determine the kernel name using the type T, e.g. T == int will concatinate  "_INT".
+	std::string kernel_id = "bitonic_local";
+	ConcatKernelID(T(), kernel_id);
+
+	timer::Start();
+	cl::Kernel kernel = kernel_cache.Get(program, kernel_id);
+	size_t group_size = PreferredLocalSize(kernel);
+	T* sorted = buffer_pool.Host<T>("filter_sorted", std::max<size_t>(1, subset.count));
+
+	/* Sort in the same manner as Sort(), alternating unshifted and shifted passes until the result is sorted, but ping-ponging between two
+	   device buffers rather than uploading every pass. The shifted passes read half a work group beyond the padding, which is also filled. */
+	cl::Buffer buffers[2] = { subset.values, buffer_pool.Device(context, "filter_sort", CL_MEM_READ_WRITE, subset.capacity * sizeof(T)) };
+	size_t padded = PadSubset(subset, buffers[0], group_size, group_size / 2, std::numeric_limits<T>::max());
+	PadSubset(subset, buffers[1], group_size, group_size / 2, std::numeric_limits<T>::max());
+
+	// Whether a pass left the subset sorted is checked on the device, so only a flag rather than the subset is read back every pass.
+	std::string check_id = "subset_sorted";
+	ConcatKernelID(T(), check_id);
+	cl::Kernel check = kernel_cache.Get(program, check_id);
+	cl::Buffer unsorted_buffer = buffer_pool.Device(context, "filter_unsorted", CL_MEM_READ_WRITE, sizeof(int));
+	check.setArg(1, unsorted_buffer);
+	check.setArg(2, (int)subset.count);
+
+	KernelProfile profile;
+	kernel.setArg(2, cl::Local(group_size * sizeof(T)));
+	size_t max_passes = MaxSortPasses(padded, group_size);
+	int unsorted = 1;
+	int pass = 0;
+	for (; unsorted && subset.count > 1; pass++)
+	{
+		if ((size_t)pass > max_passes)
+		{
+			std::cerr << "ERROR: " << kernel_id << " did not sort " << subset.count << " matches within " << max_passes << " passes" << std::endl;
+			break;
+		}
+
+		kernel.setArg(0, buffers[pass % 2]);
+		kernel.setArg(1, buffers[(pass + 1) % 2]);
+		kernel.setArg(3, pass % 2);
+		EnqueueProfiled(kernel, padded, group_size, profile);
+
+		unsorted = 0;
+		queue.enqueueFillBuffer(unsorted_buffer, unsorted, 0, sizeof(int));
+		check.setArg(0, buffers[(pass + 1) % 2]);
+		queue.enqueueNDRangeKernel(check, cl::NullRange, cl::NDRange(padded), cl::NDRange(group_size));
+		queue.enqueueReadBuffer(unsorted_buffer, CL_TRUE, 0, sizeof(int), &unsorted);
+	}
+
+	// The last pass wrote buffers[pass % 2], which is the subset itself when there was nothing to sort.
+	if (subset.count)
+		queue.enqueueReadBuffer(buffers[pass % 2], CL_TRUE, 0, subset.count * sizeof(T), sorted);
+
+	PrintProfilerInfo(kernel_id, profile.ex_time, profile.profiled_info, timer::Stop(profiler_resolution));
+	PrintCounterInfo(kernel_id, counters::sorted);
+	return sorted;
+}
+
+template<typename T>
+void PrintFilteredStatistics(T*& A, size_t original_size, fp_type division, const RecordFilter& filter)
+{
+	DeviceSubset<T> subset = Filter(ResidentColumns(A, original_size), filter, division);
+	printf("%s: %zu of %zu records\n", filter.Describe().c_str(), subset.count, original_size);
+	if (!subset.count)
+	{
+		printf("\n");
+		return;
+	}
+
+	// The reductions come first, the sort then reorders the subset in place.
+	typedef typename Accumulator<T>::type Acc;
+	T min = SubsetReduce<T>(subset, "reduce_min", std::numeric_limits<T>::max());
+	T max = SubsetReduce<T>(subset, "reduce_max", std::numeric_limits<T>::lowest());
+	Acc sum = SubsetReduce<Acc>(subset, "reduce_sum", (T)0);
+	T subset_mean = (T)mean(sum, subset.count);
+	Acc sqr_diff = SubsetReduce<Acc>(subset, "sum_sqr_diff", subset_mean, &subset_mean);
+
+	// The first and last matches are found from the index list, as it is in dataset order.
+	int first = 0, last = 0;
+	queue.enqueueReadBuffer(subset.indices, CL_TRUE, 0, sizeof(int), &first);
+	queue.enqueueReadBuffer(subset.indices, CL_TRUE, (subset.count - 1) * sizeof(int), sizeof(int), &last);
+
+	T* sorted = SubsetSort(subset);
+	printf("\tMinimum: %.1f, Maximum: %.1f, Mean: %.5f, Standard Deviation: %.3f\n", min / division, max / division,
+		mean(sum / (double)division, subset.count), sqrt(CorrectedVariance(sqr_diff, sum, subset_mean, subset.count)) / division);
+	printf("\tLower Quartile: %.3f, Median: %.3f, Upper Quartile: %.3f\n", source(sorted, subset.count, 0.25) / division,
+		source(sorted, subset.count, 0.5) / division, source(sorted, subset.count, 0.75) / division);
+	if (times.size > (size_t)last)
+		printf("\tFirst match: %s, Last match: %s\n", FormatMinutes(times.minutes[first]).c_str(), FormatMinutes(times.minutes[last]).c_str());
+	printf("\n");
+}
+
+#endif
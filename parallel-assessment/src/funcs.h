@@ -2,6 +2,11 @@
 #define funcs_h
 
 #include <iostream>
+#include <string>
+#include <algorithm>
+#include <typeinfo>
+#include <cmath>
+#include <limits>
 
 #ifndef cl_included
 	#define cl_included
@@ -13,28 +18,35 @@
 #endif
 
 #include "windows_fileread.h"
+#include "resource_pool.h"
 
 // ------------------------------------------------------------------------ Helper Functions ------------------------------------------------------------------------ //
 
-int* convert(fp_type* arr, size_t size, int multiplier)
+ArenaArray<int> convert(fp_type* arr, size_t size, int multiplier)
 {
-	// Convert from a floating point array to an integer array.
-	int* new_arr = new int[size];
+	// Convert from a floating point array to an integer array, rounding since e.g. 2.3f * 10 is 22.99999.
+	counters::Scope scope(counters::convert);
+	ArenaArray<int> new_arr(size, DatasetMemory);
 	for (size_t i = 0; i < size; i++)
-		new_arr[i] = arr[i] * multiplier;
+		new_arr[i] = (int)std::lround(arr[i] * multiplier);
 
 	return new_arr;
 }
-fp_type* convert(int* arr, size_t size, int multiplier)
+ArenaArray<fp_type> convert(int* arr, size_t size, int multiplier)
 {
 	// Convert from an integer array to a floating point array.
-	fp_type* new_arr = new fp_type[size];
+	counters::Scope scope(counters::convert);
+	ArenaArray<fp_type> new_arr(size, DatasetMemory);
 	for (size_t i = 0; i < size; i++)
-		new_arr[i] = arr[i] / multiplier;
+		new_arr[i] = (fp_type)arr[i] / multiplier;
 
 	return new_arr;
 }
 
+// Accumulator types of the sums and sums of squared differences, the x10 integers are summed in 64 bits so no dataset size can overflow them.
+template<typename T> struct Accumulator { typedef T type; };
+template<> struct Accumulator<int> { typedef long long type; };
+
 template<typename T>
 T mean(T value, fp_type size)
 {
@@ -50,6 +62,14 @@ T source(const T* arr, int size, fp_type indexer)
 	return arr[src_index];
 }
 
+template<typename T>
+ArenaArray<T>& PaddedCopy()
+{
+	// The padded copy of the dataset made by Resize(), one per element type, each copy returning the one before it to the arena.
+	static ArenaArray<T> padded;
+	return padded;
+}
+
 template<typename T>
 void Resize(T*& arr, size_t& size, int add_size)
 {
@@ -58,22 +78,24 @@ void Resize(T*& arr, size_t& size, int add_size)
 
 	// Claculate the new size for the array and create a buffer at the given size.
 	size_t new_size = size + add_size;
-	T* new_arr = new T[new_size];
+	ArenaArray<T> new_arr(new_size, ScratchMemory);
 
 	// Parse the values from the old array to the new one, whether the sizing is smaller or larger.
-	memcpy(new_arr, arr, ((add_size < 0) ? new_size : size) * sizeof(T));
-	for (int i = size; i < new_size; i++)
+	memcpy(new_arr.Data(), arr, ((add_size < 0) ? new_size : size) * sizeof(T));
+	for (size_t i = size; i < new_size; i++)
 		new_arr[i] = 0;
 
-	// Set the reference variables to the new values.
+	// Set the reference variables to the new values, the previous padded copy (never the dataset itself) is then released.
 	size = new_size;
-	arr = new_arr;
+	arr = new_arr.Data();
+	PaddedCopy<T>() = std::move(new_arr);
 }
 
 template<typename T>
 bool Sorted(T*& arr, size_t size)
 {
 	// Sequentially check whether or not an array is sorted. Maximum complexity = O(N);
+	counters::Scope scope(counters::sorted);
 	for (int i = 0; i < size - 1; i++)
 	{
 		if (arr[i] > arr[i+1])
@@ -88,10 +110,13 @@ bool Sorted(T*& arr, size_t size)
 cl::Context context;
 cl::CommandQueue queue;
 cl::Program program;
+KernelCache kernel_cache;							// One kernel object per kernel name, created on first use.
+BufferPool buffer_pool;								// Device and host scratch buffers reused between executions.
 bool wg_size_changed = true;						// Whether the workgroup size was changed since last execution.
 bool max_wg_size = false;							// Whether or not the work groups are max size.
 size_t local_size;									// The currently selected work group size.
 ProfilingResolution profiler_resolution = PROF_NS;	// The desired profiler resolution.
+bool profiler_output = true;						// Whether or not profiling info is printed and logged, disabled when benchmarking.
 
 enum OptimizeFlags
 {
@@ -100,9 +125,20 @@ enum OptimizeFlags
 };
 OptimizeFlags optimize_flag = Performance;			// The current optimization mode for the program.
 
+enum ExecutionBackend
+{
+	SingleDevice,
+	MultiDevice,
+	NativeThreads
+};
+ExecutionBackend execution_backend = SingleDevice;	// Where the statistics operations are executed.
+
 void PrintProfilerInfo(std::string kernel_id, size_t ex_time, unsigned long* profiled_info, size_t ex_time_total = 0)
 {
 	// Output the detailed kernel execution information along side chronos based elapsed time for sequential executions.
+	if (!profiler_output)
+		return;
+
 	const char* resolution_str = GetResolutionString(profiler_resolution);
 	std::string profiling_str = (profiled_info) ? GetFullProfilingInfo(profiled_info) : std::to_string(ex_time);
 	std::string total_execution_str = std::to_string(ex_time_total);
@@ -115,6 +151,38 @@ void PrintProfilerInfo(std::string kernel_id, size_t ex_time, unsigned long* pro
 	winstr::Write(output.c_str());
 }
 
+void PrintCounterInfo(const std::string& kernel_id, counters::Region& region)
+{
+	// Output and log the hardware counters of the host work of an operation beneath its profiling info, when counting is enabled.
+	if (!counters::enabled)
+		return;
+
+	counters::Sample sample = region.Take();
+	if (!profiler_output || !sample.scopes)
+		return;
+
+	std::string output = "Counters (" + kernel_id + ", " + region.Name() + "): " + counters::Format(sample);
+	std::cout << output << std::endl;
+	winstr::Write(output.c_str());
+}
+
+void PrintMemoryInfo()
+{
+	// Output the current and peak host memory of every arena category alongside the device buffers of the pool, after every operation.
+	if (!profiler_output)
+		return;
+
+	std::string output = "Memory: dataset " + FormatBytes(memory_arena.CurrentBytes(DatasetMemory)) + " (peak "
+		+ FormatBytes(memory_arena.PeakBytes(DatasetMemory)) + "), scratch " + FormatBytes(memory_arena.CurrentBytes(ScratchMemory)) + " (peak "
+		+ FormatBytes(memory_arena.PeakBytes(ScratchMemory)) + "), total peak " + FormatBytes(memory_arena.PeakBytes()) + ", cached "
+		+ FormatBytes(memory_arena.CachedBytes()) + ", huge pages " + FormatBytes(memory_arena.HugePageBytes()) + ", device buffers "
+		+ FormatBytes(buffer_pool.DeviceBytes()) + ", " + std::to_string(memory_arena.LiveBlocks()) + " blocks ("
+		+ std::to_string(memory_arena.ReusedAllocations()) + " of " + std::to_string(memory_arena.ReusedAllocations() + memory_arena.SystemAllocations())
+		+ " allocations reused)";
+	std::cout << output << "\n" << std::endl;
+	winstr::Write(output.c_str());
+}
+
 template<typename T>
 void ProfiledExecution(cl::Kernel kernel, cl::Buffer buffer, size_t arr_size, T*& arr, size_t len, const char* kernel_name)
 {
@@ -126,7 +194,9 @@ void ProfiledExecution(cl::Kernel kernel, cl::Buffer buffer, size_t arr_size, T*
 	// Print the profiling information for this kernel execution.
 	unsigned long ex_time_total = timer::Stop(profiler_resolution);
 	unsigned long ex_time = prof_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - prof_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
-	PrintProfilerInfo(kernel_name, ex_time, GetFullProfilingInfoData(prof_event, profiler_resolution), ex_time_total);
+	unsigned long profiled_info[4];
+	GetFullProfilingInfoData(prof_event, profiler_resolution, profiled_info);
+	PrintProfilerInfo(kernel_name, ex_time, profiled_info, ex_time_total);
 
 	// Flush the queue.
 	queue.flush();
@@ -144,7 +214,8 @@ void CumulativeProfiledExecution(cl::Kernel kernel, cl::Buffer buffer, size_t ar
 	ex_time_total += timer::QuerySinceLast(profiler_resolution);
 	ex_time += prof_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - prof_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
 
-	unsigned long* this_profiled_info = GetFullProfilingInfoData(prof_event, profiler_resolution);
+	unsigned long this_profiled_info[4];
+	GetFullProfilingInfoData(prof_event, profiler_resolution, this_profiled_info);
 	for (int i = 0; i < 4; i++)
 		profiled_info[i] += this_profiled_info[i];
 
@@ -152,13 +223,19 @@ void CumulativeProfiledExecution(cl::Kernel kernel, cl::Buffer buffer, size_t ar
 	queue.flush();
 }
 
-template<typename T>
-void CLResize(cl::Kernel kernel, T*& arr, size_t& size)
+size_t PreferredLocalSize(cl::Kernel kernel)
 {
 	// Calculate the best work group size for the device and return the min group size or max group size based on current settings.
 	cl::Device device = context.getInfo<CL_CONTEXT_DEVICES>()[0];
-	size_t pref_size = (max_wg_size) ? kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device)
+	return (max_wg_size) ? kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device)
 		: kernel.getWorkGroupInfo<CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE>(device);
+}
+
+template<typename T>
+void CLResize(cl::Kernel kernel, T*& arr, size_t& size)
+{
+	// Fetch the work group size which the array must be padded to a multiple of.
+	size_t pref_size = PreferredLocalSize(kernel);
 
 	// Calculate and apply the padding size to the array.
 	size_t padding_size = size % pref_size;
@@ -186,10 +263,10 @@ void CheckResize(cl::Kernel kernel, T*& arr, size_t& size, size_t original_size)
 }
 
 template<typename T>
-cl::Buffer EnqueueBuffer(cl::Kernel kernel, int arg_index, int mem_mode, T* data, size_t data_size)
+cl::Buffer EnqueueBuffer(cl::Kernel kernel, int arg_index, int mem_mode, T* data, size_t data_size, const char* slot)
 {
-	// Create a new cl buffer with the provided memory mode and data size (in bytes).
-	cl::Buffer buffer(context, mem_mode, data_size);
+	// Take a cl buffer with the provided memory mode and data size (in bytes) from the pool, this is only allocated if the slot is too small.
+	cl::Buffer buffer = buffer_pool.Device(context, slot, mem_mode, data_size);
 	
 	// Enqueue the buffer differently based on whether or not the mem_mode is READ_ONLY or not.
 	if (mem_mode == CL_MEM_READ_ONLY)
@@ -207,31 +284,80 @@ template<> void ConcatKernelID(int type, std::string& original) { original += "_
 template<> void ConcatKernelID(float type, std::string& original) { original += "_FP"; }
 template<> void ConcatKernelID(double type, std::string& original) { original += "_FP"; }
 
+template<typename Acc>
+bool GroupPartials(cl::Device device)
+{
+	/* The 64 bit integer sums add the result of every work group onto out[0] with atom_add, which needs cl_khr_int64_base_atomics. Devices
+	   without it run the _PARTIALS kernels instead, which write the result of every work group to its own element for the host to add. */
+	if (typeid(Acc) != typeid(long long))
+		return false;
+
+	std::string extensions = device.getInfo<CL_DEVICE_EXTENSIONS>();
+	return extensions.find("cl_khr_int64_base_atomics") == std::string::npos;
+}
+
+template<typename Acc>
+Acc AddPartials(const Acc* partials, size_t count)
+{
+	Acc total = 0;
+	for (size_t i = 0; i < count; i++)
+		total += partials[i];
+
+	return total;
+}
+
 template<typename T>
-void Sum(T*& inbuf, T*& outbuf, size_t& len, size_t original_len)
+void Sum(T*& inbuf, typename Accumulator<T>::type*& outbuf, size_t& len, size_t original_len)
 {
 	// Determine the kernel name using the type T, e.g. T == int will concatinate  "_INT".
 	std::string kernel_id = "reduce_sum";
 	ConcatKernelID(*inbuf, kernel_id);
 
-	// Start a chrono timer and create the kernel with the determined id.
+	// The integer sums of a device without 64 bit atomics write a partial sum per work group.
+	typedef typename Accumulator<T>::type Acc;
+	bool partials = GroupPartials<Acc>(context.getInfo<CL_CONTEXT_DEVICES>()[0]);
+	if (partials)
+		kernel_id += "_PARTIALS";
+
+	// Start a chrono timer and fetch the kernel with the determined id, this is only created on the first execution.
 	timer::Start();
-	cl::Kernel kernel = cl::Kernel(program, kernel_id.c_str());
+	cl::Kernel kernel = kernel_cache.Get(program, kernel_id);
 
 	// Check if the data set is in need of a resize, this will only resize if the local_size has changed since last execution.
 	CheckResize(kernel, inbuf, len, original_len);
 
-	// Reset outbuf to a blank array of type T.
-	outbuf = new T[1]{ 0 };
+	// Reset outbuf to a blank pooled array of the accumulator type, 64 bits for integers, holding the partial sum of every work group if any.
+	size_t out_count = (partials) ? len / local_size : 1;
+	outbuf = buffer_pool.Host<Acc>(kernel_id, out_count);
+	outbuf[0] = 0;
 
 	// Determine the byte size of outbuf and inbuf, and provide necessary kernel arguments for reduce_sum.
 	size_t data_size = len * sizeof(T);
-	cl::Buffer buffer_A = EnqueueBuffer(kernel, 0, CL_MEM_READ_ONLY, inbuf, data_size);
-	cl::Buffer buffer_B = EnqueueBuffer(kernel, 1, CL_MEM_READ_WRITE, outbuf, sizeof(T));
-	kernel.setArg(2, cl::Local(local_size * sizeof(T)));
+	cl::Buffer buffer_A = EnqueueBuffer(kernel, 0, CL_MEM_READ_ONLY, inbuf, data_size, "in");
+	cl::Buffer buffer_B = EnqueueBuffer(kernel, 1, CL_MEM_READ_WRITE, outbuf, out_count * sizeof(Acc), "out");
+	kernel.setArg(2, cl::Local(local_size * sizeof(Acc)));
 
 	// Output the profiled execution times for this particular kernel.
-	ProfiledExecution(kernel, buffer_B, sizeof(T), outbuf, len, kernel_id.c_str());
+	ProfiledExecution(kernel, buffer_B, out_count * sizeof(Acc), outbuf, len, kernel_id.c_str());
+	if (partials)
+		outbuf[0] = AddPartials(outbuf, out_count);
+}
+
+template<typename T>
+T MinMaxIdentity(bool dir)
+{
+	// The value which never changes a minimum (dir == false) or a maximum (dir == true).
+	return (dir) ? std::numeric_limits<T>::lowest() : std::numeric_limits<T>::max();
+}
+
+template<typename T>
+void SeedMinMax(cl::Buffer buffer_A, cl::Buffer buffer_B, size_t len, size_t original_len, T identity)
+{
+	/* The min/max kernels have no size argument, so the zero padding of Resize() would be the minimum of a positive dataset (and the
+	   maximum of a negative one). The padding of the device copy is overwritten with the identity, which also seeds the result. */
+	if (len > original_len)
+		queue.enqueueFillBuffer(buffer_A, identity, original_len * sizeof(T), (len - original_len) * sizeof(T));
+	queue.enqueueFillBuffer(buffer_B, identity, 0, sizeof(T));
 }
 
 template<typename T>
@@ -241,21 +367,23 @@ void LocalMinMax(T*& inbuf, T*& outbuf, size_t& len, size_t original_len, bool d
 	std::string kernel_id = (dir) ? "reduce_max" : "reduce_min";
 	ConcatKernelID(*inbuf, kernel_id);
 
-	// Start a chrono timer and create the kernel with the determined id.
+	// Start a chrono timer and fetch the kernel with the determined id, this is only created on the first execution.
 	timer::Start();
-	cl::Kernel kernel = cl::Kernel(program, kernel_id.c_str());
+	cl::Kernel kernel = kernel_cache.Get(program, kernel_id);
 
 	// Check if the data set is in need of a resize, this will only resize if the local_size has changed since last execution.
 	CheckResize(kernel, inbuf, len, original_len);
 
-	// Reset outbuf to a blank array of type T.
-	outbuf = new T[1] { 0 };
+	// Reset outbuf to a blank pooled array of type T.
+	outbuf = buffer_pool.Host<T>(kernel_id, 1);
+	outbuf[0] = MinMaxIdentity<T>(dir);
 
 	// Determine the byte size of outbuf and inbuf, and provide necessary kernel arguments for reduce_max/min.
 	size_t data_size = len * sizeof(T);
-	cl::Buffer buffer_A = EnqueueBuffer(kernel, 0, CL_MEM_READ_ONLY, inbuf, data_size);
-	cl::Buffer buffer_B = EnqueueBuffer(kernel, 1, CL_MEM_READ_WRITE, outbuf, sizeof(T));
+	cl::Buffer buffer_A = EnqueueBuffer(kernel, 0, CL_MEM_READ_ONLY, inbuf, data_size, "in");
+	cl::Buffer buffer_B = EnqueueBuffer(kernel, 1, CL_MEM_READ_WRITE, outbuf, sizeof(T), "out");
 	kernel.setArg(2, cl::Local(local_size * sizeof(T)));
+	SeedMinMax(buffer_A, buffer_B, len, original_len, outbuf[0]);
 
 	// Output the profiled execution times for this particular kernel.
 	ProfiledExecution(kernel, buffer_B, sizeof(T), outbuf, len, kernel_id.c_str());
@@ -268,54 +396,82 @@ void GlobalMinMax(T*& inbuf, T*& outbuf, size_t& len, size_t original_len, bool
 	std::string kernel_id = (dir) ? "reduce_max_global" : "reduce_min_global";
 	ConcatKernelID(*inbuf, kernel_id);
 
-	// Start a chrono timer and create the kernel with the determined id.
+	// Start a chrono timer and fetch the kernel with the determined id, this is only created on the first execution.
 	timer::Start();
-	cl::Kernel kernel = cl::Kernel(program, kernel_id.c_str());
+	cl::Kernel kernel = kernel_cache.Get(program, kernel_id);
 
 	// Check if the data set is in need of a resize, this will only resize if the local_size has changed since last execution.
 	CheckResize(kernel, inbuf, len, original_len);
 
-	// Reset outbuf to a blank array of type T.
-	outbuf = new T[len];
+	// Point outbuf at a pooled array of type T, the kernel output overwrites it entirely.
+	outbuf = buffer_pool.Host<T>(kernel_id, len);
 
 	// Determine the byte size of outbuf and inbuf, and provide necessary kernel arguments for reduce_max/min_global.
 	size_t data_size = len * sizeof(T);
-	cl::Buffer buffer_A = EnqueueBuffer(kernel, 0, CL_MEM_READ_ONLY, inbuf, data_size);
-	cl::Buffer buffer_B = EnqueueBuffer(kernel, 1, CL_MEM_READ_WRITE, outbuf, data_size);
+	cl::Buffer buffer_A = EnqueueBuffer(kernel, 0, CL_MEM_READ_ONLY, inbuf, data_size, "in");
+	cl::Buffer buffer_B = EnqueueBuffer(kernel, 1, CL_MEM_READ_WRITE, outbuf, data_size, "out");
+	SeedMinMax(buffer_A, buffer_B, len, original_len, MinMaxIdentity<T>(dir));
 
 	// Output the profiled execution times for this particular kernel.
 	ProfiledExecution(kernel, buffer_B, data_size, outbuf, len, kernel_id.c_str());
 }
 
 template<typename T>
-void Variance(T*& inbuf, T*& outbuf, size_t& len, size_t original_len, T mean)
+void Variance(T*& inbuf, typename Accumulator<T>::type*& outbuf, size_t& len, size_t original_len, T mean)
 {
 	// Determine the kernel name using the type T, e.g. T == int will concatinate  "_INT".
 	std::string kernel_id = "sum_sqr_diff";
 	ConcatKernelID(*inbuf, kernel_id);
 
-	// Start a chrono timer and create the kernel with the determined id.
+	// The integer sums of a device without 64 bit atomics write a partial sum per work group.
+	typedef typename Accumulator<T>::type Acc;
+	bool partials = GroupPartials<Acc>(context.getInfo<CL_CONTEXT_DEVICES>()[0]);
+	if (partials)
+		kernel_id += "_PARTIALS";
+
+	// Start a chrono timer and fetch the kernel with the determined id, this is only created on the first execution.
 	timer::Start();
-	cl::Kernel kernel = cl::Kernel(program, kernel_id.c_str());
+	cl::Kernel kernel = kernel_cache.Get(program, kernel_id);
 
 	// Check if the data set is in need of a resize, this will only resize if the local_size has changed since last execution.
 	CheckResize(kernel, inbuf, len, original_len);
 
-	// Reset outbuf to a blank array of type T.
-	outbuf = new T[1] { 0 };
+	// Reset outbuf to a blank pooled array of the accumulator type, 64 bits for integers, holding the partial sum of every work group if any.
+	size_t out_count = (partials) ? len / local_size : 1;
+	outbuf = buffer_pool.Host<Acc>(kernel_id, out_count);
+	outbuf[0] = 0;
 
 	// Determine the byte size of outbuf and inbuf, and provide necessary kernel arguments for sum_sqr_diff.
 	size_t data_size = len * sizeof(T);
-	cl::Buffer buffer_A = EnqueueBuffer(kernel, 0, CL_MEM_READ_ONLY, inbuf, data_size);
-	cl::Buffer buffer_B = EnqueueBuffer(kernel, 1, CL_MEM_READ_WRITE, outbuf, sizeof(T));
-	kernel.setArg(2, cl::Local(local_size * sizeof(T)));
+	cl::Buffer buffer_A = EnqueueBuffer(kernel, 0, CL_MEM_READ_ONLY, inbuf, data_size, "in");
+	cl::Buffer buffer_B = EnqueueBuffer(kernel, 1, CL_MEM_READ_WRITE, outbuf, out_count * sizeof(Acc), "out");
+	kernel.setArg(2, cl::Local(local_size * sizeof(Acc)));
 	kernel.setArg(3, mean);
 
-	// Output the profiled execution times for this particular kernel.
-	ProfiledExecution(kernel, buffer_B, sizeof(T), outbuf, len, kernel_id.c_str());
+	// Output the profiled execution times for this particular kernel, outbuf holds the sum of squared differences (see CorrectedVariance).
+	ProfiledExecution(kernel, buffer_B, out_count * sizeof(Acc), outbuf, len, kernel_id.c_str());
+	if (partials)
+		outbuf[0] = AddPartials(outbuf, out_count);
 
-	// Return the mean of the sum of squared differences.
-	outbuf[0] /= len;
+	// The padding of Resize() is zero, so the squared difference of every padded element from the mean is removed again.
+	outbuf[0] -= (Acc)(len - original_len) * ((Acc)mean * mean);
+}
+
+template<typename Acc, typename T>
+double CorrectedVariance(Acc sqr_diff, Acc sum, T shift, size_t count)
+{
+	/* The squared differences are taken from shift, the mean in the type of the data (truncated for integers), rather than the exact mean
+	   sum / count. As sum((x - mean)^2) = sum((x - shift)^2) - (sum - count * shift)^2 / count, the exact variance follows from the sums. */
+	double offset = (double)sum - (double)shift * count;
+	return std::max(0.0, ((double)sqr_diff - offset * offset / count) / count);
+}
+
+size_t MaxSortPasses(size_t len, size_t group_size)
+{
+	/* Every pass of bitonic_local sorts whole work groups, alternately shifted by half a group, which is an odd-even transposition sort of
+	   the half groups. That needs at most one pass per half group, so twice as many (plus the first pass) can only be a faulty kernel. */
+	size_t half = std::max<size_t>(1, group_size / 2);
+	return 2 * ((len + half - 1) / half) + 2;
 }
 
 template<typename T>
@@ -328,20 +484,30 @@ T* Sort(T*& inbuf, T outbuf[], size_t& len, size_t original_len)
 	std::string kernel_id = "bitonic_local";
 	ConcatKernelID(*inbuf, kernel_id);
 
-	// Start a chrono timer and create the kernel with the determined id.
+	// Start a chrono timer and fetch the kernel with the determined id, this is only created on the first execution.
 	timer::Start();
-	cl::Kernel kernel = cl::Kernel(program, kernel_id.c_str());
+	cl::Kernel kernel = kernel_cache.Get(program, kernel_id);
 
 	// Check if the data set is in need of a resize, this will only resize if the local_size has changed since last execution.
 	CheckResize(kernel, inbuf, len, original_len);
 
-	// Reset outbuf to a blank array of type T.
-	outbuf = new T[len];
+	// Point outbuf at a pooled array of type T, the kernel output overwrites it entirely.
+	outbuf = buffer_pool.Host<T>(kernel_id, len);
 
-	// Determine the byte size of outbuf and inbuf, and provide necessary kernel arguments for bitonic_local.
+	/* Pad the device copies with the maximum rather than the zeros of Resize(), so the padding sorts to the end and the first original_len
+	   values are the sorted dataset. The shifted passes read and write half a work group beyond len, so both buffers hold that much more. */
 	size_t data_size = len * sizeof(T);
-	cl::Buffer buffer_A = EnqueueBuffer(kernel, 0, CL_MEM_READ_ONLY, inbuf, data_size);
-	cl::Buffer buffer_B = EnqueueBuffer(kernel, 1, CL_MEM_READ_WRITE, outbuf, data_size);
+	size_t alloc_size = (len + local_size / 2) * sizeof(T);
+	T padding = std::numeric_limits<T>::max();
+	cl::Buffer buffer_A = buffer_pool.Device(context, "in", CL_MEM_READ_ONLY, alloc_size);
+	cl::Buffer buffer_B = buffer_pool.Device(context, "out", CL_MEM_READ_WRITE, alloc_size);
+	queue.enqueueWriteBuffer(buffer_A, CL_TRUE, 0, original_len * sizeof(T), &inbuf[0]);
+	queue.enqueueFillBuffer(buffer_A, padding, original_len * sizeof(T), alloc_size - original_len * sizeof(T));
+	queue.enqueueFillBuffer(buffer_B, padding, 0, alloc_size);
+
+	// Provide necessary kernel arguments for bitonic_local.
+	kernel.setArg(0, buffer_A);
+	kernel.setArg(1, buffer_B);
 	kernel.setArg(2, cl::Local(local_size * sizeof(T)));
 	kernel.setArg(3, 0); // 0 represents an unshifted sort, thus when local_size = 32, sorting 0 -> 31, 32 -> 63, etc ...
 
@@ -349,10 +515,18 @@ T* Sort(T*& inbuf, T outbuf[], size_t& len, size_t original_len)
 	CumulativeProfiledExecution(kernel, buffer_B, data_size, outbuf, len, ex_time_total, ex_time, profiled_info);
 
 	int i = 1; // 1 represents an shifted sort, thus when local_size = 32, sorting 16 -> 47, 70 -> 101, etc ...
+	size_t max_passes = MaxSortPasses(len, local_size);
 	while (!Sorted(outbuf, len))
 	{
-		// Only buffer_A and the merge arguments need to be re-assigned.
-		buffer_A = EnqueueBuffer(kernel, 0, CL_MEM_READ_ONLY, outbuf, data_size);
+		// A kernel which fails to sort would otherwise loop forever, so the passes are bounded by those an odd-even merge requires.
+		if ((size_t)i > max_passes)
+		{
+			std::cerr << "ERROR: " << kernel_id << " did not sort " << len << " elements within " << max_passes << " passes" << std::endl;
+			break;
+		}
+
+		// Only buffer_A and the merge arguments need to be re-assigned, the padding beyond len is never overwritten.
+		queue.enqueueWriteBuffer(buffer_A, CL_TRUE, 0, data_size, &outbuf[0]);
 		kernel.setArg(3, (i++ % 2));
 
 		// Perform cumulative execution.
@@ -361,6 +535,7 @@ T* Sort(T*& inbuf, T outbuf[], size_t& len, size_t original_len)
 
 	// Once Sorted() == true, the while loop is terminated and the cumulative profiler info is printed.
 	PrintProfilerInfo(kernel_id, ex_time, profiled_info, ex_time_total);
+	PrintCounterInfo(kernel_id, counters::sorted);
 	std::cout << "\n";
 	timer::Stop();
 
@@ -368,26 +543,187 @@ T* Sort(T*& inbuf, T outbuf[], size_t& len, size_t original_len)
 	return outbuf;
 }
 
-int* sorted_array_int = nullptr;
-int* SortOptim(int*& A, int*& B, size_t& base_size, size_t original_size)
+// ------------------------------------------------------------------------ Scan Functions ------------------------------------------------------------------------ //
+
+/* The prefix sums of the floating point kernels are accumulated in double, as the difference of two large float sums loses every digit, and
+   those of the integer kernels in 64 bits like Accumulator<int>, as the sum of a billion records overflows 32 bits. */
+template<typename T> struct ScanSum { typedef T type; };
+template<> struct ScanSum<float> { typedef double type; };
+template<> struct ScanSum<int> { typedef long long type; };
+
+struct KernelProfile
+{
+	unsigned long ex_time = 0;
+	unsigned long profiled_info[4] { 0, 0, 0, 0 };
+};
+
+void EnqueueProfiled(cl::Kernel kernel, size_t size, size_t group_size, KernelProfile& profile)
+{
+	// Enqueue the kernel over size work items rounded up to whole work groups, accumulating the profiling info without reading back a result.
+	cl::Event prof_event;
+	size_t global_size = ((size + group_size - 1) / group_size) * group_size;
+	queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(std::max(global_size, group_size)), cl::NDRange(group_size), NULL, &prof_event);
+	prof_event.wait();
+
+	profile.ex_time += prof_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - prof_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+	unsigned long this_profiled_info[4];
+	GetFullProfilingInfoData(prof_event, profiler_resolution, this_profiled_info);
+	for (int i = 0; i < 4; i++)
+		profile.profiled_info[i] += this_profiled_info[i];
+}
+
+template<typename T>
+cl::Buffer PooledBuffer(const std::string& slot, const T* data, size_t count)
 {
-	// If the cached integer array is not set, perform 'shifted bitonic sort' on the data and store result within the cache.
-	if (!sorted_array_int)
-		sorted_array_int = Sort(A, B, base_size, original_size);
+	// Take a read/write buffer from the pool, uploading data when provided. These buffers stay on the device between kernels.
+	cl::Buffer buffer = buffer_pool.Device(context, slot, CL_MEM_READ_WRITE, std::max<size_t>(1, count) * sizeof(T));
+	if (data && count)
+		queue.enqueueWriteBuffer(buffer, CL_TRUE, 0, count * sizeof(T), data);
+
+	return buffer;
+}
 
-	// Return the cached integer array.
-	return sorted_array_int;
+template<typename T, typename Out = T>
+std::string ScanKernelID(const std::string& name, const std::string& op)
+{
+	/* Scans of double values (the block totals of a floating point sum) have their own kernels, as ConcatKernelID maps double onto "_FP",
+	   and so do scans of 64 bit integers. Integers scanned into 64 bit sums and floats scanned into double sums are named after both types,
+	   e.g. scan_add_INT_LONG and scan_add_FP_DP. */
+	std::string kernel_id = name + "_" + op;
+	if (typeid(T) == typeid(double))
+		kernel_id += "_DP";
+	else if (typeid(T) == typeid(long long))
+		kernel_id += "_LONG";
+	else ConcatKernelID(T(), kernel_id);
+
+	if (typeid(T) == typeid(int) && typeid(Out) == typeid(long long))
+		kernel_id += "_LONG";
+	else if (typeid(T) == typeid(float) && typeid(Out) == typeid(double))
+		kernel_id += "_DP";
+	return kernel_id;
 }
 
-fp_type* sorted_array_fp = nullptr;
-fp_type* SortOptim(fp_type*& A, fp_type*& B, size_t& base_size, size_t original_size)
+size_t ScanLocalSize(cl::Kernel block_kernel, cl::Kernel combine_kernel, size_t local_bytes_per_item)
 {
-	// If the cached floating point array is not set, perform 'shifted bitonic sort' on the data and store result within the cache.
-	if (!sorted_array_fp)
-		sorted_array_fp = Sort(A, B, base_size, original_size);
+	// The scan kernels need a power of two work group size, which both kernels of a level support and whose block fits in local memory.
+	cl::Device device = context.getInfo<CL_CONTEXT_DEVICES>()[0];
+	cl_ulong local_mem_size = device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+	size_t limit = std::min(PreferredLocalSize(block_kernel), PreferredLocalSize(combine_kernel));
 
-	// Return the cached floating point array.
-	return sorted_array_fp;
+	size_t group_size = 1;
+	while (group_size * 2 <= limit && group_size * 2 * local_bytes_per_item <= local_mem_size)
+		group_size <<= 1;
+
+	return group_size;
+}
+
+template<typename In, typename Out>
+void EnqueueScan(const std::string& op, cl::Buffer in, cl::Buffer out, size_t size, bool inclusive, KernelProfile& profile, int level = 0)
+{
+	// Fetch the block and offset kernels, every work item scans two elements.
+	cl::Kernel block_kernel = kernel_cache.Get(program, ScanKernelID<In, Out>("scan", op));
+	cl::Kernel offsets_kernel = kernel_cache.Get(program, ScanKernelID<Out>("scan_offsets", op));
+	size_t group_size = ScanLocalSize(block_kernel, offsets_kernel, 2 * sizeof(Out));
+	size_t group_count = std::max<size_t>(1, (size + group_size * 2 - 1) / (group_size * 2));
+
+	// Scan every block independently, keeping the total of each block.
+	std::string slot = "scan_level" + std::to_string(level);
+	cl::Buffer sums_buffer = PooledBuffer<Out>(slot + "_sums", nullptr, group_count);
+	block_kernel.setArg(0, in);
+	block_kernel.setArg(1, out);
+	block_kernel.setArg(2, sums_buffer);
+	block_kernel.setArg(3, cl::Local(group_size * 2 * sizeof(Out)));
+	block_kernel.setArg(4, (int)inclusive);
+	block_kernel.setArg(5, (int)size);
+	EnqueueProfiled(block_kernel, group_count * group_size, group_size, profile);
+
+	if (group_count == 1)
+		return;
+
+	// The exclusive scan of the block totals is the offset of every block, which recurses until the totals fit within a single block.
+	cl::Buffer offsets_buffer = PooledBuffer<Out>(slot + "_offsets", nullptr, group_count);
+	EnqueueScan<Out, Out>(op, sums_buffer, offsets_buffer, group_count, false, profile, level + 1);
+
+	offsets_kernel.setArg(0, out);
+	offsets_kernel.setArg(1, offsets_buffer);
+	offsets_kernel.setArg(2, (int)size);
+	EnqueueProfiled(offsets_kernel, group_count * group_size, group_size, profile);
+}
+
+template<typename In, typename Out>
+void EnqueueSegmentedScan(const std::string& op, cl::Buffer in, cl::Buffer heads, cl::Buffer out, size_t size, bool inclusive, KernelProfile& profile, int level = 0)
+{
+	// Fetch the block and carry kernels, every work item scans two elements.
+	cl::Kernel block_kernel = kernel_cache.Get(program, ScanKernelID<In, Out>("segmented_scan", op));
+	cl::Kernel carry_kernel = kernel_cache.Get(program, ScanKernelID<Out>("segmented_carry", op));
+	size_t group_size = ScanLocalSize(block_kernel, carry_kernel, 2 * (sizeof(Out) + 2 * sizeof(int)));
+	size_t group_count = std::max<size_t>(1, (size + group_size * 2 - 1) / (group_size * 2));
+
+	// Scan every block independently, keeping the scan of each block from its last head, whether it contains a head and where the first is.
+	std::string slot = "segmented_scan_level" + std::to_string(level);
+	cl::Buffer sums_buffer = PooledBuffer<Out>(slot + "_sums", nullptr, group_count);
+	cl::Buffer group_heads_buffer = PooledBuffer<int>(slot + "_heads", nullptr, group_count);
+	cl::Buffer group_first_buffer = PooledBuffer<int>(slot + "_first", nullptr, group_count);
+	block_kernel.setArg(0, in);
+	block_kernel.setArg(1, heads);
+	block_kernel.setArg(2, out);
+	block_kernel.setArg(3, sums_buffer);
+	block_kernel.setArg(4, group_heads_buffer);
+	block_kernel.setArg(5, group_first_buffer);
+	block_kernel.setArg(6, cl::Local(group_size * 2 * sizeof(Out)));
+	block_kernel.setArg(7, cl::Local(group_size * 4 * sizeof(int)));
+	block_kernel.setArg(8, (int)inclusive);
+	block_kernel.setArg(9, (int)size);
+	EnqueueProfiled(block_kernel, group_count * group_size, group_size, profile);
+
+	if (group_count == 1)
+		return;
+
+	/* The value leaving block g is its own total when it contains a head, otherwise its total continued from the value leaving block g-1.
+	   That is an inclusive segmented scan of the block totals with the blocks containing a head as the segment heads. */
+	cl::Buffer carries_buffer = PooledBuffer<Out>(slot + "_carries", nullptr, group_count);
+	EnqueueSegmentedScan<Out, Out>(op, sums_buffer, group_heads_buffer, carries_buffer, group_count, true, profile, level + 1);
+
+	carry_kernel.setArg(0, out);
+	carry_kernel.setArg(1, carries_buffer);
+	carry_kernel.setArg(2, group_first_buffer);
+	carry_kernel.setArg(3, (int)size);
+	EnqueueProfiled(carry_kernel, group_count * group_size, group_size, profile);
+}
+
+template<typename T, typename Out>
+Out* Scan(const std::string& op, const T* inbuf, const int* heads, size_t len, bool inclusive)
+{
+	/* Inclusive or exclusive scan of inbuf with op ("add", "min" or "max"), restarting at every non zero element of heads when provided.
+	   Unlike the reductions the scan kernels check their bounds, so the unpadded length is used. The result is a pooled array. */
+	std::string kernel_id = (heads) ? "segmented_scan_" + op : "scan_" + op;
+	ConcatKernelID(T(), kernel_id);
+
+	// Start a chrono timer and upload the data to pooled device buffers.
+	timer::Start();
+	KernelProfile profile;
+	cl::Buffer in_buffer = PooledBuffer("scan_in", inbuf, len);
+	cl::Buffer out_buffer = PooledBuffer<Out>("scan_out", nullptr, len);
+
+	if (heads)
+		EnqueueSegmentedScan<T, Out>(op, in_buffer, PooledBuffer("scan_heads", heads, len), out_buffer, len, inclusive, profile);
+	else EnqueueScan<T, Out>(op, in_buffer, out_buffer, len, inclusive, profile);
+
+	// Point outbuf at a pooled array of type Out and read back the result.
+	Out* outbuf = buffer_pool.Host<Out>(kernel_id, std::max<size_t>(1, len));
+	if (len)
+		queue.enqueueReadBuffer(out_buffer, CL_TRUE, 0, len * sizeof(Out), outbuf);
+
+	// Output the cumulative profiling information of every level of the scan.
+	PrintProfilerInfo(kernel_id, profile.ex_time, profile.profiled_info, timer::Stop(profiler_resolution));
+	return outbuf;
+}
+
+void ReleasePools()
+{
+	// Release every cached kernel and pooled buffer, any arrays previously returned from the pool become invalid.
+	kernel_cache.Release();
+	buffer_pool.Release();
 }
 
 #endif
\ No newline at end of file
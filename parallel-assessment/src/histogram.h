@@ -0,0 +1,324 @@
+#ifndef histogram_h
+#define histogram_h
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define HISTOGRAM_SSE2
+	#include <emmintrin.h>
+#endif
+
+#include "funcs.h"
+#include "native_funcs.h"
+#include "records.h"
+
+/* The temperatures are recorded to a single decimal place, so multiplied by 10 every value is an integer key within a tiny range (roughly
+   -300 to +400). A histogram with one bin per key is therefore an exact representation of the whole distribution, from which the median,
+   quartiles, any percentile, the mode and the CDF can be read in O(bins) without ever sorting the dataset. */
+
+class Histogram
+{
+	private:
+		int min_key = 0;								// Key of the first bin.
+		fp_type scale = 10.0;							// Keys per unit, i.e. the reciprocal of the bin width.
+		std::vector<unsigned long long> counts;			// Number of records within each bin.
+		std::vector<unsigned long long> cumulative;		// Inclusive prefix sum of counts, the unnormalised CDF.
+
+	public:
+		Histogram() { }
+		Histogram(int _min_key, size_t bin_count, fp_type _scale)
+			: min_key(_min_key), scale(_scale), counts(bin_count, 0), cumulative(bin_count, 0) { }
+
+		template<typename C>
+		void Assign(const C* bins)
+		{
+			// Copy the bins produced by a kernel or native pass and rebuild the cumulative counts.
+			for (size_t i = 0; i < counts.size(); i++)
+				counts[i] = bins[i];
+			Finalize();
+		}
+
+		void Finalize()
+		{
+			unsigned long long running = 0;
+			for (size_t i = 0; i < counts.size(); i++)
+				cumulative[i] = (running += counts[i]);
+		}
+
+		void Merge(const Histogram& other)
+		{
+			// Both histograms must share the same keys, as is the case for every station histogram of one dataset.
+			for (size_t i = 0; i < counts.size() && i < other.counts.size(); i++)
+				counts[i] += other.counts[i];
+			Finalize();
+		}
+
+		size_t Bins() const { return counts.size(); }
+		int MinKey() const { return min_key; }
+		unsigned long long Count(size_t bin) const { return counts[bin]; }
+		unsigned long long Total() const { return (cumulative.empty()) ? 0 : cumulative.back(); }
+		bool Empty() const { return Total() == 0; }
+		fp_type Value(size_t bin) const { return (min_key + (int)bin) / scale; }
+
+		size_t BinOfRank(unsigned long long rank) const
+		{
+			// The bin which holds the rank-th smallest record (from 0), i.e. the first bin whose cumulative count exceeds rank.
+			return std::upper_bound(cumulative.begin(), cumulative.end(), rank) - cumulative.begin();
+		}
+
+		fp_type Percentile(fp_type p) const
+		{
+			// Select the same element as source() does within a sorted array, so that both paths report identical results.
+			if (Empty())
+				return 0;
+
+			unsigned long long rank = std::min(Total() - 1, (unsigned long long)(Total() * p));
+			return Value(BinOfRank(rank));
+		}
+
+		fp_type Median() const { return Percentile(0.5); }
+		fp_type LowerQuartile() const { return Percentile(0.25); }
+		fp_type UpperQuartile() const { return Percentile(0.75); }
+		fp_type Min() const { return Value(BinOfRank(0)); }
+		fp_type Max() const { return Value(BinOfRank(Total() - 1)); }
+
+		fp_type Mode() const
+		{
+			// The most frequent value, ties are resolved towards the lowest value.
+			return Value(std::max_element(counts.begin(), counts.end()) - counts.begin());
+		}
+
+		fp_type Cdf(fp_type value) const
+		{
+			// Fraction of the records which are less than or equal to value.
+			if (Empty())
+				return 0;
+
+			long long bin = (long long)std::floor(value * scale + 1e-3) - min_key;
+			if (bin < 0)
+				return 0;
+
+			return (fp_type)cumulative[std::min((size_t)bin, counts.size() - 1)] / Total();
+		}
+};
+
+// Histogram key of a value, the integer array already holds x10 keys whereas floating point values are rounded to the nearest key.
+inline int HistogramKey(int value, fp_type) { return value; }
+inline int HistogramKey(fp_type value, fp_type scale) { return (int)std::nearbyint(value * scale); }
+
+template<typename T>
+void KeyRange(ThreadPool& pool, const T* arr, size_t size, fp_type scale, int& min_key, int& max_key)
+{
+	// Find the smallest and largest key in parallel, only the first size (unpadded) elements are considered.
+	std::vector<int> mins(pool.Size(), std::numeric_limits<int>::max());
+	std::vector<int> maxs(pool.Size(), std::numeric_limits<int>::min());
+	pool.ParallelFor(size, pool.Size(), [&](size_t p, size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			int key = HistogramKey(arr[i], scale);
+			mins[p] = std::min(mins[p], key);
+			maxs[p] = std::max(maxs[p], key);
+		}
+	});
+
+	min_key = *std::min_element(mins.begin(), mins.end());
+	max_key = *std::max_element(maxs.begin(), maxs.end());
+	if (min_key > max_key)
+		min_key = max_key = 0;
+}
+
+// ------------------------------------------------------------------------ Native Histogram ------------------------------------------------------------------------ //
+
+const size_t histogram_replicas = 4;	// Number of interleaved counter tables per partition.
+
+inline void HistogramKeys4(const int* src, fp_type, int min_key, int* out)
+{
+	// Compute the bins of four consecutive values at once.
+	#ifdef HISTOGRAM_SSE2
+		_mm_storeu_si128((__m128i*)out, _mm_sub_epi32(_mm_loadu_si128((const __m128i*)src), _mm_set1_epi32(min_key)));
+	#else
+		for (int i = 0; i < 4; i++)
+			out[i] = src[i] - min_key;
+	#endif
+}
+inline void HistogramKeys4(const float* src, fp_type scale, int min_key, int* out)
+{
+	// _mm_cvtps_epi32 rounds to the nearest even integer, the same rounding as nearbyint and convert_int_rte.
+	#ifdef HISTOGRAM_SSE2
+		__m128i keys = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(src), _mm_set1_ps((float)scale)));
+		_mm_storeu_si128((__m128i*)out, _mm_sub_epi32(keys, _mm_set1_epi32(min_key)));
+	#else
+		for (int i = 0; i < 4; i++)
+			out[i] = HistogramKey(src[i], scale) - min_key;
+	#endif
+}
+inline void HistogramKeys4(const double* src, fp_type scale, int min_key, int* out)
+{
+	for (int i = 0; i < 4; i++)
+		out[i] = HistogramKey((fp_type)src[i], scale) - min_key;
+}
+
+template<typename T>
+void BinPartition(const T* arr, const unsigned short* keys, size_t begin, size_t end, fp_type scale, int min_key, size_t bin_count, size_t rows, unsigned int* tables)
+{
+	/* Consecutive records are counted into different replicas of the table, so that a run of equal temperatures (which is common, as
+	   neighbouring readings are close) does not serialise on a store to load dependency through a single counter. The bins are computed
+	   four at a time with SIMD, the replicas are later summed together. */
+	size_t replica_size = rows * bin_count;
+	int bins[4];
+	size_t i = begin;
+	for (; i + 4 <= end; i += 4)
+	{
+		HistogramKeys4(arr + i, scale, min_key, bins);
+		for (size_t r = 0; r < histogram_replicas; r++)
+		{
+			size_t row = (keys) ? keys[i + r] : 0;
+			if ((unsigned int)bins[r] < bin_count && row < rows)
+				tables[r * replica_size + row * bin_count + bins[r]]++;
+		}
+	}
+
+	// Bin the remaining (at most three) records individually.
+	for (; i < end; i++)
+	{
+		int bin = HistogramKey(arr[i], scale) - min_key;
+		size_t row = (keys) ? keys[i] : 0;
+		if ((unsigned int)bin < bin_count && row < rows)
+			tables[row * bin_count + bin]++;
+	}
+}
+
+template<typename T>
+std::vector<Histogram> NativeHistograms(T* arr, size_t original_len, const StationColumn* column)
+{
+	std::string kernel_id = (column) ? "native_histogram_keyed" : "native_histogram";
+	ConcatKernelID(*arr, kernel_id);
+
+	timer::Start();
+	ThreadPool& pool = *GetThreadPool();
+
+	// Size the bins to the key range of the dataset, one row of bins per station when a station column is provided.
+	fp_type scale = 10.0;
+	int min_key, max_key;
+	KeyRange(pool, arr, original_len, scale, min_key, max_key);
+	size_t bin_count = max_key - min_key + 1;
+	size_t rows = (column) ? column->StationCount() : 1;
+	size_t table_size = histogram_replicas * rows * bin_count;
+
+	// Every partition counts into its own replicated tables, so that no counter is ever shared between threads.
+	size_t partitions = std::max<size_t>(1, std::min(pool.Size(), original_len));
+	std::vector<unsigned int> tables(partitions * table_size, 0);
+	pool.ParallelFor(original_len, partitions, [&](size_t p, size_t begin, size_t end)
+	{
+		BinPartition(arr, (column) ? column->ids.Data() : nullptr, begin, end, scale, min_key, bin_count, rows, &tables[p * table_size]);
+	});
+
+	// Sum every replica of every partition into the final bins, in parallel across the bins.
+	size_t replica_size = rows * bin_count;
+	std::vector<unsigned long long> bins(replica_size, 0);
+	pool.ParallelFor(replica_size, pool.Size(), [&](size_t, size_t begin, size_t end)
+	{
+		for (size_t t = 0; t < partitions * histogram_replicas; t++)
+		{
+			for (size_t i = begin; i < end; i++)
+				bins[i] += tables[t * replica_size + i];
+		}
+	});
+
+	std::vector<Histogram> histograms(rows, Histogram(min_key, bin_count, scale));
+	for (size_t r = 0; r < rows; r++)
+		histograms[r].Assign(&bins[r * bin_count]);
+
+	PrintNativeInfo(kernel_id, pool);
+	return histograms;
+}
+
+// ------------------------------------------------------------------------ Device Histogram ------------------------------------------------------------------------ //
+
+template<typename T>
+std::vector<Histogram> DeviceHistograms(T*& inbuf, size_t& len, size_t original_len, const StationColumn* column)
+{
+	// Declare unsigned long variables for the profiling output.
+	unsigned long ex_time_total = 0, ex_time = 0, profiled_info[4] { 0, 0, 0, 0 };
+
+	// Determine the kernel name using the type T, e.g. T == int will concatinate  "_INT".
+	std::string kernel_id = (column) ? "histogram_keyed" : "histogram";
+	ConcatKernelID(*inbuf, kernel_id);
+
+	// The key range is found on the host thread pool, as the padded device reductions would include the padding within the range.
+	fp_type scale = 10.0;
+	int min_key, max_key;
+	KeyRange(*GetThreadPool(), inbuf, original_len, scale, min_key, max_key);
+	int bin_count = max_key - min_key + 1;
+	int rows = (column) ? (int)column->StationCount() : 1;
+
+	// Determine how many rows of bins fit within local memory at once, keeping a quarter free for the runtime.
+	cl::Device device = context.getInfo<CL_CONTEXT_DEVICES>()[0];
+	cl_ulong local_mem_size = device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+	int rows_per_pass = std::min(rows, (int)((local_mem_size * 3 / 4) / (bin_count * sizeof(cl_uint))));
+	if (rows_per_pass < 1)
+	{
+		// A single row of bins does not fit within local memory, which only happens for an unrealistic range of temperatures.
+		std::cout << "Histogram range exceeds local memory, using the native thread pool instead.\n";
+		return NativeHistograms(inbuf, original_len, column);
+	}
+
+	// Start a chrono timer and fetch the kernel with the determined id, this is only created on the first execution.
+	timer::Start();
+	cl::Kernel kernel = kernel_cache.Get(program, kernel_id);
+
+	// Check if the data set is in need of a resize, this will only resize if the local_size has changed since last execution.
+	CheckResize(kernel, inbuf, len, original_len);
+
+	// Point the bins at a pooled array, the kernel output overwrites it entirely.
+	size_t bins_size = rows * bin_count * sizeof(cl_uint);
+	cl_uint* bins = buffer_pool.Host<cl_uint>(kernel_id, rows * bin_count);
+
+	// Provide the kernel arguments, the floating point kernels also take the scale which maps each value onto its key.
+	int arg = 0;
+	cl::Buffer buffer_A = EnqueueBuffer(kernel, arg++, CL_MEM_READ_ONLY, inbuf, len * sizeof(T), "in");
+	if (column)
+		EnqueueBuffer(kernel, arg++, CL_MEM_READ_ONLY, column->ids.Data(), original_len * sizeof(unsigned short), "keys");
+	cl::Buffer buffer_B = EnqueueBuffer(kernel, arg++, CL_MEM_READ_WRITE, bins, bins_size, "bins");
+	kernel.setArg(arg++, cl::Local(rows_per_pass * bin_count * sizeof(cl_uint)));
+	if (typeid(T) != typeid(int))
+		kernel.setArg(arg++, (T)scale);
+	kernel.setArg(arg++, min_key);
+	kernel.setArg(arg++, bin_count);
+
+	/* Launch a few work groups per compute unit, rather than one work item per element, so that each work group bins many elements into
+	   its local histogram before the merge. The kernel strides over the dataset and ignores everything beyond original_len. */
+	cl_uint compute_units = device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+	size_t group_count = compute_units * 4;
+	size_t global_size = std::min(len, group_count * local_size);
+
+	// Execute once per range of rows which fits within local memory, an unkeyed histogram always fits within one pass.
+	for (int first_row = 0; first_row < rows; first_row += rows_per_pass)
+	{
+		int pass_arg = arg;
+		if (column)
+		{
+			kernel.setArg(pass_arg++, first_row);
+			kernel.setArg(pass_arg++, std::min(rows_per_pass, rows - first_row));
+		}
+		kernel.setArg(pass_arg++, (int)original_len);
+
+		// Perform cumulative execution, this will accumulate the total execution time in the last 3 parameters ready for later use.
+		CumulativeProfiledExecution(kernel, buffer_B, bins_size, bins, global_size, ex_time_total, ex_time, profiled_info);
+	}
+
+	PrintProfilerInfo(kernel_id, ex_time, profiled_info, ex_time_total);
+	timer::Stop();
+
+	std::vector<Histogram> histograms(rows, Histogram(min_key, bin_count, scale));
+	for (int r = 0; r < rows; r++)
+		histograms[r].Assign(&bins[r * bin_count]);
+
+	return histograms;
+}
+
+#endif
@@ -12,7 +12,8 @@
 
 
 // REDUCE_SUM
-__kernel void reduce_sum_INT(__global const int* in, __global int* out, __local int* scratch)
+#ifdef cl_khr_int64_base_atomics
+__kernel void reduce_sum_INT(__global const int* in, __global long* out, __local long* scratch)
 {
 	// Get the global ID for writing to global memory buffers (in & out), and get the local id to point to the correct location in the scratch.
 	int id = get_global_id(0);
@@ -37,10 +38,34 @@ __kernel void reduce_sum_INT(__global const int* in, __global int* out, __local
 		barrier(CLK_LOCAL_MEM_FENCE);
 	}
 
-	/* If the local id is equal to 0, perform an atomic_add operation to sum the first element of each scratch into
-	   the first element of the output buffer [0] */
+	/* If the local id is equal to 0, perform a 64 bit atom_add operation to sum the first element of each scratch into
+	   the first element of the output buffer [0], so that the sum of any number of elements cannot overflow. */
+	if (!lid)
+		atom_add(&out[0], scratch[lid]);
+}
+#endif
+
+/* Identical to reduce_sum_INT for devices without cl_khr_int64_base_atomics, where the sum of every work group is written to its own element
+   of partials rather than added to out[0], and the host adds the partial sums. */
+__kernel void reduce_sum_INT_PARTIALS(__global const int* in, __global long* partials, __local long* scratch)
+{
+	int id = get_global_id(0);
+	int lid = get_local_id(0);
+
+	scratch[lid] = in[id];
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int i = get_local_size(0) / 2; i > 0; i >>= 1)
+	{
+		if (lid < i)
+			scratch[lid] += scratch[lid+i];
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
 	if (!lid)
-		atomic_add(&out[0], scratch[lid]);
+		partials[get_group_id(0)] = scratch[lid];
 }
 
 
@@ -91,8 +116,12 @@ __kernel void reduce_min_global_INT(__global const int* in, __global int* out)
 	int id = get_global_id(0);
 	int lid = get_local_id(0);
 
-	// Buffer N elements, where N is the work group size, from the input to the output buffer at index id.
-	out[id] = in[id];
+	/* Buffer N elements, where N is the work group size, from the input to the output buffer at index id. out[0] is the result, seeded
+	   by the host, which every other work group updates atomically, so the first work item only ever updates it atomically too. */
+	if (id)
+		out[id] = in[id];
+	else
+		atomic_min(&out[0], in[0]);
 
 	// Wait for all threads to finish/sync global memory operations up to this point, this is very inefficient!
 	barrier(CLK_GLOBAL_MEM_FENCE);
@@ -107,7 +136,10 @@ __kernel void reduce_min_global_INT(__global const int* in, __global int* out)
 			// Swap elements at index id+1 on the in buffer, with element at index id on the out buffer.
 			int other = in[id+i];
 			int mine = out[id];
-			out[id] = (mine < other) ? mine : other;
+			if (id)
+				out[id] = (mine < other) ? mine : other;
+			else
+				atomic_min(&out[0], other);
 		}
 
 		// Wait for all threads to finish/sync global memory operations up to this point, this is very inefficient!
@@ -165,8 +197,12 @@ __kernel void reduce_max_global_INT(__global const int* in, __global int* out)
 	int id = get_global_id(0);
 	int lid = get_local_id(0);
 
-	// Buffer N elements, where N is the work group size, from the input to the output buffer at index id.
-	out[id] = in[id];
+	/* Buffer N elements, where N is the work group size, from the input to the output buffer at index id. out[0] is the result, seeded
+	   by the host, which every other work group updates atomically, so the first work item only ever updates it atomically too. */
+	if (id)
+		out[id] = in[id];
+	else
+		atomic_max(&out[0], in[0]);
 
 	// Wait for all threads to finish/sync global memory operations up to this point, this is very inefficient!
 	barrier(CLK_GLOBAL_MEM_FENCE);
@@ -181,7 +217,10 @@ __kernel void reduce_max_global_INT(__global const int* in, __global int* out)
 			// Swap elements at index id+1 on the in buffer, with element at index id on the out buffer.
 			int other = in[id+i];
 			int mine = out[id];
-			out[id] = (mine > other) ? mine : other;
+			if (id)
+				out[id] = (mine > other) ? mine : other;
+			else
+				atomic_max(&out[0], other);
 		}
 
 		// Wait for all threads to finish/sync global memory operations up to this point, this is very inefficient!
@@ -195,15 +234,16 @@ __kernel void reduce_max_global_INT(__global const int* in, __global int* out)
 
 
 // SUM_SQR_DIFF
-__kernel void sum_sqr_diff_INT(__global const int* in, __global int* out, __local int* scratch, int mean)
+#ifdef cl_khr_int64_base_atomics
+__kernel void sum_sqr_diff_INT(__global const int* in, __global long* out, __local long* scratch, int mean)
 {
 	// Get the global ID for writing to global memory buffers (in & out), and get the local id to point to the correct location in the scratch.
 	int id = get_global_id(0);
 	int lid = get_local_id(0);
 
-	// Calculate the input[id] - mean and copy its squared value to the scratch at index lid.
-	int diff = (in[id] - mean);
-	scratch[lid] = (diff * diff) / 10;
+	// Calculate the input[id] - mean and copy its squared value to the scratch at index lid, in 64 bits as the square may exceed an int.
+	long diff = (long)in[id] - mean;
+	scratch[lid] = diff * diff;
 
 	// Wait for all threads to finish/sync local memory operations up to this point.
 	barrier(CLK_LOCAL_MEM_FENCE);
@@ -220,10 +260,33 @@ __kernel void sum_sqr_diff_INT(__global const int* in, __global int* out, __loca
 		barrier(CLK_LOCAL_MEM_FENCE);
 	}
 
-	/* If the local id is equal to 0, perform an atomic_add operation to sum the first element of each scratch into
-	   the first element of the output buffer [0] */
+	// Sum the first element of each scratch into the first element of the output buffer [0] with a 64 bit atom_add.
 	if (!lid)
-		atomic_add(&out[0], scratch[lid]);
+		atom_add(&out[0], scratch[lid]);
+}
+#endif
+
+// Identical to sum_sqr_diff_INT for devices without cl_khr_int64_base_atomics, writing the sum of every work group to partials.
+__kernel void sum_sqr_diff_INT_PARTIALS(__global const int* in, __global long* partials, __local long* scratch, int mean)
+{
+	int id = get_global_id(0);
+	int lid = get_local_id(0);
+
+	long diff = (long)in[id] - mean;
+	scratch[lid] = diff * diff;
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int i = get_local_size(0) / 2; i > 0; i >>= 1)
+	{
+		if (lid < i)
+			scratch[lid] += scratch[lid + i];
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	if (!lid)
+		partials[get_group_id(0)] = scratch[lid];
 }
 
 
@@ -308,6 +371,80 @@ __kernel void bitonic_local_INT(__global const int* in, __global int* out, __loc
 		out[offset_id] = in[offset_id];
 }
 
+
+
+// HISTOGRAM
+__kernel void histogram_INT(__global const int* in, __global uint* bins, __local uint* local_bins, int min_key, int bin_count, int size)
+{
+	// Get the global ID, the local ID and the work group size, the global size is the stride between the elements each work item bins.
+	int id = get_global_id(0);
+	int lid = get_local_id(0);
+	int N = get_local_size(0);
+	int stride = get_global_size(0);
+
+	// Clear this work group's private copy of the histogram, each work item clearing every N-th bin.
+	for (int i = lid; i < bin_count; i += N)
+		local_bins[i] = 0;
+
+	// Wait for all threads to finish/sync local memory operations up to this point.
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	/* Bin every stride-th element into the local histogram, only the elements below size are binned so that the padding added by
+	   CLResize is never counted. Contention on a local atomic is far cheaper than contention on the same global bin. */
+	for (int i = id; i < size; i += stride)
+	{
+		int bin = in[i] - min_key;
+		if (bin >= 0 && bin < bin_count)
+			atomic_inc(&local_bins[bin]);
+	}
+
+	// Wait for all threads to finish/sync local memory operations up to this point.
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	// Merge the local histogram into the global histogram, skipping empty bins to save on global atomics.
+	for (int i = lid; i < bin_count; i += N)
+	{
+		if (local_bins[i])
+			atomic_add(&bins[i], local_bins[i]);
+	}
+}
+
+
+
+// HISTOGRAM_KEYED
+__kernel void histogram_keyed_INT(__global const int* in, __global const ushort* keys, __global uint* bins, __local uint* local_bins, int min_key, int bin_count, int first_key, int key_count, int size)
+{
+	int id = get_global_id(0);
+	int lid = get_local_id(0);
+	int N = get_local_size(0);
+	int stride = get_global_size(0);
+
+	/* Identical to histogram_INT, except that every key (station) within [first_key, first_key + key_count) has its own row of bins. The
+	   host selects key_count so that every row fits within local memory, executing the kernel once per range of keys. */
+	int local_count = key_count * bin_count;
+	for (int i = lid; i < local_count; i += N)
+		local_bins[i] = 0;
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int i = id; i < size; i += stride)
+	{
+		int key = keys[i] - first_key;
+		int bin = in[i] - min_key;
+		if (key >= 0 && key < key_count && bin >= 0 && bin < bin_count)
+			atomic_inc(&local_bins[key * bin_count + bin]);
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	// The global histogram holds the rows of every key, so the rows of this range begin at first_key * bin_count.
+	for (int i = lid; i < local_count; i += N)
+	{
+		if (local_bins[i])
+			atomic_add(&bins[first_key * bin_count + i], local_bins[i]);
+	}
+}
+
 // #################################################################################################### //
 // ########################################## DOUBLE KERNELS ########################################## //
 // #################################################################################################### //
@@ -420,7 +557,10 @@ __kernel void reduce_min_global_FP(__global const fp_type* in, __global fp_type*
 	int id = get_global_id(0);
 	int lid = get_local_id(0);
 
-	out[id] = in[id];
+	if (id)
+		out[id] = in[id];
+	else
+		atomic_min_f(&out[0], in[0]);
 
 	barrier(CLK_GLOBAL_MEM_FENCE);
 
@@ -430,7 +570,10 @@ __kernel void reduce_min_global_FP(__global const fp_type* in, __global fp_type*
 		{
 			fp_type other = in[id+i];
 			fp_type mine = out[id];
-			out[id] = (mine < other) ? mine : other;
+			if (id)
+				out[id] = (mine < other) ? mine : other;
+			else
+				atomic_min_f(&out[0], other);
 		}
 
 		barrier(CLK_GLOBAL_MEM_FENCE);
@@ -475,7 +618,10 @@ __kernel void reduce_max_global_FP(__global const fp_type* in, __global fp_type*
 	int id = get_global_id(0);
 	int lid = get_local_id(0);
 
-	out[id] = in[id];
+	if (id)
+		out[id] = in[id];
+	else
+		atomic_max_f(&out[0], in[0]);
 
 	barrier(CLK_GLOBAL_MEM_FENCE);
 
@@ -485,7 +631,10 @@ __kernel void reduce_max_global_FP(__global const fp_type* in, __global fp_type*
 		{
 			fp_type other = in[id+i];
 			fp_type mine = out[id];
-			out[id] = (mine > other) ? mine : other;
+			if (id)
+				out[id] = (mine > other) ? mine : other;
+			else
+				atomic_max_f(&out[0], other);
 		}
 
 		barrier(CLK_GLOBAL_MEM_FENCE);
@@ -570,4 +719,1082 @@ __kernel void bitonic_local_FP(__global const fp_type* in, __global fp_type* out
 
 	if (merge && gid == max_group)
 		out[offset_id] = in[offset_id];
-}
\ No newline at end of file
+}
+
+
+
+// HISTOGRAM
+__kernel void histogram_FP(__global const fp_type* in, __global uint* bins, __local uint* local_bins, fp_type scale, int min_key, int bin_count, int size)
+{
+	int id = get_global_id(0);
+	int lid = get_local_id(0);
+	int N = get_local_size(0);
+	int stride = get_global_size(0);
+
+	for (int i = lid; i < bin_count; i += N)
+		local_bins[i] = 0;
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	// The floating point values are rounded onto the same x10 integer keys as the integer kernels, e.g. 12.3 lands within bin 123.
+	for (int i = id; i < size; i += stride)
+	{
+		int bin = convert_int_rte(in[i] * scale) - min_key;
+		if (bin >= 0 && bin < bin_count)
+			atomic_inc(&local_bins[bin]);
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int i = lid; i < bin_count; i += N)
+	{
+		if (local_bins[i])
+			atomic_add(&bins[i], local_bins[i]);
+	}
+}
+
+
+
+// HISTOGRAM_KEYED
+__kernel void histogram_keyed_FP(__global const fp_type* in, __global const ushort* keys, __global uint* bins, __local uint* local_bins, fp_type scale, int min_key, int bin_count, int first_key, int key_count, int size)
+{
+	int id = get_global_id(0);
+	int lid = get_local_id(0);
+	int N = get_local_size(0);
+	int stride = get_global_size(0);
+
+	int local_count = key_count * bin_count;
+	for (int i = lid; i < local_count; i += N)
+		local_bins[i] = 0;
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int i = id; i < size; i += stride)
+	{
+		int key = keys[i] - first_key;
+		int bin = convert_int_rte(in[i] * scale) - min_key;
+		if (key >= 0 && key < key_count && bin >= 0 && bin < bin_count)
+			atomic_inc(&local_bins[key * bin_count + bin]);
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int i = lid; i < local_count; i += N)
+	{
+		if (local_bins[i])
+			atomic_add(&bins[first_key * bin_count + i], local_bins[i]);
+	}
+}
+
+
+// ################################################################################################## //
+// ########################################## SCAN KERNELS ########################################## //
+// ################################################################################################## //
+
+// Work efficient (Blelloch) scans, generated for every operator and type from the macros below. Each work //
+// group scans a block of two elements per work item in local memory and writes the total of its block,    //
+// the host then scans the block totals with the same kernels (recursively, until a single block remains)  //
+// and combines them back into every block. See Scan() within funcs.h. The kernels named after two types   //
+// accumulate into the second, the _INT_LONG kernels summing integers into 64 bits and the _FP_DP kernels  //
+// summing floats into double, while the _LONG and _DP kernels scan their block totals. Like every kernel  //
+// accumulating in double the _DP kernels only exist on devices with cl_khr_fp64, elsewhere the host falls //
+// back onto the float sums of scan_add_FP.                                                                //
+
+#define OP_ADD(a, b) ((a) + (b))
+#define OP_MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define OP_MAX(a, b) (((a) > (b)) ? (a) : (b))
+
+
+
+// SCAN_BLOCK
+/* Exclusive scan of each block of 2 * local_size elements, building a reduction tree over the block (up-sweep) and then passing the prefix
+   of every node down the tree (down-sweep). Inclusive results combine each exclusive result with its own element. Elements beyond size take
+   the identity so that a partial block scans as though it were full, and the local size must be a power of two. */
+#define SCAN_BLOCK(NAME, IN_TYPE, OUT_TYPE, OP, IDENTITY)																	\
+__kernel void NAME(__global const IN_TYPE* in, __global OUT_TYPE* out, __global OUT_TYPE* group_sums,						\
+	__local OUT_TYPE* scratch, int inclusive, int size)																		\
+{																															\
+	int lid = get_local_id(0);																								\
+	int N = get_local_size(0);																								\
+	int base = get_group_id(0) * N * 2;																						\
+																															\
+	OUT_TYPE in_a = (base + lid < size) ? (OUT_TYPE)in[base + lid] : IDENTITY;												\
+	OUT_TYPE in_b = (base + lid + N < size) ? (OUT_TYPE)in[base + lid + N] : IDENTITY;										\
+	scratch[lid] = in_a;																									\
+	scratch[lid + N] = in_b;																								\
+																															\
+	int offset = 1;																											\
+	for (int d = N; d > 0; d >>= 1)																							\
+	{																														\
+		barrier(CLK_LOCAL_MEM_FENCE);																						\
+		if (lid < d)																										\
+		{																													\
+			int left = offset * (2 * lid + 1) - 1;																			\
+			int right = offset * (2 * lid + 2) - 1;																			\
+			scratch[right] = OP(scratch[left], scratch[right]);																\
+		}																													\
+		offset <<= 1;																										\
+	}																														\
+																															\
+	/* The root holds the total of the block, which is replaced by the identity before the down-sweep. */					\
+	if (lid == 0)																											\
+	{																														\
+		group_sums[get_group_id(0)] = scratch[2 * N - 1];																	\
+		scratch[2 * N - 1] = IDENTITY;																						\
+	}																														\
+																															\
+	for (int d = 1; d < 2 * N; d <<= 1)																						\
+	{																														\
+		offset >>= 1;																										\
+		barrier(CLK_LOCAL_MEM_FENCE);																						\
+		if (lid < d)																										\
+		{																													\
+			int left = offset * (2 * lid + 1) - 1;																			\
+			int right = offset * (2 * lid + 2) - 1;																			\
+			OUT_TYPE t = scratch[left];																						\
+			scratch[left] = scratch[right];																					\
+			scratch[right] = OP(scratch[right], t);																			\
+		}																													\
+	}																														\
+	barrier(CLK_LOCAL_MEM_FENCE);																							\
+																															\
+	if (base + lid < size)																									\
+		out[base + lid] = (inclusive) ? OP(scratch[lid], in_a) : scratch[lid];												\
+	if (base + lid + N < size)																								\
+		out[base + lid + N] = (inclusive) ? OP(scratch[lid + N], in_b) : scratch[lid + N];									\
+}
+
+SCAN_BLOCK(scan_add_INT, int, int, OP_ADD, 0)
+SCAN_BLOCK(scan_min_INT, int, int, OP_MIN, INT_MAX)
+SCAN_BLOCK(scan_max_INT, int, int, OP_MAX, INT_MIN)
+SCAN_BLOCK(scan_min_FP, fp_type, fp_type, OP_MIN, INFINITY)
+SCAN_BLOCK(scan_max_FP, fp_type, fp_type, OP_MAX, -INFINITY)
+SCAN_BLOCK(scan_add_FP, fp_type, fp_type, OP_ADD, 0.0f)
+SCAN_BLOCK(scan_add_INT_LONG, int, long, OP_ADD, 0)
+SCAN_BLOCK(scan_add_LONG, long, long, OP_ADD, 0)
+#ifdef cl_khr_fp64
+SCAN_BLOCK(scan_add_FP_DP, fp_type, double, OP_ADD, 0.0)
+SCAN_BLOCK(scan_add_DP, double, double, OP_ADD, 0.0)
+#endif
+
+
+
+// SCAN_OFFSETS
+/* Combine the exclusive scan of the block totals into every element of each block. Must be executed with the same work group size as
+   SCAN_BLOCK, the first block is skipped as its offset is always the identity. */
+#define SCAN_OFFSETS(NAME, OUT_TYPE, OP)																					\
+__kernel void NAME(__global OUT_TYPE* out, __global const OUT_TYPE* group_offsets, int size)								\
+{																															\
+	int lid = get_local_id(0);																								\
+	int N = get_local_size(0);																								\
+	int base = get_group_id(0) * N * 2;																						\
+	if (get_group_id(0) == 0)																								\
+		return;																												\
+																															\
+	OUT_TYPE offset = group_offsets[get_group_id(0)];																		\
+	if (base + lid < size)																									\
+		out[base + lid] = OP(offset, out[base + lid]);																		\
+	if (base + lid + N < size)																								\
+		out[base + lid + N] = OP(offset, out[base + lid + N]);																\
+}
+
+SCAN_OFFSETS(scan_offsets_add_INT, int, OP_ADD)
+SCAN_OFFSETS(scan_offsets_min_INT, int, OP_MIN)
+SCAN_OFFSETS(scan_offsets_max_INT, int, OP_MAX)
+SCAN_OFFSETS(scan_offsets_min_FP, fp_type, OP_MIN)
+SCAN_OFFSETS(scan_offsets_max_FP, fp_type, OP_MAX)
+SCAN_OFFSETS(scan_offsets_add_FP, fp_type, OP_ADD)
+SCAN_OFFSETS(scan_offsets_add_LONG, long, OP_ADD)
+#ifdef cl_khr_fp64
+SCAN_OFFSETS(scan_offsets_add_DP, double, OP_ADD)
+#endif
+
+
+
+// SEGMENTED_SCAN_BLOCK
+/* Segmented variant of SCAN_BLOCK, restarting at every element whose head flag is set. The up-sweep only combines a left subtree into a
+   right subtree which contains no head, and the down-sweep passes the identity (rather than the prefix) into every subtree beginning with a
+   head (Sengupta et al., Scan Primitives for GPU Computing). flags holds the working flags in its first half and the original head flags in
+   its second half. Every block also writes whether it contains a head and the position of its first head, from which the host carries the
+   scan across blocks with SEGMENTED_SCAN_CARRY. */
+#define SEGMENTED_SCAN_BLOCK(NAME, IN_TYPE, OUT_TYPE, OP, IDENTITY)															\
+__kernel void NAME(__global const IN_TYPE* in, __global const int* heads, __global OUT_TYPE* out,							\
+	__global OUT_TYPE* group_sums, __global int* group_heads, __global int* group_first,										\
+	__local OUT_TYPE* scratch, __local int* flags, int inclusive, int size)													\
+{																															\
+	int lid = get_local_id(0);																								\
+	int N = get_local_size(0);																								\
+	int base = get_group_id(0) * N * 2;																						\
+	__local int first_head;																									\
+																															\
+	OUT_TYPE in_a = (base + lid < size) ? (OUT_TYPE)in[base + lid] : IDENTITY;												\
+	OUT_TYPE in_b = (base + lid + N < size) ? (OUT_TYPE)in[base + lid + N] : IDENTITY;										\
+	int head_a = (base + lid < size && heads[base + lid]);																	\
+	int head_b = (base + lid + N < size && heads[base + lid + N]);															\
+	scratch[lid] = in_a;																									\
+	scratch[lid + N] = in_b;																								\
+	flags[lid] = flags[2 * N + lid] = head_a;																				\
+	flags[lid + N] = flags[3 * N + lid] = head_b;																			\
+																															\
+	if (lid == 0)																											\
+		first_head = 2 * N;																									\
+	barrier(CLK_LOCAL_MEM_FENCE);																							\
+	if (head_a)																												\
+		atomic_min(&first_head, lid);																						\
+	else if (head_b)																										\
+		atomic_min(&first_head, lid + N);																					\
+																															\
+	int offset = 1;																											\
+	for (int d = N; d > 0; d >>= 1)																							\
+	{																														\
+		barrier(CLK_LOCAL_MEM_FENCE);																						\
+		if (lid < d)																										\
+		{																													\
+			int left = offset * (2 * lid + 1) - 1;																			\
+			int right = offset * (2 * lid + 2) - 1;																			\
+			if (!flags[right])																								\
+				scratch[right] = OP(scratch[left], scratch[right]);															\
+			flags[right] |= flags[left];																					\
+		}																													\
+		offset <<= 1;																										\
+	}																														\
+																															\
+	/* The root holds the scan of the block from its last head, which is exactly what the following block continues from. */	\
+	if (lid == 0)																											\
+	{																														\
+		group_sums[get_group_id(0)] = scratch[2 * N - 1];																	\
+		group_heads[get_group_id(0)] = (first_head < 2 * N);																\
+		group_first[get_group_id(0)] = first_head;																			\
+		scratch[2 * N - 1] = IDENTITY;																						\
+	}																														\
+																															\
+	for (int d = 1; d < 2 * N; d <<= 1)																						\
+	{																														\
+		offset >>= 1;																										\
+		barrier(CLK_LOCAL_MEM_FENCE);																						\
+		if (lid < d)																										\
+		{																													\
+			int left = offset * (2 * lid + 1) - 1;																			\
+			int right = offset * (2 * lid + 2) - 1;																			\
+			OUT_TYPE t = scratch[left];																						\
+			scratch[left] = scratch[right];																					\
+			if (flags[2 * N + left + 1])																					\
+				scratch[right] = IDENTITY;																					\
+			else if (!flags[left])																							\
+				scratch[right] = OP(scratch[right], t);																		\
+			else																											\
+				scratch[right] = t;																							\
+			flags[left] = 0;																								\
+		}																													\
+	}																														\
+	barrier(CLK_LOCAL_MEM_FENCE);																							\
+																															\
+	if (base + lid < size)																									\
+		out[base + lid] = (inclusive) ? OP(scratch[lid], in_a) : scratch[lid];												\
+	if (base + lid + N < size)																								\
+		out[base + lid + N] = (inclusive) ? OP(scratch[lid + N], in_b) : scratch[lid + N];									\
+}
+
+SEGMENTED_SCAN_BLOCK(segmented_scan_add_INT, int, int, OP_ADD, 0)
+SEGMENTED_SCAN_BLOCK(segmented_scan_min_INT, int, int, OP_MIN, INT_MAX)
+SEGMENTED_SCAN_BLOCK(segmented_scan_max_INT, int, int, OP_MAX, INT_MIN)
+SEGMENTED_SCAN_BLOCK(segmented_scan_min_FP, fp_type, fp_type, OP_MIN, INFINITY)
+SEGMENTED_SCAN_BLOCK(segmented_scan_max_FP, fp_type, fp_type, OP_MAX, -INFINITY)
+SEGMENTED_SCAN_BLOCK(segmented_scan_add_FP, fp_type, fp_type, OP_ADD, 0.0f)
+SEGMENTED_SCAN_BLOCK(segmented_scan_add_INT_LONG, int, long, OP_ADD, 0)
+SEGMENTED_SCAN_BLOCK(segmented_scan_add_LONG, long, long, OP_ADD, 0)
+#ifdef cl_khr_fp64
+SEGMENTED_SCAN_BLOCK(segmented_scan_add_FP_DP, fp_type, double, OP_ADD, 0.0)
+SEGMENTED_SCAN_BLOCK(segmented_scan_add_DP, double, double, OP_ADD, 0.0)
+#endif
+
+
+
+// SEGMENTED_SCAN_CARRY
+/* Combine the value carried out of the preceding block into every element before the first head of each block. carries holds the inclusive
+   segmented scan of the block totals (restarting at every block which contains a head), so the carry into block g is carries[g - 1]. */
+#define SEGMENTED_SCAN_CARRY(NAME, OUT_TYPE, OP)																			\
+__kernel void NAME(__global OUT_TYPE* out, __global const OUT_TYPE* carries, __global const int* group_first, int size)	\
+{																															\
+	int lid = get_local_id(0);																								\
+	int N = get_local_size(0);																								\
+	int base = get_group_id(0) * N * 2;																						\
+	if (get_group_id(0) == 0)																								\
+		return;																												\
+																															\
+	OUT_TYPE carry = carries[get_group_id(0) - 1];																			\
+	int first = group_first[get_group_id(0)];																				\
+	if (lid < first && base + lid < size)																					\
+		out[base + lid] = OP(carry, out[base + lid]);																		\
+	if (lid + N < first && base + lid + N < size)																			\
+		out[base + lid + N] = OP(carry, out[base + lid + N]);																\
+}
+
+SEGMENTED_SCAN_CARRY(segmented_carry_add_INT, int, OP_ADD)
+SEGMENTED_SCAN_CARRY(segmented_carry_min_INT, int, OP_MIN)
+SEGMENTED_SCAN_CARRY(segmented_carry_max_INT, int, OP_MAX)
+SEGMENTED_SCAN_CARRY(segmented_carry_min_FP, fp_type, OP_MIN)
+SEGMENTED_SCAN_CARRY(segmented_carry_max_FP, fp_type, OP_MAX)
+SEGMENTED_SCAN_CARRY(segmented_carry_add_FP, fp_type, OP_ADD)
+SEGMENTED_SCAN_CARRY(segmented_carry_add_LONG, long, OP_ADD)
+#ifdef cl_khr_fp64
+SEGMENTED_SCAN_CARRY(segmented_carry_add_DP, double, OP_ADD)
+#endif
+
+
+// #################################################################################################### //
+// ########################################## FILTER KERNELS ########################################## //
+// #################################################################################################### //
+
+// Stream compaction of the records matching a filter (a temperature range and optionally one station), //
+// executed as two passes over the device resident columns. The first counts the matches of every work   //
+// group, the host scans the counts with scan_add_INT and the second writes every match to its position  //
+// within a dense output, preserving the order of the dataset. See filter.h.                             //
+
+#define FILTER_MATCH(i) ((i) < size && in[i] >= lo && in[i] <= hi && (station < 0 || stations[i] == station))
+
+int local_exclusive_scan(__local int* scratch)
+{
+	// Exclusive scan of the 2 * local_size values within scratch in the same manner as SCAN_BLOCK, returning the total of the block.
+	int lid = get_local_id(0);
+	int N = get_local_size(0);
+
+	int offset = 1;
+	for (int d = N; d > 0; d >>= 1)
+	{
+		barrier(CLK_LOCAL_MEM_FENCE);
+		if (lid < d)
+			scratch[offset * (2 * lid + 2) - 1] += scratch[offset * (2 * lid + 1) - 1];
+		offset <<= 1;
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+	int total = scratch[2 * N - 1];
+	barrier(CLK_LOCAL_MEM_FENCE);
+	if (lid == 0)
+		scratch[2 * N - 1] = 0;
+
+	for (int d = 1; d < 2 * N; d <<= 1)
+	{
+		offset >>= 1;
+		barrier(CLK_LOCAL_MEM_FENCE);
+		if (lid < d)
+		{
+			int left = offset * (2 * lid + 1) - 1;
+			int right = offset * (2 * lid + 2) - 1;
+			int t = scratch[left];
+			scratch[left] = scratch[right];
+			scratch[right] += t;
+		}
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	return total;
+}
+
+
+
+// FILTER_COUNT
+/* Count the matching records within each block of 2 * local_size records. */
+#define FILTER_COUNT(NAME, TYPE)																							\
+__kernel void NAME(__global const TYPE* in, __global const ushort* stations, __global int* group_counts,					\
+	__local int* scratch, TYPE lo, TYPE hi, int station, int size)															\
+{																															\
+	int lid = get_local_id(0);																								\
+	int N = get_local_size(0);																								\
+	int base = get_group_id(0) * N * 2;																						\
+																															\
+	scratch[lid] = FILTER_MATCH(base + lid) + FILTER_MATCH(base + lid + N);													\
+	for (int i = N / 2; i > 0; i >>= 1)																						\
+	{																														\
+		barrier(CLK_LOCAL_MEM_FENCE);																						\
+		if (lid < i)																										\
+			scratch[lid] += scratch[lid + i];																				\
+	}																														\
+																															\
+	if (!lid)																												\
+		group_counts[get_group_id(0)] = scratch[0];																			\
+}
+
+FILTER_COUNT(filter_count_INT, int)
+FILTER_COUNT(filter_count_FP, fp_type)
+
+
+
+// FILTER_COMPACT
+/* Write every matching record of each block to the dense output, from the inclusive scan of the group counts (the end of the output of
+   every block) and an exclusive scan of the matches within the block. indices receives the record index of every match. */
+#define FILTER_COMPACT(NAME, TYPE)																							\
+__kernel void NAME(__global const TYPE* in, __global const ushort* stations, __global const int* group_ends,				\
+	__global TYPE* out, __global int* indices, __local int* scratch, TYPE lo, TYPE hi, int station, int size)				\
+{																															\
+	int lid = get_local_id(0);																								\
+	int N = get_local_size(0);																								\
+	int base = get_group_id(0) * N * 2;																						\
+																															\
+	int match_a = FILTER_MATCH(base + lid);																					\
+	int match_b = FILTER_MATCH(base + lid + N);																				\
+	scratch[lid] = match_a;																									\
+	scratch[lid + N] = match_b;																								\
+	local_exclusive_scan(scratch);																							\
+																															\
+	int group_offset = (get_group_id(0)) ? group_ends[get_group_id(0) - 1] : 0;												\
+	if (match_a)																											\
+	{																														\
+		out[group_offset + scratch[lid]] = in[base + lid];																	\
+		indices[group_offset + scratch[lid]] = base + lid;																	\
+	}																														\
+	if (match_b)																											\
+	{																														\
+		out[group_offset + scratch[lid + N]] = in[base + lid + N];															\
+		indices[group_offset + scratch[lid + N]] = base + lid + N;															\
+	}																														\
+}
+
+FILTER_COMPACT(filter_compact_INT, int)
+FILTER_COMPACT(filter_compact_FP, fp_type)
+
+
+
+// SUBSET_SORTED
+/* Flag a subset which is not yet sorted, the host clears unsorted before every check and only reads it back. */
+#define SUBSET_SORTED(NAME, TYPE)																							\
+__kernel void NAME(__global const TYPE* in, __global int* unsorted, int size)												\
+{																															\
+	int i = get_global_id(0);																								\
+	if (i + 1 < size && in[i] > in[i + 1])																					\
+		*unsorted = 1;																										\
+}
+
+SUBSET_SORTED(subset_sorted_INT, int)
+SUBSET_SORTED(subset_sorted_FP, fp_type)
+
+
+// ######################################################################################################## //
+// ########################################## COMPRESSED KERNELS ########################################## //
+// ######################################################################################################## //
+
+// Reductions over the compressed columns of compressed.h, which decode every value in registers rather    //
+// than expanding the column beforehand. _I16 columns hold every value as a short, _PACKED columns hold    //
+// blocks of 256 values as offsets from the minimum of the block (frame of reference), each packed into as //
+// few bits as the range of the block needs, and _HALF columns hold the floating point column as half,     //
+// widened by vload_half (which needs no cl_khr_fp16). Every work item reduces a grid stride of the        //
+// column, so only a few work groups are needed to keep the device busy. The widen kernels expand a column //
+// once for the sorts.                                                                                     //
+
+#define PACKED_BLOCK_SHIFT 8
+
+int decode_packed(__global const uint* packed, __global const int* block_ref, __global const uint* block_offset, int i)
+{
+	// The bit width of a block is its length in words over 8, as every block holds 256 values and thus 8 words per bit.
+	int block = i >> PACKED_BLOCK_SHIFT;
+	uint first = block_offset[block];
+	uint bits = (block_offset[block + 1] - first) >> 3;
+
+	// A block of equal values occupies no words at all, so there is nothing to read (and the last such block ends the buffer).
+	if (!bits)
+		return block_ref[block];
+
+	uint bit = (uint)(i & ((1 << PACKED_BLOCK_SHIFT) - 1)) * bits;
+	uint word = first + (bit >> 5);
+	uint shift = bit & 31;
+
+	// Values may straddle two words, the block always ends on a word boundary so the second word is within the block.
+	uint value = packed[word] >> shift;
+	if (shift + bits > 32)
+		value |= packed[word + 1] << (32 - shift);
+
+	return block_ref[block] + (int)(value & ((bits < 32) ? ((1u << bits) - 1) : 0xFFFFFFFFu));
+}
+
+#define I16_COLUMN __global const short* in
+#define PACKED_COLUMN __global const uint* in, __global const int* block_ref, __global const uint* block_offset
+#define HALF_COLUMN __global const half* in
+#define DECODE_I16(i) ((int)in[i])
+#define DECODE_PACKED(i) decode_packed(in, block_ref, block_offset, i)
+#define DECODE_HALF(i) vload_half(i, in)
+
+// The partial sums of devices without cl_khr_int64_base_atomics, every work group writing its result to its own element of the output.
+#define GROUP_PARTIAL(out, value) ((out)[get_group_id(0)] = (value))
+
+
+
+// COMPRESSED_REDUCE
+/* Equivalent of reduce_sum_INT, reduce_min_INT and reduce_max_INT, the sums accumulating in 64 bits, and of the _FP kernels for _HALF. */
+#define COMPRESSED_REDUCE(NAME, COLUMN, DECODE, ACC_TYPE, OP, IDENTITY, ATOMIC)												\
+__kernel void NAME(COLUMN, __global ACC_TYPE* out, __local ACC_TYPE* scratch, int size)										\
+{																															\
+	int lid = get_local_id(0);																								\
+																															\
+	ACC_TYPE acc = IDENTITY;																								\
+	for (int i = get_global_id(0); i < size; i += get_global_size(0))														\
+		acc = OP(acc, DECODE(i));																							\
+	scratch[lid] = acc;																										\
+																															\
+	for (int i = get_local_size(0) / 2; i > 0; i >>= 1)																		\
+	{																														\
+		barrier(CLK_LOCAL_MEM_FENCE);																						\
+		if (lid < i)																										\
+			scratch[lid] = OP(scratch[lid], scratch[lid + i]);																\
+	}																														\
+																															\
+	if (!lid)																												\
+		ATOMIC(&out[0], scratch[0]);																						\
+}
+
+#ifdef cl_khr_int64_base_atomics
+COMPRESSED_REDUCE(reduce_sum_I16, I16_COLUMN, DECODE_I16, long, OP_ADD, 0, atom_add)
+COMPRESSED_REDUCE(reduce_sum_PACKED, PACKED_COLUMN, DECODE_PACKED, long, OP_ADD, 0, atom_add)
+#endif
+COMPRESSED_REDUCE(reduce_sum_I16_PARTIALS, I16_COLUMN, DECODE_I16, long, OP_ADD, 0, GROUP_PARTIAL)
+COMPRESSED_REDUCE(reduce_sum_PACKED_PARTIALS, PACKED_COLUMN, DECODE_PACKED, long, OP_ADD, 0, GROUP_PARTIAL)
+COMPRESSED_REDUCE(reduce_min_I16, I16_COLUMN, DECODE_I16, int, OP_MIN, INT_MAX, atomic_min)
+COMPRESSED_REDUCE(reduce_max_I16, I16_COLUMN, DECODE_I16, int, OP_MAX, INT_MIN, atomic_max)
+COMPRESSED_REDUCE(reduce_min_PACKED, PACKED_COLUMN, DECODE_PACKED, int, OP_MIN, INT_MAX, atomic_min)
+COMPRESSED_REDUCE(reduce_max_PACKED, PACKED_COLUMN, DECODE_PACKED, int, OP_MAX, INT_MIN, atomic_max)
+COMPRESSED_REDUCE(reduce_sum_HALF, HALF_COLUMN, DECODE_HALF, fp_type, OP_ADD, 0.0f, atomic_add_f)
+COMPRESSED_REDUCE(reduce_min_HALF, HALF_COLUMN, DECODE_HALF, fp_type, OP_MIN, INFINITY, atomic_min_f)
+COMPRESSED_REDUCE(reduce_max_HALF, HALF_COLUMN, DECODE_HALF, fp_type, OP_MAX, -INFINITY, atomic_max_f)
+
+
+
+// COMPRESSED_SQR_DIFF
+/* Equivalent of sum_sqr_diff_INT, and of sum_sqr_diff_FP for _HALF. */
+#define COMPRESSED_SQR_DIFF(NAME, COLUMN, DECODE, ACC_TYPE, MEAN_TYPE, ATOMIC)												\
+__kernel void NAME(COLUMN, __global ACC_TYPE* out, __local ACC_TYPE* scratch, MEAN_TYPE mean, int size)						\
+{																															\
+	int lid = get_local_id(0);																								\
+																															\
+	ACC_TYPE acc = 0;																										\
+	for (int i = get_global_id(0); i < size; i += get_global_size(0))														\
+	{																														\
+		ACC_TYPE diff = (ACC_TYPE)DECODE(i) - mean;																			\
+		acc += diff * diff;																									\
+	}																														\
+	scratch[lid] = acc;																										\
+																															\
+	for (int i = get_local_size(0) / 2; i > 0; i >>= 1)																		\
+	{																														\
+		barrier(CLK_LOCAL_MEM_FENCE);																						\
+		if (lid < i)																										\
+			scratch[lid] += scratch[lid + i];																				\
+	}																														\
+																															\
+	if (!lid)																												\
+		ATOMIC(&out[0], scratch[0]);																						\
+}
+
+#ifdef cl_khr_int64_base_atomics
+COMPRESSED_SQR_DIFF(sum_sqr_diff_I16, I16_COLUMN, DECODE_I16, long, int, atom_add)
+COMPRESSED_SQR_DIFF(sum_sqr_diff_PACKED, PACKED_COLUMN, DECODE_PACKED, long, int, atom_add)
+#endif
+COMPRESSED_SQR_DIFF(sum_sqr_diff_I16_PARTIALS, I16_COLUMN, DECODE_I16, long, int, GROUP_PARTIAL)
+COMPRESSED_SQR_DIFF(sum_sqr_diff_PACKED_PARTIALS, PACKED_COLUMN, DECODE_PACKED, long, int, GROUP_PARTIAL)
+COMPRESSED_SQR_DIFF(sum_sqr_diff_HALF, HALF_COLUMN, DECODE_HALF, fp_type, fp_type, atomic_add_f)
+
+
+
+// COMPRESSED_WIDEN
+/* Expand a compressed column into the plain column of its type, on the device, so that only the compressed bytes are uploaded for a sort. */
+#define COMPRESSED_WIDEN(NAME, COLUMN, DECODE, TYPE)																		\
+__kernel void NAME(COLUMN, __global TYPE* out, int size)																	\
+{																															\
+	int i = get_global_id(0);																								\
+	if (i < size)																											\
+		out[i] = DECODE(i);																									\
+}
+
+COMPRESSED_WIDEN(widen_I16, I16_COLUMN, DECODE_I16, int)
+COMPRESSED_WIDEN(widen_PACKED, PACKED_COLUMN, DECODE_PACKED, int)
+COMPRESSED_WIDEN(widen_HALF, HALF_COLUMN, DECODE_HALF, fp_type)
+
+
+// ######################################################################################################### //
+// ########################################## COMPENSATED KERNELS ########################################## //
+// ######################################################################################################### //
+
+// Deterministic sums of the floating point column for the precision mode. reduce_sum_FP and sum_sqr_diff_FP  //
+// accumulate millions of floats through atomic_add_f in whatever order the work groups finish, so neither    //
+// the result nor its rounding error is reproducible. Here every work item sums a grid stride of the column   //
+// with Neumaier's compensated summation, each work group combines the (sum, compensation) pairs of its work  //
+// items as a fixed tree and writes them to its own slot, and the host combines the slots pairwise in order   //
+// (see summation.h). The _DP kernels accumulate in double and only exist on devices with cl_khr_fp64.       //
+
+// The compensation is the rounding error of each addition, which is lost if the multiplication of a squared difference is fused into it.
+#pragma OPENCL FP_CONTRACT OFF
+
+#define NEUMAIER_ADD(ACC_TYPE, SUM, COMP, VALUE)																			\
+{																															\
+	ACC_TYPE t = SUM + VALUE;																								\
+	COMP += (fabs(SUM) >= fabs(VALUE)) ? (SUM - t) + VALUE : (VALUE - t) + SUM;												\
+	SUM = t;																												\
+}
+
+#define NO_MEAN
+#define FP_MEAN fp_type mean,
+#define DP_MEAN double mean,
+#define SUM_VALUE(x) (x)
+#define SQR_DIFF_VALUE(x) (((x) - mean) * ((x) - mean))
+
+
+
+// COMPENSATED_SUM
+/* Writes the sum and compensation of work group g to partials[2g] and partials[2g + 1], the sum of the group being their total. */
+#define COMPENSATED_SUM(NAME, ACC_TYPE, MEAN, VALUE)																		\
+__kernel void NAME(__global const fp_type* in, __global ACC_TYPE* partials, __local ACC_TYPE* sums, __local ACC_TYPE* comps,	\
+	MEAN int size)																											\
+{																															\
+	int lid = get_local_id(0);																								\
+																															\
+	ACC_TYPE sum = 0, comp = 0;																								\
+	for (int i = get_global_id(0); i < size; i += get_global_size(0))														\
+	{																														\
+		ACC_TYPE value = VALUE((ACC_TYPE)in[i]);																			\
+		NEUMAIER_ADD(ACC_TYPE, sum, comp, value)																			\
+	}																														\
+	sums[lid] = sum;																										\
+	comps[lid] = comp;																										\
+																															\
+	for (int i = get_local_size(0) / 2; i > 0; i >>= 1)																		\
+	{																														\
+		barrier(CLK_LOCAL_MEM_FENCE);																						\
+		if (lid < i)																										\
+		{																													\
+			ACC_TYPE other = sums[lid + i];																					\
+			NEUMAIER_ADD(ACC_TYPE, sums[lid], comps[lid], other)															\
+			comps[lid] += comps[lid + i];																					\
+		}																													\
+	}																														\
+																															\
+	if (!lid)																												\
+	{																														\
+		partials[2 * get_group_id(0)] = sums[0];																			\
+		partials[2 * get_group_id(0) + 1] = comps[0];																		\
+	}																														\
+}
+
+COMPENSATED_SUM(compensated_sum_FP, fp_type, NO_MEAN, SUM_VALUE)
+COMPENSATED_SUM(compensated_sqr_diff_FP, fp_type, FP_MEAN, SQR_DIFF_VALUE)
+#ifdef cl_khr_fp64
+COMPENSATED_SUM(compensated_sum_DP, double, NO_MEAN, SUM_VALUE)
+COMPENSATED_SUM(compensated_sqr_diff_DP, double, DP_MEAN, SQR_DIFF_VALUE)
+#endif
+
+#pragma OPENCL FP_CONTRACT ON
+
+
+// ######################################################################################################### //
+// ########################################## TIME SERIES KERNELS ########################################## //
+// ######################################################################################################### //
+
+// The kernels below operate on the dataset once it has been ordered by station and time (see timeseries.h). //
+// Rather than treating every record independently, each record belongs to a segment (a station, or a      //
+// single day of a station) given by seg_start, the index of the first record within its segment. Every    //
+// kernel exists for each operator and type, so they are generated from the macros below rather than being //
+// written out by hand. The segmented sums, minimums and maximums use the scan kernels above.               //
+
+
+
+// WINDOW_MEAN
+/* Mean of every window [window_start, id] from the segmented prefix sums, which restart at every station. The sum of a window is the
+   difference of two prefix sums, unless the window begins at the start of the station in which case it is the prefix sum itself. */
+#define WINDOW_MEAN(NAME, SUM_TYPE)																							\
+__kernel void NAME(__global const SUM_TYPE* prefix, __global const int* seg_start, __global const int* window_start,		\
+	__global fp_type* out, int size)																						\
+{																															\
+	int id = get_global_id(0);																								\
+	if (id >= size)																											\
+		return;																												\
+																															\
+	int first = window_start[id];																							\
+	SUM_TYPE sum = prefix[id] - ((first > seg_start[id]) ? prefix[first - 1] : 0);											\
+	out[id] = (fp_type)sum / (id - first + 1);																				\
+}
+
+WINDOW_MEAN(window_mean_INT_LONG, long)
+WINDOW_MEAN(window_mean_FP, fp_type)
+#ifdef cl_khr_fp64
+WINDOW_MEAN(window_mean_FP_DP, double)
+#endif
+
+
+
+// SPARSE_LEVEL
+/* Build level k of a doubling table over one tile of the series, where level k holds the min/max of the 2^k elements ending at each element
+   (clipped to the start of its segment and of the tile). Level k is level k-1 combined with level k-1 shifted left by 2^(k-1), all levels of
+   the tile are stored within one buffer. base is the position of the tile's first element within the series, and the levels are offset in
+   size_t as size * level may exceed an int. */
+#define SPARSE_LEVEL(NAME, TYPE, OP)																						\
+__kernel void NAME(__global TYPE* levels, __global const int* seg_start, int level, int base, int size)						\
+{																															\
+	int id = get_global_id(0);																								\
+	if (id >= size)																											\
+		return;																												\
+																															\
+	__global const TYPE* prev = levels + (size_t)(level - 1) * size;														\
+	int other = id - (1 << (level - 1));																					\
+	levels[(size_t)level * size + id] = (other >= 0 && base + other >= seg_start[base + id]) ? OP(prev[id], prev[other]) : prev[id];	\
+}
+
+SPARSE_LEVEL(sparse_level_min_INT, int, OP_MIN)
+SPARSE_LEVEL(sparse_level_max_INT, int, OP_MAX)
+SPARSE_LEVEL(sparse_level_min_FP, fp_type, OP_MIN)
+SPARSE_LEVEL(sparse_level_max_FP, fp_type, OP_MAX)
+
+
+
+// WINDOW_EXTREME
+/* Min/max of every window [window_start, id] from the doubling table of a tile, as two (possibly overlapping) power of two ranges which
+   together cover the window exactly. The tile begins with the halo positions before its own, which its windows reach back into, so the
+   work items start after the halo. */
+#define WINDOW_EXTREME(NAME, TYPE, OP)																						\
+__kernel void NAME(__global const TYPE* levels, __global const int* window_start, __global TYPE* out, int base, int halo, int size)	\
+{																															\
+	int id = get_global_id(0) + halo;																						\
+	if (id >= size)																											\
+		return;																												\
+																															\
+	int first = window_start[base + id] - base;																				\
+	int level = 31 - clz(id - first + 1);																					\
+	out[base + id] = OP(levels[(size_t)level * size + id], levels[(size_t)level * size + first + (1 << level) - 1]);		\
+}
+
+WINDOW_EXTREME(window_min_INT, int, OP_MIN)
+WINDOW_EXTREME(window_max_INT, int, OP_MAX)
+WINDOW_EXTREME(window_min_FP, fp_type, OP_MIN)
+WINDOW_EXTREME(window_max_FP, fp_type, OP_MAX)
+
+
+
+// DEGREE_DAYS
+/* Degree days of every day from its minimum and maximum temperature, using the mean of the two. Growing degree days count the degrees above
+   base, heating degree days count the degrees below base. The daily values are then accumulated per season with segmented_scan_add_FP_DP. */
+#define DEGREE_DAYS(NAME, TYPE)																								\
+__kernel void NAME(__global const TYPE* daily_min, __global const TYPE* daily_max, __global fp_type* out,					\
+	fp_type scale, fp_type base, int heating, int size)																		\
+{																															\
+	int id = get_global_id(0);																								\
+	if (id >= size)																											\
+		return;																												\
+																															\
+	fp_type mean = ((fp_type)daily_min[id] + (fp_type)daily_max[id]) / (2.0f * scale);										\
+	out[id] = max((heating) ? base - mean : mean - base, 0.0f);																\
+}
+
+DEGREE_DAYS(degree_days_INT, int)
+DEGREE_DAYS(degree_days_FP, fp_type)
+
+
+// ################################################################################################### //
+// ########################################## TOP K KERNELS ########################################## //
+// ################################################################################################### //
+
+// The k hottest or coldest records without sorting the dataset. Every work group keeps the best        //
+// records it has seen in local memory as a bitonic K-buffer of buffer_size entries, sorted best first. //
+// It claims tiles of buffer_size records in turn, and a tile containing no record better than the      //
+// current k-th best is skipped after a single comparison per record, so once the buffer holds good     //
+// candidates most tiles cost no more than reading them. Otherwise the tile is sorted, the buffer keeps //
+// the better of every entry and its mirror within the tile (a bitonic sequence holding the best        //
+// buffer_size of both) and a bitonic merge sorts it again. Each group writes its best k records with   //
+// their row indices, and the same kernels then merge the candidates of every group until a single      //
+// group remains. See topk.h.                                                                           //
+
+// Records are ordered by value, ties are resolved towards the lower row so that the result is deterministic.
+#define TOP_K_BETTER(va, ra, vb, rb) ((((largest) ? ((va) > (vb)) : ((va) < (vb)))) || ((va) == (vb) && (ra) < (rb)))
+
+#define TOP_K_RECORDS(TYPE) __global const TYPE* in
+#define TOP_K_CANDIDATES(TYPE) __global const TYPE* in, __global const int* in_rows
+#define RECORD_ROW(i) (i)
+#define CANDIDATE_ROW(i) in_rows[i]
+
+#define TOP_K_SWAP(TYPE, a, b)																								\
+{																															\
+	TYPE value = values[a];																									\
+	int row = rows[a];																										\
+	values[a] = values[b];																									\
+	rows[a] = rows[b];																										\
+	values[b] = value;																										\
+	rows[b] = row;																											\
+}
+
+
+
+// TOP_K
+/* values and rows hold 2 * buffer_size entries each, the buffer followed by the current tile. */
+#define TOP_K(NAME, TYPE, COLUMN, ROW)																						\
+__kernel void NAME(COLUMN(TYPE), __global TYPE* out, __global int* out_rows, __local TYPE* values, __local int* rows,		\
+	TYPE worst, int largest, int k, int buffer_size, int size)																\
+{																															\
+	int lid = get_local_id(0);																								\
+	int N = get_local_size(0);																								\
+	int B = buffer_size;																									\
+	__local int better_found;																								\
+																															\
+	for (int i = lid; i < B; i += N)																						\
+	{																														\
+		values[i] = worst;																									\
+		rows[i] = INT_MAX;																									\
+	}																														\
+																															\
+	for (int tile = get_group_id(0) * B; tile < size; tile += get_num_groups(0) * B)										\
+	{																														\
+		barrier(CLK_LOCAL_MEM_FENCE);																						\
+		if (!lid)																											\
+			better_found = 0;																								\
+		barrier(CLK_LOCAL_MEM_FENCE);																						\
+																															\
+		/* Load the tile behind the buffer, noting whether any of its records beats the k-th best so far. */				\
+		TYPE kth_value = values[k - 1];																						\
+		int kth_row = rows[k - 1];																							\
+		for (int i = lid; i < B; i += N)																					\
+		{																													\
+			int id = tile + i;																								\
+			TYPE value = (id < size) ? in[id] : worst;																		\
+			int row = (id < size) ? ROW(id) : INT_MAX;																		\
+			values[B + i] = value;																							\
+			rows[B + i] = row;																								\
+			if (TOP_K_BETTER(value, row, kth_value, kth_row))																\
+				better_found = 1;																							\
+		}																													\
+		barrier(CLK_LOCAL_MEM_FENCE);																						\
+		if (!better_found)																									\
+			continue;																										\
+																															\
+		/* Sort the tile best first. */																						\
+		for (int span = 2; span <= B; span <<= 1)																			\
+		{																													\
+			for (int stride = span / 2; stride > 0; stride >>= 1)															\
+			{																												\
+				for (int p = lid; p < B / 2; p += N)																		\
+				{																											\
+					int a = B + 2 * p - (p & (stride - 1));																	\
+					int b = a + stride;																						\
+					if (TOP_K_BETTER(values[b], rows[b], values[a], rows[a]) == (((a - B) & span) == 0))					\
+						TOP_K_SWAP(TYPE, a, b)																				\
+				}																											\
+				barrier(CLK_LOCAL_MEM_FENCE);																				\
+			}																												\
+		}																													\
+																															\
+		/* Keep the better of every buffer entry and its mirror within the tile, then merge the bitonic result. */			\
+		for (int i = lid; i < B; i += N)																					\
+		{																													\
+			int j = 2 * B - 1 - i;																							\
+			if (TOP_K_BETTER(values[j], rows[j], values[i], rows[i]))														\
+			{																												\
+				values[i] = values[j];																						\
+				rows[i] = rows[j];																							\
+			}																												\
+		}																													\
+		for (int stride = B / 2; stride > 0; stride >>= 1)																	\
+		{																													\
+			barrier(CLK_LOCAL_MEM_FENCE);																					\
+			for (int p = lid; p < B / 2; p += N)																			\
+			{																												\
+				int a = 2 * p - (p & (stride - 1));																			\
+				int b = a + stride;																							\
+				if (TOP_K_BETTER(values[b], rows[b], values[a], rows[a]))													\
+					TOP_K_SWAP(TYPE, a, b)																					\
+			}																												\
+		}																													\
+	}																														\
+																															\
+	barrier(CLK_LOCAL_MEM_FENCE);																							\
+	for (int i = lid; i < k; i += N)																						\
+	{																														\
+		out[get_group_id(0) * k + i] = values[i];																			\
+		out_rows[get_group_id(0) * k + i] = rows[i];																		\
+	}																														\
+}
+
+TOP_K(top_k_INT, int, TOP_K_RECORDS, RECORD_ROW)
+TOP_K(top_k_FP, fp_type, TOP_K_RECORDS, RECORD_ROW)
+TOP_K(top_k_merge_INT, int, TOP_K_CANDIDATES, CANDIDATE_ROW)
+TOP_K(top_k_merge_FP, fp_type, TOP_K_CANDIDATES, CANDIDATE_ROW)
+
+
+// ######################################################################################################### //
+// ########################################## CORRELATION KERNELS ########################################## //
+// ######################################################################################################### //
+
+// Cross-station statistics over the station series aligned onto a common time axis (see                //
+// correlation.h). The aligned grid holds one row of slots per station, a slot being missing where the  //
+// station has no record at that time. Every pair of stations is given groups_per_pair work groups,     //
+// each of which sums the moments of a grid stride of the slots where both stations have a record. The  //
+// values are shifted by the mean of their station and the day of every slot is relative to the middle  //
+// of the dataset, so the squares stay small. The host then adds up the partial moments of every pair,  //
+// so the whole station by station matrix is a single kernel execution.                                 //
+
+#define PAIR_MOMENT_COUNT 9
+#define PRESENT_INT(v) ((v) != INT_MIN)
+#define PRESENT_FP(v) (!isnan(v))
+
+
+
+// PAIR_MOMENTS
+/* partials receives n, sum x, sum y, sum x^2, sum y^2, sum xy, sum t, sum t^2 and sum t(y - x) of every work group, where t is the day. */
+#define PAIR_MOMENTS(NAME, TYPE, ACC_TYPE, PRESENT)																			\
+__kernel void NAME(__global const TYPE* grid, __global const int* days, __global const TYPE* shifts, __global const int* pairs,	\
+	__global ACC_TYPE* partials, __local ACC_TYPE* scratch, int groups_per_pair, int slots)									\
+{																															\
+	int lid = get_local_id(0);																								\
+	int N = get_local_size(0);																								\
+	int pair = get_group_id(0) / groups_per_pair;																			\
+	int part = get_group_id(0) % groups_per_pair;																			\
+	int a = pairs[2 * pair];																								\
+	int b = pairs[2 * pair + 1];																							\
+																															\
+	ACC_TYPE m[PAIR_MOMENT_COUNT];																							\
+	for (int j = 0; j < PAIR_MOMENT_COUNT; j++)																				\
+		m[j] = 0;																											\
+																															\
+	for (int u = part * N + lid; u < slots; u += groups_per_pair * N)														\
+	{																														\
+		TYPE va = grid[(size_t)a * slots + u];																				\
+		TYPE vb = grid[(size_t)b * slots + u];																				\
+		if (PRESENT(va) && PRESENT(vb))																						\
+		{																													\
+			ACC_TYPE x = (ACC_TYPE)va - (ACC_TYPE)shifts[a];																\
+			ACC_TYPE y = (ACC_TYPE)vb - (ACC_TYPE)shifts[b];																\
+			ACC_TYPE t = (ACC_TYPE)days[u];																					\
+			m[0] += 1;																										\
+			m[1] += x;																										\
+			m[2] += y;																										\
+			m[3] += x * x;																									\
+			m[4] += y * y;																									\
+			m[5] += x * y;																									\
+			m[6] += t;																										\
+			m[7] += t * t;																									\
+			m[8] += t * (y - x);																							\
+		}																													\
+	}																														\
+																															\
+	for (int j = 0; j < PAIR_MOMENT_COUNT; j++)																				\
+		scratch[j * N + lid] = m[j];																						\
+	for (int i = N / 2; i > 0; i >>= 1)																						\
+	{																														\
+		barrier(CLK_LOCAL_MEM_FENCE);																						\
+		if (lid < i)																										\
+		{																													\
+			for (int j = 0; j < PAIR_MOMENT_COUNT; j++)																		\
+				scratch[j * N + lid] += scratch[j * N + lid + i];															\
+		}																													\
+	}																														\
+																															\
+	if (!lid)																												\
+	{																														\
+		for (int j = 0; j < PAIR_MOMENT_COUNT; j++)																			\
+			partials[get_group_id(0) * PAIR_MOMENT_COUNT + j] = scratch[j * N];												\
+	}																														\
+}
+
+PAIR_MOMENTS(pair_moments_INT, int, long, PRESENT_INT)
+PAIR_MOMENTS(pair_moments_FP, fp_type, fp_type, PRESENT_FP)
+#ifdef cl_khr_fp64
+PAIR_MOMENTS(pair_moments_DP, fp_type, double, PRESENT_FP)
+#endif
+
+
+// ######################################################################################################### //
+// ########################################## CLIMATOLOGY KERNELS ########################################## //
+// ######################################################################################################### //
+
+// Anomaly detection against a climatology baseline (see climatology.h). The records are grouped by     //
+// station, day of the year and hour, the groups being stored one after another within order (a         //
+// counting sort on the host, performed once per dataset). The first kernel gives one work item to      //
+// every group and computes its mean and standard deviation in a single pass over its records, the      //
+// second scores every record as a z-score against its group and appends the records beyond the         //
+// threshold to a compact list, so only the flagged rows are read back.                                 //
+
+
+
+// CLIMATOLOGY
+/* The values of a group are taken about its first value (shift), so that sum((x - mean)^2) = sqr_diff - offset^2 / n as within
+   CorrectedVariance, which is exact for integers and keeps the squares small for floating point values. */
+#define CLIMATOLOGY(NAME, TYPE, ACC_TYPE, REAL_TYPE)																		\
+__kernel void NAME(__global const TYPE* values, __global const int* order, __global const int* offsets, __global fp_type* means,	\
+	__global fp_type* deviations, int groups)																				\
+{																															\
+	int g = get_global_id(0);																								\
+	if (g >= groups)																										\
+		return;																												\
+																															\
+	int begin = offsets[g];																									\
+	int end = offsets[g + 1];																								\
+	if (begin == end)																										\
+	{																														\
+		means[g] = 0;																										\
+		deviations[g] = 0;																									\
+		return;																												\
+	}																														\
+																															\
+	TYPE shift = values[order[begin]];																						\
+	ACC_TYPE offset = 0;																									\
+	ACC_TYPE sqr_diff = 0;																									\
+	for (int i = begin + 1; i < end; i++)																					\
+	{																														\
+		ACC_TYPE d = (ACC_TYPE)values[order[i]] - (ACC_TYPE)shift;															\
+		offset += d;																										\
+		sqr_diff += d * d;																									\
+	}																														\
+																															\
+	REAL_TYPE n = (REAL_TYPE)(end - begin);																					\
+	REAL_TYPE mean_offset = (REAL_TYPE)offset / n;																			\
+	means[g] = (fp_type)((REAL_TYPE)shift + mean_offset);																	\
+	deviations[g] = (fp_type)sqrt(max((REAL_TYPE)0, (REAL_TYPE)sqr_diff / n - mean_offset * mean_offset));					\
+}
+
+CLIMATOLOGY(climatology_INT, int, long, fp_type)
+CLIMATOLOGY(climatology_FP, fp_type, fp_type, fp_type)
+#ifdef cl_khr_fp64
+CLIMATOLOGY(climatology_DP, fp_type, double, double)
+#endif
+
+
+
+// ANOMALY_SCORES
+/* Scoring and compaction fused into one kernel: each work item scores its record against the climatology of its group, the flagged
+   records of a work group are counted in local memory and a single global atomic per work group reserves their places within rows and
+   scores. Groups of fewer than min_count records, or without any spread, are never flagged. The order of the flagged rows depends on
+   the order in which the work groups finish, so the host sorts them by row. */
+#define ANOMALY_SCORES(NAME, TYPE)																							\
+__kernel void NAME(__global const TYPE* values, __global const int* keys, __global const int* offsets, __global const fp_type* means,	\
+	__global const fp_type* deviations, __global int* rows, __global fp_type* scores, __global int* flagged, fp_type threshold,	\
+	int min_count, int size)																								\
+{																															\
+	__local int local_count;																								\
+	__local int local_base;																									\
+	int i = get_global_id(0);																								\
+	int lid = get_local_id(0);																								\
+	if (!lid)																												\
+		local_count = 0;																									\
+	barrier(CLK_LOCAL_MEM_FENCE);																							\
+																															\
+	int slot = -1;																											\
+	fp_type z = 0;																											\
+	if (i < size)																											\
+	{																														\
+		int g = keys[i];																									\
+		fp_type deviation = deviations[g];																					\
+		if (offsets[g + 1] - offsets[g] >= min_count && deviation > 0)														\
+		{																													\
+			z = ((fp_type)values[i] - means[g]) / deviation;																\
+			if (fabs(z) >= threshold)																						\
+				slot = atomic_inc(&local_count);																			\
+		}																													\
+	}																														\
+	barrier(CLK_LOCAL_MEM_FENCE);																							\
+																															\
+	if (!lid)																												\
+		local_base = atomic_add(flagged, local_count);																		\
+	barrier(CLK_LOCAL_MEM_FENCE);																							\
+																															\
+	if (slot >= 0)																											\
+	{																														\
+		rows[local_base + slot] = i;																						\
+		scores[local_base + slot] = z;																						\
+	}																														\
+}
+
+ANOMALY_SCORES(anomaly_scores_INT, int)
+ANOMALY_SCORES(anomaly_scores_FP, fp_type)
\ No newline at end of file
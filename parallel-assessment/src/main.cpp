@@ -8,6 +8,8 @@
 #include "analytics.h"
 #include "funcs.h"
 #include "paths.h"
+#include "records.h"
+#include "dataset.h"
 #include "menu_system.h"
 
 #ifndef cl_included
@@ -25,6 +27,20 @@ void PrintHelp() {
 	std::cerr << "  -p : select platform " << std::endl;
 	std::cerr << "  -d : select device" << std::endl;
 	std::cerr << "  -l : list all platforms and devices" << std::endl;
+	std::cerr << "  -m : split operations across all devices" << std::endl;
+	std::cerr << "  -n : execute operations on the native thread pool" << std::endl;
+	std::cerr << "  -t : select the number of native threads" << std::endl;
+	std::cerr << "  -s : load the short dataset" << std::endl;
+	std::cerr << "  -i : load every file of a directory or glob as one dataset" << std::endl;
+	std::cerr << "  -S : only load records of a station" << std::endl;
+	std::cerr << "  -Y : only load records of a year, or range of years as first:last" << std::endl;
+	std::cerr << "  -z : index the dataset and decode only the records and columns which are used" << std::endl;
+	std::cerr << "  -q : normalised rank error of the quantile sketches, e.g. 0.001 (default 0.005)" << std::endl;
+	std::cerr << "  -j : minutes per time slot when joining stations at matching times (default 60)" << std::endl;
+	std::cerr << "  -a : fewest records of a station, day of the year and hour for its climatology to flag anomalies (default 5)" << std::endl;
+	std::cerr << "  -H : never back the large host arrays with huge pages" << std::endl;
+	std::cerr << "  -C : count cycles, instructions, LLC misses and branch misses of the host work (Linux only)" << std::endl;
+	std::cerr << "  -R : directory of the project (holding src and data), found automatically by default" << std::endl;
 	std::cerr << "  -h : print this message" << std::endl;
 }
 
@@ -53,25 +69,51 @@ inline void InitCL(int platform_id, int device_id)
 	}
 }
 
-inline void InitData(const char* dir, fp_type*& out_arr, size_t& out_size)
+inline bool InitData(const std::string& pattern, const DatasetQuery& query, fp_type*& out_arr, int*& out_int_arr, size_t& out_size)
 {
+	// List the partitions of the dataset, a single file being a dataset of one partition.
 	timer::Start();
-	unsigned int len;
-	const char* inFile = winstr::ReadOptimal(dir, len);
-
-	std::cout << "Sequential read "<< GetResolutionString(profiler_resolution) << ": " << timer::Query(profiler_resolution) << std::endl;
+	if (!dataset.Open(pattern))
+	{
+		std::cout << "No files match " << pattern << std::endl;
+		return false;
+	}
 
-	out_size = winstr::QueryLineCount(inFile, len);
-	out_arr = winstr::ParseLines(inFile, len, ' ', 5, out_size);
+	/* Read the partitions kept by the query through the pipeline, which parses the temperature (column 5), station and time columns of every
+	   block already read, converts the temperatures to integers (multiplied by 10) and streams every parsed block to the device. A lazy load
+	   only indexes the lines and decodes the temperatures of the selected records, leaving the station and time columns until their first use. */
+	dataset.stream_to_device = !dataset.lazy;
+	dataset.Load(*GetThreadPool(), query, ' ', 5, stations, times);
+	out_arr = dataset.values.Data();
+	out_int_arr = dataset.int_values.Data();
+	out_size = dataset.size;
+
+	// The streamed columns become the resident columns of the filtered statistics, which then never upload the dataset again.
+	if (dataset.stream_to_device && out_size)
+	{
+		fp_columns.Adopt(out_size, dataset.device_values, dataset.device_station_ids);
+		int_columns.Adopt(out_size, dataset.device_int_values, dataset.device_station_ids);
+	}
 
-	std::cout << "Sequential parse " << GetResolutionString(profiler_resolution) << ": " << timer::QuerySinceLast(profiler_resolution) << std::endl;
-	timer::Stop();
+	std::cout << "Loaded " << dataset.loaded.size() << " of " << dataset.partitions.size() << " partitions (" << query.Describe() << ", "
+		<< dataset.LoadedBytes() << " bytes, " << out_size << " records, " << stations.StationCount() << " stations)" << std::endl;
+	if (dataset.lazy)
+		std::cout << "Indexed read/lazy parse (" << dataset.io_threads << " I/O threads, " << GetThreadPool()->Size() << " threads) ";
+	else std::cout << "Pipelined read/parse/upload (" << ((dataset.lanes) ? dataset.lanes : GetThreadPool()->Size()) << " lanes) ";
+	std::cout << GetResolutionString(profiler_resolution) << ": " << timer::Stop(profiler_resolution) << std::endl;
+	PrintCounterInfo("load", counters::read);
+	PrintCounterInfo("load", counters::parse);
+	PrintCounterInfo("load", counters::convert);
+	return out_size > 0;
 }
 
 int main(int argc, char **argv) {
 	int platform_id = 0;
 	int device_id = 0;
-	char* file_dir = "temp_lincolnshire.txt";
+	const char* file_dir = "temp_lincolnshire.txt";
+	const char* dataset_pattern = nullptr;
+	const char* root = nullptr;
+	DatasetQuery query;
 
 	for (int i = 1; i < argc; i++)
 	{
@@ -80,29 +122,49 @@ int main(int argc, char **argv) {
 		else if (strcmp(argv[i], "-l") == 0) { std::cout << ListPlatformsDevices() << std::endl; }
 		else if (strcmp(argv[i], "-h") == 0) { PrintHelp(); }
 		else if (strcmp(argv[i], "-s") == 0) { file_dir = "temp_lincolnshire_short.txt"; }
+		else if (strcmp(argv[i], "-m") == 0) { execution_backend = MultiDevice; }
+		else if (strcmp(argv[i], "-n") == 0) { execution_backend = NativeThreads; }
+		else if ((strcmp(argv[i], "-t") == 0) && (i < (argc - 1))) { thread_count = atoi(argv[++i]); }
+		else if (strcmp(argv[i], "-z") == 0) { dataset.lazy = true; }
+		else if (strcmp(argv[i], "-H") == 0) { memory_arena.huge_pages = false; }
+		else if (strcmp(argv[i], "-C") == 0) { counters::enabled = true; }
+		else if ((strcmp(argv[i], "-j") == 0) && (i < (argc - 1))) { join_resolution = std::max(1, atoi(argv[++i])); }
+		else if ((strcmp(argv[i], "-a") == 0) && (i < (argc - 1))) { climatology_min_count = std::max(2, atoi(argv[++i])); }
+		else if ((strcmp(argv[i], "-q") == 0) && (i < (argc - 1))) { dataset.sketch_error = std::max(1e-6, atof(argv[++i])); }
+		else if ((strcmp(argv[i], "-i") == 0) && (i < (argc - 1))) { dataset_pattern = argv[++i]; }
+		else if ((strcmp(argv[i], "-R") == 0) && (i < (argc - 1))) { root = argv[++i]; }
+		else if ((strcmp(argv[i], "-S") == 0) && (i < (argc - 1))) { query.station = argv[++i]; }
+		else if ((strcmp(argv[i], "-Y") == 0) && (i < (argc - 1)))
+		{
+			if (!ParseYearRange(argv[++i], query))
+				std::cerr << "Invalid year range " << argv[i] << ", loading every year." << std::endl;
+		}
 	}
 
 	try
 	{
-		InitPaths();
+		InitPaths(root);
 		InitCL(platform_id, device_id);
 		InitMenus();
 
+		if (execution_backend == MultiDevice)
+			GetMultiDevice();
+
 		// Integer and floating point arrays to account for alternate precision within funcs.h.
 		int *A, *B;
 		fp_type *A_f, *B_f;
 
-		// Initialize all of the data, this reads the file and parses it as floating point numbers.
+		// Initialize all of the data, this reads every partition of the dataset and parses it as floating point numbers and integers.
 		size_t base_size = 0;
-		InitData(std::string(data_path + file_dir).c_str(), A_f, base_size);
+		// The integer array A holds every temperature multiplied by 10, converted as the floating point array is parsed.
+		bool finished = !InitData((dataset_pattern) ? std::string(dataset_pattern) : data_path + file_dir, query, A_f, A, base_size);
+		if (finished)
+			std::cout << "The dataset is empty." << std::endl;
 
-		// Convert from the floating point array to integers and store within A.
 		size_t original_size = base_size;
-		A = convert(A_f, base_size, 10);
 
 		std::cout << std::endl;
-		
-		bool finished = false;
+
 		while (!finished)
 		{
 			// Loop to constantly display interactive menu system, for unlimited operations on the given dataset in one runtime.
@@ -111,10 +173,26 @@ int main(int argc, char **argv) {
 			else if (optimize_flag == Precision)
 				MainMenu(A_f, B_f, base_size, original_size, finished);
 		}
+
+		// Release the cached kernels and pooled scratch buffers before the context is torn down.
+		ReleaseMultiDevice();
+		ReleaseThreadPool();
+		climatology_index.Release();
+		sorted_index.Invalidate();
+		time_series.Release();
+		ReleaseColumns();
+		compressed_column.Release();
+		half_column.Release();
+		stations.Release();
+		times.Release();
+		dataset.Release();
+		ReleasePools();
 	}
 	catch (cl::Error err) {
 		std::cerr << "ERROR: " << err.what() << ", " << getErrorString(err.err()) << std::endl;
+	#ifdef _WIN32
 		system("pause");
+	#endif
 	}
 
 	return 0;
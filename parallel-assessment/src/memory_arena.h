@@ -0,0 +1,296 @@
+#ifndef memoryarena_h
+#define memoryarena_h
+
+#include <map>
+#include <mutex>
+#include <new>
+#include <string>
+#include <cstddef>
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+#endif
+
+/* Every host array of the program (the dataset columns, the padded copies of Resize() and the scratch and result slots of the BufferPool)
+   is allocated from the arena below and owned by an ArenaArray, which returns it to the arena when it is released or destroyed. Previously
+   these were raw new[] arrays of which many were never deleted, so memory grew with every query of a long session.
+
+   Blocks are rounded up to a size class (powers of two up to a huge page, then whole huge pages) and a released block is kept on the free
+   list of its class, up to cache_limit bytes, so that a repeated query reuses the blocks of the query before rather than asking the system
+   again. Blocks of at least a huge page are mapped directly and, where enabled, backed by huge pages: transparent huge pages on Linux and
+   large pages on Windows (which requires the lock pages in memory privilege, otherwise normal pages are used). Mapped pages are not
+   touched here, so the first write (possibly from a pinned worker thread) still decides which NUMA node backs each page. */
+
+enum MemoryCategory
+{
+	DatasetMemory,						// Columns of the loaded dataset.
+	ScratchMemory,						// Padded copies, scratch and result buffers reused between executions.
+	memory_category_count
+};
+
+const size_t huge_page_bytes = 2 << 20;		// Size class granularity of the large blocks, the common x86 huge page.
+const size_t min_block_bytes = 64;
+
+class MemoryArena
+{
+	struct Block
+	{
+		size_t bytes = 0;				// Size class of the block.
+		MemoryCategory category = ScratchMemory;
+		bool mapped = false;			// Whether the block was mapped directly rather than taken from the heap.
+		bool huge = false;				// Whether the block is backed by huge pages.
+	};
+
+	private:
+		std::mutex mutex;
+		std::map<void*, Block> live;						// Every block currently handed out.
+		std::multimap<size_t, std::pair<void*, Block>> cached;	// Released blocks by size class, reused before allocating again.
+		size_t cached_bytes = 0;
+		size_t current[memory_category_count] = {};
+		size_t peak[memory_category_count] = {};
+		size_t peak_total = 0;
+		size_t huge_bytes = 0;
+		size_t system_allocations = 0;
+		size_t reused_allocations = 0;
+
+		static size_t SizeClass(size_t bytes)
+		{
+			if (bytes >= huge_page_bytes)
+				return (bytes + huge_page_bytes - 1) / huge_page_bytes * huge_page_bytes;
+
+			size_t size_class = min_block_bytes;
+			while (size_class < bytes)
+				size_class <<= 1;
+			return size_class;
+		}
+
+		void* SystemAllocate(Block& block)
+		{
+			// Small blocks come from the heap, large blocks are mapped directly so that they can be given huge pages and are returned in full.
+			if (block.bytes < huge_page_bytes)
+				return ::operator new(block.bytes);
+
+			block.mapped = true;
+		#ifdef _WIN32
+			SIZE_T large_page = GetLargePageMinimum();
+			if (huge_pages && large_page && block.bytes % large_page == 0)
+			{
+				void* data = VirtualAlloc(NULL, block.bytes, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+				if (data)
+				{
+					block.huge = true;
+					return data;
+				}
+			}
+
+			void* data = VirtualAlloc(NULL, block.bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+			if (!data)
+				throw std::bad_alloc();
+			return data;
+		#else
+			void* data = mmap(nullptr, block.bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (data == MAP_FAILED)
+				throw std::bad_alloc();
+			#ifdef MADV_HUGEPAGE
+			block.huge = huge_pages && madvise(data, block.bytes, MADV_HUGEPAGE) == 0;
+			#endif
+			return data;
+		#endif
+		}
+
+		void SystemFree(void* data, const Block& block)
+		{
+			if (!block.mapped)
+			{
+				::operator delete(data);
+				return;
+			}
+
+		#ifdef _WIN32
+			VirtualFree(data, 0, MEM_RELEASE);
+		#else
+			munmap(data, block.bytes);
+		#endif
+		}
+
+	public:
+		bool huge_pages = true;							// Whether blocks of at least a huge page are backed by huge pages.
+		size_t cache_limit = 256 << 20;					// Most bytes of released blocks kept for reuse.
+
+		~MemoryArena()
+		{
+			Trim();
+		}
+
+		void* Allocate(size_t bytes, MemoryCategory category)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			Block block;
+			block.bytes = SizeClass(std::max<size_t>(1, bytes));
+			block.category = category;
+
+			// Reuse a released block of the same size class where there is one, otherwise ask the system.
+			void* data = nullptr;
+			std::multimap<size_t, std::pair<void*, Block>>::iterator it = cached.find(block.bytes);
+			if (it != cached.end())
+			{
+				data = it->second.first;
+				block.mapped = it->second.second.mapped;
+				block.huge = it->second.second.huge;
+				cached_bytes -= block.bytes;
+				cached.erase(it);
+				reused_allocations++;
+			}
+			else
+			{
+				data = SystemAllocate(block);
+				system_allocations++;
+			}
+
+			live[data] = block;
+			current[category] += block.bytes;
+			peak[category] = std::max(peak[category], current[category]);
+			peak_total = std::max(peak_total, CurrentBytes());
+			if (block.huge)
+				huge_bytes += block.bytes;
+			return data;
+		}
+
+		void Free(void* data)
+		{
+			if (!data)
+				return;
+
+			std::lock_guard<std::mutex> lock(mutex);
+			std::map<void*, Block>::iterator it = live.find(data);
+			if (it == live.end())
+				return;
+
+			Block block = it->second;
+			live.erase(it);
+			current[block.category] -= block.bytes;
+			if (block.huge)
+				huge_bytes -= block.bytes;
+
+			// Keep the block for the next allocation of its class unless the cache is full.
+			if (cached_bytes + block.bytes <= cache_limit)
+			{
+				cached.insert(std::make_pair(block.bytes, std::make_pair(data, block)));
+				cached_bytes += block.bytes;
+			}
+			else SystemFree(data, block);
+		}
+
+		void Trim()
+		{
+			// Return every cached block to the system.
+			std::lock_guard<std::mutex> lock(mutex);
+			for (std::multimap<size_t, std::pair<void*, Block>>::iterator it = cached.begin(); it != cached.end(); ++it)
+				SystemFree(it->second.first, it->second.second);
+			cached.clear();
+			cached_bytes = 0;
+		}
+
+		size_t CurrentBytes() const
+		{
+			size_t total = 0;
+			for (int c = 0; c < memory_category_count; c++)
+				total += current[c];
+			return total;
+		}
+
+		size_t CurrentBytes(MemoryCategory category) const { return current[category]; }
+		size_t PeakBytes(MemoryCategory category) const { return peak[category]; }
+		size_t PeakBytes() const { return peak_total; }
+		size_t CachedBytes() const { return cached_bytes; }
+		size_t HugePageBytes() const { return huge_bytes; }
+		size_t LiveBlocks() const { return live.size(); }
+		size_t SystemAllocations() const { return system_allocations; }
+		size_t ReusedAllocations() const { return reused_allocations; }
+};
+
+MemoryArena memory_arena;					// Owner of every host array, see ArenaArray.
+
+template<typename T>
+class ArenaArray
+{
+	/* A single owner of an uninitialised array of count T from the arena, returned to the arena when released, reallocated or destroyed.
+	   Only trivially copyable types are held, the elements are never constructed or destroyed. */
+	private:
+		T* data = nullptr;
+		size_t count = 0;
+
+	public:
+		ArenaArray() {}
+
+		ArenaArray(size_t _count, MemoryCategory category)
+		{
+			Allocate(_count, category);
+		}
+
+		ArenaArray(ArenaArray&& other)
+			: data(other.data), count(other.count)
+		{
+			other.data = nullptr;
+			other.count = 0;
+		}
+
+		ArenaArray& operator=(ArenaArray&& other)
+		{
+			if (this != &other)
+			{
+				Release();
+				std::swap(data, other.data);
+				std::swap(count, other.count);
+			}
+			return *this;
+		}
+
+		ArenaArray(const ArenaArray&) = delete;
+		ArenaArray& operator=(const ArenaArray&) = delete;
+
+		~ArenaArray()
+		{
+			Release();
+		}
+
+		T* Allocate(size_t _count, MemoryCategory category)
+		{
+			Release();
+			data = static_cast<T*>(memory_arena.Allocate(std::max<size_t>(1, _count) * sizeof(T), category));
+			count = _count;
+			return data;
+		}
+
+		void Release()
+		{
+			memory_arena.Free(data);
+			data = nullptr;
+			count = 0;
+		}
+
+		T* Data() const { return data; }
+		size_t Count() const { return count; }
+		T& operator[](size_t i) const { return data[i]; }
+};
+
+std::string FormatBytes(size_t bytes)
+{
+	// Format a byte count in the largest binary unit below it, e.g. "14.3 MiB".
+	const char* units[] = { "B", "KiB", "MiB", "GiB", "TiB" };
+	double value = (double)bytes;
+	int unit = 0;
+	while (value >= 1024.0 && unit < 4)
+	{
+		value /= 1024.0;
+		unit++;
+	}
+
+	char buffer[32];
+	snprintf(buffer, sizeof(buffer), (unit) ? "%.1f %s" : "%.0f %s", value, units[unit]);
+	return buffer;
+}
+
+#endif
@@ -4,9 +4,24 @@
 #include <vector>
 #include <string>
 #include <functional>
+#include <memory>
 #include <iostream>
 
 #include "funcs.h"
+#include "multi_device.h"
+#include "native_funcs.h"
+#include "histogram.h"
+#include "records.h"
+#include "timeseries.h"
+#include "filter.h"
+#include "compressed.h"
+#include "summation.h"
+#include "dataset.h"
+#include "quantile_sketch.h"
+#include "topk.h"
+#include "correlation.h"
+#include "climatology.h"
+#include "sorted_index.h"
 
 class MenuSystem
 {
@@ -42,18 +57,18 @@ class MenuSystem
 
 	private:
 		int current_screen = 0;
-		std::vector<Screen*> screens;
+		std::vector<std::unique_ptr<Screen>> screens;
 
 	public:
 		void AddScreen(const char* description)
 		{
-			if (description != "")
-				screens.push_back(new Screen(description));
+			if (description && *description)
+				screens.emplace_back(new Screen(description));
 		}
 
 		void AddScreenOption(int index, const char* text)
 		{
-			if (index >= 0 && index < screens.size() && text != "")
+			if (index >= 0 && index < screens.size() && text && *text)
 				screens[index]->AddOption(text);
 		}
 
@@ -76,6 +91,24 @@ class MenuSystem
 			return selection;
 		}
 
+		double GetValueInput(const char* prompt)
+		{
+			std::cout << prompt;
+
+			std::string input;
+			std::cin >> input;
+			double value = 0.0;
+
+			try { value = std::stod(input); }
+			catch(...)
+			{
+				std::cout << "\nInvalid value, try again. ";
+				return GetValueInput(prompt);
+			}
+
+			return value;
+		}
+
 		void ShowScreen(int index)
 		{
 			if (index >= 0 && index < screens.size())
@@ -90,10 +123,10 @@ class MenuSystem
    including a main menu, global/local menu and optimization menu. From the menu system, the user can perform any operation they
    desire and even modify program runtime variables to operate differently on the data set. */
 
-MenuSystem* menu_system;
+std::unique_ptr<MenuSystem> menu_system;
 void InitMenus()
 {
-	menu_system = new MenuSystem();
+	menu_system.reset(new MenuSystem());
 
 	menu_system->AddScreen("What would you like to do?");
 	menu_system->AddScreenOption(0, "Find Minimum");
@@ -105,6 +138,15 @@ void InitMenus()
 	menu_system->AddScreenOption(0, "Find Lower Quartile");
 	menu_system->AddScreenOption(0, "Toggle Work Group Size");
 	menu_system->AddScreenOption(0, "Choose Optimization Mode");
+	menu_system->AddScreenOption(0, "Choose Execution Backend");
+	menu_system->AddScreenOption(0, "Temperature Distribution");
+	menu_system->AddScreenOption(0, "Time Series Aggregates");
+	menu_system->AddScreenOption(0, "Filtered Statistics");
+	menu_system->AddScreenOption(0, "Choose Column Storage");
+	menu_system->AddScreenOption(0, "Extreme Records (Top K)");
+	menu_system->AddScreenOption(0, "Station Correlations");
+	menu_system->AddScreenOption(0, "Anomaly Detection");
+	menu_system->AddScreenOption(0, "Sorted Index Queries");
 	menu_system->AddScreenOption(0, "Exit");
 
 	menu_system->AddScreen("Operate using Global or Local memory?");
@@ -114,6 +156,220 @@ void InitMenus()
 	menu_system->AddScreen("What would you like to optimize for?");
 	menu_system->AddScreenOption(2, "Performance");
 	menu_system->AddScreenOption(2, "Precision");
+	menu_system->AddScreenOption(2, "Precision (Compensated Float Sums)");
+	menu_system->AddScreenOption(2, "Precision (Compensated Double Sums)");
+
+	menu_system->AddScreen("Where would you like to execute?");
+	menu_system->AddScreenOption(3, "OpenCL (Single Device)");
+	menu_system->AddScreenOption(3, "OpenCL (All Devices)");
+	menu_system->AddScreenOption(3, "Native Thread Pool");
+
+	menu_system->AddScreen("Distribution of which records?");
+	menu_system->AddScreenOption(4, "All Stations");
+	menu_system->AddScreenOption(4, "Per Station");
+	menu_system->AddScreenOption(4, "Any Percentile (Quantile Sketch)");
+	menu_system->AddScreenOption(4, "Any Percentile (Exact Selection)");
+
+	menu_system->AddScreen("Which time series aggregate?");
+	menu_system->AddScreenOption(5, "24 Hour Rolling Mean/Min/Max");
+	menu_system->AddScreenOption(5, "30 Day Rolling Mean/Min/Max");
+	menu_system->AddScreenOption(5, "Daily Minimum/Maximum");
+	menu_system->AddScreenOption(5, "Degree Days");
+
+	menu_system->AddScreen("Statistics of which records?");
+	menu_system->AddScreenOption(6, "Below Freezing");
+	menu_system->AddScreenOption(6, "At or Above Freezing");
+	menu_system->AddScreenOption(6, "Temperature Range");
+	menu_system->AddScreenOption(6, "Single Station");
+
+	menu_system->AddScreen("How should the columns be stored?");
+	menu_system->AddScreenOption(7, "Plain (4 bytes per record)");
+	menu_system->AddScreenOption(7, "Int16 (2 bytes per record, Performance)");
+	menu_system->AddScreenOption(7, "Bit-Packed Blocks (Performance)");
+	menu_system->AddScreenOption(7, "Half (2 bytes per record, Precision)");
+
+	menu_system->AddScreen("Which station correlations?");
+	menu_system->AddScreenOption(8, "Every Station Pair");
+	menu_system->AddScreenOption(8, "One Station Pair");
+	menu_system->AddScreenOption(8, "Set Join Resolution");
+
+	menu_system->AddScreen("Which sorted index query?");
+	menu_system->AddScreenOption(9, "Percentile Rank of a Temperature");
+	menu_system->AddScreenOption(9, "Count Between Two Temperatures");
+	menu_system->AddScreenOption(9, "Any Percentile");
+	menu_system->AddScreenOption(9, "Trimmed Mean");
+	menu_system->AddScreenOption(9, "Rebuild Index");
+}
+
+/* The functions below route each statistics operation to the currently selected execution backend. The multi-device and native backends
+   always operate on the local reduction variants since they have no global memory equivalent, and the single device reductions use the
+   compressed kernels when a storage of their column is selected (int16 or bit-packed for the integer column, half for the floating point
+   column), while the floating point sums otherwise use the compensated kernels when a compensated summation is selected. */
+
+template<typename T>
+void BackendMinMax(T*& A, T*& B, size_t& base_size, size_t original_size, bool dir)
+{
+	switch (execution_backend)
+	{
+		case MultiDevice: MultiMinMax(A, B, base_size, original_size, dir); break;
+		case NativeThreads: NativeMinMax(A, B, base_size, original_size, dir); break;
+		default:
+			if (!StorageReduce(A, B, original_size, (dir) ? "reduce_max" : "reduce_min", (dir) ? std::numeric_limits<T>::lowest() : std::numeric_limits<T>::max()))
+				LocalMinMax(A, B, base_size, original_size, dir);
+			break;
+	}
+}
+
+template<typename T>
+typename Accumulator<T>::type BackendSum(T*& A, size_t& base_size, size_t original_size)
+{
+	// The sums are of the accumulator type (64 bits for integers) rather than T, so the result is returned rather than held within B.
+	typedef typename Accumulator<T>::type Acc;
+	Acc* S = nullptr;
+	switch (execution_backend)
+	{
+		case MultiDevice: MultiSum(A, S, base_size, original_size); break;
+		case NativeThreads: NativeSum(A, S, base_size, original_size); break;
+		default:
+			if (!StorageReduce(A, S, original_size, "reduce_sum", (Acc)0) && !CompensatedReduce(A, S, original_size))
+				Sum(A, S, base_size, original_size);
+			break;
+	}
+
+	return S[0];
+}
+
+template<typename T>
+double BackendVariance(T*& A, size_t& base_size, size_t original_size, typename Accumulator<T>::type sum)
+{
+	// The squared differences are taken from the mean in the type of the data, then corrected to the exact mean of sum.
+	typedef typename Accumulator<T>::type Acc;
+	T shift = (T)mean(sum, original_size);
+	Acc* S = nullptr;
+	switch (execution_backend)
+	{
+		case MultiDevice: MultiVariance(A, S, base_size, original_size, shift); break;
+		case NativeThreads: NativeVariance(A, S, base_size, original_size, shift); break;
+		default:
+			if (!StorageReduce(A, S, original_size, "sum_sqr_diff", (Acc)0, &shift) && !CompensatedReduce(A, S, original_size, &shift))
+				Variance(A, S, base_size, original_size, shift);
+			break;
+	}
+
+	return CorrectedVariance(S[0], sum, shift, original_size);
+}
+
+template<typename T>
+std::vector<Histogram> BackendHistograms(T*& A, size_t& base_size, size_t original_size, const StationColumn* column)
+{
+	// The multi-device backend has no histogram of its own, the bins are tiny so a single device is already bound by reading the input.
+	switch (execution_backend)
+	{
+		case NativeThreads: return NativeHistograms(A, original_size, column);
+		default: return DeviceHistograms(A, base_size, original_size, column);
+	}
+}
+
+template<typename T>
+std::vector<ExtremeRecord<T>> BackendTopK(T*& A, size_t original_size, size_t k, bool largest)
+{
+	// As with the histograms, the multi-device backend uses the single device as the candidates are tiny once each group has merged.
+	switch (execution_backend)
+	{
+		case NativeThreads: return NativeTopK(A, original_size, k, largest);
+		default: return DeviceTopK(ResidentColumns(A, original_size), k, largest);
+	}
+}
+
+template<typename T>
+void ExtremesMenu(T*& A, size_t original_size, fp_type division)
+{
+	// The station and time of every record are reported, so both columns must be decoded (and the station column resident).
+	RequireRecordColumns();
+	size_t k = (size_t)std::max(1.0, menu_system->GetValueInput("How many records (K)? "));
+	if (k > max_top_k)
+	{
+		printf("K is limited to %zu.\n", max_top_k);
+		k = max_top_k;
+	}
+
+	std::vector<ExtremeRecord<T>> hottest = BackendTopK(A, original_size, k, true);
+	std::vector<ExtremeRecord<T>> coldest = BackendTopK(A, original_size, k, false);
+	PrintExtremes("Hottest records", hottest, division);
+	PrintExtremes("Coldest records", coldest, division);
+}
+
+int StationInput(const char* prompt)
+{
+	// List the stations and return the selected station id, or -1 when the selection is invalid.
+	printf("%s", prompt);
+	for (size_t i = 0; i < stations.StationCount(); i++)
+		printf("\n\t%zu. %s", i + 1, stations.names[i].c_str());
+
+	int station = menu_system->GetScreenOptionSelection() - 1;
+	return (station < 0 || station >= (int)stations.StationCount()) ? -1 : station;
+}
+
+template<typename T>
+void CorrelationMenu(T*& A, size_t original_size, fp_type division)
+{
+	menu_system->ShowScreen(8);
+
+	// The multi-device backend uses the single device, every pair of the matrix is already a single execution.
+	int selection = menu_system->GetScreenOptionSelection();
+	if (selection == 3)
+	{
+		join_resolution = (unsigned int)std::max(1.0, menu_system->GetValueInput("Minutes per time slot: "));
+		printf("Join Resolution = %u minutes\n\n", join_resolution);
+		return;
+	}
+	if (selection != 1 && selection != 2)
+		return;
+
+	RequireRecordColumns();
+	int a = -1, b = -1;
+	if (selection == 2)
+	{
+		a = StationInput("First station?");
+		b = (a < 0) ? -1 : StationInput("Second station?");
+		if (a < 0 || b < 0 || a == b)
+			return;
+	}
+
+	std::vector<PairStatistics> statistics = StationCorrelations(A, original_size, execution_backend == NativeThreads, division);
+	if (selection == 1)
+	{
+		ReportCorrelations(statistics);
+		return;
+	}
+
+	for (size_t p = 0; p < statistics.size(); p++)
+	{
+		if (statistics[p].a == std::min(a, b) && statistics[p].b == std::max(a, b))
+			ReportPair(statistics[p]);
+	}
+}
+
+template<typename T>
+void AnomalyMenu(T*& A, size_t original_size, fp_type division)
+{
+	// The station and time of every record are reported, so both columns must be decoded. The multi-device backend uses the single device.
+	RequireRecordColumns();
+	double threshold = menu_system->GetValueInput("Z-score threshold: ");
+	if (threshold > 0)
+		anomaly_threshold = threshold;
+
+	ReportAnomalies(ClimatologyAnomalies(A, original_size, execution_backend == NativeThreads), A, division);
+}
+
+const char* BackendName()
+{
+	switch (execution_backend)
+	{
+		case MultiDevice: return "OPENCL (ALL DEVICES)";
+		case NativeThreads: return "NATIVE THREAD POOL";
+		default: return "OPENCL (SINGLE DEVICE)";
+	}
 }
 
 template<typename T>
@@ -131,12 +387,245 @@ void MinMaxMenu(T*& A, T*& B, size_t& base_size, size_t original_size, fp_type d
 			printf(text, B[0] / division);
 			break;
 		case 2:
-			LocalMinMax(A, B, base_size, original_size, dir);
+			BackendMinMax(A, B, base_size, original_size, dir);
 			printf(text, B[0] / division);
 			break;
 	}
 }
 
+void PrintDistribution(const std::string& name, const Histogram& histogram)
+{
+	// Every statistic below is read directly from the bins, none of them require the dataset to be sorted.
+	if (histogram.Empty())
+		return;
+
+	printf("%s (%llu records, %zu bins of %.1f)\n", name.c_str(), histogram.Total(), histogram.Bins(), 1.0 / 10.0);
+	printf("\tMinimum: %.1f, Maximum: %.1f, Mode: %.1f\n", histogram.Min(), histogram.Max(), histogram.Mode());
+	printf("\tP1: %.1f, P5: %.1f, Lower Quartile: %.1f, Median: %.1f, Upper Quartile: %.1f, P95: %.1f, P99: %.1f\n",
+		histogram.Percentile(0.01), histogram.Percentile(0.05), histogram.LowerQuartile(), histogram.Median(),
+		histogram.UpperQuartile(), histogram.Percentile(0.95), histogram.Percentile(0.99));
+	printf("\tCDF: P(T <= 0.0) = %.4f, P(T <= 10.0) = %.4f, P(T <= 20.0) = %.4f\n\n", histogram.Cdf(0.0), histogram.Cdf(10.0), histogram.Cdf(20.0));
+}
+
+void PrintSketchPercentile(double q)
+{
+	// Answered from the sketches built while parsing, so neither the columns nor the device are touched.
+	const QuantileSketch& sketch = dataset.sketch;
+	timer::Start();
+	fp_type value = sketch.Quantile(q);
+	long long time = timer::Stop(PROF_US);
+	printf("P%g: %.3f (sketch of %llu records in %zu items, rank error within %.2f%%, answered in %lld [us])\n", q * 100.0, value,
+		sketch.Count(), sketch.Items(), sketch.RankError() * 100.0, time);
+
+	// Every partition keeps its own sketch, which answers the same percentile of the partition alone.
+	if (dataset.loaded.size() > 1 && dataset.loaded.size() <= 32)
+	{
+		for (size_t i = 0; i < dataset.loaded.size(); i++)
+		{
+			const DatasetPartition& partition = dataset.partitions[dataset.loaded[i]];
+			if (partition.sketch.Count())
+				printf("\t%s: %.3f (%llu records)\n", partition.path.c_str(), partition.sketch.Quantile(q), partition.sketch.Count());
+		}
+	}
+	printf("\n");
+}
+
+template<typename T>
+void SortedIndexMenu(T*& A, T*& B, size_t& base_size, size_t original_size, fp_type division)
+{
+	menu_system->ShowScreen(9);
+
+	// Every query reads the values in the units of the column, so the temperatures entered are multiplied by the division.
+	int selection = menu_system->GetScreenOptionSelection();
+	if (selection == 5)
+	{
+		sorted_index.Invalidate();
+		GetSortedIndex(A, B, base_size, original_size);
+		printf("\n");
+		return;
+	}
+
+	SortedIndex& index = GetSortedIndex(A, B, base_size, original_size);
+	switch (selection)
+	{
+		case 1:
+		{
+			double value = menu_system->GetValueInput("Temperature: ");
+			timer::Start();
+			double rank = index.Rank<T>(value * division);
+			long long time = timer::Stop(PROF_NS);
+			printf("%.3f is at percentile rank %.3f (%zu of %zu readings at or below, in %lld [ns])\n\n", value, rank,
+				index.CountAtMost<T>(value * division), index.Size(), time);
+			break;
+		}
+		case 2:
+		{
+			double low = menu_system->GetValueInput("Lowest temperature: ");
+			double high = menu_system->GetValueInput("Highest temperature: ");
+			timer::Start();
+			size_t count = index.CountBetween<T>(low * division, high * division);
+			long long time = timer::Stop(PROF_NS);
+			printf("%zu readings between %.3f and %.3f (%.3f%%, in %lld [ns])\n\n", count, low, high, 100.0 * count / index.Size(), time);
+			break;
+		}
+		case 3:
+		{
+			double q = menu_system->GetValueInput("Percentile (0-100): ") / 100.0;
+			timer::Start();
+			T value = index.Percentile<T>(q);
+			long long time = timer::Stop(PROF_NS);
+			int row = SortedRow(index, index.PercentilePosition(q));
+			printf("P%g: %.3f (record %d, in %lld [ns])\n\n", q * 100.0, value / division, row, time);
+			break;
+		}
+		case 4:
+		{
+			double percent = menu_system->GetValueInput("Percentage trimmed from each end (0-50): ");
+			timer::Start();
+			double trimmed = index.TrimmedMean<T>(percent / 100.0);
+			long long time = timer::Stop(PROF_NS);
+			printf("Trimmed Mean (%g%% from each end): %.5f (in %lld [ns])\n\n", percent, trimmed / division, time);
+			break;
+		}
+	}
+}
+
+template<typename T>
+void DistributionMenu(T*& A, size_t& base_size, size_t original_size)
+{
+	menu_system->ShowScreen(4);
+
+	int selection = menu_system->GetScreenOptionSelection();
+	switch (selection)
+	{
+		case 1:
+			PrintDistribution("All Stations", BackendHistograms(A, base_size, original_size, nullptr)[0]);
+			break;
+		case 2:
+		{
+			RequireRecordColumns();
+			std::vector<Histogram> histograms = BackendHistograms(A, base_size, original_size, &stations);
+			for (size_t i = 0; i < histograms.size(); i++)
+				PrintDistribution(stations.names[i], histograms[i]);
+			break;
+		}
+		case 3:
+			PrintSketchPercentile(menu_system->GetValueInput("Percentile (0-100): ") / 100.0);
+			break;
+		case 4:
+		{
+			// The exact fallback, selecting the record of the same rank from the loaded column rather than sorting it.
+			double q = menu_system->GetValueInput("Percentile (0-100): ") / 100.0;
+			timer::Start();
+			T value = SelectQuantile(A, original_size, q);
+			long long time = timer::Stop(PROF_US);
+			printf("P%g: %.3f (exact, selected in %lld [us])\n\n", q * 100.0, value / ((typeid(T) == typeid(int)) ? 10.0 : 1.0), time);
+			break;
+		}
+	}
+}
+
+template<typename T>
+void TimeSeriesMenu(T*& A, fp_type division)
+{
+	menu_system->ShowScreen(5);
+
+	// The time series kernels always execute on the single device, as every aggregate depends on the time order of whole stations.
+	int selection = menu_system->GetScreenOptionSelection();
+	if (selection >= 1 && selection <= 4)
+		RequireRecordColumns();
+
+	switch (selection)
+	{
+		case 1:
+			ReportRolling(GetTimeSeries(), Rolling(GetTimeSeries(), A, minutes_per_day), division, "rolling_24h");
+			break;
+		case 2:
+			ReportRolling(GetTimeSeries(), Rolling(GetTimeSeries(), A, 30 * minutes_per_day), division, "rolling_30d");
+			break;
+		case 3:
+			ReportDaily(DailyExtremes(GetTimeSeries(), A), division);
+			break;
+		case 4:
+		{
+			// Growing degree days above 10.0 and heating degree days below 15.5, the usual UK base temperatures.
+			DailySeries<T> daily = DailyExtremes(GetTimeSeries(), A);
+			std::vector<double> growing = DegreeDays(daily, division, 10.0, false);
+			std::vector<double> heating = DegreeDays(daily, division, 15.5, true);
+			ReportDegreeDays(daily, growing, heating);
+			break;
+		}
+	}
+}
+
+template<typename T>
+void FilterMenu(T*& A, size_t original_size, fp_type division)
+{
+	menu_system->ShowScreen(6);
+
+	// Filtered statistics always execute on the single device, where the columns and the compacted subset stay resident.
+	RequireRecordColumns();
+	RecordFilter filter;
+	int selection = menu_system->GetScreenOptionSelection();
+	switch (selection)
+	{
+		case 1:
+			filter.max_value = 0.0;
+			filter.max_inclusive = false;
+			break;
+		case 2:
+			filter.min_value = 0.0;
+			break;
+		case 3:
+			filter.min_value = menu_system->GetValueInput("Minimum temperature: ");
+			filter.max_value = menu_system->GetValueInput("Maximum temperature: ");
+			printf("\n");
+			break;
+		case 4:
+		{
+			int station = StationInput("Which station?");
+			if (station < 0)
+				return;
+			filter.station = station;
+			break;
+		}
+		default:
+			return;
+	}
+
+	PrintFilteredStatistics(A, original_size, division, filter);
+}
+
+void BackendMenu()
+{
+	menu_system->ShowScreen(3);
+
+	int selection = menu_system->GetScreenOptionSelection();
+	switch (selection)
+	{
+		case 1: execution_backend = SingleDevice; break;
+		case 2: execution_backend = MultiDevice; GetMultiDevice(); break;
+		case 3: execution_backend = NativeThreads; GetThreadPool(); break;
+	}
+}
+
+void StorageMenu()
+{
+	menu_system->ShowScreen(7);
+
+	int selection = menu_system->GetScreenOptionSelection();
+	switch (selection)
+	{
+		case 1: column_storage = PlainColumns; break;
+		case 2: column_storage = Int16Columns; break;
+		case 3: column_storage = PackedColumns; break;
+		case 4: column_storage = HalfColumns; break;
+	}
+
+	// The sorted values of the index were sorted from the previous storage, so the next query sorts the column of the new one.
+	sorted_index.Invalidate();
+}
+
 void OptimizeMenu()
 {
 	menu_system->ShowScreen(2);
@@ -144,9 +633,22 @@ void OptimizeMenu()
 	int selection = menu_system->GetScreenOptionSelection();
 	switch (selection)
 	{
-		case 1: optimize_flag = Performance; break;
-		case 2: optimize_flag = Precision; break;
+		case 1: optimize_flag = Performance; summation_mode = AtomicSummation; break;
+		case 2: optimize_flag = Precision; summation_mode = AtomicSummation; break;
+		case 3: optimize_flag = Precision; summation_mode = CompensatedFloat; break;
+		case 4: optimize_flag = Precision; summation_mode = CompensatedDouble; break;
 	}
+
+	// base_size is shared by both columns, so the column of the new mode is padded again before its next kernel reads base_size values.
+	wg_size_changed = true;
+}
+
+std::string OptimizeName()
+{
+	if (optimize_flag == Performance)
+		return "PERFORMANCE";
+
+	return (summation_mode == AtomicSummation) ? "PRECISION" : std::string("PRECISION, ") + SummationName(summation_mode) + " SUMS";
 }
 
 template<typename T>
@@ -162,22 +664,22 @@ void MainMenu(T*& A, T*& B, size_t& base_size, size_t original_size, bool& finis
 			MinMaxMenu(A, B, base_size, original_size, division, selection - 1);
 			break;
 		case 3:
-			Sum(A, B, base_size, original_size);
-			printf("Mean: %.5f\n\n", mean(B[0] / division, original_size));
+			printf("Mean: %.5f\n\n", mean(BackendSum(A, base_size, original_size) / (double)division, original_size));
 			break;
 		case 4:
-			Sum(A, B, base_size, original_size);
-			Variance(A, B, base_size, original_size, mean(B[0], original_size));
-			printf("Standard Deviation: %.3f\n\n", sqrt(B[0] / division));
+		{
+			typename Accumulator<T>::type sum = BackendSum(A, base_size, original_size);
+			printf("Standard Deviation: %.3f\n\n", sqrt(BackendVariance(A, base_size, original_size, sum)) / division);
 			break;
+		}
 		case 5:
-			printf("Median: %.3f\n\n", source(SortOptim(A, B, base_size, original_size), original_size, 0.5) / division);
+			printf("Median: %.3f\n\n", GetSortedIndex(A, B, base_size, original_size).template Percentile<T>(0.5) / division);
 			break;
 		case 6:
-			printf("Upper Quartile: %.3f\n\n", source(SortOptim(A, B, base_size, original_size), original_size, 0.75) / division);
+			printf("Upper Quartile: %.3f\n\n", GetSortedIndex(A, B, base_size, original_size).template Percentile<T>(0.75) / division);
 			break;
 		case 7:
-			printf("Lower Quartile: %.3f\n\n", source(SortOptim(A, B, base_size, original_size), original_size, 0.25) / division);
+			printf("Lower Quartile: %.3f\n\n", GetSortedIndex(A, B, base_size, original_size).template Percentile<T>(0.25) / division);
 			break;
 		case 8:
 			max_wg_size = !max_wg_size;
@@ -186,12 +688,45 @@ void MainMenu(T*& A, T*& B, size_t& base_size, size_t original_size, bool& finis
 			break;
 		case 9:
 			OptimizeMenu();
-			printf("Optimize Mode = %s\n\n", (optimize_flag == Performance) ? "PERFORMANCE" : "PRECISION");
+			printf("Optimize Mode = %s\n\n", OptimizeName().c_str());
+			break;
+		case 10:
+			BackendMenu();
+			printf("Execution Backend = %s\n\n", BackendName());
+			break;
+		case 11:
+			DistributionMenu(A, base_size, original_size);
+			break;
+		case 12:
+			TimeSeriesMenu(A, division);
+			break;
+		case 13:
+			FilterMenu(A, original_size, division);
+			break;
+		case 14:
+			StorageMenu();
+			printf("Column Storage = %s\n\n", StorageName(column_storage));
+			break;
+		case 15:
+			ExtremesMenu(A, original_size, division);
+			break;
+		case 16:
+			CorrelationMenu(A, original_size, division);
+			break;
+		case 17:
+			AnomalyMenu(A, original_size, division);
+			break;
+		case 18:
+			SortedIndexMenu(A, B, base_size, original_size, division);
 			break;
 		default:
 			finished = true;
 			break;
 	}
+
+	// Report the memory after every operation, which should stay flat however many queries are run.
+	if (!finished)
+		PrintMemoryInfo();
 }
 
 #endif
\ No newline at end of file
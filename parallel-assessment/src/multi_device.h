@@ -0,0 +1,444 @@
+#ifndef multidevice_h
+#define multidevice_h
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <limits>
+#include <algorithm>
+#include <chrono>
+
+#include "Utils.h"
+#include "funcs.h"
+
+/* The functions within funcs.h all execute on the first device of a single context. This scheduler instead creates one lane for every
+   available OpenCL device across all platforms, where CPU devices are first split into one sub-device per NUMA node (or equal halves if
+   the runtime cannot partition by affinity). The dataset is partitioned between lanes proportionally to their measured throughput, each
+   lane runs the same reduction/sort kernels on its own thread and queue, and the partial results are merged on the host afterwards. */
+
+struct DeviceLane
+{
+	std::string name;
+	cl::Device device;
+	cl::Context context;
+	cl::CommandQueue queue;
+	cl::Program program;
+	KernelCache kernel_cache;
+	BufferPool buffer_pool;
+
+	double weight = 1.0;			// Relative share of the dataset, replaced with measured elements/ns after the first execution.
+	bool measured = false;			// Whether or not weight holds a measured throughput rather than the initial estimate.
+	size_t offset = 0;				// Start of this lane's partition within the dataset.
+	size_t count = 0;				// Number of elements within this lane's partition.
+	unsigned long ex_time = 0;		// Wall clock time of the last execution on this lane [ns].
+};
+
+class MultiDeviceScheduler
+{
+	private:
+		std::vector<DeviceLane> lanes;
+
+		static std::vector<cl::Device> SplitDevice(cl::Device device)
+		{
+			// Only CPU devices are split, GPUs and accelerators are already a single memory domain.
+			std::vector<cl::Device> sub_devices;
+			cl_device_type device_type = device.getInfo<CL_DEVICE_TYPE>();
+			if (!(device_type & CL_DEVICE_TYPE_CPU))
+				return { device };
+
+			// Prefer one sub-device per NUMA node, so each socket works on its own partition from its own memory.
+			const cl_device_partition_property numa_props[] = { CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN, CL_DEVICE_AFFINITY_DOMAIN_NUMA, 0 };
+			try { device.createSubDevices(numa_props, &sub_devices); }
+			catch (const cl::Error&) { sub_devices.clear(); }
+
+			if (sub_devices.size() > 1)
+				return sub_devices;
+
+			// Fall back to equal halves of the compute units when there is only one NUMA node (or affinity partitioning is unsupported).
+			sub_devices.clear();
+			cl_uint compute_units = device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+			if (compute_units >= 4)
+			{
+				const cl_device_partition_property equal_props[] = { CL_DEVICE_PARTITION_EQUALLY, (cl_device_partition_property)(compute_units / 2), 0 };
+				try { device.createSubDevices(equal_props, &sub_devices); }
+				catch (const cl::Error&) { sub_devices.clear(); }
+			}
+
+			return (sub_devices.empty()) ? std::vector<cl::Device>{ device } : sub_devices;
+		}
+
+		void AddLane(cl::Device device, const std::string& name)
+		{
+			DeviceLane lane;
+			lane.name = name;
+			lane.device = device;
+			lane.context = cl::Context({ device });
+			lane.queue = cl::CommandQueue(lane.context, device, CL_QUEUE_PROFILING_ENABLE);
+
+			// Every context requires its own build of the kernel file.
+			cl::Program::Sources sources;
+			AddSources(sources, "kernels.cl");
+			lane.program = cl::Program(lane.context, sources);
+			try { lane.program.build({ device }); }
+			catch (const cl::Error&)
+			{
+				std::cout << "Skipping device lane '" << name << "', build log:\n" << lane.program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device) << std::endl;
+				return;
+			}
+
+			// The initial weight is a rough peak throughput estimate, this is replaced by measurements after the first execution.
+			cl_uint compute_units = device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+			cl_uint clock_frequency = device.getInfo<CL_DEVICE_MAX_CLOCK_FREQUENCY>();
+			lane.weight = (double)compute_units * clock_frequency;
+			lanes.push_back(std::move(lane));
+		}
+
+		size_t LocalSize(DeviceLane& lane, cl::Kernel& kernel)
+		{
+			// Mirror CLResize, selecting either the maximum or the preferred multiple work group size for this lane's device.
+			return (max_wg_size) ? kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(lane.device)
+				: kernel.getWorkGroupInfo<CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE>(lane.device);
+		}
+
+		void Partition(size_t size)
+		{
+			// Every lane is guaranteed at least 1% of the total weight so that it is always re-measured and can recover its share.
+			double total_weight = 0.0, max_weight = 0.0;
+			for (size_t i = 0; i < lanes.size(); i++)
+				max_weight = std::max(max_weight, lanes[i].weight);
+			for (size_t i = 0; i < lanes.size(); i++)
+				total_weight += std::max(lanes[i].weight, max_weight * 0.01);
+
+			// Split the dataset proportionally to the weights, the final lane takes any rounding remainder.
+			size_t offset = 0;
+			for (size_t i = 0; i < lanes.size(); i++)
+			{
+				size_t count = (i == lanes.size() - 1) ? size - offset
+					: (size_t)(size * (std::max(lanes[i].weight, max_weight * 0.01) / total_weight));
+
+				lanes[i].offset = offset;
+				lanes[i].count = std::min(count, size - offset);
+				offset += lanes[i].count;
+			}
+		}
+
+		void UpdateWeights()
+		{
+			// Weights only become comparable once every active lane has been measured, until then the estimates are kept.
+			for (size_t i = 0; i < lanes.size(); i++)
+			{
+				if (lanes[i].count && !lanes[i].ex_time)
+					return;
+			}
+
+			for (size_t i = 0; i < lanes.size(); i++)
+			{
+				if (!lanes[i].count)
+					continue;
+
+				// Smooth the measured elements/ns so that one noisy execution does not swing the partitioning.
+				double throughput = (double)lanes[i].count / lanes[i].ex_time;
+				lanes[i].weight = (lanes[i].measured) ? (lanes[i].weight * 0.5 + throughput * 0.5) : throughput;
+				lanes[i].measured = true;
+			}
+
+			// Lanes which were not measured this time take the mean throughput of the others, rather than a mismatched estimate.
+			double measured_total = 0.0; int measured_count = 0;
+			for (size_t i = 0; i < lanes.size(); i++)
+			{
+				if (lanes[i].measured) { measured_total += lanes[i].weight; measured_count++; }
+			}
+			for (size_t i = 0; i < lanes.size(); i++)
+			{
+				if (!lanes[i].measured && measured_count)
+					lanes[i].weight = measured_total / measured_count;
+			}
+		}
+
+		template<typename T, typename Out>
+		void LaneReduce(DeviceLane& lane, const std::string& kernel_id, const T* data, Out neutral, bool with_mean, T mean, Out& result)
+		{
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			result = neutral;
+			lane.ex_time = 0;
+			if (!lane.count)
+				return;
+
+			// Every lane's device decides for itself whether its integer sums need the partial sums of devices without 64 bit atomics.
+			bool partials = GroupPartials<Out>(lane.device);
+			cl::Kernel& kernel = lane.kernel_cache.Get(lane.program, (partials) ? kernel_id + "_PARTIALS" : kernel_id);
+			size_t lane_local_size = LocalSize(lane, kernel);
+			size_t padded = ((lane.count + lane_local_size - 1) / lane_local_size) * lane_local_size;
+
+			/* Upload this lane's partition directly from the dataset and pad the tail on the device with the neutral element, which is the mean
+			   for the squared differences. The output is of the accumulator type, 64 bits for the integer sums. */
+			T padding = (with_mean) ? mean : (T)neutral;
+			std::vector<Out> sums((partials) ? padded / lane_local_size : 1, neutral);
+			cl::Buffer buffer_A = lane.buffer_pool.Device(lane.context, "in", CL_MEM_READ_ONLY, padded * sizeof(T));
+			cl::Buffer buffer_B = lane.buffer_pool.Device(lane.context, "out", CL_MEM_READ_WRITE, sums.size() * sizeof(Out));
+			lane.queue.enqueueWriteBuffer(buffer_A, CL_FALSE, 0, lane.count * sizeof(T), &data[lane.offset]);
+			if (padded > lane.count)
+				lane.queue.enqueueFillBuffer(buffer_A, padding, lane.count * sizeof(T), (padded - lane.count) * sizeof(T));
+			lane.queue.enqueueWriteBuffer(buffer_B, CL_TRUE, 0, sums.size() * sizeof(Out), sums.data());
+
+			kernel.setArg(0, buffer_A);
+			kernel.setArg(1, buffer_B);
+			kernel.setArg(2, cl::Local(lane_local_size * sizeof(Out)));
+			if (with_mean)
+				kernel.setArg(3, mean);
+
+			lane.queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(padded), cl::NDRange(lane_local_size));
+			lane.queue.enqueueReadBuffer(buffer_B, CL_TRUE, 0, sums.size() * sizeof(Out), sums.data());
+			result = (partials) ? AddPartials(sums.data(), sums.size()) : sums[0];
+
+			lane.ex_time = (unsigned long)std::max<long long>(1, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+		}
+
+		template<typename T>
+		void LaneSort(DeviceLane& lane, const std::string& kernel_id, const T* data, T* sorted)
+		{
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			lane.ex_time = 0;
+			if (!lane.count)
+				return;
+
+			cl::Kernel& kernel = lane.kernel_cache.Get(lane.program, kernel_id);
+			size_t lane_local_size = LocalSize(lane, kernel);
+			size_t padded = ((lane.count + lane_local_size - 1) / lane_local_size) * lane_local_size;
+
+			/* Pad with the maximum value so the padding always sorts to the end of the partition. The buffers hold an extra work group of
+			   padding since the shifted merge passes of bitonic_local read half a work group beyond the global size. */
+			T neutral = std::numeric_limits<T>::max();
+			size_t alloc_size = (padded + lane_local_size) * sizeof(T);
+			cl::Buffer buffer_A = lane.buffer_pool.Device(lane.context, "in", CL_MEM_READ_ONLY, alloc_size);
+			cl::Buffer buffer_B = lane.buffer_pool.Device(lane.context, "out", CL_MEM_READ_WRITE, alloc_size);
+			T* outbuf = lane.buffer_pool.Host<T>(kernel_id, padded);
+
+			lane.queue.enqueueWriteBuffer(buffer_A, CL_FALSE, 0, lane.count * sizeof(T), &data[lane.offset]);
+			lane.queue.enqueueFillBuffer(buffer_A, neutral, lane.count * sizeof(T), alloc_size - lane.count * sizeof(T));
+			lane.queue.enqueueFillBuffer(buffer_B, neutral, 0, alloc_size);
+
+			kernel.setArg(0, buffer_A);
+			kernel.setArg(1, buffer_B);
+			kernel.setArg(2, cl::Local(lane_local_size * sizeof(T)));
+			kernel.setArg(3, 0);
+
+			lane.queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(padded), cl::NDRange(lane_local_size));
+			lane.queue.enqueueReadBuffer(buffer_B, CL_TRUE, 0, padded * sizeof(T), outbuf);
+
+			// Alternate shifted and unshifted passes until the partition is sorted, exactly as Sort() does for a single device.
+			int i = 1;
+			size_t max_passes = MaxSortPasses(padded, lane_local_size);
+			while (!Sorted(outbuf, padded))
+			{
+				if ((size_t)i > max_passes)
+				{
+					std::cerr << "ERROR: " << kernel_id << " did not sort " << lane.count << " elements on " << lane.name << " within " << max_passes << " passes" << std::endl;
+					break;
+				}
+
+				lane.queue.enqueueCopyBuffer(buffer_B, buffer_A, 0, 0, padded * sizeof(T));
+				kernel.setArg(3, (i++ % 2));
+
+				lane.queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(padded), cl::NDRange(lane_local_size));
+				lane.queue.enqueueReadBuffer(buffer_B, CL_TRUE, 0, padded * sizeof(T), outbuf);
+			}
+
+			std::copy(outbuf, outbuf + lane.count, &sorted[lane.offset]);
+			lane.ex_time = (unsigned long)std::max<long long>(1, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+		}
+
+		void PrintLaneInfo(const std::string& kernel_id, unsigned long ex_time_total)
+		{
+			// Output and log the partition and execution time of every lane, followed by the total execution time.
+			if (!profiler_output)
+				return;
+
+			std::string output = "Multi-device (" + kernel_id + ") across " + std::to_string(lanes.size()) + " lane(s):";
+			for (size_t i = 0; i < lanes.size(); i++)
+			{
+				output += "\n\tLane " + std::to_string(i) + " (" + lanes[i].name + ") elements " + std::to_string(lanes[i].count)
+					+ ", execution time " + GetResolutionString(profiler_resolution) + ": " + std::to_string(lanes[i].ex_time / profiler_resolution);
+			}
+			output += "\nTotal execution time " + std::string(GetResolutionString(profiler_resolution)) + ": " + std::to_string(ex_time_total);
+
+			std::cout << output << std::endl;
+			winstr::Write(output.c_str());
+		}
+
+	public:
+		void Init()
+		{
+			// Enumerate every device on every platform, skipping CPUs already exposed through another platform's runtime.
+			std::vector<cl::Platform> platforms;
+			cl::Platform::get(&platforms);
+
+			std::vector<std::string> cpu_names;
+			for (size_t i = 0; i < platforms.size(); i++)
+			{
+				std::vector<cl::Device> devices;
+				platforms[i].getDevices((cl_device_type)CL_DEVICE_TYPE_ALL, &devices);
+
+				for (size_t j = 0; j < devices.size(); j++)
+				{
+					std::string name = devices[j].getInfo<CL_DEVICE_NAME>();
+					cl_device_type device_type = devices[j].getInfo<CL_DEVICE_TYPE>();
+					if (device_type & CL_DEVICE_TYPE_CPU)
+					{
+						if (std::find(cpu_names.begin(), cpu_names.end(), name) != cpu_names.end())
+							continue;
+						cpu_names.push_back(name);
+					}
+
+					std::vector<cl::Device> sub_devices = SplitDevice(devices[j]);
+					for (size_t k = 0; k < sub_devices.size(); k++)
+						AddLane(sub_devices[k], (sub_devices.size() > 1) ? name + " [" + std::to_string(k) + "]" : name);
+				}
+			}
+
+			std::cout << "Multi-device scheduler initialised with " << lanes.size() << " lane(s)." << std::endl;
+		}
+
+		size_t LaneCount() const { return lanes.size(); }
+
+		template<typename T, typename Out>
+		Out Reduce(const std::string& kernel_id, const T* data, size_t size, Out neutral, bool with_mean = false, T mean = 0)
+		{
+			// Partition the dataset and run the reduction on every lane concurrently, one host thread per lane.
+			timer::Start();
+			Partition(size);
+
+			std::vector<Out> partials(lanes.size(), neutral);
+			std::vector<std::thread> threads;
+			for (size_t i = 0; i < lanes.size(); i++)
+				threads.push_back(std::thread(&MultiDeviceScheduler::LaneReduce<T, Out>, this, std::ref(lanes[i]), std::cref(kernel_id), data, neutral, with_mean, mean, std::ref(partials[i])));
+			for (size_t i = 0; i < threads.size(); i++)
+				threads[i].join();
+
+			// Merge the partial results with the same operation the kernel applies between work groups.
+			Out result = neutral;
+			bool is_min = kernel_id.find("reduce_min") == 0;
+			bool is_max = kernel_id.find("reduce_max") == 0;
+			for (size_t i = 0; i < partials.size(); i++)
+			{
+				if (!lanes[i].count) continue;
+				if (is_min) result = std::min(result, partials[i]);
+				else if (is_max) result = std::max(result, partials[i]);
+				else result += partials[i];
+			}
+
+			PrintLaneInfo(kernel_id, timer::Stop(profiler_resolution));
+			UpdateWeights();
+			return result;
+		}
+
+		template<typename T>
+		void Sort(const std::string& kernel_id, const T* data, size_t size, T* sorted)
+		{
+			// Sort every lane's partition concurrently into its own region of the output.
+			timer::Start();
+			Partition(size);
+
+			std::vector<std::thread> threads;
+			for (size_t i = 0; i < lanes.size(); i++)
+				threads.push_back(std::thread(&MultiDeviceScheduler::LaneSort<T>, this, std::ref(lanes[i]), std::cref(kernel_id), data, sorted));
+			for (size_t i = 0; i < threads.size(); i++)
+				threads[i].join();
+
+			// Merge the sorted runs pairwise on the host, doubling the run width each pass.
+			std::vector<size_t> bounds;
+			for (size_t i = 0; i < lanes.size(); i++)
+				bounds.push_back(lanes[i].offset);
+			bounds.push_back(size);
+
+			for (size_t width = 1; width < lanes.size(); width <<= 1)
+			{
+				for (size_t i = 0; i + width < lanes.size(); i += width * 2)
+				{
+					size_t last = std::min(i + width * 2, lanes.size());
+					std::inplace_merge(&sorted[bounds[i]], &sorted[bounds[i + width]], &sorted[0] + bounds[last]);
+				}
+			}
+
+			PrintLaneInfo(kernel_id, timer::Stop(profiler_resolution));
+			PrintCounterInfo(kernel_id, counters::sorted);
+			UpdateWeights();
+		}
+
+		void Release() { lanes.clear(); }
+};
+
+// ------------------------------------------------------------------------ Multi-Device Functions ------------------------------------------------------------------------ //
+
+MultiDeviceScheduler* multi_device = nullptr;		// Created on first use, as building the program for every device is expensive.
+
+MultiDeviceScheduler* GetMultiDevice()
+{
+	if (!multi_device)
+	{
+		multi_device = new MultiDeviceScheduler();
+		multi_device->Init();
+	}
+
+	return multi_device;
+}
+
+/* The functions below share the signatures of their single device equivalents in funcs.h so the menus can swap between them. They operate
+   on the original (unpadded) length since each lane pads its own partition to its own work group size, so the padded length is unused. */
+
+template<typename T>
+void MultiSum(T*& inbuf, typename Accumulator<T>::type*& outbuf, size_t&, size_t original_len)
+{
+	std::string kernel_id = "reduce_sum";
+	ConcatKernelID(*inbuf, kernel_id);
+
+	typedef typename Accumulator<T>::type Acc;
+	outbuf = buffer_pool.Host<Acc>("multi_" + kernel_id, 1);
+	outbuf[0] = GetMultiDevice()->Reduce(kernel_id, inbuf, original_len, (Acc)0);
+}
+
+template<typename T>
+void MultiMinMax(T*& inbuf, T*& outbuf, size_t&, size_t original_len, bool dir)
+{
+	std::string kernel_id = (dir) ? "reduce_max" : "reduce_min";
+	ConcatKernelID(*inbuf, kernel_id);
+
+	T neutral = (dir) ? std::numeric_limits<T>::lowest() : std::numeric_limits<T>::max();
+	outbuf = buffer_pool.Host<T>("multi_" + kernel_id, 1);
+	outbuf[0] = GetMultiDevice()->Reduce(kernel_id, inbuf, original_len, neutral);
+}
+
+template<typename T>
+void MultiVariance(T*& inbuf, typename Accumulator<T>::type*& outbuf, size_t&, size_t original_len, T mean)
+{
+	std::string kernel_id = "sum_sqr_diff";
+	ConcatKernelID(*inbuf, kernel_id);
+
+	// Each lane pads with the mean, so the padding adds nothing to the sum of squared differences.
+	typedef typename Accumulator<T>::type Acc;
+	outbuf = buffer_pool.Host<Acc>("multi_" + kernel_id, 1);
+	outbuf[0] = GetMultiDevice()->Reduce(kernel_id, inbuf, original_len, (Acc)0, true, mean);
+}
+
+template<typename T>
+T* MultiSort(T*& inbuf, T outbuf[], size_t&, size_t original_len)
+{
+	std::string kernel_id = "bitonic_local";
+	ConcatKernelID(*inbuf, kernel_id);
+
+	outbuf = buffer_pool.Host<T>("multi_" + kernel_id, original_len);
+	GetMultiDevice()->Sort(kernel_id, inbuf, original_len, outbuf);
+	return outbuf;
+}
+
+void ReleaseMultiDevice()
+{
+	if (multi_device)
+	{
+		multi_device->Release();
+		delete multi_device;
+		multi_device = nullptr;
+	}
+}
+
+#endif
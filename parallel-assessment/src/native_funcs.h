@@ -0,0 +1,364 @@
+#ifndef nativefuncs_h
+#define nativefuncs_h
+
+#include <vector>
+#include <string>
+#include <limits>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#include "thread_pool.h"
+#include "analytics.h"
+#include "funcs.h"
+
+/* Native (non OpenCL) implementations of the parsing and statistics operations, executed as stealable tasks on the NUMA aware thread pool.
+   Every operation splits the dataset into the same contiguous position based partitions, so the node which first touched (parsed) a range
+   of the dataset is the node which later reduces it. */
+
+ThreadPool* thread_pool = nullptr;					// Created on first use with one worker per logical CPU.
+size_t thread_count = 0;							// Requested number of workers, 0 selects every logical CPU.
+
+ThreadPool* GetThreadPool()
+{
+	if (!thread_pool)
+		thread_pool = new ThreadPool(thread_count);
+
+	return thread_pool;
+}
+
+void ReleaseThreadPool()
+{
+	delete thread_pool;
+	thread_pool = nullptr;
+}
+
+// Accumulator types for the native reductions, integers are summed in 64 bits like Accumulator and floats in double.
+template<typename T> struct NativeAccumulator { typedef double type; };
+template<> struct NativeAccumulator<int> { typedef long long type; };
+
+// ------------------------------------------------------------------------ Parallel Parsing ------------------------------------------------------------------------ //
+
+bool ParseFixed(const char* begin, const char* end, fp_type& value)
+{
+	// Parse a fixed point decimal (e.g. "-12.5") without the locale handling and null termination requirements of atof.
+	bool negative = false;
+	if (begin < end && (*begin == '-' || *begin == '+'))
+		negative = (*begin++ == '-');
+
+	long long mantissa = 0;
+	double scale = 1.0;
+	bool digits = false, fraction = false;
+	for (; begin < end; begin++)
+	{
+		if (*begin >= '0' && *begin <= '9')
+		{
+			mantissa = mantissa * 10 + (*begin - '0');
+			digits = true;
+			if (fraction)
+				scale *= 10.0;
+		}
+		else if (*begin == '.' && !fraction) fraction = true;
+		else break;
+	}
+
+	value = (fp_type)((negative ? -mantissa : mantissa) / scale);
+	return digits;
+}
+
+fp_type ParseColumnValue(const char* line, const char* line_end, char delimiter, unsigned char column_index)
+{
+	// Skip to the requested column and parse it in place, an unparsable value is read as zero.
+	unsigned char current_column = 0;
+	while (line < line_end && current_column < column_index)
+	{
+		if (*line++ == delimiter)
+			current_column++;
+	}
+
+	fp_type value;
+	return (ParseFixed(line, line_end, value)) ? value : 0;
+}
+
+template<typename Func>
+void ForEachLine(const char* data, size_t begin, size_t end, Func func)
+{
+	// Call func(line_begin, line_end) for every non-empty line within [begin, end), using memchr to find each newline.
+	const char* cursor = data + begin;
+	const char* last = data + end;
+	while (cursor < last)
+	{
+		const char* newline = (const char*)memchr(cursor, '\n', last - cursor);
+		const char* line_end = (newline) ? newline : last;
+		if (line_end > cursor && *cursor != '\r')
+			func(cursor, line_end);
+
+		cursor = line_end + 1;
+	}
+}
+
+/* Byte ranges of a text buffer which always begin at the start of a line, alongside the output offset of each range's first record. Every
+   column parser splits the buffer with SplitLines so that record i refers to the same line within every parsed column. */
+struct LineChunks
+{
+	std::vector<size_t> bounds;
+	std::vector<size_t> offsets;
+
+	size_t Count() const { return bounds.size() - 1; }
+	size_t Records() const { return offsets.back(); }
+};
+
+LineChunks SplitLines(ThreadPool& pool, const char* data, size_t len)
+{
+	// Split the buffer into chunks which always begin at the start of a line.
+	LineChunks chunks;
+	size_t chunk_count = std::max<size_t>(1, std::min(pool.DefaultPartitions(), len / 4096 + 1));
+	chunks.bounds.assign(chunk_count + 1, len);
+	chunks.bounds[0] = 0;
+	for (size_t k = 1; k < chunk_count; k++)
+	{
+		size_t start = std::max(chunks.bounds[k - 1], (len * k) / chunk_count);
+		const char* newline = (const char*)memchr(data + start, '\n', len - start);
+		chunks.bounds[k] = (newline) ? (newline - data) + 1 : len;
+	}
+
+	// Count the records within every chunk in parallel, then prefix sum the counts into each chunk's output offset.
+	chunks.offsets.assign(chunk_count + 1, 0);
+	pool.ParallelFor(chunk_count, chunk_count, [&](size_t p, size_t, size_t)
+	{
+		size_t count = 0;
+		ForEachLine(data, chunks.bounds[p], chunks.bounds[p + 1], [&](const char*, const char*) { count++; });
+		chunks.offsets[p + 1] = count;
+	});
+	for (size_t k = 0; k < chunk_count; k++)
+		chunks.offsets[k + 1] += chunks.offsets[k];
+
+	return chunks;
+}
+
+/* Offset of the first byte of every record within a text buffer, built in one parallel pass over the chunks of SplitLines. Any record can
+   then be parsed on its own, so the columns of a large file are only decoded for the rows which are actually used. */
+struct LineIndex
+{
+	const char* data = nullptr;
+	size_t len = 0;
+	std::vector<size_t> starts;
+
+	size_t Count() const { return starts.size(); }
+	const char* Begin(size_t i) const { return data + starts[i]; }
+	const char* End(size_t i) const
+	{
+		const char* newline = (const char*)memchr(data + starts[i], '\n', len - starts[i]);
+		return (newline) ? newline : data + len;
+	}
+
+	void Build(ThreadPool& pool, const char* text, size_t text_len)
+	{
+		data = text;
+		len = text_len;
+		LineChunks chunks = SplitLines(pool, text, text_len);
+		starts.resize(chunks.Records());
+		pool.ParallelFor(chunks.Count(), chunks.Count(), [&](size_t k, size_t, size_t)
+		{
+			size_t index = chunks.offsets[k];
+			ForEachLine(text, chunks.bounds[k], chunks.bounds[k + 1], [&](const char* line, const char*) { starts[index++] = line - text; });
+		});
+	}
+};
+
+ArenaArray<fp_type> ParallelParse(ThreadPool& pool, const char* data, size_t len, char delimiter, unsigned char column_index, size_t& out_size)
+{
+	LineChunks chunks = SplitLines(pool, data, len);
+	const std::vector<size_t>& bounds = chunks.bounds;
+	const std::vector<size_t>& offsets = chunks.offsets;
+	size_t chunk_count = chunks.Count();
+
+	/* The output is allocated without initialisation so that no page is touched here. Each chunk is then parsed on the node which owns its
+	   position within the output, making the parse itself the first touch and placing every page on the node which will later reduce it. */
+	out_size = chunks.Records();
+	ArenaArray<fp_type> out_data(out_size, DatasetMemory);
+
+	TaskGroup group;
+	for (size_t k = 0; k < chunk_count; k++)
+	{
+		pool.Submit(group, pool.NodeOf(offsets[k], out_size), [&, k]()
+		{
+			counters::Scope scope(counters::parse);
+			size_t index = offsets[k];
+			ForEachLine(data, bounds[k], bounds[k + 1], [&](const char* line, const char* line_end)
+			{
+				out_data[index++] = ParseColumnValue(line, line_end, delimiter, column_index);
+			});
+		});
+	}
+	group.Wait();
+
+	return out_data;
+}
+
+ArenaArray<int> ParallelConvert(ThreadPool& pool, const fp_type* arr, size_t size, int multiplier)
+{
+	// Equivalent of convert() in funcs.h, but performed per partition so that the integer copy is first touched on the same nodes.
+	ArenaArray<int> new_arr(size, DatasetMemory);
+	pool.ParallelFor(size, pool.DefaultPartitions(), [&](size_t, size_t begin, size_t end)
+	{
+		counters::Scope scope(counters::convert);
+		for (size_t i = begin; i < end; i++)
+			new_arr[i] = (int)std::lround(arr[i] * multiplier);
+	});
+
+	return new_arr;
+}
+
+// ------------------------------------------------------------------------ Native Functions ------------------------------------------------------------------------ //
+
+void PrintNativeInfo(const std::string& kernel_id, const ThreadPool& pool)
+{
+	// Output the execution time of a native operation alongside the number of tasks which were stolen, and the counters of the reductions.
+	unsigned long ex_time = timer::Stop(profiler_resolution);
+	PrintProfilerInfo(kernel_id + ", " + std::to_string(pool.Size()) + " threads, " + std::to_string(pool.Steals()) + " total steals", ex_time, nullptr);
+	PrintCounterInfo(kernel_id, counters::reduce);
+}
+
+/* The operations below share the signatures of their device equivalents in funcs.h so the menus can swap between them. The padded length is
+   unused, as the threads only ever read the original records. */
+
+template<typename T>
+void NativeSum(T*& inbuf, typename Accumulator<T>::type*& outbuf, size_t&, size_t original_len)
+{
+	std::string kernel_id = "native_sum";
+	ConcatKernelID(*inbuf, kernel_id);
+
+	timer::Start();
+	ThreadPool& pool = *GetThreadPool();
+
+	// Reduce every partition into its own partial, the partials are then combined in order so the result is deterministic.
+	typedef typename NativeAccumulator<T>::type Acc;
+	std::vector<Acc> partials(pool.DefaultPartitions(), 0);
+	pool.ParallelFor(original_len, partials.size(), [&](size_t p, size_t begin, size_t end)
+	{
+		counters::Scope scope(counters::reduce);
+		Acc sum = 0;
+		for (size_t i = begin; i < end; i++)
+			sum += inbuf[i];
+		partials[p] = sum;
+	});
+
+	Acc total = 0;
+	for (size_t p = 0; p < partials.size(); p++)
+		total += partials[p];
+
+	outbuf = buffer_pool.Host<typename Accumulator<T>::type>(kernel_id, 1);
+	outbuf[0] = (typename Accumulator<T>::type)total;
+
+	PrintNativeInfo(kernel_id, pool);
+}
+
+template<typename T>
+void NativeMinMax(T*& inbuf, T*& outbuf, size_t&, size_t original_len, bool dir)
+{
+	std::string kernel_id = (dir) ? "native_max" : "native_min";
+	ConcatKernelID(*inbuf, kernel_id);
+
+	timer::Start();
+	ThreadPool& pool = *GetThreadPool();
+
+	T neutral = (dir) ? std::numeric_limits<T>::lowest() : std::numeric_limits<T>::max();
+	std::vector<T> partials(pool.DefaultPartitions(), neutral);
+	pool.ParallelFor(original_len, partials.size(), [&](size_t p, size_t begin, size_t end)
+	{
+		counters::Scope scope(counters::reduce);
+		T result = neutral;
+		for (size_t i = begin; i < end; i++)
+			result = (dir) ? std::max(result, inbuf[i]) : std::min(result, inbuf[i]);
+		partials[p] = result;
+	});
+
+	outbuf = buffer_pool.Host<T>(kernel_id, 1);
+	outbuf[0] = (dir) ? *std::max_element(partials.begin(), partials.end()) : *std::min_element(partials.begin(), partials.end());
+
+	PrintNativeInfo(kernel_id, pool);
+}
+
+template<typename T>
+void NativeVariance(T*& inbuf, typename Accumulator<T>::type*& outbuf, size_t&, size_t original_len, T mean)
+{
+	std::string kernel_id = "native_sum_sqr_diff";
+	ConcatKernelID(*inbuf, kernel_id);
+
+	timer::Start();
+	ThreadPool& pool = *GetThreadPool();
+
+	typedef typename NativeAccumulator<T>::type Acc;
+	std::vector<Acc> partials(pool.DefaultPartitions(), 0);
+	pool.ParallelFor(original_len, partials.size(), [&](size_t p, size_t begin, size_t end)
+	{
+		counters::Scope scope(counters::reduce);
+		Acc sum = 0;
+		for (size_t i = begin; i < end; i++)
+		{
+			Acc diff = (Acc)inbuf[i] - mean;
+			sum += diff * diff;
+		}
+		partials[p] = sum;
+	});
+
+	Acc total = 0;
+	for (size_t p = 0; p < partials.size(); p++)
+		total += partials[p];
+
+	// Match Variance(), which returns the sum of squared differences.
+	outbuf = buffer_pool.Host<typename Accumulator<T>::type>(kernel_id, 1);
+	outbuf[0] = (typename Accumulator<T>::type)total;
+
+	PrintNativeInfo(kernel_id, pool);
+}
+
+template<typename T>
+T* NativeSort(T*& inbuf, T outbuf[], size_t&, size_t original_len)
+{
+	std::string kernel_id = "native_sort";
+	ConcatKernelID(*inbuf, kernel_id);
+
+	timer::Start();
+	ThreadPool& pool = *GetThreadPool();
+
+	// Copy and sort every partition in parallel, the copy is also the first touch of each partition of the output.
+	ArenaArray<T> run_storage(original_len, ScratchMemory), merged_storage(original_len, ScratchMemory);
+	T* runs = run_storage.Data();
+	T* merged = merged_storage.Data();
+	size_t partitions = std::max<size_t>(1, std::min(pool.Size(), original_len));
+	std::vector<size_t> bounds(partitions + 1);
+	for (size_t p = 0; p <= partitions; p++)
+		bounds[p] = (original_len * p) / partitions;
+
+	pool.ParallelFor(original_len, partitions, [&](size_t, size_t begin, size_t end)
+	{
+		std::copy(inbuf + begin, inbuf + end, runs + begin);
+		std::sort(runs + begin, runs + end);
+	});
+
+	// Merge neighbouring runs pairwise as tasks, doubling the run width each pass and swapping between the two buffers.
+	for (size_t width = 1; width < partitions; width <<= 1)
+	{
+		TaskGroup group;
+		for (size_t p = 0; p < partitions; p += width * 2)
+		{
+			size_t first = bounds[p], middle = bounds[std::min(p + width, partitions)], last = bounds[std::min(p + width * 2, partitions)];
+			pool.Submit(group, pool.NodeOf(first, original_len), [=]()
+			{
+				std::merge(runs + first, runs + middle, runs + middle, runs + last, merged + first);
+			});
+		}
+		group.Wait();
+		std::swap(runs, merged);
+	}
+
+	outbuf = buffer_pool.Host<T>(kernel_id, original_len);
+	pool.ParallelFor(original_len, partitions, [&](size_t, size_t begin, size_t end) { std::copy(runs + begin, runs + end, outbuf + begin); });
+
+	PrintNativeInfo(kernel_id, pool);
+	return outbuf;
+}
+
+#endif
@@ -1,8 +1,10 @@
 #ifndef paths_h
 #define paths_h
 
-#include <windows.h>
 #include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdlib>
 
 // Typedef for the floating point type to be used, this can either be double or float in the current state of the program.
 typedef float fp_type;
@@ -12,16 +14,48 @@ std::string src_path = "./src/";
 std::string kernel_path = "./src/kernels/";
 std::string data_path = "./data/";
 
-void InitPaths()
+bool IsProjectRoot(const std::string& root)
 {
-	// This function ensures that the correct paths are gathered whether running from Visual Studio or simply from command line.
-	if (!IsDebuggerPresent())
+	// The root is the directory holding src/kernels/kernels.cl, every other path is relative to it.
+	std::ifstream kernels(root + "src/kernels/kernels.cl");
+	return kernels.good();
+}
+
+void InitPaths(const char* root = nullptr)
+{
+	/* This function ensures that the correct paths are gathered however the program is run. The root of the project is taken from the -R
+	   flag, then from the ASSESSMENT_ROOT environment variable, then from the ASSESSMENT_ROOT definition of the build (CMake defines it as
+	   the source directory). Otherwise the working directory is used when it is the project itself (Visual Studio or a command line within
+	   it), then the project relative to the x64\Release output directory of the solution. */
+	std::string candidates[] = {
+		(root) ? root : "",
+		(std::getenv("ASSESSMENT_ROOT")) ? std::getenv("ASSESSMENT_ROOT") : "",
+	#ifdef ASSESSMENT_ROOT
+		ASSESSMENT_ROOT,
+	#else
+		"",
+	#endif
+		"./",
+		"../../parallel-assessment/"
+	};
+
+	for (std::string candidate : candidates)
 	{
-		base_path = "../../parallel-assessment/";
-		src_path = "../../parallel-assessment/src/";
-		kernel_path = "../../parallel-assessment/src/kernels/";
-		data_path = "../../parallel-assessment/data/";
+		if (candidate.empty())
+			continue;
+		if (candidate.back() != '/' && candidate.back() != '\\')
+			candidate += "/";
+		if (!IsProjectRoot(candidate))
+			continue;
+
+		base_path = candidate;
+		src_path = base_path + "src/";
+		kernel_path = base_path + "src/kernels/";
+		data_path = base_path + "data/";
+		return;
 	}
+
+	std::cerr << "Unable to find src/kernels/kernels.cl, set the project directory with -R or ASSESSMENT_ROOT." << std::endl;
 }
 
 #endif
\ No newline at end of file
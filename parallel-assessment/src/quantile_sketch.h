@@ -0,0 +1,207 @@
+#ifndef quantile_sketch_h
+#define quantile_sketch_h
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#include "funcs.h"
+
+/* A mergeable KLL quantile sketch. The values are held within a stack of compactors, an item on level h standing for 2^h values of the
+   input. Whenever the sketch outgrows its capacity the lowest full level is sorted and every other item (the odd or the even ones, by the
+   toss of a coin) is promoted to the level above, which halves the level while moving any rank by at most 2^h. The capacity of a level
+   shrinks geometrically below the top, so the whole sketch holds O(k) items however many values it has seen, and any quantile is answered
+   within a normalised rank error of about 1.7 / k by a binary search over its few items.
+
+   Two sketches with the same k merge by concatenating their levels and compacting again, so sketches built by separate threads over
+   separate parts of the data combine into a sketch of the whole with the same error, in any grouping. The coin is a fixed xorshift sequence, so the
+   same values merged in the same order always give the same answers. */
+
+inline size_t SketchK(double rank_error)
+{
+	// The k giving a normalised rank error of about rank_error, the sketch section of the benchmark measures the actual error.
+	return std::max<size_t>(8, (size_t)std::ceil(1.7 / std::max(rank_error, 1e-6)));
+}
+
+class QuantileSketch
+{
+	private:
+		size_t k = 200;
+		std::vector<std::vector<fp_type>> levels;
+		size_t items = 0;						// Items held over every level.
+		size_t max_items = 0;					// Items held once every level is at its capacity.
+		unsigned long long count = 0;			// Values seen, the sum of the weights of every item.
+		fp_type min = 0, max = 0;
+		unsigned int coin = 0x9E3779B9u;
+
+		mutable std::vector<fp_type> sorted;				// Every item in value order, built on the first query after a change.
+		mutable std::vector<unsigned long long> cumulative;	// Weight of the items up to and including each sorted item.
+
+		size_t Capacity(size_t level) const
+		{
+			size_t depth = levels.size() - level - 1;
+			return std::max<size_t>(2, (size_t)std::ceil(k * std::pow(2.0 / 3.0, (double)depth)));
+		}
+
+		void Grow()
+		{
+			levels.emplace_back();
+			max_items = 0;
+			for (size_t h = 0; h < levels.size(); h++)
+				max_items += Capacity(h);
+		}
+
+		bool Flip()
+		{
+			coin ^= coin << 13;
+			coin ^= coin >> 17;
+			coin ^= coin << 5;
+			return coin & 1;
+		}
+
+		void Compress()
+		{
+			// Compact the lowest level which has reached its capacity, promoting half of its items to the level above.
+			for (size_t h = 0; h < levels.size(); h++)
+			{
+				if (levels[h].size() < Capacity(h))
+					continue;
+				if (h + 1 == levels.size())
+					Grow();
+
+				std::vector<fp_type>& level = levels[h];
+				std::sort(level.begin(), level.end());
+
+				// An odd item out stays on its level, so that the promoted pairs are always whole.
+				size_t begin = level.size() & 1;
+				for (size_t i = begin + Flip(); i < level.size(); i += 2)
+					levels[h + 1].push_back(level[i]);
+				level.resize(begin);
+
+				items = 0;
+				for (size_t l = 0; l < levels.size(); l++)
+					items += levels[l].size();
+				return;
+			}
+		}
+
+		void Prepare() const
+		{
+			if (!sorted.empty() || !items)
+				return;
+
+			std::vector<std::pair<fp_type, unsigned long long>> weighted;
+			weighted.reserve(items);
+			for (size_t h = 0; h < levels.size(); h++)
+			{
+				for (size_t i = 0; i < levels[h].size(); i++)
+					weighted.push_back(std::make_pair(levels[h][i], 1ull << h));
+			}
+			std::sort(weighted.begin(), weighted.end());
+
+			sorted.resize(weighted.size());
+			cumulative.resize(weighted.size());
+			unsigned long long weight = 0;
+			for (size_t i = 0; i < weighted.size(); i++)
+			{
+				weight += weighted[i].second;
+				sorted[i] = weighted[i].first;
+				cumulative[i] = weight;
+			}
+		}
+
+	public:
+		QuantileSketch(size_t _k = 200)
+			: k(std::max<size_t>(2, _k))
+		{
+			Grow();
+		}
+
+		void Update(fp_type value)
+		{
+			if (!count || value < min)
+				min = value;
+			if (!count || value > max)
+				max = value;
+			count++;
+
+			levels[0].push_back(value);
+			sorted.clear();
+			if (++items >= max_items)
+				Compress();
+		}
+
+		void Merge(const QuantileSketch& other)
+		{
+			if (!other.count)
+				return;
+
+			min = (count) ? std::min(min, other.min) : other.min;
+			max = (count) ? std::max(max, other.max) : other.max;
+			count += other.count;
+
+			while (levels.size() < other.levels.size())
+				Grow();
+			for (size_t h = 0; h < other.levels.size(); h++)
+				levels[h].insert(levels[h].end(), other.levels[h].begin(), other.levels[h].end());
+
+			items += other.items;
+			sorted.clear();
+			while (items >= max_items)
+			{
+				size_t before = items;
+				Compress();
+				if (items == before)
+					break;
+			}
+		}
+
+		fp_type Quantile(double q) const
+		{
+			// Select the value of rank q * count, as source() does within a sorted array, so that the answers are directly comparable.
+			if (!count)
+				return 0;
+			if (q <= 0)
+				return min;
+			if (q >= 1)
+				return max;
+
+			Prepare();
+			unsigned long long rank = std::min(count - 1, (unsigned long long)(count * q));
+			size_t i = std::upper_bound(cumulative.begin(), cumulative.end(), rank) - cumulative.begin();
+			return std::min(std::max(sorted[std::min(i, sorted.size() - 1)], min), max);
+		}
+
+		double Rank(fp_type value) const
+		{
+			// Estimated fraction of the values which are less than or equal to value.
+			if (!count)
+				return 0;
+
+			Prepare();
+			size_t i = std::upper_bound(sorted.begin(), sorted.end(), value) - sorted.begin();
+			return (i) ? (double)cumulative[i - 1] / count : 0.0;
+		}
+
+		unsigned long long Count() const { return count; }
+		size_t Items() const { return items; }
+		size_t K() const { return k; }
+		double RankError() const { return 1.7 / k; }
+		fp_type Min() const { return min; }
+		fp_type Max() const { return max; }
+};
+
+template<typename T>
+T SelectQuantile(const T* A, size_t size, double q)
+{
+	// The exact value of rank q * size, found by selection over a copy in O(N) rather than by sorting the data.
+	if (!size)
+		return 0;
+
+	std::vector<T> copy(A, A + size);
+	size_t rank = std::min(size - 1, (size_t)(size * std::min(std::max(q, 0.0), 1.0)));
+	std::nth_element(copy.begin(), copy.begin() + rank, copy.end());
+	return copy[rank];
+}
+
+#endif
@@ -0,0 +1,232 @@
+#ifndef records_h
+#define records_h
+
+#include <vector>
+#include <string>
+#include <map>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <climits>
+
+#include "thread_pool.h"
+#include "native_funcs.h"
+#include "memory_arena.h"
+
+/* Per record columns other than the temperature, parsed with the same line chunks as ParallelParse so that index i of every column refers
+   to the same line of the dataset. Station names are interned into small integer ids, which keeps the column compact enough to be uploaded
+   to a device alongside the temperatures and used directly as a histogram key, while the date and time columns are combined into a single
+   minute timestamp. */
+
+struct StationColumn
+{
+	std::vector<std::string> names;		// Station name of every id, in order of first appearance within the dataset.
+	ArenaArray<unsigned short> ids;		// Station id of every record.
+	size_t size = 0;
+
+	size_t StationCount() const { return names.size(); }
+
+	void Release()
+	{
+		ids.Release();
+		names.clear();
+		size = 0;
+	}
+};
+
+StationColumn stations;					// Station column of the loaded dataset.
+
+struct StationDictionary
+{
+	std::map<std::string, unsigned short> ids;
+	std::vector<std::string> names;		// Station name of every id, in order of first appearance.
+	unsigned short last_id = 0;
+
+	unsigned short Intern(const char* name, size_t name_len)
+	{
+		// Consecutive records almost always share a station, so the last name is compared before the dictionary is searched.
+		if (!names.empty() && names[last_id].size() == name_len && memcmp(names[last_id].data(), name, name_len) == 0)
+			return last_id;
+
+		std::string key(name, name_len);
+		std::map<std::string, unsigned short>::iterator it = ids.find(key);
+		if (it == ids.end())
+		{
+			it = ids.insert(std::make_pair(key, (unsigned short)names.size())).first;
+			names.push_back(key);
+		}
+		last_id = it->second;
+		return last_id;
+	}
+
+	unsigned short InternLine(const char* line, const char* line_end, char delimiter)
+	{
+		const char* name_end = (const char*)memchr(line, delimiter, line_end - line);
+		return Intern(line, ((name_end) ? name_end : line_end) - line);
+	}
+};
+
+std::vector<unsigned short> MergeStationNames(const std::vector<std::string>& names, StationDictionary& global)
+{
+	// Map the local ids of one chunk onto the global ids, chunks being merged in dataset order so that the ids are too.
+	std::vector<unsigned short> remap(names.size());
+	for (size_t i = 0; i < names.size(); i++)
+		remap[i] = global.Intern(names[i].data(), names[i].size());
+
+	return remap;
+}
+
+void ParseStations(ThreadPool& pool, const char* data, size_t len, char delimiter, StationColumn& out_column)
+{
+	LineChunks chunks = SplitLines(pool, data, len);
+	out_column.Release();
+	out_column.size = chunks.Records();
+	out_column.ids.Allocate(out_column.size, DatasetMemory);
+
+	// Every chunk interns its names into its own small dictionary, so that no lock is taken per record.
+	std::vector<std::vector<std::string>> chunk_names(chunks.Count());
+	TaskGroup group;
+	for (size_t k = 0; k < chunks.Count(); k++)
+	{
+		pool.Submit(group, pool.NodeOf(chunks.offsets[k], out_column.size), [&, k]()
+		{
+			StationDictionary local;
+			size_t index = chunks.offsets[k];
+			ForEachLine(data, chunks.bounds[k], chunks.bounds[k + 1], [&](const char* line, const char* line_end)
+			{
+				out_column.ids[index++] = local.InternLine(line, line_end, delimiter);
+			});
+			chunk_names[k].swap(local.names);
+		});
+	}
+	group.Wait();
+
+	// Merge the chunk dictionaries in dataset order, producing a table which maps every chunk's local ids onto the global ids.
+	StationDictionary global;
+	std::vector<std::vector<unsigned short>> remap(chunks.Count());
+	for (size_t k = 0; k < chunks.Count(); k++)
+		remap[k] = MergeStationNames(chunk_names[k], global);
+	out_column.names = global.names;
+
+	// Rewrite the local ids in parallel, each chunk on the node which parsed it.
+	for (size_t k = 0; k < chunks.Count(); k++)
+	{
+		pool.Submit(group, pool.NodeOf(chunks.offsets[k], out_column.size), [&, k]()
+		{
+			for (size_t i = chunks.offsets[k]; i < chunks.offsets[k + 1]; i++)
+				out_column.ids[i] = remap[k][out_column.ids[i]];
+		});
+	}
+	group.Wait();
+}
+
+struct TimeColumn
+{
+	ArenaArray<unsigned int> minutes;	// Minutes since 1900-01-01 00:00 of every record.
+	size_t size = 0;
+
+	void Release()
+	{
+		minutes.Release();
+		size = 0;
+	}
+};
+
+TimeColumn times;						// Time column of the loaded dataset.
+
+const unsigned int minutes_per_day = 24 * 60;
+
+int DaysFromCivil(int year, unsigned int month, unsigned int day)
+{
+	// Days since 1970-01-01 of a proleptic gregorian date, counting years from March so that the leap day is the last day of a year.
+	year -= (month <= 2);
+	int era = (year >= 0 ? year : year - 399) / 400;
+	unsigned int year_of_era = (unsigned int)(year - era * 400);
+	unsigned int day_of_year = (153 * (month + ((month > 2) ? -3 : 9)) + 2) / 5 + day - 1;
+	unsigned int day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+	return era * 146097 + (int)day_of_era - 719468;
+}
+
+void CivilFromDays(int days, int& year, unsigned int& month, unsigned int& day)
+{
+	// Inverse of DaysFromCivil.
+	days += 719468;
+	int era = (days >= 0 ? days : days - 146096) / 146097;
+	unsigned int day_of_era = (unsigned int)(days - era * 146097);
+	unsigned int year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+	unsigned int day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+	unsigned int month_index = (5 * day_of_year + 2) / 153;
+	day = day_of_year - (153 * month_index + 2) / 5 + 1;
+	month = month_index + ((month_index < 10) ? 3 : -9);
+	year = (int)year_of_era + era * 400 + (month <= 2);
+}
+
+const int epoch_days = DaysFromCivil(1900, 1, 1);
+
+std::string FormatMinutes(unsigned int minutes)
+{
+	// Format a minute timestamp as "YYYY-MM-DD HH:MM".
+	int year;
+	unsigned int month, day;
+	CivilFromDays(epoch_days + (int)(minutes / minutes_per_day), year, month, day);
+
+	char buffer[32];
+	snprintf(buffer, sizeof(buffer), "%04d-%02u-%02u %02u:%02u", year, month, day, (minutes % minutes_per_day) / 60, minutes % 60);
+	return buffer;
+}
+
+unsigned int ParseUnsigned(const char*& cursor, const char* end, char delimiter)
+{
+	// Parse the unsigned integer at cursor, leaving cursor on the character after the following delimiter.
+	unsigned int value = 0;
+	while (cursor < end && *cursor >= '0' && *cursor <= '9')
+		value = value * 10 + (*cursor++ - '0');
+	while (cursor < end && *cursor++ != delimiter);
+
+	return value;
+}
+
+unsigned int ParseRecordMinutes(const char* line, const char* line_end, char delimiter)
+{
+	// Skip the station name, then parse the year, month, day and HHMM columns (1 to 4) of the record into a single minute timestamp.
+	while (line < line_end && *line++ != delimiter);
+	int year = (int)ParseUnsigned(line, line_end, delimiter);
+	unsigned int month = ParseUnsigned(line, line_end, delimiter);
+	unsigned int day = ParseUnsigned(line, line_end, delimiter);
+	unsigned int hhmm = ParseUnsigned(line, line_end, delimiter);
+
+	int days = DaysFromCivil(year, std::max(1u, month), std::max(1u, day)) - epoch_days;
+	return (unsigned int)std::max(0, days) * minutes_per_day + (hhmm / 100) * 60 + hhmm % 100;
+}
+
+unsigned int YearMinutes(int year)
+{
+	// Minute timestamp of 00:00 on the first of January of a year, clamped in the same manner as ParseRecordMinutes.
+	long long minutes = (long long)(DaysFromCivil(year, 1, 1) - epoch_days) * minutes_per_day;
+	return (unsigned int)std::min<long long>(std::max<long long>(0, minutes), UINT_MAX);
+}
+
+void ParseTimes(ThreadPool& pool, const char* data, size_t len, char delimiter, TimeColumn& out_column)
+{
+	// Parse the date and time columns of every record into a single minute timestamp.
+	LineChunks chunks = SplitLines(pool, data, len);
+	out_column.Release();
+	out_column.size = chunks.Records();
+	out_column.minutes.Allocate(out_column.size, DatasetMemory);
+
+	TaskGroup group;
+	for (size_t k = 0; k < chunks.Count(); k++)
+	{
+		pool.Submit(group, pool.NodeOf(chunks.offsets[k], out_column.size), [&, k]()
+		{
+			size_t index = chunks.offsets[k];
+			ForEachLine(data, chunks.bounds[k], chunks.bounds[k + 1], [&](const char* line, const char* line_end)
+			{
+				out_column.minutes[index++] = ParseRecordMinutes(line, line_end, delimiter);
+			});
+		});
+	}
+	group.Wait();
+}
+
+#endif
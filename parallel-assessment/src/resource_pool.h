@@ -0,0 +1,119 @@
+#ifndef resourcepool_h
+#define resourcepool_h
+
+#include <map>
+#include <string>
+#include <vector>
+#include <memory>
+
+#ifndef cl_included
+	#define cl_included
+	#ifdef __APPLE__
+		#include <OpenCL/cl.hpp>
+	#else
+		#include <CL/cl.hpp>
+	#endif
+#endif
+
+#include "memory_arena.h"
+
+/* Creating a cl::Kernel is a name lookup inside the program plus a driver allocation, and creating a cl::Buffer is a device allocation,
+   neither of which are free. Previously every operation created both from scratch (and a fresh host output array which was never deleted),
+   so a long interactive session would slowly grow. These two classes keep one kernel object per kernel name and one buffer per named slot,
+   only growing a slot when a larger size is requested. */
+
+class KernelCache
+{
+	private:
+		std::map<std::string, cl::Kernel> kernels;
+
+	public:
+		cl::Kernel& Get(const cl::Program& program, const std::string& kernel_id)
+		{
+			// Create the kernel on first request, all following requests return the same kernel object.
+			std::map<std::string, cl::Kernel>::iterator it = kernels.find(kernel_id);
+			if (it == kernels.end())
+				it = kernels.insert(std::make_pair(kernel_id, cl::Kernel(program, kernel_id.c_str()))).first;
+
+			return it->second;
+		}
+
+		size_t Count() const { return kernels.size(); }
+		void Release() { kernels.clear(); }
+};
+
+class BufferPool
+{
+	struct DeviceSlot
+	{
+		cl::Buffer buffer;
+		size_t capacity = 0;
+	};
+
+	struct HostSlot
+	{
+		ArenaArray<char> data;
+		size_t capacity = 0;
+	};
+
+	private:
+		std::map<std::string, DeviceSlot> device_slots;
+		std::map<std::string, HostSlot> host_slots;
+
+	public:
+		cl::Buffer Device(const cl::Context& context, const std::string& slot, int mem_mode, size_t data_size)
+		{
+			// Slots are keyed on both the name and memory mode, so a READ_ONLY input can never be handed out as a READ_WRITE output.
+			DeviceSlot& device_slot = device_slots[slot + "#" + std::to_string(mem_mode)];
+
+			// Only reallocate when the requested size outgrows the slot, smaller requests simply use the front of the buffer.
+			if (device_slot.capacity < data_size)
+			{
+				device_slot.buffer = cl::Buffer(context, mem_mode, data_size);
+				device_slot.capacity = data_size;
+			}
+
+			return device_slot.buffer;
+		}
+
+		template<typename T>
+		T* Host(const std::string& slot, size_t count)
+		{
+			/* Host slots are plain byte arrays from the memory arena which are grown in the same manner as the device slots above. They are
+			   deliberately left uninitialised, so that the first write (possibly from a pinned worker thread) decides which NUMA node backs each page. */
+			HostSlot& host_slot = host_slots[slot];
+			if (host_slot.capacity < count * sizeof(T))
+			{
+				host_slot.data.Allocate(count * sizeof(T), ScratchMemory);
+				host_slot.capacity = count * sizeof(T);
+			}
+
+			return reinterpret_cast<T*>(host_slot.data.Data());
+		}
+
+		size_t DeviceBytes() const
+		{
+			size_t total = 0;
+			for (std::map<std::string, DeviceSlot>::const_iterator it = device_slots.begin(); it != device_slots.end(); ++it)
+				total += it->second.capacity;
+
+			return total;
+		}
+
+		size_t HostBytes() const
+		{
+			size_t total = 0;
+			for (std::map<std::string, HostSlot>::const_iterator it = host_slots.begin(); it != host_slots.end(); ++it)
+				total += it->second.capacity;
+
+			return total;
+		}
+
+		void Release()
+		{
+			device_slots.clear();
+			host_slots.clear();
+		}
+};
+
+#endif
@@ -0,0 +1,307 @@
+#ifndef sortedindex_h
+#define sortedindex_h
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+
+#include "funcs.h"
+#include "native_funcs.h"
+#include "multi_device.h"
+#include "compressed.h"
+#include "dataset.h"
+
+/* A sorted view of the temperature column, replacing the sorted copies which SortOptim() and its backend variants cached per type. Those
+   copies were never invalidated (a work group resize left the padding of the copy before it within the cache) and only ever answered a
+   point lookup by source(). The index instead keeps the first size values of the sort of the selected backend (see BackendSort), copied
+   out of its pooled buffers. A query of the record at a sorted position needs a permutation of the rows as well, which is only sorted on
+   the host for such a query, ordered by the floating point column and then by row. Since the integer column is the rounded floating point
+   column multiplied by 10 (and every storage rounds monotonically), the same permutation orders the sorted values of either type.
+
+   Alongside the sorted values of a type the index keeps their prefix sums (exact 64 bit sums of the integers, double sums of the floating
+   point values), so that a rank, a percentile, the count of readings within a range and a trimmed mean are all answered in O(log N) by a
+   binary search and the difference of two prefix sums. Every array is owned by the index and released with Invalidate(), the index being
+   rebuilt on the next query whenever the column or its size has changed. */
+
+template<typename T>
+struct SortedView
+{
+	typedef typename ScanSum<typename Accumulator<T>::type>::type Sum;
+
+	ArenaArray<T> values;					// Column of the type in sorted order.
+	ArenaArray<Sum> prefix;					// Sum of the first i sorted values at i, followed by the sum of every value.
+};
+
+class SortedIndex
+{
+	private:
+		const fp_type* source = nullptr;	// Floating point column the permutation was sorted by.
+		size_t size = 0;
+		ArenaArray<int> order;				// Row of every sorted position.
+		SortedView<int> int_view;
+		SortedView<fp_type> fp_view;
+
+		template<typename T>
+		static double ColumnValue(double value)
+		{
+			// Round a bound to the precision of the column, so that a bound of 12.3 includes every reading parsed from 12.3.
+			if (std::is_floating_point<T>::value)
+				return (double)(T)value;
+
+			// A bound such as 1.1 multiplied by 10 is 11.000000000000002 in double, which is snapped back onto the integer it represents.
+			double nearest = std::round(value);
+			return (std::fabs(value - nearest) < 1e-6) ? nearest : value;
+		}
+
+		SortedView<int>& View(int) { return int_view; }
+		SortedView<fp_type>& View(fp_type) { return fp_view; }
+		const SortedView<int>& View(int) const { return int_view; }
+		const SortedView<fp_type>& View(fp_type) const { return fp_view; }
+
+	public:
+		bool Valid(const fp_type* column, size_t count) const
+		{
+			return source && source == column && size == count;
+		}
+
+		void Reset(const fp_type* column, size_t count)
+		{
+			Invalidate();
+			source = column;
+			size = count;
+		}
+
+		bool Ordered() const { return order.Data() != nullptr; }
+
+		void Order(ThreadPool& pool)
+		{
+			order.Allocate(size, DatasetMemory);
+			if (!size)
+				return;
+
+			// Rows are ordered by value and then by row, so that the permutation (and every record it selects) is deterministic.
+			const fp_type* column = source;
+			auto before = [column](int a, int b) { return column[a] < column[b] || (column[a] == column[b] && a < b); };
+
+			// Sort the rows of every partition in parallel, then merge neighbouring runs pairwise exactly as NativeSort() does.
+			ArenaArray<int> merged_storage(size, ScratchMemory);
+			int* runs = order.Data();
+			int* merged = merged_storage.Data();
+			size_t partitions = std::max<size_t>(1, std::min(pool.Size(), size));
+			std::vector<size_t> bounds(partitions + 1);
+			for (size_t p = 0; p <= partitions; p++)
+				bounds[p] = (size * p) / partitions;
+
+			pool.ParallelFor(size, partitions, [&](size_t, size_t begin, size_t end)
+			{
+				for (size_t i = begin; i < end; i++)
+					runs[i] = (int)i;
+				std::sort(runs + begin, runs + end, before);
+			});
+
+			for (size_t width = 1; width < partitions; width <<= 1)
+			{
+				TaskGroup group;
+				for (size_t p = 0; p < partitions; p += width * 2)
+				{
+					size_t first = bounds[p], middle = bounds[std::min(p + width, partitions)], last = bounds[std::min(p + width * 2, partitions)];
+					pool.Submit(group, pool.NodeOf(first, size), [=]()
+					{
+						std::merge(runs + first, runs + middle, runs + middle, runs + last, merged + first, before);
+					});
+				}
+				group.Wait();
+				std::swap(runs, merged);
+			}
+
+			// The merge passes alternate between both arrays, the permutation is kept in whichever holds the final pass.
+			if (runs != order.Data())
+				order = std::move(merged_storage);
+		}
+
+		template<typename T>
+		void Materialize(ThreadPool& pool, const T* sorted)
+		{
+			// Copy the sorted values of the type out of the buffers of the sort, then scan their prefix sums in two passes over the partitions.
+			typedef typename SortedView<T>::Sum Sum;
+			SortedView<T>& view = View(T());
+			if (view.values.Data())
+				return;
+
+			view.values.Allocate(size, DatasetMemory);
+			view.prefix.Allocate(size + 1, DatasetMemory);
+			T* values = view.values.Data();
+			Sum* prefix = view.prefix.Data();
+
+			size_t partitions = pool.DefaultPartitions();
+			std::vector<Sum> totals(partitions + 1, (Sum)0);
+			pool.ParallelFor(size, partitions, [&](size_t p, size_t begin, size_t end)
+			{
+				Sum total = 0;
+				for (size_t i = begin; i < end; i++)
+				{
+					values[i] = sorted[i];
+					total += values[i];
+				}
+				totals[p + 1] = total;
+			});
+
+			for (size_t p = 1; p <= partitions; p++)
+				totals[p] += totals[p - 1];
+
+			prefix[0] = 0;
+			pool.ParallelFor(size, partitions, [&](size_t p, size_t begin, size_t end)
+			{
+				Sum running = totals[p];
+				for (size_t i = begin; i < end; i++)
+				{
+					running += values[i];
+					prefix[i + 1] = running;
+				}
+			});
+		}
+
+		template<typename T>
+		bool Materialized() const
+		{
+			return View(T()).values.Data() != nullptr;
+		}
+
+		void Invalidate()
+		{
+			// Return every array to the arena, the next query rebuilds the index from the column it is given.
+			order.Release();
+			int_view.values.Release();
+			int_view.prefix.Release();
+			fp_view.values.Release();
+			fp_view.prefix.Release();
+			source = nullptr;
+			size = 0;
+		}
+
+		size_t Size() const { return size; }
+		int Row(size_t position) const { return order[position]; }
+
+		template<typename T>
+		size_t CountBelow(double value) const
+		{
+			// Readings strictly below the value, the values being in the units of the column.
+			const T* values = View(T()).values.Data();
+			value = ColumnValue<T>(value);
+			return std::lower_bound(values, values + size, value, [](T a, double b) { return a < b; }) - values;
+		}
+
+		template<typename T>
+		size_t CountAtMost(double value) const
+		{
+			const T* values = View(T()).values.Data();
+			value = ColumnValue<T>(value);
+			return std::upper_bound(values, values + size, value, [](double a, T b) { return a < b; }) - values;
+		}
+
+		template<typename T>
+		size_t CountBetween(double low, double high) const
+		{
+			// Readings within [low, high], both bounds inclusive.
+			if (high < low)
+				return 0;
+			return CountAtMost<T>(high) - CountBelow<T>(low);
+		}
+
+		template<typename T>
+		double Rank(double value) const
+		{
+			// Percentile rank of a value, the percentage of readings at or below it.
+			return (size) ? 100.0 * CountAtMost<T>(value) / size : 0.0;
+		}
+
+		size_t PercentilePosition(double q) const
+		{
+			// The same position as source() selects, clamped to the column.
+			size_t position = (size_t)(size * std::max(0.0, q));
+			return std::min(position, size - 1);
+		}
+
+		template<typename T>
+		T Percentile(double q) const
+		{
+			return View(T()).values[PercentilePosition(q)];
+		}
+
+		template<typename T>
+		double RangeSum(size_t begin, size_t end) const
+		{
+			// Sum of the sorted values within [begin, end), as the difference of two prefix sums.
+			const SortedView<T>& view = View(T());
+			return (double)(view.prefix[end] - view.prefix[begin]);
+		}
+
+		template<typename T>
+		double TrimmedMean(double fraction) const
+		{
+			// Mean of the readings left once the given fraction is removed from each end, or the median once nothing would be left.
+			size_t trim = (size_t)(size * std::min(std::max(fraction, 0.0), 0.5));
+			if (trim * 2 >= size)
+				return (double)Percentile<T>(0.5);
+			return RangeSum<T>(trim, size - trim) / (double)(size - trim * 2);
+		}
+};
+
+SortedIndex sorted_index;					// Sorted view of the loaded dataset, built on first use.
+
+template<typename T>
+T* BackendSort(T*& A, T*& B, size_t& base_size, size_t original_size)
+{
+	// Sort with the current backend, the single device sorting the compressed column instead whenever a storage of it is selected.
+	switch (execution_backend)
+	{
+		case MultiDevice: return MultiSort(A, B, base_size, original_size);
+		case NativeThreads: return NativeSort(A, B, base_size, original_size);
+		default:
+		{
+			T* sorted = StorageSort(A, original_size);
+			return (sorted) ? sorted : Sort(A, B, base_size, original_size);
+		}
+	}
+}
+
+template<typename T>
+SortedIndex& GetSortedIndex(T*& A, T*& B, size_t& base_size, size_t size)
+{
+	/* The index is keyed on the floating point column of the dataset and holds the first size sorted values of A, as sorted by the current
+	   backend, so the padding of a resized copy never enters the index. */
+	if (!sorted_index.Valid(dataset.values.Data(), size))
+		sorted_index.Reset(dataset.values.Data(), size);
+
+	if (!sorted_index.Materialized<T>())
+	{
+		T* sorted = (size) ? BackendSort(A, B, base_size, size) : nullptr;
+
+		std::string kernel_id = "native_sort_index_copy";
+		ConcatKernelID(T(), kernel_id);
+		ThreadPool& pool = *GetThreadPool();
+		timer::Start();
+		sorted_index.Materialize(pool, sorted);
+		PrintNativeInfo(kernel_id, pool);
+	}
+
+	return sorted_index;
+}
+
+int SortedRow(SortedIndex& index, size_t position)
+{
+	// The permutation of the rows is only sorted on the host by the first query of a record, the sorted values answering every other query.
+	if (!index.Ordered())
+	{
+		ThreadPool& pool = *GetThreadPool();
+		timer::Start();
+		index.Order(pool);
+		PrintNativeInfo("native_sort_index", pool);
+	}
+
+	return index.Row(position);
+}
+
+#endif
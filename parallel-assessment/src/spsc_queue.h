@@ -0,0 +1,75 @@
+#ifndef spsc_queue_h
+#define spsc_queue_h
+
+#include <vector>
+#include <atomic>
+#include <thread>
+
+/* A bounded single producer, single consumer queue. The producer only ever writes the tail and the consumer only ever writes the head, so
+   neither side takes a lock: a push publishes its slot with a release store of the tail, which the consumer's acquire load of the tail
+   observes before reading the slot (and the same in reverse for the head, which hands the slot back). The head and tail are padded onto
+   separate cache lines so that the two threads do not contend for one line. */
+
+template<typename T>
+class SpscQueue
+{
+	private:
+		std::vector<T> slots;
+		size_t mask;
+		char head_padding[64];
+		std::atomic<size_t> head;				// Next slot to pop.
+		char tail_padding[64];
+		std::atomic<size_t> tail;				// Next slot to push.
+
+	public:
+		SpscQueue(size_t capacity) : head(0), tail(0)
+		{
+			// Round the capacity up to a power of two, so that a slot is the position masked rather than divided.
+			size_t size = 1;
+			while (size < capacity)
+				size <<= 1;
+
+			slots.resize(size);
+			mask = size - 1;
+		}
+
+		bool TryPush(const T& value)
+		{
+			size_t position = tail.load(std::memory_order_relaxed);
+			if (position - head.load(std::memory_order_acquire) == slots.size())
+				return false;
+
+			slots[position & mask] = value;
+			tail.store(position + 1, std::memory_order_release);
+			return true;
+		}
+
+		bool TryPop(T& value)
+		{
+			size_t position = head.load(std::memory_order_relaxed);
+			if (position == tail.load(std::memory_order_acquire))
+				return false;
+
+			value = slots[position & mask];
+			head.store(position + 1, std::memory_order_release);
+			return true;
+		}
+
+		// Blocking variants, which yield while the queue is full or empty as every stage of a pipeline is expected to keep up.
+		void Push(const T& value)
+		{
+			while (!TryPush(value))
+				std::this_thread::yield();
+		}
+
+		T Pop()
+		{
+			T value;
+			while (!TryPop(value))
+				std::this_thread::yield();
+
+			return value;
+		}
+};
+
+#endif
@@ -0,0 +1,151 @@
+#ifndef summation_h
+#define summation_h
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cmath>
+
+#include "funcs.h"
+
+/* Deterministic compensated sums of the floating point column. reduce_sum_FP and sum_sqr_diff_FP combine their work groups with a CAS
+   based atomic_add_f, so the order of the float additions (and therefore the rounding of the mean and standard deviation) changes from one
+   execution to the next. The compensated kernels instead sum a fixed grid stride per work item with Neumaier's algorithm, combine the work
+   items as a fixed tree and leave one (sum, compensation) pair per work group, which the host combines pairwise in group order. For a given
+   device and work group size the result is identical on every execution, and accurate to the accumulator rather than to the number of
+   additions. */
+
+enum SummationMode
+{
+	AtomicSummation,		// reduce_sum_FP and sum_sqr_diff_FP.
+	CompensatedFloat,		// Neumaier summation accumulated in float.
+	CompensatedDouble		// Neumaier summation accumulated in double, where the device supports cl_khr_fp64.
+};
+SummationMode summation_mode = AtomicSummation;	// How the precision mode sums the floating point column on a single device.
+
+bool DeviceSupportsFP64()
+{
+	cl::Device device = context.getInfo<CL_CONTEXT_DEVICES>()[0];
+	std::string extensions = device.getInfo<CL_DEVICE_EXTENSIONS>();
+	return extensions.find("cl_khr_fp64") != std::string::npos;
+}
+
+const char* SummationName(SummationMode mode)
+{
+	switch (mode)
+	{
+		case CompensatedFloat: return "COMPENSATED (FLOAT)";
+		case CompensatedDouble: return "COMPENSATED (DOUBLE)";
+		default: return "ATOMIC";
+	}
+}
+
+// ------------------------------------------------------------------------ Summation Functions ------------------------------------------------------------------------ //
+
+inline void NeumaierAdd(double& sum, double& comp, double value)
+{
+	// Host equivalent of NEUMAIER_ADD within kernels.cl.
+	double t = sum + value;
+	comp += (std::fabs(sum) >= std::fabs(value)) ? (sum - t) + value : (value - t) + sum;
+	sum = t;
+}
+
+template<typename Acc>
+double CombinePartials(const Acc* partials, size_t group_count)
+{
+	// Combine the (sum, compensation) pair of every work group as a fixed pairwise tree, the same shape as within each work group.
+	std::vector<double> sums(group_count), comps(group_count);
+	for (size_t g = 0; g < group_count; g++)
+	{
+		sums[g] = partials[2 * g];
+		comps[g] = partials[2 * g + 1];
+	}
+
+	for (size_t stride = 1; stride < group_count; stride <<= 1)
+	{
+		for (size_t g = 0; g + stride < group_count; g += 2 * stride)
+		{
+			NeumaierAdd(sums[g], comps[g], sums[g + stride]);
+			comps[g] += comps[g + stride];
+		}
+	}
+
+	return sums[0] + comps[0];
+}
+
+template<typename Acc>
+double EnqueueCompensatedSum(cl::Buffer in, size_t size, const double* mean, KernelProfile& profile, std::string& kernel_id)
+{
+	// Determine the kernel name from the operation and accumulator, e.g. the squared differences accumulated in double are "compensated_sqr_diff_DP".
+	kernel_id = (mean) ? "compensated_sqr_diff" : "compensated_sum";
+	kernel_id += (sizeof(Acc) == sizeof(double)) ? "_DP" : "_FP";
+	cl::Kernel kernel = kernel_cache.Get(program, kernel_id);
+
+	/* The tree needs a power of two work group size holding two accumulators per work item. The group count is fixed by the device rather
+	   than the data, a few work groups per compute unit, so that the order of every addition is the same on every execution. */
+	size_t group_size = ScanLocalSize(kernel, kernel, 2 * sizeof(Acc));
+	cl::Device device = context.getInfo<CL_CONTEXT_DEVICES>()[0];
+	cl_uint compute_units = device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+	size_t group_count = std::max<size_t>(1, std::min<size_t>(compute_units * 8, (size + group_size - 1) / group_size));
+
+	cl::Buffer partials_buffer = PooledBuffer<Acc>(kernel_id + "_partials", nullptr, group_count * 2);
+	int arg = 0;
+	kernel.setArg(arg++, in);
+	kernel.setArg(arg++, partials_buffer);
+	kernel.setArg(arg++, cl::Local(group_size * sizeof(Acc)));
+	kernel.setArg(arg++, cl::Local(group_size * sizeof(Acc)));
+	if (mean)
+		kernel.setArg(arg++, (Acc)*mean);
+	kernel.setArg(arg++, (int)size);
+	EnqueueProfiled(kernel, group_count * group_size, group_size, profile);
+
+	std::vector<Acc> partials(group_count * 2);
+	queue.enqueueReadBuffer(partials_buffer, CL_TRUE, 0, partials.size() * sizeof(Acc), partials.data());
+	return CombinePartials(partials.data(), group_count);
+}
+
+double CompensatedSum(const fp_type* data, size_t size, SummationMode mode, const double* mean = nullptr)
+{
+	/* Sum of data, or of its squared differences from mean when provided. Unlike the atomic reductions the kernels check their bounds,
+	   so the unpadded size is used and the padding of Resize() never enters the sum. */
+	timer::Start();
+	KernelProfile profile;
+	std::string kernel_id;
+	cl::Buffer in_buffer = PooledBuffer("compensated_in", data, size);
+
+	double result = (mode == CompensatedDouble) ? EnqueueCompensatedSum<double>(in_buffer, size, mean, profile, kernel_id)
+		: EnqueueCompensatedSum<fp_type>(in_buffer, size, mean, profile, kernel_id);
+
+	PrintProfilerInfo(kernel_id, profile.ex_time, profile.profiled_info, timer::Stop(profiler_resolution));
+	return result;
+}
+
+/* The functions below route the floating point sums of the precision mode to the compensated kernels when selected, returning false when
+   the atomic kernels should be used instead. The integer column is summed exactly by the integer kernels. */
+
+template<typename T, typename Out>
+bool CompensatedReduce(T*&, Out*&, size_t, const T* = nullptr)
+{
+	return false;
+}
+
+bool CompensatedReduce(fp_type*& A, fp_type*& B, size_t original_size, const fp_type* mean = nullptr)
+{
+	if (summation_mode == AtomicSummation)
+		return false;
+
+	// Fall back on float accumulation where the device has no double precision.
+	SummationMode mode = summation_mode;
+	if (mode == CompensatedDouble && !DeviceSupportsFP64())
+	{
+		std::cout << "The device does not support cl_khr_fp64, accumulating in float.\n";
+		mode = CompensatedFloat;
+	}
+
+	double mean_value = (mean) ? *mean : 0.0;
+	B = buffer_pool.Host<fp_type>((mean) ? "compensated_sqr_diff" : "compensated_sum", 1);
+	B[0] = (fp_type)CompensatedSum(A, original_size, mode, (mean) ? &mean_value : nullptr);
+	return true;
+}
+
+#endif
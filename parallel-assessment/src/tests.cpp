@@ -0,0 +1,1256 @@
+#define CL_USE_DEPRECATED_OPENCL_1_2_APIS
+#define __CL_ENABLE_EXCEPTIONS
+
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <string>
+#include <random>
+#include <numeric>
+#include <limits>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+
+#ifndef _WIN32
+	#include <unistd.h>
+#endif
+
+#include "Utils.h"
+#include "windows_fileread.h"
+#include "analytics.h"
+#include "funcs.h"
+#include "paths.h"
+#include "records.h"
+#include "dataset.h"
+#include "menu_system.h"
+
+/* Regression and accuracy tests of every kernel within kernels.cl and of every native path. Each case writes a generated dataset in the
+   format of the lincolnshire files, loads it through the same pipeline as the analyzer and compares the result of every operation, on
+   every backend and in both optimization modes, against a reference computed on the host in double (or long double) precision.
+
+   The cases are chosen to break the kernels rather than to resemble the data: sizes which are not a multiple of any work group size, a
+   single record, every value equal, every value negative and every value positive (the latter two catch reductions seeded with zero).
+   Every comparison has a tolerance budget of its mode, see Budget below. A single section can be selected with -t <name>, the exit code
+   is the number of failed checks (capped at 255) so the program can be used as a test target. */
+
+namespace test
+{
+	int checks = 0;
+	int failures = 0;
+	bool verbose = false;
+	std::string current_case = "";
+
+	void Check(bool passed, const std::string& name, const std::string& detail = "")
+	{
+		checks++;
+		if (!passed)
+			failures++;
+		if (!passed || verbose)
+			std::printf("%s [%s] %s%s%s\n", (passed) ? "PASS" : "FAIL", current_case.c_str(), name.c_str(), (detail.empty()) ? "" : ": ", detail.c_str());
+	}
+
+	std::string Detail(double actual, double expected, double tolerance)
+	{
+		char buffer[128];
+		snprintf(buffer, sizeof(buffer), "got %.9g, expected %.9g (tolerance %.3g)", actual, expected, tolerance);
+		return buffer;
+	}
+
+	void Near(double actual, double expected, double tolerance, const std::string& name)
+	{
+		bool passed = (std::isnan(actual) && std::isnan(expected)) || actual == expected || std::fabs(actual - expected) <= tolerance;
+		Check(passed, name, (passed && !verbose) ? "" : Detail(actual, expected, tolerance));
+	}
+
+	void Equal(double actual, double expected, const std::string& name)
+	{
+		Near(actual, expected, 0.0, name);
+	}
+
+	// ------------------------------------------------------------------------ Tolerance Budgets ------------------------------------------------------------------------ //
+
+	/* Every tolerance is the worst case bound of its mode relative to the sum of the magnitudes which are accumulated, so that a result which
+	   fails is wrong rather than unlucky. The integer column is exact (the data has a single decimal place), so the performance mode has no
+	   budget at all. The floating point column is compared against a reference over the parsed floats, so the budgets only cover the
+	   accumulation: n ulps for the atomic float sums, a few ulps for the compensated sums, then the rounding of the result to fp_type. */
+
+	const double float_eps = std::numeric_limits<fp_type>::epsilon();
+
+	double Budget(bool integer, SummationMode mode, size_t n)
+	{
+		if (integer)
+			return 0.0;
+
+		switch (mode)
+		{
+			case CompensatedFloat: return (4.0 + n * float_eps) * float_eps + float_eps;
+			case CompensatedDouble: return 4.0 * std::numeric_limits<double>::epsilon() + float_eps;
+			default: return (n + 1) * float_eps;
+		}
+	}
+
+	// ------------------------------------------------------------------------ Generated Datasets ------------------------------------------------------------------------ //
+
+	struct Record
+	{
+		int station;
+		unsigned int minutes;					// Minutes since 1900-01-01, a multiple of 10.
+		int tenths;								// Temperature multiplied by 10, exact.
+	};
+
+	struct Case
+	{
+		std::string name;
+		std::vector<Record> records;
+	};
+
+	const char* station_names[] = { "ALPHA", "BRAVO", "CHARLIE" };
+
+	Case MakeCase(const std::string& name, size_t size, int min_tenths, int max_tenths, unsigned int seed, int station_count = 3, int days = 2 * 365, int slots = 24 * 6)
+	{
+		// Records at random ten minute slots of the first days since 2000, few days and slots crowding many records into every group.
+		std::mt19937 generator(seed);
+		std::uniform_int_distribution<int> station(0, station_count - 1);
+		std::uniform_int_distribution<int> day(0, days - 1);
+		std::uniform_int_distribution<int> slot(0, slots - 1);
+		std::uniform_int_distribution<int> noise(min_tenths, max_tenths);
+		unsigned int first_minute = YearMinutes(2000);
+
+		Case c;
+		c.name = name;
+		for (size_t i = 0; i < size; i++)
+		{
+			Record record;
+			record.station = station(generator);
+			record.minutes = first_minute + day(generator) * minutes_per_day + slot(generator) * 10;
+			record.tenths = noise(generator);
+			c.records.push_back(record);
+		}
+		return c;
+	}
+
+	std::string CasePath()
+	{
+		// The cases are written to the temporary directory, never the project, so an aborted run leaves nothing in the source tree.
+	#ifdef _WIN32
+		char dir[MAX_PATH + 1];
+		DWORD length = GetTempPathA(sizeof(dir), dir);
+		std::string path = (length && length < sizeof(dir)) ? std::string(dir, length) : std::string(".\\");
+		return path + "assessment_test_case_" + std::to_string(GetCurrentProcessId()) + ".txt";
+	#else
+		const char* dir = std::getenv("TMPDIR");
+		std::string path = (dir && *dir) ? std::string(dir) : std::string("/tmp");
+		return path + "/assessment_test_case_" + std::to_string(getpid()) + ".txt";
+	#endif
+	}
+
+	int RecordYear(const Record& record)
+	{
+		int year;
+		unsigned int month, day;
+		CivilFromDays(epoch_days + (int)(record.minutes / minutes_per_day), year, month, day);
+		return year;
+	}
+
+	std::string RecordLine(const Record& record)
+	{
+		// A record in the format of the dataset, "STATION YYYY MM DD HHMM T.T".
+		int year;
+		unsigned int month, day;
+		CivilFromDays(epoch_days + (int)(record.minutes / minutes_per_day), year, month, day);
+		unsigned int minute_of_day = record.minutes % minutes_per_day;
+
+		char line[96];
+		snprintf(line, sizeof(line), "%s %d %02u %02u %02u%02u %s%d.%d\n", station_names[record.station], year, month, day, minute_of_day / 60,
+			minute_of_day % 60, (record.tenths < 0) ? "-" : "", std::abs(record.tenths) / 10, std::abs(record.tenths) % 10);
+		return line;
+	}
+
+	std::string WriteCase(const Case& c)
+	{
+		std::string path = CasePath();
+		std::ofstream file(path.c_str(), std::ios::binary);
+		for (size_t i = 0; i < c.records.size(); i++)
+			file << RecordLine(c.records[i]);
+		return path;
+	}
+
+	std::string WritePartitions(const Case& c, std::vector<std::string>& out_files)
+	{
+		// Write the records into a directory of "<STATION>_<YEAR>.txt" partitions beside the case file, in the order of the records.
+		std::string directory = CasePath();
+		directory = directory.substr(0, directory.find_last_of('.')) + "_partitions";
+	#ifdef _WIN32
+		CreateDirectoryA(directory.c_str(), NULL);
+	#else
+		mkdir(directory.c_str(), 0755);
+	#endif
+
+		std::map<std::string, std::ofstream> files;
+		for (size_t i = 0; i < c.records.size(); i++)
+		{
+			const Record& record = c.records[i];
+			std::string path = directory + "/" + station_names[record.station] + "_" + std::to_string(RecordYear(record)) + ".txt";
+			if (!files.count(path))
+			{
+				files[path].open(path.c_str(), std::ios::binary);
+				out_files.push_back(path);
+			}
+			files[path] << RecordLine(record);
+		}
+		return directory;
+	}
+
+	void RemovePartitions(const std::string& directory, const std::vector<std::string>& files)
+	{
+		for (size_t i = 0; i < files.size(); i++)
+			std::remove(files[i].c_str());
+	#ifdef _WIN32
+		RemoveDirectoryA(directory.c_str());
+	#else
+		rmdir(directory.c_str());
+	#endif
+	}
+
+	void ResetCaches()
+	{
+		// Every cache keyed on the address of a column is dropped, as the arena may hand the next case the very same address.
+		time_series.Release();
+		climatology_index.Release();
+		sorted_index.Invalidate();
+		ReleaseColumns();
+		compressed_column.Release();
+		half_column.Release();
+		aligned_int = AlignedSeries<int>();
+		aligned_fp = AlignedSeries<fp_type>();
+		buffer_pool.Release();
+	}
+
+	bool LoadCase(const Case& c, bool lazy)
+	{
+		ResetCaches();
+		dataset.lazy = lazy;
+		dataset.stream_to_device = !lazy;
+		if (!dataset.Open(WriteCase(c)))
+			return false;
+
+		dataset.Load(*GetThreadPool(), DatasetQuery(), ' ', 5, stations, times);
+		if (lazy)
+			RequireRecordColumns();
+
+		// As after a load within the analyzer, the next kernel pads its own copy of the new columns.
+		wg_size_changed = true;
+
+		if (dataset.stream_to_device && dataset.size)
+		{
+			fp_columns.Adopt(dataset.size, dataset.device_values, dataset.device_station_ids);
+			int_columns.Adopt(dataset.size, dataset.device_int_values, dataset.device_station_ids);
+		}
+		return dataset.size == c.records.size();
+	}
+
+	// ------------------------------------------------------------------------ References ------------------------------------------------------------------------ //
+
+	/* Every reference is computed from the generated records: in tenths for the integer column and from the parsed floats for the floating
+	   point column, so that the parsing itself is tested separately by the parse section. */
+
+	template<typename T>
+	std::vector<T> Column(const Case& c);
+
+	template<>
+	std::vector<int> Column<int>(const Case& c)
+	{
+		std::vector<int> column;
+		for (size_t i = 0; i < c.records.size(); i++)
+			column.push_back(c.records[i].tenths);
+		return column;
+	}
+
+	template<>
+	std::vector<fp_type> Column<fp_type>(const Case& c)
+	{
+		std::vector<fp_type> column;
+		for (size_t i = 0; i < c.records.size(); i++)
+			column.push_back((fp_type)(c.records[i].tenths / 10.0));
+		return column;
+	}
+
+	struct Moments
+	{
+		long double sum = 0, magnitude = 0;		// Sum of the values and of their magnitudes.
+		long double sqr_diff = 0;				// Sum of the squared differences from the exact mean.
+		double min = 0, max = 0;
+	};
+
+	template<typename T>
+	Moments MomentsOf(const std::vector<T>& values)
+	{
+		Moments m;
+		m.min = *std::min_element(values.begin(), values.end());
+		m.max = *std::max_element(values.begin(), values.end());
+		for (size_t i = 0; i < values.size(); i++)
+		{
+			m.sum += values[i];
+			m.magnitude += std::fabs((long double)values[i]);
+		}
+		long double mean = m.sum / values.size();
+		for (size_t i = 0; i < values.size(); i++)
+			m.sqr_diff += (values[i] - mean) * (values[i] - mean);
+		return m;
+	}
+
+	const char* ModeName(bool integer, SummationMode mode)
+	{
+		return (integer) ? "performance" : (mode == AtomicSummation) ? "precision" : (mode == CompensatedFloat) ? "compensated float" : "compensated double";
+	}
+
+	const char* BackendLabel(ExecutionBackend backend)
+	{
+		return (backend == MultiDevice) ? "multi" : (backend == NativeThreads) ? "native" : "device";
+	}
+
+	// ------------------------------------------------------------------------ Sections ------------------------------------------------------------------------ //
+
+	void CompareRecords(const std::vector<Record>& records, const std::string& label)
+	{
+		// The loaded columns must hold exactly the given records, in order, as their float and as their integer in tenths.
+		Equal((double)dataset.size, (double)records.size(), label + " size");
+		if (dataset.size != records.size())
+			return;
+
+		size_t value_errors = 0, int_errors = 0, station_errors = 0, time_errors = 0;
+		for (size_t i = 0; i < records.size(); i++)
+		{
+			value_errors += dataset.values[i] != (fp_type)(records[i].tenths / 10.0);
+			int_errors += dataset.int_values[i] != records[i].tenths;
+			station_errors += stations.names[stations.ids[i]] != station_names[records[i].station];
+			time_errors += times.minutes[i] != records[i].minutes;
+		}
+		Equal((double)value_errors, 0, label + " values");
+		Equal((double)int_errors, 0, label + " integer values");
+		Equal((double)station_errors, 0, label + " stations");
+		Equal((double)time_errors, 0, label + " times");
+	}
+
+	void Queries(const Case& c)
+	{
+		/* A station and a year range selected from the records sorted by station and time, once from a single file, where the lazy load
+		   binary searches the rows of the file (see SelectRows), and once from a directory of station and year partitions, where both loads
+		   prune the partitions by their names. The lazy and pipelined loads must both select exactly the matching records. */
+		Case sorted = c;
+		std::stable_sort(sorted.records.begin(), sorted.records.end(), [](const Record& a, const Record& b)
+		{
+			return (a.station != b.station) ? a.station < b.station : a.minutes < b.minutes;
+		});
+
+		DatasetQuery queries[2];
+		queries[0].station = station_names[1];
+		queries[0].first_year = queries[0].last_year = 2001;
+		queries[1].first_year = 2000;
+		queries[1].last_year = 2000;
+
+		std::vector<std::string> files;
+		std::string directory = WritePartitions(sorted, files);
+		std::string sources[] = { WriteCase(sorted), directory };
+		for (size_t q = 0; q < 2; q++)
+		{
+			std::vector<Record> expected;
+			for (size_t i = 0; i < sorted.records.size(); i++)
+			{
+				const Record& record = sorted.records[i];
+				int year = RecordYear(record);
+				bool station = queries[q].station.empty() || queries[q].station == station_names[record.station];
+				if (station && year >= queries[q].first_year && year <= queries[q].last_year)
+					expected.push_back(record);
+			}
+
+			for (size_t source = 0; source < 2; source++)
+			{
+				for (int lazy = 0; lazy < 2; lazy++)
+				{
+					std::string label = std::string((lazy) ? "lazy" : "pipelined") + " query of " + queries[q].Describe()
+						+ ((source) ? " from partitions" : " from one file");
+					ResetCaches();
+					dataset.lazy = lazy != 0;
+					dataset.stream_to_device = false;
+					if (!dataset.Open(sources[source]))
+					{
+						Check(false, label, "the case did not open");
+						continue;
+					}
+
+					dataset.Load(*GetThreadPool(), queries[q], ' ', 5, stations, times);
+					if (lazy)
+						RequireRecordColumns();
+					CompareRecords(expected, label);
+				}
+			}
+		}
+		RemovePartitions(directory, files);
+	}
+
+	void Parse(const Case& c)
+	{
+		/* The pipelined and the lazy load must decode exactly the value of every record. The pipelined load is repeated with blocks of a few
+		   bytes, so that the lines straddle the blocks and some blocks hold no beginning of a line at all. */
+		size_t default_block_bytes = dataset.block_bytes;
+		const size_t block_bytes[] = { default_block_bytes, 37, 5 };
+		for (int lazy = 0; lazy < 2; lazy++)
+		{
+			for (size_t b = 0; b < ((lazy) ? 1 : sizeof(block_bytes) / sizeof(block_bytes[0])); b++)
+			{
+				dataset.block_bytes = block_bytes[b];
+				std::string label = std::string((lazy) ? "lazy" : "pipelined") + " parse";
+				if (b)
+					label += " (" + std::to_string(block_bytes[b]) + " byte blocks)";
+				if (LoadCase(c, lazy != 0))
+					CompareRecords(c.records, label);
+				else Check(false, label, "the case did not load");
+			}
+		}
+		dataset.block_bytes = default_block_bytes;
+
+		Queries(c);
+		LoadCase(c, false);
+	}
+
+	template<typename T>
+	void Reduce(const Case& c, T* column, ExecutionBackend backend, SummationMode mode)
+	{
+		// Minimum, maximum, mean and standard deviation of one backend in one mode, with both work group sizes to move the padding.
+		bool integer = typeid(T) == typeid(int);
+		fp_type division = (integer) ? 10.0 : 1.0;
+		std::vector<T> reference = Column<T>(c);
+		Moments m = MomentsOf(reference);
+		size_t n = reference.size();
+		double budget = Budget(integer, mode, n);
+
+		execution_backend = backend;
+		summation_mode = mode;
+		std::string label = std::string(BackendLabel(backend)) + " " + ModeName(integer, mode);
+		if (column_storage != PlainColumns)
+			label += std::string(" ") + StorageName(column_storage);
+		for (int wg = 0; wg < 2; wg++)
+		{
+			max_wg_size = wg != 0;
+			wg_size_changed = true;
+			std::string wg_label = label + ((wg) ? " max wg" : " min wg");
+
+			T* A = column;
+			T* B = nullptr;
+			size_t base_size = n;
+			BackendMinMax(A, B, base_size, n, false);
+			Equal(B[0], m.min, wg_label + " min");
+			BackendMinMax(A, B, base_size, n, true);
+			Equal(B[0], m.max, wg_label + " max");
+
+			if (backend == SingleDevice)
+			{
+				GlobalMinMax(A, B, base_size, n, false);
+				Equal(B[0], m.min, wg_label + " global min");
+				GlobalMinMax(A, B, base_size, n, true);
+				Equal(B[0], m.max, wg_label + " global max");
+			}
+
+			typename Accumulator<T>::type sum = BackendSum(A, base_size, n);
+			Near((double)sum, (double)m.sum, budget * (double)m.magnitude, wg_label + " sum");
+			double expected_mean = (double)(m.sum / n) / division;
+			double rounding = 4.0 * std::numeric_limits<double>::epsilon() * std::fabs(expected_mean);
+			Near(mean(sum / (double)division, n), expected_mean, budget * (double)m.magnitude / n / division + rounding, wg_label + " mean");
+
+			// The squared differences carry the budget of their own sum, plus the rounding of the shift which they are taken about.
+			double variance = BackendVariance(A, base_size, n, sum);
+			double expected = (double)(m.sqr_diff / n);
+			double spread = std::max(std::fabs(m.max - m.sum / n), std::fabs(m.min - m.sum / n));
+			double tolerance = budget * (expected + spread * spread) + budget * (double)m.magnitude / n * spread * 2;
+			Near(std::sqrt(variance) / division, std::sqrt(expected) / division, std::sqrt(tolerance) / division, wg_label + " standard deviation");
+		}
+		max_wg_size = false;
+		wg_size_changed = true;
+	}
+
+	void Reductions(const Case& c)
+	{
+		int* A = dataset.int_values.Data();
+		fp_type* A_f = dataset.values.Data();
+		ExecutionBackend backends[] = { SingleDevice, MultiDevice, NativeThreads };
+		for (int b = 0; b < 3; b++)
+		{
+			Reduce(c, A, backends[b], AtomicSummation);
+			Reduce(c, A_f, backends[b], AtomicSummation);
+		}
+		Reduce(c, A_f, SingleDevice, CompensatedFloat);
+		Reduce(c, A_f, SingleDevice, CompensatedDouble);
+		execution_backend = SingleDevice;
+		summation_mode = AtomicSummation;
+	}
+
+	void HalfConversions()
+	{
+		// FloatToHalf must round to nearest even as vstore_half does, HalfToFloat being exact.
+		const float values[] = { 21.3f, -0.1f, 2049.0f, 2051.0f, 65504.0f, 65520.0f, -1e6f, 5.9604645e-8f, 2.9802322e-8f, 1e-9f, 0.0f };
+		const float expected[] = { 21.296875f, -0.0999755859375f, 2048.0f, 2052.0f, 65504.0f, INFINITY, -INFINITY, 5.9604645e-8f, 0.0f, 0.0f, 0.0f };
+		for (int i = 0; i < 11; i++)
+			Equal(HalfToFloat(FloatToHalf(values[i])), expected[i], "half of " + std::to_string(values[i]));
+		Check(std::isnan(HalfToFloat(FloatToHalf(NAN))), "half of nan");
+	}
+
+	void Storage(const Case& c)
+	{
+		// The compressed integer columns must give exactly the results of the plain column.
+		ColumnStorage storages[] = { Int16Columns, PackedColumns };
+		size_t n = c.records.size();
+		std::vector<int> reference = Column<int>(c);
+		std::sort(reference.begin(), reference.end());
+		for (int s = 0; s < 2; s++)
+		{
+			column_storage = storages[s];
+			Reduce(c, dataset.int_values.Data(), SingleDevice, AtomicSummation);
+
+			int* A = dataset.int_values.Data();
+			int* sorted = StorageSort(A, n);
+			Check(sorted && std::equal(reference.begin(), reference.end(), sorted), std::string("storage sort ") + StorageName(column_storage));
+		}
+
+		/* The half column must give the results of the plain kernels over the values rounded to half, within the budget of the atomic float
+		   sums, and sort them exactly. */
+		column_storage = HalfColumns;
+		fp_type* A_f = dataset.values.Data();
+		std::vector<fp_type> rounded(n);
+		for (size_t i = 0; i < n; i++)
+			rounded[i] = HalfToFloat(FloatToHalf((float)A_f[i]));
+		Moments m = MomentsOf(rounded);
+		double budget = Budget(false, AtomicSummation, n);
+		for (int wg = 0; wg < 2; wg++)
+		{
+			max_wg_size = wg != 0;
+			wg_size_changed = true;
+			std::string label = std::string("HALF") + ((wg) ? " max wg" : " min wg");
+
+			fp_type* A = A_f;
+			fp_type* B = nullptr;
+			size_t base_size = n;
+			BackendMinMax(A, B, base_size, n, false);
+			Equal(B[0], m.min, label + " min");
+			BackendMinMax(A, B, base_size, n, true);
+			Equal(B[0], m.max, label + " max");
+
+			fp_type sum = BackendSum(A, base_size, n);
+			Near(sum, (double)m.sum, budget * (double)m.magnitude, label + " sum");
+			fp_type shift = (fp_type)mean(sum, n);
+			StorageReduce(A, B, n, "sum_sqr_diff", (fp_type)0, &shift);
+			double expected = 0.0;
+			for (size_t i = 0; i < n; i++)
+				expected += ((double)rounded[i] - shift) * ((double)rounded[i] - shift);
+			Near(B[0], expected, budget * (expected + (double)m.magnitude * std::fabs(shift)), label + " sum of squared differences");
+
+			std::vector<fp_type> sorted_reference(rounded);
+			std::sort(sorted_reference.begin(), sorted_reference.end());
+			fp_type* sorted = StorageSort(A, n);
+			Check(sorted && std::equal(sorted_reference.begin(), sorted_reference.end(), sorted), label + " storage sort");
+		}
+		max_wg_size = false;
+		wg_size_changed = true;
+		column_storage = PlainColumns;
+	}
+
+	template<typename T>
+	void SortsOf(const Case& c, T* column)
+	{
+		// Every sort must leave exactly the sorted dataset within its first records, whatever the padding of the work groups.
+		std::vector<T> reference = Column<T>(c);
+		std::sort(reference.begin(), reference.end());
+		size_t n = reference.size();
+		std::string type = (typeid(T) == typeid(int)) ? " int" : " fp";
+
+		for (int wg = 0; wg < 2; wg++)
+		{
+			max_wg_size = wg != 0;
+			wg_size_changed = true;
+			std::string wg_label = type + ((wg) ? " max wg" : " min wg");
+
+			T* A = column;
+			T* B = nullptr;
+			size_t base_size = n;
+			T* sorted = Sort(A, B, base_size, n);
+			Check(std::equal(reference.begin(), reference.end(), sorted), "device sort" + wg_label);
+			sorted = NativeSort(A, B, base_size, n);
+			Check(std::equal(reference.begin(), reference.end(), sorted), "native sort" + wg_label);
+			sorted = MultiSort(A, B, base_size, n);
+			Check(std::equal(reference.begin(), reference.end(), sorted), "multi-device sort" + wg_label);
+		}
+		max_wg_size = false;
+		wg_size_changed = true;
+	}
+
+	template<typename T>
+	void IndexOf(const Case& c, T* column)
+	{
+		// Every query of the sorted index against a scan of the sorted reference, the index holding the sort of every backend in turn.
+		fp_type division = (typeid(T) == typeid(int)) ? 10.0 : 1.0;
+		std::vector<T> reference = Column<T>(c);
+		std::sort(reference.begin(), reference.end());
+		size_t n = reference.size();
+
+		// The packed storage is lossless for the integer column, so its sort must also give exactly the plain sorted values.
+		ExecutionBackend backends[] = { SingleDevice, MultiDevice, NativeThreads, SingleDevice };
+		int variants = (typeid(T) == typeid(int)) ? 4 : 3;
+		for (int v = 0; v < variants; v++)
+		{
+			execution_backend = backends[v];
+			column_storage = (v == 3) ? PackedColumns : PlainColumns;
+			sorted_index.Invalidate();
+			std::string type = std::string((typeid(T) == typeid(int)) ? " int " : " fp ") + BackendLabel(backends[v]) + ((v == 3) ? " packed" : "");
+
+			T* A = column;
+			T* B = nullptr;
+			size_t base_size = n;
+			SortedIndex& index = GetSortedIndex(A, B, base_size, n);
+			const double percentiles[] = { 0.0, 0.01, 0.25, 0.5, 0.75, 0.99, 1.0 };
+			for (int p = 0; p < 7; p++)
+			{
+				T expected = reference[std::min(n - 1, (size_t)(n * percentiles[p]))];
+				Equal(index.Percentile<T>(percentiles[p]), expected, "index percentile" + type);
+				Equal(column[SortedRow(index, index.PercentilePosition(percentiles[p]))], expected, "index row" + type);
+			}
+
+			const double bounds[][2] = { { -5.0, 0.0 }, { 0.0, 10.0 }, { 1.1, 1.1 }, { -100.0, 100.0 }, { 3.0, -3.0 } };
+			for (int b = 0; b < 5; b++)
+			{
+				T low = (T)std::lround(bounds[b][0] * division), high = (T)std::lround(bounds[b][1] * division);
+				if (typeid(T) != typeid(int))
+				{
+					low = (T)bounds[b][0];
+					high = (T)bounds[b][1];
+				}
+				size_t expected = 0;
+				for (size_t i = 0; i < n; i++)
+					expected += reference[i] >= low && reference[i] <= high;
+				Equal((double)index.CountBetween<T>(bounds[b][0] * division, bounds[b][1] * division), (double)expected, "index count between" + type);
+			}
+
+			const double trims[] = { 0.0, 0.1, 0.25, 0.5 };
+			for (int t = 0; t < 4; t++)
+			{
+				size_t trim = (size_t)(n * trims[t]);
+				long double expected = 0;
+				if (trim * 2 >= n)
+					expected = reference[std::min(n - 1, n / 2)];
+				else
+				{
+					for (size_t i = trim; i < n - trim; i++)
+						expected += reference[i];
+					expected /= (n - trim * 2);
+				}
+				Near(index.TrimmedMean<T>(trims[t]), (double)expected, 1e-9 * std::max(1.0, std::fabs((double)expected)), "index trimmed mean" + type);
+			}
+		}
+		execution_backend = SingleDevice;
+		column_storage = PlainColumns;
+		sorted_index.Invalidate();
+		wg_size_changed = true;
+	}
+
+	void Sorts(const Case& c)
+	{
+		SortsOf(c, dataset.int_values.Data());
+		SortsOf(c, dataset.values.Data());
+		IndexOf(c, dataset.int_values.Data());
+		IndexOf(c, dataset.values.Data());
+	}
+
+	template<typename T>
+	void HistogramsOf(const Case& c, T* column)
+	{
+		// The histograms are exact, every bin must hold the number of records of its key, per station and over every station.
+		std::string type = (typeid(T) == typeid(int)) ? " int" : " fp";
+		size_t n = c.records.size();
+		T* A = column;
+		size_t base_size = n;
+		wg_size_changed = true;
+		for (int keyed = 0; keyed < 2; keyed++)
+		{
+			const StationColumn* station_column = (keyed) ? &stations : nullptr;
+			std::vector<Histogram> device = DeviceHistograms(A, base_size, n, station_column);
+			std::vector<Histogram> native = NativeHistograms(A, n, station_column);
+			std::string label = type + ((keyed) ? " per station" : "");
+			Check(device.size() == native.size() && device.size() == ((keyed) ? stations.StationCount() : 1), "histogram rows" + label);
+
+			size_t device_errors = 0, native_errors = 0;
+			for (size_t r = 0; r < device.size() && r < native.size(); r++)
+			{
+				std::map<int, unsigned long long> expected;
+				for (size_t i = 0; i < n; i++)
+				{
+					if (!keyed || stations.ids[i] == r)
+						expected[c.records[i].tenths]++;
+				}
+
+				for (size_t bin = 0; bin < device[r].Bins(); bin++)
+					device_errors += device[r].Count(bin) != expected[device[r].MinKey() + (int)bin];
+				for (size_t bin = 0; bin < native[r].Bins(); bin++)
+					native_errors += native[r].Count(bin) != expected[native[r].MinKey() + (int)bin];
+				device_errors += device[r].Total() != native[r].Total();
+			}
+			Equal((double)device_errors, 0, "device histogram" + label);
+			Equal((double)native_errors, 0, "native histogram" + label);
+		}
+
+		// The exact selection and the quantile sketch of the load against the sorted reference.
+		std::vector<T> reference = Column<T>(c);
+		std::sort(reference.begin(), reference.end());
+		std::vector<fp_type> sorted_fp = Column<fp_type>(c);
+		std::sort(sorted_fp.begin(), sorted_fp.end());
+		const double percentiles[] = { 0.0, 0.1, 0.5, 0.9, 1.0 };
+		for (int p = 0; p < 5; p++)
+		{
+			size_t rank = std::min(n - 1, (size_t)(n * percentiles[p]));
+			Equal(SelectQuantile(column, n, percentiles[p]), reference[rank], "exact selection" + type);
+
+			// The sketch guarantees its rank error, so the value it returns must lie within that many ranks of the exact rank.
+			fp_type value = dataset.sketch.Quantile(percentiles[p]);
+			double slack = dataset.sketch.RankError() * n + 1;
+			size_t lo = (size_t)std::max(0.0, rank - slack), hi = (size_t)std::min(n - 1.0, rank + slack);
+			Check(value >= sorted_fp[lo] && value <= sorted_fp[hi], "quantile sketch" + type, Detail(value, sorted_fp[rank], slack));
+		}
+	}
+
+	void Histograms(const Case& c)
+	{
+		HistogramsOf(c, dataset.int_values.Data());
+		HistogramsOf(c, dataset.values.Data());
+	}
+
+	template<typename T, typename Out, typename Op>
+	std::vector<Out> ReferenceScan(const std::vector<T>& in, const std::vector<int>& heads, bool inclusive, Out identity, Op op)
+	{
+		std::vector<Out> out(in.size());
+		Out running = identity;
+		for (size_t i = 0; i < in.size(); i++)
+		{
+			if (!heads.empty() && heads[i])
+				running = identity;
+			if (!inclusive)
+				out[i] = running;
+			running = op(running, (Out)in[i]);
+			if (inclusive)
+				out[i] = running;
+		}
+		return out;
+	}
+
+	template<typename T, typename Out, typename Op>
+	void ScanOf(const std::vector<T>& in, const std::vector<int>& heads, const std::string& op_name, Out identity, Op op, double tolerance)
+	{
+		std::string type = (typeid(T) == typeid(int)) ? " int" : (typeid(Out) == typeid(float)) ? " fp float sums" : " fp";
+		for (int inclusive = 0; inclusive < 2; inclusive++)
+		{
+			std::vector<Out> expected = ReferenceScan<T, Out>(in, heads, inclusive != 0, identity, op);
+			Out* result = Scan<T, Out>(op_name, in.data(), (heads.empty()) ? nullptr : heads.data(), in.size(), inclusive != 0);
+			size_t errors = 0;
+			for (size_t i = 0; i < in.size(); i++)
+				errors += result[i] != expected[i] && !(std::fabs((double)result[i] - (double)expected[i]) <= tolerance);
+			std::string label = std::string((heads.empty()) ? "scan " : "segmented scan ") + op_name + ((inclusive) ? " inclusive" : " exclusive") + type;
+			Equal((double)errors, 0, label);
+		}
+	}
+
+	void Scans(const Case& c)
+	{
+		// Plain scans and scans restarting at every station of the dataset order, which gives segments of every length including one.
+		std::vector<int> ints = Column<int>(c);
+		std::vector<fp_type> floats = Column<fp_type>(c);
+		std::vector<int> heads(c.records.size(), 0);
+		for (size_t i = 0; i < heads.size(); i++)
+			heads[i] = (i == 0 || c.records[i].station != c.records[i - 1].station);
+
+		long double magnitude = 0;
+		for (size_t i = 0; i < floats.size(); i++)
+			magnitude += std::fabs(floats[i]);
+
+		for (int segmented = 0; segmented < 2; segmented++)
+		{
+			const std::vector<int>& h = (segmented) ? heads : std::vector<int>();
+			ScanOf<int, int>(ints, h, "add", 0, [](int a, int b) { return a + b; }, 0.0);
+			ScanOf<int, int>(ints, h, "min", std::numeric_limits<int>::max(), [](int a, int b) { return std::min(a, b); }, 0.0);
+			ScanOf<int, int>(ints, h, "max", std::numeric_limits<int>::min(), [](int a, int b) { return std::max(a, b); }, 0.0);
+			ScanOf<fp_type, fp_type>(floats, h, "min", INFINITY, [](fp_type a, fp_type b) { return std::min(a, b); }, 0.0);
+			ScanOf<fp_type, fp_type>(floats, h, "max", -INFINITY, [](fp_type a, fp_type b) { return std::max(a, b); }, 0.0);
+			if (DeviceSupportsFP64())
+				ScanOf<fp_type, double>(floats, h, "add", 0.0, [](double a, double b) { return a + b; },
+					4.0 * std::numeric_limits<double>::epsilon() * (double)magnitude * std::log2(floats.size() + 2.0));
+
+			// The float sums which devices without cl_khr_fp64 fall back onto, against a sequential float reference of far greater error.
+			ScanOf<fp_type, fp_type>(floats, h, "add", 0.0f, [](fp_type a, fp_type b) { return a + b; },
+				float_eps * (double)magnitude * (floats.size() + std::log2(floats.size() + 2.0)));
+		}
+	}
+
+	template<typename T>
+	void FiltersOf(const Case& c, T* column)
+	{
+		// Statistics of the subsets of a few filters, each against the records selected on the host.
+		typedef typename Accumulator<T>::type Acc;
+		std::string type = (typeid(T) == typeid(int)) ? " int" : " fp";
+		fp_type division = (typeid(T) == typeid(int)) ? 10.0 : 1.0;
+		std::vector<T> values = Column<T>(c);
+		size_t n = values.size();
+
+		RecordFilter filters[4];
+		filters[0].max_value = 0.0f;
+		filters[0].max_inclusive = false;
+		filters[1].min_value = 0.0f;
+		filters[2].min_value = -2.5f;
+		filters[2].max_value = 12.0f;
+		filters[3].station = 1;
+
+		for (int f = 0; f < 4; f++)
+		{
+			std::vector<T> expected;
+			for (size_t i = 0; i < n; i++)
+			{
+				double value = c.records[i].tenths / 10.0;
+				bool above = (filters[f].min_inclusive) ? value >= filters[f].min_value : value > filters[f].min_value;
+				bool below = (filters[f].max_inclusive) ? value <= filters[f].max_value : value < filters[f].max_value;
+				if (above && below && (filters[f].station < 0 || stations.names[stations.ids[i]] == station_names[filters[f].station]))
+					expected.push_back(values[i]);
+			}
+
+			// The station filter selects by the id of the station within the loaded dictionary.
+			if (filters[f].station >= 0)
+				filters[f].station = (int)(std::find(stations.names.begin(), stations.names.end(), station_names[filters[f].station]) - stations.names.begin());
+
+			std::string label = "filter " + std::to_string(f) + type;
+			DeviceSubset<T> subset = Filter(ResidentColumns(column, n), filters[f], division);
+			Equal((double)subset.count, (double)expected.size(), label + " count");
+			if (!subset.count || subset.count != expected.size())
+				continue;
+
+			Moments m = MomentsOf(expected);
+			double budget = Budget(typeid(T) == typeid(int), AtomicSummation, expected.size());
+			Equal(SubsetReduce<T>(subset, "reduce_min", std::numeric_limits<T>::max()), m.min, label + " min");
+			Equal(SubsetReduce<T>(subset, "reduce_max", std::numeric_limits<T>::lowest()), m.max, label + " max");
+			Near((double)SubsetReduce<Acc>(subset, "reduce_sum", (T)0), (double)m.sum, budget * (double)m.magnitude, label + " sum");
+
+			std::sort(expected.begin(), expected.end());
+			T* sorted = SubsetSort(subset);
+			Check(std::equal(expected.begin(), expected.end(), sorted), label + " sort");
+		}
+	}
+
+	void Filters(const Case& c)
+	{
+		FiltersOf(c, dataset.int_values.Data());
+		FiltersOf(c, dataset.values.Data());
+	}
+
+	template<typename T>
+	void TimeSeriesOf(const Case& c, T* column)
+	{
+		// Rolling windows, daily extremes and degree days against references over the records sorted by station, time and row.
+		std::string type = (typeid(T) == typeid(int)) ? " int" : " fp";
+		fp_type division = (typeid(T) == typeid(int)) ? 10.0 : 1.0;
+		std::vector<T> values = Column<T>(c);
+		size_t n = values.size();
+
+		std::vector<size_t> order(n);
+		std::iota(order.begin(), order.end(), 0);
+		std::sort(order.begin(), order.end(), [&](size_t a, size_t b)
+		{
+			if (stations.ids[a] != stations.ids[b])
+				return stations.ids[a] < stations.ids[b];
+			if (c.records[a].minutes != c.records[b].minutes)
+				return c.records[a].minutes < c.records[b].minutes;
+			return a < b;
+		});
+
+		/* The doubling table of the rolling minimums and maximums is built over tiles of the series, so the windows are checked once with the
+		   default table and once with a table of a single byte, which splits the series into tiles of the fewest positions possible. */
+		TimeSeries& series = GetTimeSeries();
+		size_t default_table_bytes = sparse_table_bytes;
+		for (size_t table_bytes : { default_table_bytes, (size_t)1 })
+		{
+			sparse_table_bytes = table_bytes;
+			std::string label = type + ((table_bytes == 1) ? " tiled" : "");
+			RollingSeries<T> rolling = Rolling(series, column, minutes_per_day);
+			size_t mean_errors = 0, extreme_errors = 0;
+			for (size_t i = 0; i < n; i++)
+			{
+				long double sum = 0, magnitude = 0;
+				T lo = values[order[i]], hi = values[order[i]];
+				size_t count = 0;
+				for (size_t j = i + 1; j-- > 0; )
+				{
+					if (stations.ids[order[j]] != stations.ids[order[i]])
+						break;
+					magnitude += std::fabs((long double)values[order[j]]);
+					if (c.records[order[j]].minutes + minutes_per_day <= c.records[order[i]].minutes)
+						continue;
+					sum += values[order[j]];
+					lo = std::min(lo, values[order[j]]);
+					hi = std::max(hi, values[order[j]]);
+					count++;
+				}
+
+				/* Without cl_khr_fp64 the floating point prefix sums are float, so a window is only accurate to the rounding of the prefix
+				   sums of its station (their magnitude up to the window, over every level of the scan) rather than to that of its own mean. */
+				double expected_mean = (double)(sum / count);
+				double tolerance = 4.0 * float_eps * std::max(1.0, std::fabs(expected_mean)) * (double)count;
+				if (typeid(T) != typeid(int) && !DeviceSupportsFP64())
+					tolerance += 4.0 * float_eps * (double)magnitude * std::log2(n + 2.0) / count;
+				mean_errors += !(std::fabs(rolling.mean[i] - expected_mean) <= tolerance);
+				extreme_errors += rolling.min[i] != lo || rolling.max[i] != hi;
+			}
+			Equal((double)mean_errors, 0, "rolling mean" + label);
+			Equal((double)extreme_errors, 0, "rolling min/max" + label);
+		}
+		sparse_table_bytes = default_table_bytes;
+
+		// One day per station and calendar day, in station then day order.
+		DailySeries<T> daily = DailyExtremes(series, column);
+		std::vector<T> day_min, day_max;
+		std::vector<int> day_station, day_year;
+		for (size_t i = 0; i < n; i++)
+		{
+			size_t r = order[i];
+			unsigned int day = c.records[r].minutes / minutes_per_day;
+			bool new_day = i == 0 || stations.ids[r] != stations.ids[order[i - 1]] || day != c.records[order[i - 1]].minutes / minutes_per_day;
+			if (new_day)
+			{
+				int year;
+				unsigned int month, day_of_month;
+				CivilFromDays(epoch_days + (int)day, year, month, day_of_month);
+				day_min.push_back(values[r]);
+				day_max.push_back(values[r]);
+				day_station.push_back(stations.ids[r]);
+				day_year.push_back(year);
+			}
+			day_min.back() = std::min(day_min.back(), values[r]);
+			day_max.back() = std::max(day_max.back(), values[r]);
+		}
+
+		Equal((double)daily.Size(), (double)day_min.size(), "daily count" + type);
+		if (daily.Size() != day_min.size())
+			return;
+		Check(std::equal(day_min.begin(), day_min.end(), daily.min.begin()) && std::equal(day_max.begin(), day_max.end(), daily.max.begin()), "daily min/max" + type);
+
+		// The kernel takes the mean of the extremes in fp_type, so the budget is a few float ulps per day of the season.
+		const fp_type base = 10.0f;
+		for (int heating = 0; heating < 2; heating++)
+		{
+			std::vector<double> cumulative = DegreeDays(daily, division, base, heating != 0);
+			size_t errors = 0;
+			double running = 0;
+			size_t days = 0;
+			for (size_t d = 0; d < day_min.size(); d++)
+			{
+				if (d == 0 || day_station[d] != day_station[d - 1] || day_year[d] != day_year[d - 1])
+					running = 0, days = 0;
+				double mean_value = ((double)day_min[d] + (double)day_max[d]) / (2.0 * division);
+				running += std::max((heating) ? base - mean_value : mean_value - base, 0.0);
+				days++;
+				errors += !(std::fabs(cumulative[d] - running) <= 8.0 * float_eps * (std::fabs(running) + days * 50.0));
+			}
+			Equal((double)errors, 0, std::string((heating) ? "heating" : "growing") + " degree days" + type);
+		}
+	}
+
+	void TimeSeriesSection(const Case& c)
+	{
+		TimeSeriesOf(c, dataset.int_values.Data());
+		TimeSeriesOf(c, dataset.values.Data());
+	}
+
+	template<typename T>
+	void TopKOf(const Case& c, T* column)
+	{
+		// The k best records by value and then by row, identical on both paths and to a full sort.
+		std::string type = (typeid(T) == typeid(int)) ? " int" : " fp";
+		std::vector<T> values = Column<T>(c);
+		size_t n = values.size();
+		const size_t ks[] = { 1, 10, 300 };
+		for (int largest = 0; largest < 2; largest++)
+		{
+			std::vector<ExtremeRecord<T>> expected;
+			for (size_t i = 0; i < n; i++)
+			{
+				ExtremeRecord<T> record = { values[i], (int)i };
+				expected.push_back(record);
+			}
+			std::sort(expected.begin(), expected.end(), [&](const ExtremeRecord<T>& a, const ExtremeRecord<T>& b) { return TopKBetter(a, b, largest != 0); });
+
+			for (int k = 0; k < 3; k++)
+			{
+				size_t count = std::min(ks[k], n);
+				std::vector<ExtremeRecord<T>> device = DeviceTopK(ResidentColumns(column, n), ks[k], largest != 0);
+				std::vector<ExtremeRecord<T>> native = NativeTopK(column, n, ks[k], largest != 0);
+				size_t device_errors = (device.size() != count), native_errors = (native.size() != count);
+				for (size_t i = 0; i < count && i < device.size(); i++)
+					device_errors += device[i].value != expected[i].value || device[i].row != expected[i].row;
+				for (size_t i = 0; i < count && i < native.size(); i++)
+					native_errors += native[i].value != expected[i].value || native[i].row != expected[i].row;
+
+				std::string label = std::string((largest) ? " hottest " : " coldest ") + std::to_string(ks[k]) + type;
+				Equal((double)device_errors, 0, "device top k" + label);
+				Equal((double)native_errors, 0, "native top k" + label);
+			}
+		}
+	}
+
+	void TopK(const Case& c)
+	{
+		TopKOf(c, dataset.int_values.Data());
+		TopKOf(c, dataset.values.Data());
+	}
+
+	template<typename T>
+	void CorrelationsOf(T* column)
+	{
+		// The pair statistics of both paths against a two pass reference over the same aligned grid.
+		std::string type = (typeid(T) == typeid(int)) ? " int" : " fp";
+		fp_type division = (typeid(T) == typeid(int)) ? 10.0 : 1.0;
+		size_t n = dataset.size;
+		std::vector<PairStatistics> device = StationCorrelations(column, n, false, division);
+		std::vector<PairStatistics> native = StationCorrelations(column, n, true, division);
+		const AlignedSeries<T>& aligned = GetAlignedSeries(column, n);
+		std::vector<int> pairs = StationPairs(aligned.station_count);
+		Equal((double)device.size(), (double)pairs.size() / 2, "device pairs" + type);
+		Equal((double)native.size(), (double)pairs.size() / 2, "native pairs" + type);
+		if (device.size() != pairs.size() / 2 || native.size() != pairs.size() / 2)
+			return;
+
+		double tolerance = (typeid(T) == typeid(int) || DeviceSupportsFP64()) ? 1e-9 : 1e-4;
+		size_t slots = aligned.SlotCount();
+		for (size_t p = 0; p < pairs.size() / 2; p++)
+		{
+			int a = pairs[2 * p], b = pairs[2 * p + 1];
+			long double sum_a = 0, sum_b = 0, count = 0;
+			for (size_t s = 0; s < slots; s++)
+			{
+				T va = aligned.grid[a * slots + s], vb = aligned.grid[b * slots + s];
+				if (PresentSlot(va) && PresentSlot(vb))
+				{
+					sum_a += va;
+					sum_b += vb;
+					count++;
+				}
+			}
+
+			std::string label = " pair " + std::to_string(a) + "-" + std::to_string(b) + type;
+			Equal((double)device[p].n, (double)count, "device slots" + label);
+			Equal((double)native[p].n, (double)count, "native slots" + label);
+			if (count < 2)
+				continue;
+
+			long double mean_a = sum_a / count, mean_b = sum_b / count, var_a = 0, var_b = 0, cov = 0;
+			for (size_t s = 0; s < slots; s++)
+			{
+				T va = aligned.grid[a * slots + s], vb = aligned.grid[b * slots + s];
+				if (PresentSlot(va) && PresentSlot(vb))
+				{
+					var_a += (va - mean_a) * (va - mean_a);
+					var_b += (vb - mean_b) * (vb - mean_b);
+					cov += (va - mean_a) * (vb - mean_b);
+				}
+			}
+
+			// Equal series have no variance, where the correlation is undefined on every path.
+			double expected = (var_a > 0 && var_b > 0) ? (double)(cov / std::sqrt(var_a * var_b)) : NAN;
+			Near(device[p].correlation, expected, tolerance, "device correlation" + label);
+			Near(native[p].correlation, expected, tolerance, "native correlation" + label);
+			Near(device[p].mean_a, (double)mean_a / division, tolerance * std::max(1.0, std::fabs((double)mean_a)), "device mean" + label);
+		}
+	}
+
+	void Correlations()
+	{
+		CorrelationsOf(dataset.int_values.Data());
+		CorrelationsOf(dataset.values.Data());
+	}
+
+	template<typename T>
+	void ClimatologyOf(T* column)
+	{
+		// The climatology of every group and the flagged rows of both paths against a two pass reference over the same groups.
+		std::string type = (typeid(T) == typeid(int)) ? " int" : " fp";
+		size_t n = dataset.size;
+		AnomalyReport device = ClimatologyAnomalies(column, n, false);
+		AnomalyReport native = ClimatologyAnomalies(column, n, true);
+		const ClimatologyIndex& index = climatology_index;
+
+		double tolerance = (typeid(T) == typeid(int)) ? 1e-4 : 1e-3;
+		size_t mean_errors = 0, flag_errors = 0, expected_flags = 0, marginal_flags = 0;
+		std::vector<bool> device_flags(n, false), native_flags(n, false);
+		for (size_t i = 0; i < device.anomalies.size(); i++)
+			device_flags[device.anomalies[i].row] = true;
+		for (size_t i = 0; i < native.anomalies.size(); i++)
+			native_flags[native.anomalies[i].row] = true;
+
+		for (size_t g = 0; g < index.group_count; g++)
+		{
+			size_t count = index.Count(g);
+			if (!count)
+				continue;
+
+			long double sum = 0, sqr = 0;
+			for (int p = index.offsets[g]; p < index.offsets[g + 1]; p++)
+				sum += column[index.order[p]];
+			long double group_mean = sum / count;
+			for (int p = index.offsets[g]; p < index.offsets[g + 1]; p++)
+				sqr += (column[index.order[p]] - group_mean) * (column[index.order[p]] - group_mean);
+			double deviation = (double)std::sqrt(sqr / count);
+
+			double scale = std::max(1.0, std::fabs((double)group_mean));
+			mean_errors += !(std::fabs(device.means[g] - (double)group_mean) <= tolerance * scale);
+			mean_errors += !(std::fabs(native.means[g] - (double)group_mean) <= tolerance * scale);
+			mean_errors += !(std::fabs(device.deviations[g] - deviation) <= tolerance * scale);
+
+			// Rows whose score lies within the tolerance of the threshold may be flagged either way.
+			for (int p = index.offsets[g]; p < index.offsets[g + 1]; p++)
+			{
+				int row = index.order[p];
+				double z = (deviation > 0) ? (double)((column[row] - group_mean) / deviation) : 0.0;
+				bool usable = (int)count >= climatology_min_count && deviation > 0;
+				bool flagged = usable && std::fabs(z) >= anomaly_threshold;
+				bool marginal = usable && std::fabs(std::fabs(z) - anomaly_threshold) <= 1e-3;
+				expected_flags += flagged;
+				marginal_flags += marginal;
+				if (!marginal)
+					flag_errors += (device_flags[row] != flagged) + (native_flags[row] != flagged);
+			}
+		}
+		Equal((double)mean_errors, 0, "climatology" + type);
+		Equal((double)flag_errors, 0, "anomalies" + type);
+		Near((double)device.anomalies.size(), (double)expected_flags, (double)marginal_flags, "device anomaly count" + type);
+		Near((double)native.anomalies.size(), (double)expected_flags, (double)marginal_flags, "native anomaly count" + type);
+		Check(std::is_sorted(device.anomalies.begin(), device.anomalies.end(), [](const Anomaly& a, const Anomaly& b) { return a.row < b.row; }),
+			"anomalies in row order" + type);
+	}
+
+	void Climatology()
+	{
+		// A lower threshold than the analyzer, so that the uniform noise of the dense case flags a few records.
+		double threshold = anomaly_threshold;
+		anomaly_threshold = 1.5;
+		ClimatologyOf(dataset.int_values.Data());
+		ClimatologyOf(dataset.values.Data());
+		anomaly_threshold = threshold;
+	}
+
+	void Run(const std::string& section)
+	{
+		// The adversarial cases, each small enough for a sequential emulator yet never a multiple of a work group size unless intended.
+		std::vector<Case> cases;
+		cases.push_back(MakeCase("random", 3001, -150, 300, 1));
+		cases.push_back(MakeCase("positive", 777, 1, 250, 2));
+		cases.push_back(MakeCase("negative", 700, -250, -1, 3));
+		cases.push_back(MakeCase("equal", 300, 50, 50, 4));
+		cases.push_back(MakeCase("work group multiple", 512, -100, 100, 5));
+		cases.push_back(MakeCase("one station", 257, -50, 150, 6, 1));
+		cases.push_back(MakeCase("dense", 1999, -80, 120, 8, 3, 3, 12));
+		cases.push_back(MakeCase("single", 1, 73, 73, 7, 1));
+
+		if (section.empty() || section == "storage")
+		{
+			current_case = "conversions";
+			HalfConversions();
+		}
+
+		for (size_t i = 0; i < cases.size(); i++)
+		{
+			const Case& c = cases[i];
+			current_case = c.name;
+			int case_failures = failures;
+			if (!LoadCase(c, false))
+			{
+				Check(false, "load", "the case did not load");
+				continue;
+			}
+
+			if (section.empty() || section == "parse")
+				Parse(c);
+			if (section.empty() || section == "reduce")
+				Reductions(c);
+			if (section.empty() || section == "storage")
+				Storage(c);
+			if (section.empty() || section == "sort")
+				Sorts(c);
+			if (section.empty() || section == "histogram")
+				Histograms(c);
+			if (section.empty() || section == "scan")
+				Scans(c);
+			if (section.empty() || section == "filter")
+				Filters(c);
+			if (section.empty() || section == "timeseries")
+				TimeSeriesSection(c);
+			if (section.empty() || section == "topk")
+				TopK(c);
+			if (section.empty() || section == "correlation")
+				Correlations();
+			if (section.empty() || section == "climatology")
+				Climatology();
+
+			std::printf("%-20s %s (%zu records)\n", c.name.c_str(), (failures == case_failures) ? "passed" : "FAILED", c.records.size());
+		}
+
+		ResetCaches();
+		dataset.Release();
+		std::remove(CasePath().c_str());
+	}
+}
+
+void PrintHelp() {
+	std::cerr << "Test usage:" << std::endl;
+
+	std::cerr << "  -p : select platform " << std::endl;
+	std::cerr << "  -d : select device" << std::endl;
+	std::cerr << "  -t : only run one section (parse, reduce, storage, sort, histogram, scan, filter, timeseries, topk, correlation, climatology)" << std::endl;
+	std::cerr << "  -v : report every check rather than only the failures" << std::endl;
+	std::cerr << "  -R : directory of the project (holding src and data), found automatically by default" << std::endl;
+	std::cerr << "  -h : print this message" << std::endl;
+}
+
+int main(int argc, char **argv) {
+	std::string section = "";
+	int platform_id = 0;
+	int device_id = 0;
+	const char* root = nullptr;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if ((strcmp(argv[i], "-p") == 0) && (i < (argc - 1))) { platform_id = atoi(argv[++i]); }
+		else if ((strcmp(argv[i], "-d") == 0) && (i < (argc - 1))) { device_id = atoi(argv[++i]); }
+		else if ((strcmp(argv[i], "-t") == 0) && (i < (argc - 1))) { section = argv[++i]; }
+		else if (strcmp(argv[i], "-v") == 0) { test::verbose = true; }
+		else if ((strcmp(argv[i], "-R") == 0) && (i < (argc - 1))) { root = argv[++i]; }
+		else if (strcmp(argv[i], "-h") == 0) { PrintHelp(); return 0; }
+	}
+
+	try
+	{
+		InitPaths(root);
+		profiler_output = false;
+
+		context = GetContext(platform_id, device_id);
+		queue = cl::CommandQueue(context, CL_QUEUE_PROFILING_ENABLE);
+		cl::Program::Sources sources;
+		AddSources(sources, "kernels.cl");
+		program = cl::Program(context, sources);
+		program.build();
+		std::printf("Running on %s, %s\n", GetPlatformName(platform_id).c_str(), GetDeviceName(platform_id, device_id).c_str());
+
+		test::Run(section);
+
+		ReleaseMultiDevice();
+		ReleaseThreadPool();
+		ReleasePools();
+	}
+	catch (const cl::Error& err) {
+		std::cerr << "ERROR: " << err.what() << ", " << getErrorString(err.err()) << std::endl;
+		return 1;
+	}
+
+	std::printf("\n%d of %d checks passed\n", test::checks - test::failures, test::checks);
+	return std::min(test::failures, 255);
+}
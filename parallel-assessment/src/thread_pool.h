@@ -0,0 +1,344 @@
+#ifndef threadpool_h
+#define threadpool_h
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <fstream>
+#include <sstream>
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <pthread.h>
+	#include <sched.h>
+#endif
+
+/* NUMA topology of the host, gathered from the operating system. Each node lists the logical CPUs which belong to it, when the topology
+   cannot be read (or the host is not NUMA) a single node containing every hardware thread is returned. */
+struct NumaTopology
+{
+	std::vector<std::vector<int>> node_cpus;
+
+	static std::vector<int> ParseCpuList(const std::string& list)
+	{
+		// Parse the linux cpulist format, e.g. "0-3,8-11".
+		std::vector<int> cpus;
+		std::stringstream sstream(list);
+		std::string range;
+		while (std::getline(sstream, range, ','))
+		{
+			size_t dash = range.find('-');
+			int first = std::atoi(range.c_str());
+			int last = (dash == std::string::npos) ? first : std::atoi(range.c_str() + dash + 1);
+			for (int cpu = first; cpu <= last; cpu++)
+				cpus.push_back(cpu);
+		}
+
+		return cpus;
+	}
+
+	static NumaTopology Query()
+	{
+		NumaTopology topology;
+
+		#ifdef _WIN32
+			ULONG highest_node = 0;
+			if (GetNumaHighestNodeNumber(&highest_node))
+			{
+				for (ULONG node = 0; node <= highest_node; node++)
+				{
+					ULONGLONG mask = 0;
+					if (!GetNumaNodeProcessorMask((UCHAR)node, &mask) || !mask)
+						continue;
+
+					std::vector<int> cpus;
+					for (int cpu = 0; cpu < 64; cpu++)
+					{
+						if (mask & (1ULL << cpu))
+							cpus.push_back(cpu);
+					}
+					topology.node_cpus.push_back(cpus);
+				}
+			}
+		#else
+			for (int node = 0; ; node++)
+			{
+				std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+				if (!file.is_open())
+					break;
+
+				std::string list;
+				std::getline(file, list);
+				std::vector<int> cpus = ParseCpuList(list);
+				if (!cpus.empty())
+					topology.node_cpus.push_back(cpus);
+			}
+		#endif
+
+		if (topology.node_cpus.empty())
+		{
+			unsigned int thread_count = std::max(1u, std::thread::hardware_concurrency());
+			topology.node_cpus.push_back(std::vector<int>());
+			for (unsigned int cpu = 0; cpu < thread_count; cpu++)
+				topology.node_cpus[0].push_back(cpu);
+		}
+
+		return topology;
+	}
+
+	size_t CpuCount() const
+	{
+		size_t count = 0;
+		for (size_t i = 0; i < node_cpus.size(); i++)
+			count += node_cpus[i].size();
+
+		return count;
+	}
+};
+
+bool PinThread(std::thread& thread, int cpu)
+{
+	// Pin the given thread to a single logical CPU, so that its first-touched memory stays local to its node.
+	#ifdef _WIN32
+		return cpu < 64 && SetThreadAffinityMask(thread.native_handle(), 1ULL << cpu) != 0;
+	#else
+		cpu_set_t cpu_set;
+		CPU_ZERO(&cpu_set);
+		CPU_SET(cpu, &cpu_set);
+		return pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &cpu_set) == 0;
+	#endif
+}
+
+/* A group of tasks which can be waited upon together. Every task submitted with a group increments its counter and decrements it once
+   complete, the waiting thread sleeps until the counter returns to zero. The counter is only changed and read under the mutex, as the
+   group usually lives on the stack of the waiting thread, which may destroy it as soon as it sees zero. */
+class TaskGroup
+{
+	private:
+		size_t remaining;
+		mutable std::mutex mutex;
+		std::condition_variable complete;
+
+	public:
+		TaskGroup() : remaining(0) { }
+
+		void Add()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			remaining++;
+		}
+		void Done()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--remaining == 0)
+				complete.notify_all();
+		}
+
+		bool Finished() const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return remaining == 0;
+		}
+		void Wait()
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			complete.wait(lock, [this] { return remaining == 0; });
+		}
+};
+
+/* Work stealing thread pool with one pinned worker per logical CPU (up to the requested thread count), filled node by node. Each worker
+   owns a deque, tasks submitted for a node are pushed to the workers of that node, owners pop the newest task from the back of their own
+   deque and idle workers steal the oldest task from the front of another deque, trying workers on their own node before remote nodes. */
+class ThreadPool
+{
+	struct Worker
+	{
+		std::thread thread;
+		std::deque<std::function<void()>> tasks;
+		std::mutex mutex;
+		int cpu = 0;
+		int node = 0;
+	};
+
+	private:
+		std::vector<std::unique_ptr<Worker>> workers;
+		std::vector<std::vector<size_t>> node_workers;
+		std::atomic<bool> stopping;
+		std::atomic<size_t> queued;
+		std::atomic<size_t> next_worker;
+		std::atomic<size_t> steal_count;
+		std::mutex sleep_mutex;
+		std::condition_variable wake;
+
+		bool PopOwn(size_t index, std::function<void()>& task)
+		{
+			Worker& worker = *workers[index];
+			std::lock_guard<std::mutex> lock(worker.mutex);
+			if (worker.tasks.empty())
+				return false;
+
+			task = std::move(worker.tasks.back());
+			worker.tasks.pop_back();
+			return true;
+		}
+
+		bool Steal(size_t victim, std::function<void()>& task)
+		{
+			Worker& worker = *workers[victim];
+			std::lock_guard<std::mutex> lock(worker.mutex);
+			if (worker.tasks.empty())
+				return false;
+
+			task = std::move(worker.tasks.front());
+			worker.tasks.pop_front();
+			return true;
+		}
+
+		bool TryRunOne(size_t index)
+		{
+			std::function<void()> task;
+			bool found = PopOwn(index, task);
+			bool stolen = false;
+
+			// Steal from the workers of this node first, then from every other node.
+			const std::vector<size_t>& local = node_workers[workers[index]->node];
+			for (size_t i = 0; !found && i < local.size(); i++)
+				found = stolen = (local[i] != index) && Steal(local[i], task);
+			for (size_t i = 0; !found && i < workers.size(); i++)
+				found = stolen = (workers[i]->node != workers[index]->node) && Steal(i, task);
+
+			if (!found)
+				return false;
+
+			if (stolen)
+				steal_count++;
+
+			queued--;
+			task();
+			return true;
+		}
+
+		void Run(size_t index)
+		{
+			while (!stopping)
+			{
+				if (TryRunOne(index))
+					continue;
+
+				// Sleep until a task is queued, the timeout only guards against a missed notification.
+				std::unique_lock<std::mutex> lock(sleep_mutex);
+				wake.wait_for(lock, std::chrono::milliseconds(5), [this] { return stopping || queued > 0; });
+			}
+		}
+
+	public:
+		ThreadPool(size_t thread_count = 0, bool pin = true)
+			: stopping(false), queued(0), next_worker(0), steal_count(0)
+		{
+			NumaTopology topology = NumaTopology::Query();
+			if (!thread_count || thread_count > topology.CpuCount())
+				thread_count = topology.CpuCount();
+
+			// Distribute the workers across the nodes in turn, so a partial pool still spans every socket.
+			node_workers.resize(topology.node_cpus.size());
+			std::vector<size_t> node_next(topology.node_cpus.size(), 0);
+			for (size_t node = 0; workers.size() < thread_count; node = (node + 1) % topology.node_cpus.size())
+			{
+				if (node_next[node] >= topology.node_cpus[node].size())
+					continue;
+
+				std::unique_ptr<Worker> worker(new Worker());
+				worker->node = (int)node;
+				worker->cpu = topology.node_cpus[node][node_next[node]++];
+				node_workers[node].push_back(workers.size());
+				workers.push_back(std::move(worker));
+			}
+
+			// Nodes without any workers (from a small thread count) are dropped so that node indices always have workers.
+			for (size_t node = node_workers.size(); node-- > 0;)
+			{
+				if (node_workers[node].empty())
+					node_workers.erase(node_workers.begin() + node);
+			}
+			for (size_t node = 0; node < node_workers.size(); node++)
+			{
+				for (size_t i = 0; i < node_workers[node].size(); i++)
+					workers[node_workers[node][i]]->node = (int)node;
+			}
+
+			for (size_t i = 0; i < workers.size(); i++)
+			{
+				workers[i]->thread = std::thread(&ThreadPool::Run, this, i);
+				if (pin)
+					PinThread(workers[i]->thread, workers[i]->cpu);
+			}
+		}
+
+		~ThreadPool()
+		{
+			{
+				std::lock_guard<std::mutex> lock(sleep_mutex);
+				stopping = true;
+			}
+			wake.notify_all();
+
+			for (size_t i = 0; i < workers.size(); i++)
+				workers[i]->thread.join();
+		}
+
+		size_t Size() const { return workers.size(); }
+		size_t NodeCount() const { return node_workers.size(); }
+		size_t Steals() const { return steal_count; }
+
+		size_t NodeOf(size_t position, size_t size) const
+		{
+			// Map a position within a dataset onto a node, so that contiguous ranges are always processed (and first touched) by one node.
+			return (size) ? (size_t)(((unsigned long long)position * node_workers.size()) / size) : 0;
+		}
+
+		void Submit(TaskGroup& group, size_t node, std::function<void()> task)
+		{
+			// Push the task onto the next worker of the requested node, any worker may still steal it if that node is busy.
+			const std::vector<size_t>& local = node_workers[node % node_workers.size()];
+			Worker& worker = *workers[local[next_worker++ % local.size()]];
+
+			// The queued count is raised before the push so that it can never be decremented below zero by a fast worker.
+			group.Add();
+			{
+				std::lock_guard<std::mutex> lock(sleep_mutex);
+				queued++;
+			}
+			{
+				std::lock_guard<std::mutex> lock(worker.mutex);
+				worker.tasks.push_back([&group, task]() { task(); group.Done(); });
+			}
+			wake.notify_one();
+		}
+
+		void ParallelFor(size_t size, size_t partitions, std::function<void(size_t, size_t, size_t)> body)
+		{
+			/* Split [0, size) into contiguous partitions and run body(partition, begin, end) on the node which owns that range. There are more
+			   partitions than workers so that uneven partitions can be rebalanced by stealing. */
+			TaskGroup group;
+			partitions = std::max<size_t>(1, std::min(partitions, size));
+			for (size_t p = 0; p < partitions; p++)
+			{
+				size_t begin = (size * p) / partitions;
+				size_t end = (size * (p + 1)) / partitions;
+				Submit(group, NodeOf(begin, size), [=]() { body(p, begin, end); });
+			}
+
+			group.Wait();
+		}
+
+		size_t DefaultPartitions() const { return workers.size() * 4; }
+};
+
+#endif
@@ -0,0 +1,486 @@
+#ifndef timeseries_h
+#define timeseries_h
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <numeric>
+#include <fstream>
+
+#include "funcs.h"
+#include "native_funcs.h"
+#include "records.h"
+#include "summation.h"
+
+/* Every operation within funcs.h treats the dataset as an unordered bag of temperatures. The time series operations below instead order
+   the records by station and then by time, which turns each station into a contiguous segment (and each day of a station into a smaller
+   contiguous segment). Rolling windows, daily extremes and degree days are then all built from parallel segmented scans over that order,
+   using the scan functions within funcs.h and the time series kernels at the end of kernels.cl. */
+
+class TimeSeries
+{
+	private:
+		void SortOrder(ThreadPool& pool, const StationColumn& stations, const TimeColumn& times)
+		{
+			// Records are ordered by station, then time, then their position within the dataset so that the order is always deterministic.
+			auto less = [&](unsigned int a, unsigned int b)
+			{
+				if (stations.ids[a] != stations.ids[b])
+					return stations.ids[a] < stations.ids[b];
+				if (times.minutes[a] != times.minutes[b])
+					return times.minutes[a] < times.minutes[b];
+				return a < b;
+			};
+
+			// Sort one partition per worker, then merge neighbouring partitions pairwise as tasks in the same manner as NativeSort.
+			size_t partitions = std::max<size_t>(1, std::min(pool.Size(), size));
+			std::vector<size_t> bounds(partitions + 1);
+			for (size_t p = 0; p <= partitions; p++)
+				bounds[p] = (size * p) / partitions;
+
+			pool.ParallelFor(size, partitions, [&](size_t, size_t begin, size_t end) { std::sort(order.begin() + begin, order.begin() + end, less); });
+
+			std::vector<unsigned int> merged(size);
+			for (size_t width = 1; width < partitions; width <<= 1)
+			{
+				TaskGroup group;
+				for (size_t p = 0; p < partitions; p += width * 2)
+				{
+					size_t first = bounds[p], middle = bounds[std::min(p + width, partitions)], last = bounds[std::min(p + width * 2, partitions)];
+					pool.Submit(group, pool.NodeOf(first, size), [&, first, middle, last]()
+					{
+						std::merge(order.begin() + first, order.begin() + middle, order.begin() + middle, order.begin() + last, merged.begin() + first, less);
+					});
+				}
+				group.Wait();
+				order.swap(merged);
+			}
+		}
+
+	public:
+		size_t size = 0;
+		std::vector<unsigned int> order;		// Record index of every time ordered position.
+		std::vector<unsigned short> station;	// Station id of every time ordered position.
+		std::vector<unsigned int> minutes;		// Timestamp of every time ordered position.
+		std::vector<int> station_start;			// First position of the station segment which each position belongs to.
+		std::vector<int> station_head;			// Whether each position is the first of its station, the head flags of a segmented scan.
+		std::vector<int> day_head;				// Whether each position is the first of its station day.
+
+		void Build(ThreadPool& pool, const StationColumn& stations, const TimeColumn& times)
+		{
+			size = std::min(stations.size, times.size);
+			order.resize(size);
+			std::iota(order.begin(), order.end(), 0u);
+			SortOrder(pool, stations, times);
+
+			station = Gather(pool, stations.ids.Data());
+			minutes = Gather(pool, times.minutes.Data());
+
+			// Mark the segment heads, this is a single pass performed once per dataset.
+			station_start.resize(size);
+			station_head.resize(size);
+			day_head.resize(size);
+			for (size_t i = 0; i < size; i++)
+			{
+				bool new_station = (i == 0 || station[i] != station[i - 1]);
+				bool new_day = new_station || (minutes[i] / minutes_per_day != minutes[i - 1] / minutes_per_day);
+				station_start[i] = (new_station) ? (int)i : station_start[i - 1];
+				station_head[i] = new_station;
+				day_head[i] = new_day;
+			}
+		}
+
+		template<typename T>
+		std::vector<T> Gather(ThreadPool& pool, const T* values) const
+		{
+			// Copy a record column into time order.
+			std::vector<T> ordered(size);
+			pool.ParallelFor(size, pool.DefaultPartitions(), [&](size_t, size_t begin, size_t end)
+			{
+				for (size_t i = begin; i < end; i++)
+					ordered[i] = values[order[i]];
+			});
+
+			return ordered;
+		}
+
+		std::vector<int> WindowStarts(ThreadPool& pool, unsigned int window_minutes, int& max_count) const
+		{
+			/* The first position of the window (t - window, t] ending at every position, never crossing into a previous station. Each partition
+			   binary searches for the start of its first window and then advances it with a second pointer, so this is O(N) overall. */
+			std::vector<int> starts(size);
+			std::vector<int> counts(pool.DefaultPartitions(), 0);
+			pool.ParallelFor(size, counts.size(), [&](size_t p, size_t begin, size_t end)
+			{
+				size_t first = std::partition_point(minutes.begin() + station_start[begin], minutes.begin() + begin,
+					[&](unsigned int m) { return m + window_minutes <= minutes[begin]; }) - minutes.begin();
+
+				for (size_t i = begin; i < end; i++)
+				{
+					first = std::max(first, (size_t)station_start[i]);
+					while (minutes[first] + window_minutes <= minutes[i])
+						first++;
+
+					starts[i] = (int)first;
+					counts[p] = std::max(counts[p], (int)(i - first + 1));
+				}
+			});
+
+			max_count = (size) ? *std::max_element(counts.begin(), counts.end()) : 0;
+			return starts;
+		}
+
+		void Release()
+		{
+			size = 0;
+			std::vector<unsigned int>().swap(order);
+			std::vector<unsigned short>().swap(station);
+			std::vector<unsigned int>().swap(minutes);
+			std::vector<int>().swap(station_start);
+			std::vector<int>().swap(station_head);
+			std::vector<int>().swap(day_head);
+		}
+};
+
+TimeSeries time_series;				// Time ordering of the loaded dataset, built on first use.
+size_t sparse_table_bytes = 256 << 20;	// Largest doubling table of the rolling minimums and maximums, see Rolling().
+
+TimeSeries& GetTimeSeries()
+{
+	if (!time_series.size)
+		time_series.Build(*GetThreadPool(), stations, times);
+
+	return time_series;
+}
+
+// ------------------------------------------------------------------------ Time Series Functions ------------------------------------------------------------------------ //
+
+template<typename T>
+struct RollingSeries
+{
+	std::vector<fp_type> mean;	// Mean of every window, in the same units as T.
+	std::vector<T> min;			// Minimum of every window.
+	std::vector<T> max;			// Maximum of every window.
+};
+
+template<typename T, typename Sum>
+void EnqueueWindowMeans(cl::Buffer values, cl::Buffer station_start, cl::Buffer heads, cl::Buffer windows, cl::Buffer means, size_t size,
+	KernelProfile& profile)
+{
+	// Segmented prefix sums of T in Sum restarting at every station, from which the mean of any window is the difference of two sums.
+	cl::Buffer prefix_buffer = PooledBuffer<Sum>("series_prefix", nullptr, size);
+	EnqueueSegmentedScan<T, Sum>("add", values, heads, prefix_buffer, size, true, profile);
+
+	cl::Kernel mean_kernel = kernel_cache.Get(program, ScanKernelID<T, Sum>("window", "mean"));
+	mean_kernel.setArg(0, prefix_buffer);
+	mean_kernel.setArg(1, station_start);
+	mean_kernel.setArg(2, windows);
+	mean_kernel.setArg(3, means);
+	mean_kernel.setArg(4, (int)size);
+	EnqueueProfiled(mean_kernel, size, PreferredLocalSize(mean_kernel), profile);
+}
+
+template<typename T>
+RollingSeries<T> Rolling(TimeSeries& series, const T* values, unsigned int window_minutes)
+{
+	std::string kernel_id = "rolling_window";
+	ConcatKernelID(T(), kernel_id);
+
+	timer::Start();
+	ThreadPool& pool = *GetThreadPool();
+	typedef typename ScanSum<T>::type Sum;
+	size_t size = series.size;
+
+	// Order the temperatures by station and time, and find the first position of every window on the host thread pool.
+	int max_count = 0;
+	std::vector<T> ordered = series.Gather(pool, values);
+	std::vector<int> window_start = series.WindowStarts(pool, window_minutes, max_count);
+
+	cl::Buffer values_buffer = PooledBuffer("series_values", ordered.data(), size);
+	cl::Buffer station_buffer = PooledBuffer("series_station_start", series.station_start.data(), size);
+	cl::Buffer head_buffer = PooledBuffer("series_station_head", series.station_head.data(), size);
+	cl::Buffer window_buffer = PooledBuffer("series_window_start", window_start.data(), size);
+	cl::Buffer mean_buffer = PooledBuffer<fp_type>("series_mean", nullptr, size);
+	cl::Buffer extreme_buffer = PooledBuffer<T>("series_extreme", nullptr, size);
+
+	/* The floating point prefix sums are accumulated in double, except on devices without cl_khr_fp64 where they fall back onto float and
+	   the mean of a window late within a long station keeps fewer digits. */
+	KernelProfile profile;
+	if (typeid(Sum) == typeid(double) && !DeviceSupportsFP64())
+		EnqueueWindowMeans<T, T>(values_buffer, station_buffer, head_buffer, window_buffer, mean_buffer, size, profile);
+	else EnqueueWindowMeans<T, Sum>(values_buffer, station_buffer, head_buffer, window_buffer, mean_buffer, size, profile);
+
+	RollingSeries<T> result;
+	result.mean.resize(size);
+	result.min.resize(size);
+	result.max.resize(size);
+	queue.enqueueReadBuffer(mean_buffer, CL_TRUE, 0, size * sizeof(fp_type), result.mean.data());
+
+	// The doubling table needs every level up to the largest power of two which fits within the longest window.
+	int levels = 1;
+	while ((1 << levels) <= max_count)
+		levels++;
+
+	/* The table holds levels values of every position, so rather than over the whole series it is built over tiles whose table fits within
+	   sparse_table_bytes (and the device's largest allocation). Every tile also holds the halo of max_count - 1 positions before its own,
+	   the furthest that any of its windows reaches back. */
+	cl::Device device = context.getInfo<CL_CONTEXT_DEVICES>()[0];
+	size_t halo = (max_count) ? max_count - 1 : 0;
+	size_t table_bytes = std::min<size_t>(sparse_table_bytes, device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>());
+	size_t tile = std::min(size, std::max(table_bytes / (levels * sizeof(T)), halo * 2 + 1));
+	cl::Buffer levels_buffer = PooledBuffer<T>("series_levels", nullptr, tile * levels);
+
+	for (int dir = 0; dir < 2; dir++)
+	{
+		std::string op = (dir) ? "max" : "min";
+		std::string level_id = "sparse_level_" + op;
+		std::string window_id = "window_" + op;
+		ConcatKernelID(T(), level_id);
+		ConcatKernelID(T(), window_id);
+
+		cl::Kernel level_kernel = kernel_cache.Get(program, level_id);
+		cl::Kernel window_kernel = kernel_cache.Get(program, window_id);
+		level_kernel.setArg(0, levels_buffer);
+		level_kernel.setArg(1, station_buffer);
+		window_kernel.setArg(0, levels_buffer);
+		window_kernel.setArg(1, window_buffer);
+		window_kernel.setArg(2, extreme_buffer);
+
+		// Every tile writes the windows of the positions [begin, end), its table beginning halo positions earlier at base.
+		for (size_t begin = 0; begin < size; )
+		{
+			size_t base = begin - std::min(begin, halo);
+			size_t end = std::min(size, base + tile);
+			size_t len = end - base;
+
+			// Level 0 is the ordered data itself, each following level doubles the range covered by every element.
+			queue.enqueueCopyBuffer(values_buffer, levels_buffer, base * sizeof(T), 0, len * sizeof(T));
+			level_kernel.setArg(3, (int)base);
+			level_kernel.setArg(4, (int)len);
+			for (int level = 1; level < levels; level++)
+			{
+				level_kernel.setArg(2, level);
+				EnqueueProfiled(level_kernel, len, PreferredLocalSize(level_kernel), profile);
+			}
+
+			window_kernel.setArg(3, (int)base);
+			window_kernel.setArg(4, (int)(begin - base));
+			window_kernel.setArg(5, (int)len);
+			EnqueueProfiled(window_kernel, end - begin, PreferredLocalSize(window_kernel), profile);
+			begin = end;
+		}
+
+		std::vector<T>& extremes = (dir) ? result.max : result.min;
+		queue.enqueueReadBuffer(extreme_buffer, CL_TRUE, 0, size * sizeof(T), extremes.data());
+	}
+
+	PrintProfilerInfo(kernel_id, profile.ex_time, profile.profiled_info, timer::Stop(profiler_resolution));
+	return result;
+}
+
+template<typename T>
+struct DailySeries
+{
+	std::vector<unsigned short> station;	// Station id of every day.
+	std::vector<unsigned int> day;			// Days since 1900-01-01 of every day.
+	std::vector<T> min;						// Minimum temperature of every day.
+	std::vector<T> max;						// Maximum temperature of every day.
+	std::vector<int> season_head;			// Whether each day is the first of its station year.
+
+	size_t Size() const { return day.size(); }
+};
+
+template<typename T>
+DailySeries<T> DailyExtremes(TimeSeries& series, const T* values)
+{
+	std::string kernel_id = "daily_extremes";
+	ConcatKernelID(T(), kernel_id);
+
+	timer::Start();
+	ThreadPool& pool = *GetThreadPool();
+	size_t size = series.size;
+
+	std::vector<T> ordered = series.Gather(pool, values);
+	cl::Buffer values_buffer = PooledBuffer("series_values", ordered.data(), size);
+	cl::Buffer day_buffer = PooledBuffer("series_day_head", series.day_head.data(), size);
+	cl::Buffer min_buffer = PooledBuffer<T>("series_min", nullptr, size);
+	cl::Buffer max_buffer = PooledBuffer<T>("series_max", nullptr, size);
+
+	// Segmented min and max scans restarting every day, the last position of each day then holds that day's extremes.
+	KernelProfile profile;
+	EnqueueSegmentedScan<T, T>("min", values_buffer, day_buffer, min_buffer, size, true, profile);
+	EnqueueSegmentedScan<T, T>("max", values_buffer, day_buffer, max_buffer, size, true, profile);
+
+	std::vector<T> scanned_min(size), scanned_max(size);
+	queue.enqueueReadBuffer(min_buffer, CL_TRUE, 0, size * sizeof(T), scanned_min.data());
+	queue.enqueueReadBuffer(max_buffer, CL_TRUE, 0, size * sizeof(T), scanned_max.data());
+
+	// Keep the last position of every day, marking the first day of each station year as the start of a degree day season.
+	DailySeries<T> daily;
+	int last_year = 0;
+	for (size_t i = 0; i < size; i++)
+	{
+		if (i + 1 < size && !series.day_head[i + 1])
+			continue;
+
+		int year;
+		unsigned int month, day_of_month;
+		unsigned int day = series.minutes[i] / minutes_per_day;
+		CivilFromDays(epoch_days + (int)day, year, month, day_of_month);
+
+		bool new_season = daily.day.empty() || daily.station.back() != series.station[i] || year != last_year;
+		daily.season_head.push_back(new_season);
+		daily.station.push_back(series.station[i]);
+		daily.day.push_back(day);
+		daily.min.push_back(scanned_min[i]);
+		daily.max.push_back(scanned_max[i]);
+		last_year = year;
+	}
+
+	PrintProfilerInfo(kernel_id, profile.ex_time, profile.profiled_info, timer::Stop(profiler_resolution));
+	return daily;
+}
+
+template<typename Sum>
+std::vector<double> SeasonSums(cl::Buffer degree_days, cl::Buffer season_heads, size_t size, KernelProfile& profile)
+{
+	// Inclusive segmented sums of the daily degree days accumulated in Sum, which are widened to double on the host.
+	cl::Buffer cumulative_buffer = PooledBuffer<Sum>("daily_cumulative", nullptr, size);
+	EnqueueSegmentedScan<fp_type, Sum>("add", degree_days, season_heads, cumulative_buffer, size, true, profile);
+
+	std::vector<Sum> sums(size);
+	queue.enqueueReadBuffer(cumulative_buffer, CL_TRUE, 0, size * sizeof(Sum), sums.data());
+	return std::vector<double>(sums.begin(), sums.end());
+}
+
+template<typename T>
+std::vector<double> DegreeDays(const DailySeries<T>& daily, fp_type scale, fp_type base, bool heating)
+{
+	// Cumulative degree days of every day within its station year, growing degree days above base or heating degree days below base.
+	std::string kernel_id = "degree_days";
+	ConcatKernelID(T(), kernel_id);
+
+	timer::Start();
+	size_t size = daily.Size();
+	cl::Buffer min_buffer = PooledBuffer("daily_min", daily.min.data(), size);
+	cl::Buffer max_buffer = PooledBuffer("daily_max", daily.max.data(), size);
+	cl::Buffer season_buffer = PooledBuffer("daily_season_head", daily.season_head.data(), size);
+	cl::Buffer degree_buffer = PooledBuffer<fp_type>("daily_degree_days", nullptr, size);
+
+	KernelProfile profile;
+	cl::Kernel kernel = kernel_cache.Get(program, kernel_id);
+	kernel.setArg(0, min_buffer);
+	kernel.setArg(1, max_buffer);
+	kernel.setArg(2, degree_buffer);
+	kernel.setArg(3, scale);
+	kernel.setArg(4, base);
+	kernel.setArg(5, (int)heating);
+	kernel.setArg(6, (int)size);
+	EnqueueProfiled(kernel, size, PreferredLocalSize(kernel), profile);
+
+	// Accumulate the daily degree days with a segmented sum restarting every station year, in float on devices without cl_khr_fp64.
+	std::vector<double> cumulative = (DeviceSupportsFP64())
+		? SeasonSums<double>(degree_buffer, season_buffer, size, profile)
+		: SeasonSums<fp_type>(degree_buffer, season_buffer, size, profile);
+
+	PrintProfilerInfo(kernel_id, profile.ex_time, profile.profiled_info, timer::Stop(profiler_resolution));
+	return cumulative;
+}
+
+// ------------------------------------------------------------------------ Output ------------------------------------------------------------------------ //
+
+std::string ExportPath(const std::string& name)
+{
+	return base_path + "logs/" + name + ".csv";
+}
+
+template<typename T>
+void ReportRolling(const TimeSeries& series, const RollingSeries<T>& rolling, fp_type division, const std::string& name)
+{
+	// Export every window to a csv file, then print the warmest and coldest window of every station.
+	std::ofstream file(ExportPath(name));
+	file << "station,time,mean,min,max\n";
+	for (size_t i = 0; i < series.size; i++)
+	{
+		file << stations.names[series.station[i]] << "," << FormatMinutes(series.minutes[i]) << "," << rolling.mean[i] / division << ","
+			<< rolling.min[i] / division << "," << rolling.max[i] / division << "\n";
+	}
+
+	for (size_t begin = 0; begin < series.size; )
+	{
+		size_t end = begin;
+		while (end < series.size && series.station[end] == series.station[begin])
+			end++;
+
+		size_t warmest = std::max_element(rolling.mean.begin() + begin, rolling.mean.begin() + end) - rolling.mean.begin();
+		size_t coldest = std::min_element(rolling.mean.begin() + begin, rolling.mean.begin() + end) - rolling.mean.begin();
+		printf("%s\n\tWarmest window: %.2f ending %s (min %.1f, max %.1f)\n\tColdest window: %.2f ending %s (min %.1f, max %.1f)\n",
+			stations.names[series.station[begin]].c_str(),
+			rolling.mean[warmest] / division, FormatMinutes(series.minutes[warmest]).c_str(), rolling.min[warmest] / division, rolling.max[warmest] / division,
+			rolling.mean[coldest] / division, FormatMinutes(series.minutes[coldest]).c_str(), rolling.min[coldest] / division, rolling.max[coldest] / division);
+
+		begin = end;
+	}
+	printf("Exported %zu windows to '%s'\n\n", series.size, ExportPath(name).c_str());
+}
+
+template<typename T>
+void ReportDaily(const DailySeries<T>& daily, fp_type division)
+{
+	// Export every day to a csv file, then print the hottest and coldest day of every station.
+	std::ofstream file(ExportPath("daily_extremes"));
+	file << "station,date,min,max\n";
+	for (size_t i = 0; i < daily.Size(); i++)
+		file << stations.names[daily.station[i]] << "," << FormatMinutes(daily.day[i] * minutes_per_day).substr(0, 10) << "," << daily.min[i] / division << "," << daily.max[i] / division << "\n";
+
+	for (size_t begin = 0; begin < daily.Size(); )
+	{
+		size_t end = begin;
+		while (end < daily.Size() && daily.station[end] == daily.station[begin])
+			end++;
+
+		size_t hottest = std::max_element(daily.max.begin() + begin, daily.max.begin() + end) - daily.max.begin();
+		size_t coldest = std::min_element(daily.min.begin() + begin, daily.min.begin() + end) - daily.min.begin();
+		printf("%s (%zu days)\n\tHottest day: %s, %.1f\n\tColdest day: %s, %.1f\n", stations.names[daily.station[begin]].c_str(), end - begin,
+			FormatMinutes(daily.day[hottest] * minutes_per_day).substr(0, 10).c_str(), daily.max[hottest] / division,
+			FormatMinutes(daily.day[coldest] * minutes_per_day).substr(0, 10).c_str(), daily.min[coldest] / division);
+
+		begin = end;
+	}
+	printf("Exported %zu days to '%s'\n\n", daily.Size(), ExportPath("daily_extremes").c_str());
+}
+
+template<typename T>
+void ReportDegreeDays(const DailySeries<T>& daily, const std::vector<double>& growing, const std::vector<double>& heating)
+{
+	// Export the cumulative degree days of every day, then print the mean annual total of every station.
+	std::ofstream file(ExportPath("degree_days"));
+	file << "station,date,growing_degree_days,heating_degree_days\n";
+	for (size_t i = 0; i < daily.Size(); i++)
+		file << stations.names[daily.station[i]] << "," << FormatMinutes(daily.day[i] * minutes_per_day).substr(0, 10) << "," << growing[i] << "," << heating[i] << "\n";
+
+	for (size_t begin = 0; begin < daily.Size(); )
+	{
+		// The last day of every season holds that season's total.
+		size_t end = begin, seasons = 0;
+		double growing_total = 0.0, heating_total = 0.0;
+		while (end < daily.Size() && daily.station[end] == daily.station[begin])
+		{
+			if (end + 1 == daily.Size() || daily.season_head[end + 1])
+			{
+				growing_total += growing[end];
+				heating_total += heating[end];
+				seasons++;
+			}
+			end++;
+		}
+
+		printf("%s (%zu years)\n\tMean annual growing degree days: %.1f\n\tMean annual heating degree days: %.1f\n",
+			stations.names[daily.station[begin]].c_str(), seasons, growing_total / seasons, heating_total / seasons);
+
+		begin = end;
+	}
+	printf("Exported %zu days to '%s'\n\n", daily.Size(), ExportPath("degree_days").c_str());
+}
+
+#endif
@@ -0,0 +1,174 @@
+#ifndef topk_h
+#define topk_h
+
+#include <vector>
+#include <string>
+#include <limits>
+#include <algorithm>
+#include <cstdio>
+
+#include "funcs.h"
+#include "native_funcs.h"
+#include "records.h"
+#include "filter.h"
+
+/* The k hottest and coldest records, with the row of each record so that its station and timestamp can be reported for alerting. Neither
+   path sorts the dataset: the device keeps a bitonic K-buffer per work group in local memory over the resident temperature column (see the
+   TOP K KERNELS of kernels.cl) and merges the candidates of the groups on the device, the native path keeps a bounded heap per partition.
+   Both order the records by value and then by row, so they return identical records. */
+
+const size_t max_top_k = 1024;				// Largest k, the buffer of every work group must fit within local memory.
+const size_t min_top_k_buffer = 256;		// Smallest buffer, so that every tile gives each work item a few records.
+
+template<typename T>
+struct ExtremeRecord
+{
+	T value;
+	int row;								// Index of the record within the loaded columns.
+};
+
+template<typename T>
+bool TopKBetter(const ExtremeRecord<T>& a, const ExtremeRecord<T>& b, bool largest)
+{
+	// Host equivalent of TOP_K_BETTER within kernels.cl.
+	return ((largest) ? a.value > b.value : a.value < b.value) || (a.value == b.value && a.row < b.row);
+}
+
+template<typename T>
+std::vector<ExtremeRecord<T>> DeviceTopK(DeviceColumns<T>& columns, size_t k, bool largest)
+{
+	std::vector<ExtremeRecord<T>> result;
+	k = std::min(std::min(k, max_top_k), columns.size);
+	if (!k)
+		return result;
+
+	// Determine the kernel names using the type T, e.g. T == int will concatinate  "_INT".
+	std::string kernel_id = "top_k";
+	std::string merge_id = "top_k_merge";
+	ConcatKernelID(T(), kernel_id);
+	ConcatKernelID(T(), merge_id);
+
+	timer::Start();
+	KernelProfile profile;
+	cl::Kernel kernel = kernel_cache.Get(program, kernel_id);
+	cl::Kernel merge_kernel = kernel_cache.Get(program, merge_id);
+
+	// The buffer is the power of two holding k records, a work item compares at most two entries of it at a time.
+	size_t buffer_size = min_top_k_buffer;
+	while (buffer_size < k)
+		buffer_size <<= 1;
+	size_t group_size = std::max<size_t>(1, std::min(std::min(PreferredLocalSize(kernel), PreferredLocalSize(merge_kernel)), buffer_size / 2));
+
+	cl::Device device = context.getInfo<CL_CONTEXT_DEVICES>()[0];
+	cl_uint compute_units = device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+	T worst = (largest) ? std::numeric_limits<T>::lowest() : std::numeric_limits<T>::max();
+
+	/* The first pass runs a few work groups per compute unit over the whole column, every group striding over the tiles. Each later pass
+	   merges the k candidates of every group of the pass before with far fewer groups, until a single group leaves the result. */
+	cl::Buffer in = columns.values, in_rows;
+	size_t count = columns.size;
+	size_t group_count = std::min<size_t>(compute_units * 4, (count + buffer_size - 1) / buffer_size);
+	for (int pass = 0; ; pass++)
+	{
+		std::string slot = "top_k_pass" + std::to_string(pass % 2);
+		cl::Buffer out = PooledBuffer<T>(slot + "_values", nullptr, group_count * k);
+		cl::Buffer out_rows = PooledBuffer<int>(slot + "_rows", nullptr, group_count * k);
+
+		cl::Kernel& pass_kernel = (pass) ? merge_kernel : kernel;
+		int arg = 0;
+		pass_kernel.setArg(arg++, in);
+		if (pass)
+			pass_kernel.setArg(arg++, in_rows);
+		pass_kernel.setArg(arg++, out);
+		pass_kernel.setArg(arg++, out_rows);
+		pass_kernel.setArg(arg++, cl::Local(buffer_size * 2 * sizeof(T)));
+		pass_kernel.setArg(arg++, cl::Local(buffer_size * 2 * sizeof(int)));
+		pass_kernel.setArg(arg++, worst);
+		pass_kernel.setArg(arg++, (int)largest);
+		pass_kernel.setArg(arg++, (int)k);
+		pass_kernel.setArg(arg++, (int)buffer_size);
+		pass_kernel.setArg(arg++, (int)count);
+		EnqueueProfiled(pass_kernel, group_count * group_size, group_size, profile);
+
+		if (group_count == 1)
+		{
+			// Only the k best records and their rows are read back.
+			std::vector<T> values(k);
+			std::vector<int> rows(k);
+			queue.enqueueReadBuffer(out, CL_TRUE, 0, k * sizeof(T), values.data());
+			queue.enqueueReadBuffer(out_rows, CL_TRUE, 0, k * sizeof(int), rows.data());
+			for (size_t i = 0; i < k; i++)
+			{
+				ExtremeRecord<T> record = { values[i], rows[i] };
+				result.push_back(record);
+			}
+			break;
+		}
+
+		in = out;
+		in_rows = out_rows;
+		count = group_count * k;
+		group_count = std::max<size_t>(1, (count + buffer_size * 8 - 1) / (buffer_size * 8));
+	}
+
+	PrintProfilerInfo(kernel_id, profile.ex_time, profile.profiled_info, timer::Stop(profiler_resolution));
+	return result;
+}
+
+template<typename T>
+std::vector<ExtremeRecord<T>> NativeTopK(const T* A, size_t size, size_t k, bool largest)
+{
+	std::string kernel_id = "native_top_k";
+	ConcatKernelID(T(), kernel_id);
+
+	timer::Start();
+	ThreadPool& pool = *GetThreadPool();
+	k = std::min(std::min(k, max_top_k), size);
+	auto better = [largest](const ExtremeRecord<T>& a, const ExtremeRecord<T>& b) { return TopKBetter(a, b, largest); };
+
+	// Every partition keeps a heap of its k best records with the worst on top, so a record which cannot be kept costs a single comparison.
+	std::vector<std::vector<ExtremeRecord<T>>> heaps(pool.DefaultPartitions());
+	pool.ParallelFor(size, heaps.size(), [&](size_t p, size_t begin, size_t end)
+	{
+		std::vector<ExtremeRecord<T>>& heap = heaps[p];
+		for (size_t i = begin; k && i < end; i++)
+		{
+			ExtremeRecord<T> record = { A[i], (int)i };
+			if (heap.size() < k)
+			{
+				heap.push_back(record);
+				std::push_heap(heap.begin(), heap.end(), better);
+			}
+			else if (better(record, heap.front()))
+			{
+				std::pop_heap(heap.begin(), heap.end(), better);
+				heap.back() = record;
+				std::push_heap(heap.begin(), heap.end(), better);
+			}
+		}
+	});
+
+	std::vector<ExtremeRecord<T>> result;
+	for (size_t p = 0; p < heaps.size(); p++)
+		result.insert(result.end(), heaps[p].begin(), heaps[p].end());
+	std::partial_sort(result.begin(), result.begin() + k, result.end(), better);
+	result.resize(k);
+
+	PrintNativeInfo(kernel_id, pool);
+	return result;
+}
+
+template<typename T>
+void PrintExtremes(const char* title, const std::vector<ExtremeRecord<T>>& records, fp_type division)
+{
+	printf("%s:\n", title);
+	for (size_t i = 0; i < records.size(); i++)
+	{
+		size_t row = records[i].row;
+		printf("\t%zu. %.1f at %s, %s (record %zu)\n", i + 1, records[i].value / division, stations.names[stations.ids[row]].c_str(),
+			FormatMinutes(times.minutes[row]).c_str(), row);
+	}
+	printf("\n");
+}
+
+#endif